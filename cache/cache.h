@@ -1,59 +1,74 @@
 #ifndef CACHE_H
 #define CACHE_H
 
-#include <map>
+#include <unordered_map>
+#include <functional>
 #include <vector>
-#include <set>
+#include <atomic>
 #include <iostream>
 #include "err/err.h"
 
 ///\addtogroup libmapsoft
 ///@{
 
-template <typename K, typename V> class CacheIterator;
+template <typename K, typename V, typename H> class CacheIterator;
 
 /** Cache of objects of type V, keyed by type K.
 
 Eviction starts whenever number of elements exceeds some limit (cache
 size) set at construction and removes least recently used elements.
 
+Elements are kept in a vector of nodes which form an intrusive
+doubly-linked list in order of usage (most recently used first), and
+a hash map (key -> node index) is used for lookups. All operations
+(add, get, contains, erase) take O(1) time. Key type should have
+std::hash specialization (or a hash functor H should be provided)
+and operator==.
+
+Cache collects statistics: number of hits and misses (counted in
+contains(), which is normally called before get() or add()) and
+number of evicted elements. Hit/miss counters are atomic, contains()
+can be called for a const cache shared between threads.
+
 Compiler directives:
-- DEBUG_SCACHE      -- log additions/deletions
-- DEBUG_SCACHE_GET  -- log gets
+- DEBUG_CACHE      -- log additions/deletions
+- DEBUG_CACHE_GET  -- log gets
 */
-template <typename K, typename V>
+template <typename K, typename V, typename H = std::hash<K> >
 class Cache {
   public:
-    typedef CacheIterator<K, V> iterator;
+    typedef CacheIterator<K, V, H> iterator;
 
     /// Constructor: create a cache with size n.
-    Cache (size_t n) : capacity (n) {
-      for (size_t i = 0; i < capacity; ++i){
-        free_list.insert (i);
-      }
+    Cache (size_t n) : capacity (n), head(npos), tail(npos), free_head(npos),
+                       used(0), hits(0), misses(0), evictions(0) {
+      index.reserve(capacity);
     }
 
     /// Copy constructor.
-    Cache (Cache const & other)
-       : capacity (other.capacity),
-         storage (other.storage),
-         index (other.index),
-         free_list (other.free_list),
-         usage (other.usage)
-    { }
+    Cache (Cache const & other):
+      capacity(other.capacity), storage(other.storage), index(other.index),
+      head(other.head), tail(other.tail), free_head(other.free_head),
+      used(other.used), hits(other.hits.load()), misses(other.misses.load()),
+      evictions(other.evictions) {}
 
     /// Swap the cache with another one.
-    void swap (Cache<K,V> & other) {
+    void swap (Cache<K,V,H> & other) {
       std::swap (capacity, other.capacity);
       storage.swap (other.storage);
       index.swap (other.index);
-      free_list.swap (other.free_list);
-      usage.swap (other.usage);
+      std::swap (head, other.head);
+      std::swap (tail, other.tail);
+      std::swap (free_head, other.free_head);
+      std::swap (used, other.used);
+      hits = other.hits.exchange(hits);
+      misses = other.misses.exchange(misses);
+      std::swap (evictions, other.evictions);
     }
 
     /// Assignment.
-    Cache<K,V> & operator= (Cache<K,V> const& other) {
-      Cache<K,V> dummy (other);
+    Cache<K,V,H> & operator= (Cache<K,V,H> const& other) {
+      Cache<K,V,H> dummy (other);
       swap (dummy);
       return *this;
     }
@@ -62,186 +77,226 @@ class Cache {
     size_t size_total() const { return capacity; }
 
     /// Return size of used space.
-    size_t size_used() const { return capacity-free_list.size(); }
+    size_t size_used() const { return used; }
 
     /// Add an element to the cache.
     size_t add (K const & key, V const & value) {
-      if (contains(key)) {
-        size_t idx = index[key];
-        storage[idx].second = value;
+      typename index_t::iterator i = index.find(key);
+      if (i != index.end()) {
+        storage[i->second].val.second = value;
+        use (i->second);
         return 0;
       }
 #ifdef DEBUG_CACHE
-      std::cout << "cache: add " << key << " ";
+      std::cout << "cache: add " << key << std::endl;
 #endif
-      if (free_list.size() == 0) {
-        size_t to_delete = usage[usage.size() - 1];
-#ifdef DEBUG_CACHE
-        std::cout << "no free space ";
-        std::cout << "usage size " << usage.size() << " to_delete=" << to_delete << " key=" << storage[to_delete].first;
-#endif
-        index.erase (storage[to_delete].first);
-        free_list.insert (to_delete);
-      }
+      if (capacity == 0) return 0;
 
-      size_t free_ind = *(free_list.begin());
-      free_list.erase (free_list.begin());
+      // remove least recently used element
+      if (used >= capacity) {
 #ifdef DEBUG_CACHE
-      std::cout << std::endl;
-      std::cout << "cache: free_ind=" << free_ind << std::endl;
+        std::cout << "cache: no free space, delete " << storage[tail].val.first << std::endl;
 #endif
-
-      if (storage.size() <= free_ind) {
-          if (storage.size() != free_ind)
-            throw Err() << "Cache: broken cache object";
-          storage.push_back (std::make_pair (key, value));
-      } else {
-          storage[free_ind] = std::make_pair (key, value);
+        ++evictions;
+        erase_node (tail);
       }
-      index[key] = free_ind;
-      use (free_ind);
 
-#ifdef DEBUG_CACHE
-      std::cout << "cache usage:";
-      for (size_t i = 0; i < usage.size(); ++i) {
-        std::cout << " " << usage[i];
+      size_t n;
+      if (free_head != npos) {
+        n = free_head;
+        free_head = storage[n].next;
+        storage[n].val = std::make_pair (key, value);
       }
-      std::cout << std::endl;
-#endif
+      else {
+        n = storage.size();
+        storage.push_back (Node(key, value));
+      }
+      index.insert (std::make_pair(key, n));
+      link_front (n);
+      ++used;
       return 0;
     }
 
-
     /// Check whether the cache contains a key.
-    bool contains (K const & key) const { return index.count (key) > 0; }
+    /// Update hit/miss statistics.
+    bool contains (K const & key) const {
+      bool ret = index.count (key) > 0;
+      if (ret) ++hits;
+      else ++misses;
+      return ret;
+    }
 
     /// Get element from the cache.
     V & get (K const & key) {
-      if (!contains(key)) throw Err() << "Cache: key does not exists";
-      size_t ind = index[key];
+      typename index_t::iterator i = index.find(key);
+      if (i == index.end()) throw Err() << "Cache: key does not exists";
 #ifdef DEBUG_CACHE_GET
-      std::cout << "cache get: " << key << " ind: " << ind << std::endl;
+      std::cout << "cache get: " << key << " ind: " << i->second << std::endl;
 #endif
-      use (ind);
-      return storage[ind].second;
+      use (i->second);
+      return storage[i->second].val.second;
     }
 
     /// Remove an element from the cache.
     void erase(K const & key) {
-      size_t i = index[key];
-      index.erase(key);
-      free_list.insert(i);
-      for (size_t k = 0; k < usage.size(); ++k) {
-        if (usage[k] == i) {
-          usage.erase(usage.begin() + k);
-          break;
-        }
-      }
+      typename index_t::iterator i = index.find(key);
+      if (i == index.end()) return;
+      erase_node (i->second);
     }
 
     /// Clear the cache.
     void clear () {
-      for (size_t i = 0; i < capacity; ++i) free_list.insert (i);
+      storage.clear();
       index.clear();
-      usage.clear();
+      head = tail = free_head = npos;
+      used = 0;
     }
 
-    /// Returns an iterator pointing to the first element in the cache.
-    /// Iterator traverses all the cache elements
-    /// in order of increasing keys. All iterators are valid until the
+    /// Number of successful lookups (contains() returned true).
+    size_t stat_hits() const { return hits; }
+
+    /// Number of failed lookups (contains() returned false).
+    size_t stat_misses() const { return misses; }
+
+    /// Number of elements removed to free space for new ones.
+    size_t stat_evictions() const { return evictions; }
+
+    /// Reset statistics.
+    void stat_reset() { hits = misses = evictions = 0; }
+
+    /// Returns an iterator pointing to the first element in the cache
+    /// (the most recently used one). Iterator traverses all the cache
+    /// elements in order of usage (most recently used first, not in
+    /// order of keys). All iterators are valid until the
     /// first cache insert or delete (changing value for existing key
     /// does not invalidate iterators).
     iterator begin() {
-      return CacheIterator<K, V>(this, index.begin());
+      return iterator(this, head);
     }
 
-    /// Returns an iterator pointing to the last element in the cache.
-    /// Iterator traverses all the cache elements
-    /// in order of increasing keys. All iterators are valid until the
-    /// first cache insert or delete (changing value for existing key
-    /// does not invalidate iterators).
+    /// Returns an iterator pointing after the last (least recently
+    /// used) element in the cache.
     iterator end() {
-      return CacheIterator<K, V>(this, index.end());
+      return iterator(this, npos);
     }
 
     /// Erase an element pointed to by the iterator
     iterator erase(iterator it) {
-      typename std::map<K, size_t>::const_iterator it2 = it++;
-      erase(it2->first);
+      size_t n = it.node;
+      ++it;
+      erase_node(n);
       return it;
     }
 
 private:
 
+    static const size_t npos = (size_t)-1;
+
+    // List node: key-value pair and indices of neighbours.
+    // For free nodes `next` is used for the free list.
+    struct Node {
+      std::pair<K,V> val;
+      size_t prev, next;
+      Node(K const & k, V const & v): val(k,v), prev(npos), next(npos) {}
+    };
+
+    typedef std::unordered_map<K, size_t, H> index_t;
+
     size_t capacity;
-    std::vector<std::pair<K,V> > storage;
-    std::map<K, size_t> index;
-    std::set<size_t> free_list;
-    std::vector<size_t> usage;
+    std::vector<Node> storage;
+    index_t index;
+    size_t head, tail; // most/least recently used nodes
+    size_t free_head;  // list of free nodes
+    size_t used;
+
+    mutable std::atomic<size_t> hits, misses;
+    size_t evictions;
+
+    friend class CacheIterator<K, V, H>;
+
+    // remove node from the usage list
+    void unlink (size_t n) {
+      Node & e = storage[n];
+      if (e.prev != npos) storage[e.prev].next = e.next;
+      else head = e.next;
+      if (e.next != npos) storage[e.next].prev = e.prev;
+      else tail = e.prev;
+      e.prev = e.next = npos;
+    }
 
-    friend class CacheIterator<K, V>;
+    // put node to the beginning of the usage list
+    void link_front (size_t n) {
+      Node & e = storage[n];
+      e.prev = npos;
+      e.next = head;
+      if (head != npos) storage[head].prev = n;
+      head = n;
+      if (tail == npos) tail = n;
+    }
 
-    // index end is removed
-    template <typename T>
-    void  push_vector (std::vector<T> & vec, size_t start, size_t end) {
-#ifdef DEBUG_CACHE_GET
-      std::cout << "cache push_vector: start=" << start << " end=" << end << " size=" << vec.size() << std::endl;
-#endif
-      for (size_t i = end; i > start; --i) {
-        vec[i] = vec[i-1];
-      }
+    // mark node as most recently used
+    void use (size_t n) {
+      if (n == head) return;
+      unlink (n);
+      link_front (n);
     }
 
-    void use (size_t ind) {
-      size_t i;
-      for (i = 0; i < usage.size() && usage[i] != ind; ++i);
-      if (i == usage.size()) {
-        usage.resize (usage.size()+1);
-        push_vector (usage, 0, usage.size()-1);
-        usage[0] = ind;
-      } else {
-        push_vector (usage, 0, i);
-        usage[0] = ind;
-      }
+    // remove node from the index and from the usage list,
+    // put it to the free list
+    void erase_node (size_t n) {
+      index.erase (storage[n].val.first);
+      unlink (n);
+      storage[n].next = free_head;
+      free_head = n;
+      --used;
     }
 };
 
-/*
-/// Print cache elements.
-///\relates Cache
-template <typename K, typename V>
-std::ostream & operator<< (std::ostream & s, const Cache<K,V> & cache) {
-  s   << "Cache(\n";
-  for (size_t i=0; i<cache.storage.size(); i++){
-    s << "  " << cache.storage[i].first << " => " << cache.storage[i].second << "\n";
-  }
-  s << ")";
-  return s;
-}
-*/
-
 /// Iterator class for cache
 ///\relates Cache
-template <typename K, typename V>
-class CacheIterator : public std::map<K, size_t>::const_iterator {
+template <typename K, typename V, typename H>
+class CacheIterator {
  public:
-    std::pair<K, V>& operator*() {
-      return cache->storage[std::map<K, size_t>::const_iterator::operator*().second];
+    std::pair<K, V>& operator*() { return cache->storage[node].val; }
+
+    std::pair<K, V>* operator->() { return &(cache->storage[node].val); }
+
+    CacheIterator & operator++() {
+      node = cache->storage[node].next;
+      return *this;
+    }
+
+    CacheIterator operator++(int) {
+      CacheIterator ret(*this);
+      ++(*this);
+      return ret;
+    }
+
+    CacheIterator & operator--() {
+      node = (node == Cache<K,V,H>::npos) ?
+        cache->tail : cache->storage[node].prev;
+      return *this;
     }
 
-    std::pair<K, V>* operator->() {
-      return &(cache->storage[std::map<K, size_t>::const_iterator::operator*().second]);
+    CacheIterator operator--(int) {
+      CacheIterator ret(*this);
+      --(*this);
+      return ret;
     }
 
+    bool operator==(const CacheIterator & other) const {
+      return cache == other.cache && node == other.node; }
+
+    bool operator!=(const CacheIterator & other) const {
+      return !(*this == other); }
+
  private:
-    friend class Cache<K, V>;
-    CacheIterator (Cache<K, V>* cache_,
-           typename std::map<K, size_t>::const_iterator iter_)
-      : std::map<K, size_t>::const_iterator(iter_),
-        cache(cache_)
-    { }
-
-    Cache<K, V>* cache;
+    friend class Cache<K, V, H>;
+    CacheIterator (Cache<K, V, H>* cache_, size_t node_)
+      : cache(cache_), node(node_) { }
+
+    Cache<K, V, H>* cache;
+    size_t node;
 };
 ///@}
 #endif
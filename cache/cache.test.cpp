@@ -47,6 +47,64 @@ int main() {
     assert_eq(cache.size_used(), 0);
     for (int i =  0; i < 15; ++i) assert_eq(cache.contains(i), false);
 
+    // LRU order: get() moves element to the top
+    cache.stat_reset();
+    for (int i = 0; i < 5; ++i) cache.add(i, i*i);
+    assert_eq(cache.get(0), 0);
+    assert_eq(cache.get(2), 4);
+    cache.add(5, 25); // 1 is removed
+    cache.add(6, 36); // 3 is removed
+    assert_eq(cache.contains(1), false);
+    assert_eq(cache.contains(3), false);
+    assert_eq(cache.contains(0), true);
+    assert_eq(cache.contains(2), true);
+    assert_eq(cache.contains(4), true);
+    assert_eq(cache.stat_hits(), 3);
+    assert_eq(cache.stat_misses(), 2);
+    assert_eq(cache.stat_evictions(), 2);
+
+    // iterators go from most recently used element
+    {
+      int keys[] = {6,5,2,0,4};
+      int n=0;
+      for (Cache<int,int>::iterator i=cache.begin(); i!=cache.end(); ++i)
+        assert_eq(i->first, keys[n++]);
+      assert_eq(n, 5);
+      Cache<int,int>::iterator i=cache.end();
+      --i;
+      assert_eq(i->first, 4);
+    }
+
+    // re-adding an existing key replaces the value
+    cache.add(4, -1);
+    assert_eq(cache.get(4), -1);
+    assert_eq(cache.size_used(), 5);
+
+    // copy and swap
+    {
+      Cache<int, int> c1(cache), c2(2);
+      assert_eq(c1.size_used(), 5);
+      assert_eq(c1.get(5), 25);
+      c1.swap(c2);
+      assert_eq(c1.size_total(), 2);
+      assert_eq(c1.size_used(), 0);
+      assert_eq(c2.size_total(), 5);
+      assert_eq(c2.get(6), 36);
+    }
+
+    // erase/add many times, use string keys
+    {
+      Cache<std::string, int> c(3);
+      for (int i = 0; i < 100; ++i){
+        c.add(std::to_string(i), i);
+        if (i%2) c.erase(std::to_string(i-1));
+      }
+      assert_eq(c.size_used(), 2);
+      assert_eq(c.get("99"), 99);
+      assert_eq(c.get("97"), 97);
+      assert_eq(c.contains("98"), false);
+    }
+
   }
   catch (Err & e) {
     std::cerr << "Error: " << e.str() << "\n";
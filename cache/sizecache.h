@@ -2,10 +2,10 @@
 #define SIZECACHE_H
 
 #include <map>
-#include <vector>
-#include <set>
+#include <list>
 #include <cassert>
 #include <iostream>
+#include <cstddef>
 
 ///\addtogroup libmapsoft
 ///@{
@@ -13,23 +13,41 @@
 ///cache of objects with limited size
 ///@{
 
+/** Default cost function for SizeCache: use dsize() method
+    of the object if it exists (ImageR and derived classes: size
+    of image data in bytes), size() method otherwise.
+*/
+template <typename V>
+struct SizeCacheCost {
+  size_t operator()(const V & v) const { return get(v, 0); }
+private:
+  template <typename T>
+  static auto get(const T & v, int) -> decltype(size_t(v.dsize())) { return v.dsize(); }
+  template <typename T>
+  static size_t get(const T & v, long) { return v.size(); }
+};
+
 /** Cache of objects of type V, keyed by type K.
 
     Cache eviction policy is size-based LRU: eviction starts whenever
     total stored size exceeds threshold set at construction and
     removed least recently used elements.
-    To enable that, V must have method size() returning the size of
-    object.
+    Size of an object is calculated by the cost functor S. By default
+    V must have method dsize() or size() returning the size of
+    object (see SizeCacheCost).
 
     Compiler directives:
-    - DEBUG_SCACHE      -- log additions/deletions
-    - DEBUG_SCACHE_GET  -- log gets
+    - DEBUG_CACHE       -- log additions/deletions
+    - DEBUG_CACHE_GET   -- log gets
 */
 
-template <typename K, typename V>
+template <typename K, typename V, typename S = SizeCacheCost<V> >
 class SizeCache {
+    typedef std::list<std::pair<const K, V> > usage_t;
+    typedef typename usage_t::iterator el_index;
+
 public:
-    typedef typename std::map<K, V>::iterator iterator;
+    typedef el_index iterator;
 
     /// Constructor: create the cache with size n
     SizeCache (size_t size) : upper_limit(size), current_size(0) { }
@@ -38,27 +56,29 @@ public:
     SizeCache (SizeCache const & other)
       : upper_limit(other.upper_limit),
         current_size(other.current_size),
-        storage(other.storage),
-        usage(other.usage) { }
+        usage(other.usage) {
+      for (el_index i = usage.begin(); i!=usage.end(); ++i)
+        index.insert(std::make_pair(i->first, i));
+    }
 
     /// Swap the cache with another one
-    void swap (SizeCache<K,V> & other) {
+    void swap (SizeCache<K,V,S> & other) {
       std::swap(upper_limit, other.upper_limit);
       std::swap(current_size, other.current_size);
-      storage.swap(other.storage);
+      index.swap(other.index);
       usage.swap(other.usage);
     }
 
     /// Assignment
-    SizeCache<K,V> & operator= (SizeCache<K,V> const& other) {
-      SizeCache<K,V> dummy (other);
+    SizeCache<K,V,S> & operator= (SizeCache<K,V,S> const& other) {
+      SizeCache<K,V,S> dummy (other);
       swap(dummy);
       return *this;
     }
 
     /// Return number of elements in the cache
     size_t count(){
-      return storage.size();
+      return index.size();
     }
 
     /// Return cache size
@@ -84,31 +104,26 @@ public:
 #endif
         }
 
-        size_t size = value.size();
-        while (storage.size() > 0 && current_size + size > upper_limit) {
-            el_index lru = usage[usage.size() - 1];
-            size_t s = lru->second.size();
+        size_t size = cost(value);
+        while (usage.size() > 0 && current_size + size > upper_limit) {
 #ifdef DEBUG_CACHE
             std::cout << "no free space:"
                       << " current_size=" << current_size
-                      << " lru=" << lru.first
-                      << " size=" << s
+                      << " lru=" << usage.back().first
+                      << " size=" << cost(usage.back().second)
                       << std::endl;
 #endif
-            current_size -= s;
-            usage.resize(usage.size() - 1);
-            storage.erase(lru);
+            erase_lru();
         }
 
-        std::pair<el_index, bool> n = storage.insert(std::make_pair(key, value));
+        usage.push_front(std::make_pair(key, value));
+        index.insert(std::make_pair(key, usage.begin()));
         current_size += size;
-        use(n.first);
 
 #ifdef DEBUG_CACHE
         std::cout << "cache usage:";
-        for (size_t i = 0; i < usage.size(); ++i) {
-          std::cout << " " << usage[i].first;
-        }
+        for (el_index i = usage.begin(); i != usage.end(); ++i)
+          std::cout << " " << i->first;
         std::cout << std::endl;
 #endif
         return 0;
@@ -116,105 +131,83 @@ public:
 
     /// Check whether the cache contains a key
     bool contains (K const & key) {
-      return storage.count(key) > 0;
+      return index.count(key) > 0;
     }
 
     /// Get element from cache
     V & get (K const & key) {
-      el_index ind = storage.find(key);
-      assert(ind != storage.end());
+      typename index_t::iterator ind = index.find(key);
+      assert(ind != index.end());
 #ifdef DEBUG_CACHE_GET
       std::cout << "cache get: " << key << std::endl;
 #endif
-      use(ind);
-      return ind->second;
+      // move the element to the beginning of the usage list
+      usage.splice(usage.begin(), usage, ind->second);
+      return ind->second->second;
     }
 
     /// Remove an element from the cache
     void erase(K const & key){
-      el_index ind = storage.find(key);
-      if (ind == storage.end())  return;
+      typename index_t::iterator ind = index.find(key);
+      if (ind == index.end())  return;
+      current_size -= cost(ind->second->second);
+      usage.erase(ind->second);
+      index.erase(ind);
+    }
 
-      for (size_t k = 0; k < usage.size(); ++k) {
-        if (usage[k] == ind) {
-          usage.erase(usage.begin() + k);
-          break;
-        }
-      }
-      current_size -= ind->second.size();
-      storage.erase(ind);
+    /// Remove the least recently used element, return its size.
+    /// Return 0 if the cache is empty.
+    size_t erase_lru(){
+      if (usage.size()==0) return 0;
+      size_t s = cost(usage.back().second);
+      current_size -= s;
+      index.erase(usage.back().first);
+      usage.pop_back();
+      return s;
     }
 
     /** Clear the cache. */
     void clear() {
-      storage.clear();
+      index.clear();
       usage.clear();
       current_size = 0;
     }
 
     /// Returns an iterator pointing to the first element in the cache.
-    /// Iterator traverses all the cache elements
-    /// in order of increasing keys. All iterators are valid until the
-    /// first cache insert or delete (changing value for existing key
-    /// does not invalidate iterators).
+    /// Iterator traverses all the cache elements in order of
+    /// usage (most recently used first). Iterators are valid until
+    /// the element they point to is removed from the cache.
     iterator begin() {
-      return storage.begin();
+      return usage.begin();
     }
 
     /// Returns an iterator pointing to the last element in the cache.
-    /// Iterator traverses all the cache elements
-    /// in order of increasing keys. All iterators are valid until the
-    /// first cache insert or delete (changing value for existing key
-    /// does not invalidate iterators).
+    /// Iterator traverses all the cache elements in order of
+    /// usage (most recently used first). Iterators are valid until
+    /// the element they point to is removed from the cache.
     iterator end() {
-      return storage.end();
+      return usage.end();
     }
 
     /// Erase an element pointed to by the iterator
     iterator erase(iterator it) {
-      for (size_t k = 0; k < usage.size(); ++k) {
-        if (usage[k] == it) {
-          usage.erase(usage.begin() + k);
-          break;
-        }
-      }
-      current_size -= it->second.size();
-      iterator it2(it);
-      ++it2;
-      storage.erase(it);
-      return it2;
+      current_size -= cost(it->second);
+      index.erase(it->first);
+      return usage.erase(it);
     }
 
 private:
     size_t upper_limit;
     size_t current_size;
 
-    typedef typename std::map<K, V>::iterator el_index;
-    std::map<K, V> storage;
-    std::vector<el_index> usage;
-
-    // index end is removed
-    template <typename T>
-    void push_vector (std::vector<T> & vec, size_t start, size_t end) {
-#ifdef DEBUG_CACHE_GET
-      std::cout << "cache push_vector: start=" << start << " end=" << end << " size=" << vec.size() << std::endl;
-#endif
-      for (size_t i = end; i > start; --i)
-        vec[i] = vec[i-1];
-    }
-
-    void use (el_index ind) {
-      size_t i;
-      for (i = 0; i < usage.size() && usage[i] != ind; ++i);
-      if (i == usage.size()) {
-        usage.resize (usage.size()+1);
-        push_vector (usage, 0, usage.size()-1);
-        usage[0] = ind;
-      } else {
-        push_vector (usage, 0, i);
-        usage[0] = ind;
-      }
-    }
+    // Elements are kept in the list in order of usage (most
+    // recently used first), the map contains list iterators for
+    // key lookup. Moving element to the beginning of the list and
+    // removing it are O(1), finding a key is O(log(n)).
+    typedef std::map<K, el_index> index_t;
+    index_t index;
+    usage_t usage;
+    S cost;
 };
 
 /// Print cache elements.
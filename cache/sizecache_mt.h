@@ -0,0 +1,229 @@
+#ifndef SIZECACHE_MT_H
+#define SIZECACHE_MT_H
+
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include "sizecache.h"
+#include "err/err.h"
+
+///\addtogroup libmapsoft
+///@{
+///\defgroup SizeCacheMT
+///thread-safe sharded cache with a memory budget
+///@{
+
+/** Memory budget (in bytes) which can be shared between
+    a few SizeCacheMT caches. Only counts memory, eviction is done
+    by caches themselves.
+*/
+class CacheBudget {
+  std::atomic<size_t> used;
+  std::atomic<size_t> limit;
+
+public:
+  /// Constructor: create budget with limit n
+  CacheBudget(size_t n): used(0), limit(n) {}
+
+  /// Return budget limit
+  size_t size_total() const {return limit;}
+
+  /// Change budget limit. Caches will be shrinked
+  /// on next additions.
+  void set_size_total(size_t n) {limit = n;}
+
+  /// Return total size of all elements in all caches
+  size_t size_used() const {return used;}
+
+  /// Is the budget exceeded?
+  bool over() const {return used > limit;}
+
+  /// Add/subtract size (used by caches)
+  void inc(size_t s) {used += s;}
+  void dec(size_t s) {used -= s;}
+};
+
+/** Thread-safe cache of objects of type V, keyed by type K.
+
+    Elements are distributed between N shards (by key hash),
+    each shard is a SizeCache protected by its own mutex, so different
+    threads can use the cache without contention on a single lock.
+
+    Total size of elements (in bytes, calculated by the cost functor S,
+    ImageR::dsize() by default, see SizeCacheCost) is limited by a
+    CacheBudget object. The budget can be shared between
+    many caches. When the budget is exceeded after adding an element,
+    least recently used elements of the same cache are removed, starting
+    from the shard where the element was added. The last added element is
+    never removed, and elements of other caches sharing the budget are not
+    touched (they will be shrinked on their own next additions).
+
+    Values are returned by copy (an element can be removed by other thread
+    at any moment), V should be cheap to copy (like ImageR
+    with shared data).
+
+    Hit/miss statistics is collected in get() and contains() methods.
+*/
+template <typename K, typename V,
+          typename H = std::hash<K>, typename S = SizeCacheCost<V> >
+class SizeCacheMT {
+
+  struct Shard {
+    std::mutex m;
+    SizeCache<K,V,S> c;
+    Shard(): c((size_t)-1) {} // size is limited by the budget
+  };
+
+  std::vector<std::unique_ptr<Shard> > shards;
+  std::shared_ptr<CacheBudget> budget;
+  std::atomic<size_t> hits, misses, evictions;
+  H hash;
+
+  size_t shard_num(const K & key) const { return hash(key) % shards.size(); }
+
+  // Update budget after changing shard, sizes before and after the change
+  void update_budget(size_t s1, size_t s2){
+    if (s2>s1) budget->inc(s2-s1);
+    else budget->dec(s1-s2);
+  }
+
+  // Remove LRU elements until the budget is satisfied.
+  // Start from shard n0, keep the most recent element there.
+  void shrink(size_t n0){
+    for (size_t i=0; i<shards.size() && budget->over(); i++){
+      Shard & sh = *shards[(n0+i)%shards.size()];
+      std::lock_guard<std::mutex> lk(sh.m);
+      while (budget->over() && sh.c.count() > (i==0? 1:0)){
+        budget->dec(sh.c.erase_lru());
+        ++evictions;
+      }
+    }
+  }
+
+public:
+
+  /// Constructor: create cache with own budget of `size` bytes
+  /// and `nshards` shards.
+  SizeCacheMT(size_t size, size_t nshards = 16)
+     : SizeCacheMT(std::make_shared<CacheBudget>(size), nshards) {}
+
+  /// Constructor: create cache using a shared budget.
+  SizeCacheMT(const std::shared_ptr<CacheBudget> & b, size_t nshards = 16)
+      : budget(b), hits(0), misses(0), evictions(0) {
+    if (!budget) throw Err() << "SizeCacheMT: empty budget";
+    if (nshards == 0) nshards = 1;
+    for (size_t i=0; i<nshards; i++) shards.emplace_back(new Shard);
+  }
+
+  SizeCacheMT(const SizeCacheMT &) = delete;
+  SizeCacheMT & operator=(const SizeCacheMT &) = delete;
+
+  /// Destructor: return used memory to the budget
+  ~SizeCacheMT() { clear(); }
+
+  /// Get the budget object
+  std::shared_ptr<CacheBudget> get_budget() const {return budget;}
+
+  /// Return number of shards
+  size_t nshards() const {return shards.size();}
+
+  /// Return number of elements in the cache
+  size_t count() {
+    size_t ret = 0;
+    for (auto & sh: shards){
+      std::lock_guard<std::mutex> lk(sh->m);
+      ret += sh->c.count();
+    }
+    return ret;
+  }
+
+  /// Return total size of elements in this cache
+  size_t size_used() {
+    size_t ret = 0;
+    for (auto & sh: shards){
+      std::lock_guard<std::mutex> lk(sh->m);
+      ret += sh->c.size_used();
+    }
+    return ret;
+  }
+
+  /// Return budget size
+  size_t size_total() const { return budget->size_total(); }
+
+  /// Add an element to the cache (replace if it exists)
+  void add(const K & key, const V & value){
+    size_t n = shard_num(key);
+    {
+      Shard & sh = *shards[n];
+      std::lock_guard<std::mutex> lk(sh.m);
+      size_t s1 = sh.c.size_used();
+      sh.c.add(key, value);
+      update_budget(s1, sh.c.size_used());
+    }
+    shrink(n);
+  }
+
+  /// Check whether the cache contains a key
+  bool contains(const K & key) {
+    Shard & sh = *shards[shard_num(key)];
+    std::lock_guard<std::mutex> lk(sh.m);
+    bool ret = sh.c.contains(key);
+    if (ret) ++hits;
+    else ++misses;
+    return ret;
+  }
+
+  /// Get an element: put it to v and return true,
+  /// or return false if the element does not exist.
+  bool get(const K & key, V & v) {
+    Shard & sh = *shards[shard_num(key)];
+    std::lock_guard<std::mutex> lk(sh.m);
+    if (!sh.c.contains(key)) { ++misses; return false; }
+    ++hits;
+    v = sh.c.get(key);
+    return true;
+  }
+
+  /// Get an element, throw error if it does not exist.
+  V get(const K & key) {
+    V ret;
+    if (!get(key, ret)) throw Err() << "SizeCacheMT: key does not exists";
+    return ret;
+  }
+
+  /// Remove an element from the cache
+  void erase(const K & key){
+    Shard & sh = *shards[shard_num(key)];
+    std::lock_guard<std::mutex> lk(sh.m);
+    size_t s1 = sh.c.size_used();
+    sh.c.erase(key);
+    update_budget(s1, sh.c.size_used());
+  }
+
+  /// Clear the cache
+  void clear(){
+    for (auto & sh: shards){
+      std::lock_guard<std::mutex> lk(sh->m);
+      budget->dec(sh->c.size_used());
+      sh->c.clear();
+    }
+  }
+
+  /// Number of successful lookups.
+  size_t stat_hits() const { return hits; }
+
+  /// Number of failed lookups.
+  size_t stat_misses() const { return misses; }
+
+  /// Number of elements removed to satisfy the budget.
+  size_t stat_evictions() const { return evictions; }
+
+  /// Reset statistics.
+  void stat_reset() { hits = misses = evictions = 0; }
+};
+
+///@}
+///@}
+#endif
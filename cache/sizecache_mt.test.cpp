@@ -0,0 +1,116 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "sizecache_mt.h"
+#include "err/assert_err.h"
+
+using namespace std;
+
+// Object with dsize() method (like ImageR).
+class Obj {
+public:
+    Obj(): v(0) { }
+    Obj(const int i) : v(i) { }
+    size_t dsize() const { return v; }
+    int v;
+};
+
+int main() {
+  try {
+
+    // single-thread operations
+    {
+      SizeCacheMT<int, Obj> cache(250, 4);
+      assert_eq(cache.nshards(), 4);
+      assert_eq(cache.size_total(), 250);
+      assert_eq(cache.count(), 0);
+
+      cache.add(1, Obj(100));
+      cache.add(2, Obj(100));
+      assert_eq(cache.size_used(), 200);
+      assert_eq(cache.get_budget()->size_used(), 200);
+
+      // replace element
+      cache.add(2, Obj(50));
+      assert_eq(cache.size_used(), 150);
+      assert_eq(cache.get(2).v, 50);
+
+      Obj o;
+      assert_eq(cache.get(3, o), false);
+      assert_eq(cache.get(1, o), true);
+      assert_eq(o.v, 100);
+      assert_err(cache.get(3), "SizeCacheMT: key does not exists");
+
+      // budget is exceeded: elements are removed
+      cache.add(3, Obj(200));
+      assert_eq(cache.contains(3), true);
+      assert(cache.size_used() <= 250);
+      assert(cache.stat_evictions() > 0);
+
+      // element larger then the budget is kept
+      cache.add(4, Obj(300));
+      assert_eq(cache.contains(4), true);
+      assert_eq(cache.count(), 1);
+      assert_eq(cache.size_used(), 300);
+
+      cache.erase(4);
+      assert_eq(cache.count(), 0);
+      assert_eq(cache.size_used(), 0);
+      assert_eq(cache.get_budget()->size_used(), 0);
+    }
+
+    // shared budget
+    {
+      std::shared_ptr<CacheBudget> b(new CacheBudget(1000));
+      {
+        SizeCacheMT<int, Obj> c1(b), c2(b, 2);
+        for (int i=0; i<5; i++) c1.add(i, Obj(100));
+        for (int i=0; i<5; i++) c2.add(i, Obj(100));
+        assert_eq(b->size_used(), 1000);
+        assert_eq(c1.count(), 5);
+        assert_eq(c2.count(), 5);
+
+        // c2 frees space for its own elements
+        c2.add(10, Obj(300));
+        assert_eq(c1.count(), 5);
+        assert_eq(c2.count(), 3);
+        assert_eq(b->size_used(), 1000);
+
+        c1.clear();
+        assert_eq(b->size_used(), 500);
+      }
+      // destructors return memory to the budget
+      assert_eq(b->size_used(), 0);
+    }
+
+    // many threads
+    {
+      SizeCacheMT<int, Obj> cache(10000, 8);
+      std::vector<std::thread> threads;
+      for (int t=0; t<8; t++){
+        threads.emplace_back([&cache,t](){
+          for (int i=0; i<20000; i++){
+            int k = (i*7 + t*13) % 500;
+            Obj o;
+            if (cache.get(k, o)) { assert_eq(o.v, k%50+1); }
+            else cache.add(k, Obj(k%50+1));
+            if (i%100 == 0) cache.erase((k+1) % 500);
+          }
+        });
+      }
+      for (auto & t: threads) t.join();
+      assert_eq(cache.size_used(), cache.get_budget()->size_used());
+      assert(cache.size_used() <= 10000);
+      assert_eq(cache.stat_hits() + cache.stat_misses(), 8*20000);
+    }
+
+  }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+}
+
+///\endcond
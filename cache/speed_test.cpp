@@ -0,0 +1,118 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+// Compare speed of the Cache class with the previous
+// implementation (std::map index + vector usage list with
+// linear search and shifting on every access).
+//
+// Typical usage pattern is modelled: contains() -> add() if needed -> get(),
+// keys are random in the range [0, 2*capacity).
+
+#include <map>
+#include <set>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include "cache.h"
+
+// Old implementation, kept here for comparison only.
+template <typename K, typename V>
+class OldCache {
+  public:
+    OldCache (size_t n) : capacity (n) {
+      for (size_t i = 0; i < capacity; ++i) free_list.insert (i);
+    }
+
+    void add (K const & key, V const & value) {
+      if (contains(key)) {
+        storage[index[key]].second = value;
+        return;
+      }
+      if (free_list.size() == 0) {
+        size_t to_delete = usage[usage.size() - 1];
+        index.erase (storage[to_delete].first);
+        free_list.insert (to_delete);
+      }
+      size_t free_ind = *(free_list.begin());
+      free_list.erase (free_list.begin());
+      if (storage.size() <= free_ind)
+        storage.push_back (std::make_pair (key, value));
+      else
+        storage[free_ind] = std::make_pair (key, value);
+      index[key] = free_ind;
+      use (free_ind);
+    }
+
+    bool contains (K const & key) const { return index.count (key) > 0; }
+
+    V & get (K const & key) {
+      size_t ind = index[key];
+      use (ind);
+      return storage[ind].second;
+    }
+
+  private:
+    size_t capacity;
+    std::vector<std::pair<K,V> > storage;
+    std::map<K, size_t> index;
+    std::set<size_t> free_list;
+    std::vector<size_t> usage;
+
+    void use (size_t ind) {
+      size_t i;
+      for (i = 0; i < usage.size() && usage[i] != ind; ++i);
+      if (i == usage.size()) usage.resize (usage.size()+1);
+      for (size_t j = i; j > 0; --j) usage[j] = usage[j-1];
+      usage[0] = ind;
+    }
+};
+
+template <typename C>
+double
+run(C & cache, const std::vector<int> & keys){
+  clock_t t0 = clock();
+  long sum = 0;
+  for (size_t i=0; i<keys.size(); i++){
+    int k = keys[i];
+    if (!cache.contains(k)) cache.add(k, k);
+    sum += cache.get(k);
+  }
+  if (sum == 0) std::cerr << "";
+  return double(clock()-t0)/CLOCKS_PER_SEC/keys.size()*1e9;
+}
+
+int
+main(){
+  std::cout << std::setw(10) << "capacity"
+            << std::setw(14) << "old, ns/op"
+            << std::setw(14) << "new, ns/op"
+            << std::setw(10) << "hit rate" << "\n";
+
+  srand(0);
+  for (size_t cap = 16; cap <= 65536; cap *= 4){
+    // old implementation is O(capacity) per access, limit number of operations
+    size_t nn = 2000000;
+    size_t no = std::min(nn, size_t(2e8/cap));
+
+    std::vector<int> keys(nn);
+    for (size_t i=0; i<nn; i++) keys[i] = rand() % (2*cap);
+
+    OldCache<int,int> c1(cap);
+    std::vector<int> keys1(keys.begin(), keys.begin()+no);
+    double t1 = run(c1, keys1);
+
+    Cache<int,int> c2(cap);
+    double t2 = run(c2, keys);
+
+    std::cout << std::setw(10) << cap
+              << std::setw(14) << std::setprecision(4) << t1
+              << std::setw(14) << std::setprecision(4) << t2
+              << std::setw(10) << std::setprecision(3)
+              << double(c2.stat_hits())/(c2.stat_hits()+c2.stat_misses())
+              << "\n";
+  }
+  return 0;
+}
+
+///\endcond
@@ -28,6 +28,16 @@ struct ConvBase{
     virtual void bck_pt(dPoint & p) const {
       p.x/=sc_src.x*sc_dst.x; p.y/=sc_src.y*sc_dst.y; p.z/=sc_src.z*sc_dst.z;}
 
+    // forward conversion of a contiguous array of points
+    // (can be redefined for conversions with large per-call overhead)
+    virtual void frw_arr(dPoint * p, const size_t n) const {
+      for (size_t i=0; i<n; i++) frw_pt(p[i]);}
+
+    // backward conversion of a contiguous array of points
+    // (can be redefined for conversions with large per-call overhead)
+    virtual void bck_arr(dPoint * p, const size_t n) const {
+      for (size_t i=0; i<n; i++) bck_pt(p[i]);}
+
   public:
 
   // Get copy of the object. Should be redefined in derived classes.
@@ -44,11 +54,17 @@ struct ConvBase{
   /// Backward point transformation.
   virtual void bck(dPoint & p) const {bck_pt(p);}
 
-  /// Convert a Line, point to point.
-  virtual void frw(dLine & l) const { for (auto & p:l) frw(p); }
+  /// Forward transformation of n points in a contiguous array.
+  void frw(dPoint * p, const size_t n) const {frw_arr(p, n);}
+
+  /// Backward transformation of n points in a contiguous array.
+  void bck(dPoint * p, const size_t n) const {bck_arr(p, n);}
+
+  /// Convert a Line (all points at once).
+  virtual void frw(dLine & l) const { frw(l.data(), l.size()); }
 
-  /// Convert a Line, point to point.
-  virtual void bck(dLine & l) const { for (auto & p:l) bck(p); }
+  /// Convert a Line (all points at once).
+  virtual void bck(dLine & l) const { bck(l.data(), l.size()); }
 
   /// Convert a MultiLine, point to point.
   virtual void frw(dMultiLine & ml) const { for (auto & l:ml) frw(l); }
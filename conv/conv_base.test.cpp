@@ -77,6 +77,18 @@ main(){
       cnv.bck(l1);  assert_eq(l1, dLine("[[0,0],[10,10]]"));
     }
 
+    { // test array conversions
+      dPoint pts[3] = {dPoint(0,0), dPoint(2,2), dPoint(10,10)};
+      cnv.frw(pts, 3);
+      assert_eq(pts[0], dPoint(0,0));
+      assert_eq(pts[1], dPoint(4,4));
+      assert_eq(pts[2], dPoint(100,20));
+      cnv.bck(pts, 2);
+      assert_eq(pts[1], dPoint(2,2));
+      assert_eq(pts[2], dPoint(100,20));
+      cnv.frw(pts, 0);
+    }
+
     { // test frw_acc/bck_acc line conversions
        dLine l1("[[0,0],[10,10]]");
        cnv.rescale_dst(10);
@@ -0,0 +1,202 @@
+#include <cmath>
+#include "err/err.h"
+#include "conv_grid.h"
+
+// Interpolation inside a cell: (tx,ty) are relative coordinates, 0..1
+static dPoint
+interp(const dPoint * c, const double tx, const double ty){
+  dPoint a = c[0] + (c[1]-c[0])*tx;
+  dPoint b = c[2] + (c[3]-c[2])*tx;
+  return a + (b-a)*ty;
+}
+
+static bool
+is_finite(const dPoint & p){
+  return std::isfinite(p.x) && std::isfinite(p.y);
+}
+
+ConvGrid::ConvGrid(const ConvBase & cnv_, const dRect & box,
+                   const double acc, const double min_size):
+        cnv(cnv_.clone()), acc(acc), min_size(min_size), npts(0){
+
+  if (box.is_zsize()) throw Err() << "ConvGrid: empty range";
+  if (acc <= 0) throw Err() << "ConvGrid: positive accuracy expected";
+
+  Node root;
+  root.r = box;
+  root.ch = -1;
+  root.exact = false;
+  dPoint pts[4] = {box.tlc(), box.trc(), box.blc(), box.brc()};
+  try {
+    cnv->frw(pts, 4);
+    for (int i=0; i<4; i++) root.c[i] = pts[i];
+  }
+  catch (Err & e) { root.exact = true; }
+  npts += 4;
+  nodes.push_back(root);
+  build(0);
+}
+
+void
+ConvGrid::build(const size_t n){
+  dRect r = nodes[n].r;
+  bool bad = nodes[n].exact;
+  double x1 = r.x, x2 = r.x + r.w, xm = r.x + r.w/2;
+  double y1 = r.y, y2 = r.y + r.h, ym = r.y + r.h/2;
+
+  // convert side centers and cell center
+  dPoint pts[5] = {dPoint(xm,y1), dPoint(x1,ym), dPoint(xm,ym),
+                   dPoint(x2,ym), dPoint(xm,y2)};
+  if (!bad){
+    try { cnv->frw(pts, 5); }
+    catch (Err & e) { bad = true; }
+    npts += 5;
+  }
+
+  // interpolation error in destination units
+  double err = 0;
+  if (!bad){
+    const dPoint * c = nodes[n].c;
+    for (int i=0; i<4; i++) if (!is_finite(c[i])) bad = true;
+    for (int i=0; i<5; i++) if (!is_finite(pts[i])) bad = true;
+    dPoint ip[5] = {interp(c,0.5,0), interp(c,0,0.5), interp(c,0.5,0.5),
+                    interp(c,1,0.5), interp(c,0.5,1)};
+    for (int i=0; i<5 && !bad; i++)
+      err = std::max(err, hypot(ip[i].x-pts[i].x, ip[i].y-pts[i].y));
+  }
+
+  // root is always divided once: 5 test points are not
+  // enough to check a large cell
+  if (n>0 && !bad && err < acc) return;
+
+  // cell is too small: use exact conversion
+  if (r.w <= min_size && r.h <= min_size){
+    nodes[n].exact = true;
+    return;
+  }
+
+  // make 4 children (nodes array can be reallocated here)
+  size_t ch = nodes.size();
+  nodes[n].ch = ch;
+  dPoint cc[9] = {nodes[n].c[0], pts[0], nodes[n].c[1],
+                  pts[1],        pts[2], pts[3],
+                  nodes[n].c[2], pts[4], nodes[n].c[3]};
+  for (int j=0; j<2; j++){
+    for (int i=0; i<2; i++){
+      Node nd;
+      nd.r = dRect(i? xm:x1, j? ym:y1, r.w/2, r.h/2);
+      nd.c[0] = cc[3*j+i];
+      nd.c[1] = cc[3*j+i+1];
+      nd.c[2] = cc[3*j+i+3];
+      nd.c[3] = cc[3*j+i+4];
+      nd.ch = -1;
+      nd.exact = bad;
+      nodes.push_back(nd);
+    }
+  }
+  for (int i=0; i<4; i++) build(ch+i);
+}
+
+int
+ConvGrid::find(const dPoint & p) const{
+  const dRect & r = nodes[0].r;
+  if (p.x < r.x || p.x > r.x+r.w ||
+      p.y < r.y || p.y > r.y+r.h) return -1;
+  int n = 0;
+  while (nodes[n].ch>=0){
+    const dRect & r = nodes[n].r;
+    n = nodes[n].ch + (p.x > r.x + r.w/2 ? 1:0)
+                    + (p.y > r.y + r.h/2 ? 2:0);
+  }
+  return n;
+}
+
+void
+ConvGrid::find_row(const size_t n, const double y, std::vector<size_t> & ret) const{
+  if (nodes[n].ch<0) {ret.push_back(n); return;}
+  const dRect & r = nodes[n].r;
+  size_t ch = nodes[n].ch + (y > r.y + r.h/2 ? 2:0);
+  find_row(ch, y, ret);
+  find_row(ch+1, y, ret);
+}
+
+size_t
+ConvGrid::get_ncells() const{
+  size_t ret = 0;
+  for (const auto & n: nodes) if (n.ch<0) ret++;
+  return ret;
+}
+
+void
+ConvGrid::frw_pt(dPoint & p) const{
+  p.x*=sc_src.x; p.y*=sc_src.y; p.z*=sc_src.z;
+  int n = find(p);
+  if (n<0 || nodes[n].exact){
+    cnv->frw(p);
+  }
+  else {
+    const Node & nd = nodes[n];
+    double z = p.z;
+    p = interp(nd.c, (p.x-nd.r.x)/nd.r.w, (p.y-nd.r.y)/nd.r.h);
+    p.z = z;
+  }
+  p.x*=sc_dst.x; p.y*=sc_dst.y; p.z*=sc_dst.z;
+}
+
+void
+ConvGrid::bck_pt(dPoint & p) const{
+  p.x/=sc_dst.x; p.y/=sc_dst.y; p.z/=sc_dst.z;
+  cnv->bck(p);
+  p.x/=sc_src.x; p.y/=sc_src.y; p.z/=sc_src.z;
+}
+
+void
+ConvGrid::frw_row(const dPoint & p0, const double dx,
+                  const size_t n, dPoint * out) const{
+  if (n==0) return;
+  dPoint q0(p0.x*sc_src.x, p0.y*sc_src.y, p0.z*sc_src.z);
+  double qdx = dx*sc_src.x;
+  for (size_t i=0; i<n; i++) out[i] = dPoint(q0.x + i*qdx, q0.y, q0.z);
+
+  const dRect & r = nodes[0].r;
+  std::vector<size_t> cells;
+  if (q0.y >= r.y && q0.y <= r.y+r.h) find_row(0, q0.y, cells);
+
+  // Go along the row. Cells are sorted in x direction, for dx<0
+  // cells are searched for each point. Exact conversion is done
+  // for ranges [i0,i) of points outside interpolated cells.
+  size_t i0 = 0, i = 0;
+  auto c = cells.begin();
+  while (i<n){
+    double x = out[i].x;
+    int k = -1;
+    if (qdx>=0){
+      while (c!=cells.end() && nodes[*c].r.x + nodes[*c].r.w < x) ++c;
+      if (c!=cells.end() && nodes[*c].r.x <= x) k = *c;
+    }
+    else k = find(out[i]);
+
+    if (k<0 || nodes[k].exact) { i++; continue; }
+
+    // interpolation inside cell k, incremental in x
+    if (i>i0) cnv->frw(out+i0, i-i0);
+    const Node & nd = nodes[k];
+    double ty = (q0.y - nd.r.y)/nd.r.h;
+    dPoint a = nd.c[0] + (nd.c[2]-nd.c[0])*ty;
+    dPoint b = nd.c[1] + (nd.c[3]-nd.c[1])*ty;
+    dPoint d = (b-a)*(qdx/nd.r.w);
+    dPoint v = a + (b-a)*((x-nd.r.x)/nd.r.w);
+    double xmin = nd.r.x, xmax = nd.r.x + nd.r.w;
+    for (; i<n && out[i].x>=xmin && out[i].x<=xmax; i++){
+      v.z = out[i].z;
+      out[i] = v;
+      v = v + d;
+    }
+    i0 = i;
+  }
+  if (n>i0) cnv->frw(out+i0, n-i0);
+
+  for (size_t i=0; i<n; i++){
+    out[i].x*=sc_dst.x; out[i].y*=sc_dst.y; out[i].z*=sc_dst.z;
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef CONV_GRID_H
+#define CONV_GRID_H
+
+#include <memory>
+#include <vector>
+#include "conv_base.h"
+
+///\addtogroup libmapsoft
+///@{
+
+/// Approximation of an arbitrary conversion by bilinear interpolation
+/// on an adaptive grid. The exact conversion is evaluated in nodes of
+/// a quadtree built over a rectangle in source coordinates; cells are
+/// subdivided until interpolation error is below `acc` (in destination
+/// units) or cell size reaches `min_size` (in source units).
+/// Points outside the rectangle, and cells where the exact conversion
+/// fails or does not converge, are converted exactly.
+/// Backward conversion is always exact.
+class ConvGrid : public ConvBase {
+public:
+
+  /// Build the grid for conversion `cnv` over rectangle `box`.
+  ConvGrid(const ConvBase & cnv, const dRect & box,
+           const double acc = 0.5, const double min_size = 1.0);
+
+  /// Forward point conversion (interpolation).
+  void frw_pt(dPoint & p) const override;
+
+  /// Backward point conversion (exact).
+  void bck_pt(dPoint & p) const override;
+
+  /// Convert a row of points (x0 + i*dx, y0), i=0..n-1, write result
+  /// to `out` array. Interpolated values are calculated incrementally
+  /// along each grid cell, exact conversions are done in batches.
+  void frw_row(const dPoint & p0, const double dx,
+               const size_t n, dPoint * out) const;
+
+  // redefine clone() method
+  virtual std::shared_ptr<ConvBase> clone() const override{
+    return std::shared_ptr<ConvBase>(new ConvGrid(*this));
+  }
+
+  /// Number of exact point conversions used to build the grid.
+  size_t get_npts() const {return npts;}
+
+  /// Number of grid cells (leaves of the quadtree).
+  size_t get_ncells() const;
+
+private:
+
+  struct Node {
+    dRect r;      // cell range (source coordinates)
+    dPoint c[4];  // converted corners: (x1,y1), (x2,y1), (x1,y2), (x2,y2)
+    int ch;       // index of the first of 4 children, -1 for leaves
+    bool exact;   // use exact conversion inside this cell
+  };
+
+  std::shared_ptr<ConvBase> cnv;
+  std::vector<Node> nodes;  // nodes[0] is the root
+  double acc, min_size;
+  size_t npts;
+
+  // subdivide a node if needed
+  void build(const size_t n);
+
+  // find leaf containing point p (-1 if p is outside the root)
+  int find(const dPoint & p) const;
+
+  // collect leaves crossing horizontal line y, sorted in x
+  void find_row(const size_t n, const double y, std::vector<size_t> & ret) const;
+};
+
+///@}
+#endif
@@ -0,0 +1,140 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <cassert>
+#include <cmath>
+#include "conv_grid.h"
+#include "conv_aff.h"
+#include "err/assert_err.h"
+
+// Non-linear test conversion, counts calls.
+// Undefined (NaN) for y<-100.
+class ConvTest : public ConvBase {
+public:
+  mutable size_t cnt = 0;
+  void frw_pt(dPoint & p) const override {
+    cnt++;
+    if (p.y<-100) { p.x = p.y = NAN; return; }
+    double x = p.x + 1e-3*p.y*p.y;
+    double y = p.y + 10*sin(p.x/50);
+    p.x = x; p.y = y;
+  }
+  void bck_pt(dPoint & p) const override { p.x-=1; }
+  virtual std::shared_ptr<ConvBase> clone() const override{
+    return std::shared_ptr<ConvBase>(new ConvTest(*this));
+  }
+};
+
+int
+main(){
+  try{
+
+    ConvTest cnv;
+    dRect box(0,0,256,256);
+
+    assert_err(ConvGrid(cnv, dRect()), "ConvGrid: empty range");
+    assert_err(ConvGrid(cnv, box, 0), "ConvGrid: positive accuracy expected");
+
+    // affine conversion: root is divided once
+    {
+      ConvAff2D cnv1(dPoint(10,10), 0.1);
+      ConvGrid g(cnv1, box);
+      assert_eq(g.get_ncells(), 4);
+      assert_eq(g.get_npts(), 29);
+      dPoint p1(12.3,45.6), p2(p1);
+      g.frw(p1); cnv1.frw(p2);
+      assert_deq(p1, p2, 1e-9);
+    }
+
+    // non-linear conversion, 0.5 accuracy
+    {
+      ConvGrid g(cnv, box, 0.5);
+      assert_eq(g.get_npts() < 1000, true);
+      assert_eq(g.get_ncells() > 4, true);
+
+      // every pixel: interpolation error
+      double err = 0;
+      std::vector<dPoint> row(256);
+      for (int y=0; y<256; y++){
+        g.frw_row(dPoint(0,y), 1, 256, row.data());
+        for (int x=0; x<256; x++){
+          dPoint p1(x,y), p2(x,y);
+          cnv.frw(p1);
+          g.frw(p2);
+          err = std::max(err, dist(p1, p2));
+          assert_deq(p2, row[x], 1e-9); // row walker = point conversion
+        }
+      }
+      assert_eq(err < 0.5, true);
+
+      // same with reverse direction and non-integer steps
+      row.resize(100);
+      g.frw_row(dPoint(300,10.5), -3.3, 100, row.data());
+      for (int i=0; i<100; i++){
+        dPoint p(300-3.3*i, 10.5);
+        g.frw(p);
+        assert_deq(p, row[i], 1e-9);
+      }
+
+      // points outside the range are converted exactly
+      dPoint p1(300,-20), p2(p1);
+      cnv.frw(p1); g.frw(p2);
+      assert_eq(p1, p2);
+
+      // backward conversion is exact
+      dPoint p(1,1);
+      g.bck(p);
+      assert_eq(p, dPoint(0,1));
+
+      // clone
+      auto g1 = g.clone();
+      p = dPoint(100.5,50.2);
+      dPoint q(p);
+      g.frw(p); g1->frw(q);
+      assert_eq(p, q);
+    }
+
+    // higher accuracy requires more points
+    {
+      ConvGrid g1(cnv, box, 0.5), g2(cnv, box, 0.05);
+      assert_eq(g1.get_npts() < g2.get_npts(), true);
+    }
+
+    // cells where conversion is undefined
+    {
+      ConvGrid g(cnv, dRect(0,-200,256,256), 0.5);
+      dPoint p1(10,-150), p2(10, 0);
+      g.frw(p1);
+      assert_eq(std::isnan(p1.x), true);
+      g.frw(p2);
+      assert_deq(p2, cnv.frw_pts(dPoint(10,0)), 0.5);
+      std::vector<dPoint> row(256);
+      g.frw_row(dPoint(0,-150), 1, 256, row.data());
+      for (const auto & p:row) assert_eq(std::isnan(p.x), true);
+    }
+
+    // scaling
+    {
+      ConvGrid g(cnv, box, 0.5);
+      g.rescale_src(2);
+      g.rescale_dst(0.5);
+      dPoint p1(50,60), p2(100,120);
+      g.frw(p1);
+      cnv.frw(p2);
+      assert_deq(p1, p2*0.5, 0.5);
+      std::vector<dPoint> row(10);
+      g.frw_row(dPoint(50,60), 0.5, 10, row.data());
+      assert_deq(row[0], p1, 1e-9);
+      dPoint p3(54.5,60);
+      g.frw(p3);
+      assert_deq(row[9], p3, 1e-9);
+    }
+
+  }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
@@ -58,6 +58,23 @@ public:
     p.x/=sc_src.x; p.y/=sc_src.y;
   }
 
+  /// redefine forward conversion of a point array:
+  /// each conversion processes the whole array
+  void frw_arr(dPoint * p, const size_t n) const override {
+    for (size_t j=0; j<n; j++) { p[j].x*=sc_src.x; p[j].y*=sc_src.y; }
+    for (auto i = cnvs.begin(); i!=cnvs.end(); ++i)
+      if (i->first) i->second->frw(p, n); else i->second->bck(p, n);
+    for (size_t j=0; j<n; j++) { p[j].x*=sc_dst.x; p[j].y*=sc_dst.y; }
+  }
+
+  /// redefine backward conversion of a point array
+  void bck_arr(dPoint * p, const size_t n) const override {
+    for (size_t j=0; j<n; j++) { p[j].x/=sc_dst.x; p[j].y/=sc_dst.y; }
+    for (auto i = cnvs.rbegin(); i!=cnvs.rend(); ++i)
+      if (i->first) i->second->bck(p, n); else i->second->frw(p, n);
+    for (size_t j=0; j<n; j++) { p[j].x/=sc_src.x; p[j].y/=sc_src.y; }
+  }
+
   // redefine clone() method
   virtual std::shared_ptr<ConvBase> clone() const override{
     return std::shared_ptr<ConvBase>(new ConvMulti(*this));
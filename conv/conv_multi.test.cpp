@@ -42,6 +42,16 @@ main(){
     cnv.frw(p);  assert_deq(p, dPoint(20,20), 1e-6);
     cnv.bck(p);  assert_deq(p, dPoint(10,10), 1e-6);
 
+    // Line and array conversions: same as point-to-point
+    {
+      dLine l("[[1,2],[3,4],[5,6,7]]"), l0(l);
+      cnv.frw(l);
+      for (size_t i=0; i<l.size(); i++)
+        assert_deq(l[i], cnv.frw_pts(l0[i]), 1e-6);
+      cnv.bck(l.data(), l.size());
+      assert_deq(l, l0, 1e-6);
+    }
+
    //some test with non-trivial conversion is needed
 
    // simplify()
@@ -1,5 +1,10 @@
 #include <proj.h>
 #include <proj_experimental.h> // promote_to_3d
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
 
 #include "err/err.h"
 #include "conv_geo.h"
@@ -94,34 +99,95 @@ normalized_pj(PJ_CONTEXT *ctx, const std::string & crsname){
   return p1;
 }
 
-ConvGeo::ConvGeo(const std::string & src,
-       const std::string & dst, const bool use2d){
-//  su_src  = (src == "SU");
-//  su_dst  = (dst == "SU");
-  cnv2d=use2d;
+/********************************************************************/
+// Thread-local storage of libproj objects.
+// libproj context and objects created in it can not be used from
+// different threads. Each thread keeps one context (created
+// when it is needed first time) and transformations for all ConvGeo
+// objects used in this thread (copies of a ConvGeo object have same id).
+// Creating a context is expensive (it opens the proj database),
+// so it is never recreated.
+//
+// When the last copy of a ConvGeo object is destroyed, its id is
+// sent to all threads; each thread removes the transformation
+// on its next access to the storage (or when the thread finishes).
+// libproj objects are always destroyed in the thread which created them.
+
+namespace {
+
+struct ConvGeoTLS {
+  std::shared_ptr<void> pc;  // proj context
+  std::unordered_map<size_t, std::shared_ptr<void> > pjs; // id -> crs_to_crs
+
+  std::mutex m;               // locks `removed` list
+  std::vector<size_t> removed; // ids of destroyed ConvGeo objects
+  std::atomic<bool> dirty;    // `removed` list is not empty
+
+  ConvGeoTLS();
+  ~ConvGeoTLS();
+
+  // remove transformations of destroyed ConvGeo objects
+  void cleanup(){
+    if (!dirty.load(std::memory_order_acquire)) return;
+    std::lock_guard<std::mutex> lk(m);
+    for (auto id: removed) pjs.erase(id);
+    removed.clear();
+    dirty = false;
+  }
+};
+
+// All thread storages. Never destroyed: ConvGeo objects
+// can be destroyed during static destruction.
+struct ConvGeoReg {
+  std::mutex m;
+  std::set<ConvGeoTLS*> tls;
+};
 
-  if (src==dst) return; // null pj value
+ConvGeoReg &
+conv_geo_reg(){
+  static ConvGeoReg * reg = new ConvGeoReg;
+  return *reg;
+}
 
-  // make proj context
-  pc = std::shared_ptr<void>(
-         proj_context_create(), proj_context_destroy);
-  if (!pc) throw Err() << "Can't create libproj context";
-  auto pcp = (PJ_CONTEXT*)pc.get();
-  proj_log_level((PJ_CONTEXT*)pc.get(), PJ_LOG_NONE);
+ConvGeoTLS::ConvGeoTLS(): dirty(false) {
+  auto & reg = conv_geo_reg();
+  std::lock_guard<std::mutex> lk(reg.m);
+  reg.tls.insert(this);
+}
 
-  if (src == "" || dst == "") throw Err() <<
-    "ConvGeo: can't make conversion with an empty projection string";
+ConvGeoTLS::~ConvGeoTLS(){
+  auto & reg = conv_geo_reg();
+  std::lock_guard<std::mutex> lk(reg.m);
+  reg.tls.erase(this);
+  pjs.clear(); // destroy transformations before the context
+}
+
+thread_local ConvGeoTLS conv_geo_tls;
+std::atomic<size_t> conv_geo_id(0);
+
+// Create transformation for the current thread
+std::shared_ptr<void>
+conv_geo_create(const std::string & src, const std::string & dst){
+  auto & pc = conv_geo_tls.pc;
+  if (!pc) {
+    pc = std::shared_ptr<void>(proj_context_create(), proj_context_destroy);
+    if (!pc) throw Err() << "Can't create libproj context";
+    proj_log_level((PJ_CONTEXT*)pc.get(), PJ_LOG_NONE);
+  }
+  auto pcp = (PJ_CONTEXT*)pc.get();
 
   // make transformation object
   auto psrc = normalized_pj(pcp, src);
-  auto pdst = normalized_pj(pcp, dst);
-  pj = std::shared_ptr<void>(
+  PJ * pdst;
+  try { pdst = normalized_pj(pcp, dst); }
+  catch (Err & err) { proj_destroy(psrc); throw; }
+
+  auto pj = std::shared_ptr<void>(
       proj_create_crs_to_crs_from_pj(pcp, psrc, pdst, NULL, NULL),
       proj_destroy);
   proj_destroy(psrc);
   proj_destroy(pdst);
-  auto pjp = (PJ*) pj.get();
-  if (!pjp) {
+  if (!pj) {
     int err = proj_context_errno(pcp);
     if (err==0)
       throw Err() << "Can't create libproj transformation, unknown reason";
@@ -129,8 +195,64 @@ ConvGeo::ConvGeo(const std::string & src,
                 << src << "\" to \"" << dst << "\": "
                 << proj_context_errno_string(pcp, err);
   }
+  return pj;
+}
+
+// Find transformation for a given id, create a new one if needed.
+void *
+conv_geo_get(const size_t id, const std::string & src, const std::string & dst){
+  auto & tls = conv_geo_tls;
+  tls.cleanup();
+  auto i = tls.pjs.find(id);
+  if (i != tls.pjs.end()) return i->second.get();
+  auto pj = conv_geo_create(src, dst);
+  tls.pjs.emplace(id, pj);
+  return pj.get();
+}
+
+// Shared by all copies of a ConvGeo object. When the last
+// copy is destroyed, transformations are removed in all threads.
+struct ConvGeoToken {
+  size_t id;
+  ConvGeoToken(const size_t id): id(id) {}
+  ~ConvGeoToken(){
+    auto & reg = conv_geo_reg();
+    std::lock_guard<std::mutex> lk(reg.m);
+    for (auto t: reg.tls){
+      std::lock_guard<std::mutex> lk1(t->m);
+      t->removed.push_back(id);
+      t->dirty = true;
+    }
+  }
+};
+
+}
+
+/********************************************************************/
+
+ConvGeo::ConvGeo(const std::string & src,
+       const std::string & dst, const bool use2d): src(src), dst(dst), id(0){
+//  su_src  = (src == "SU");
+//  su_dst  = (dst == "SU");
+  cnv2d=use2d;
+
+  if (src==dst) return; // trivial conversion, id=0
+
+  if (src == "" || dst == "") throw Err() <<
+    "ConvGeo: can't make conversion with an empty projection string";
+
+  // Create transformation for the current thread.
+  // This also checks projection strings.
+  id = ++conv_geo_id;
+  token = std::make_shared<ConvGeoToken>(id);
+  conv_geo_get(id, src, dst);
 }
 
+void *
+ConvGeo::get_pj() const {
+  if (id==0) return NULL;
+  return conv_geo_get(id, src, dst);
+}
 
 void
 ConvGeo::frw_pt(dPoint & p) const{
@@ -139,7 +261,7 @@ ConvGeo::frw_pt(dPoint & p) const{
   if (sc_src.z!=1.0) {p.z*=sc_src.z;}
 
 
-  PJ *pjp = (PJ*)pj.get();
+  PJ *pjp = (PJ*)get_pj();
 
   if (pjp) {
 
@@ -205,7 +327,7 @@ ConvGeo::bck_pt(dPoint & p) const{
   if (sc_dst.y!=1.0) {p.y/=sc_dst.y;}
   if (sc_dst.z!=1.0) {p.z/=sc_dst.z;}
 
-  PJ *pjp = (PJ*)pj.get();
+  PJ *pjp = (PJ*)get_pj();
   if (pjp) {
 
     // should we use altitude in the conversion?
@@ -256,6 +378,69 @@ ConvGeo::bck_pt(dPoint & p) const{
   if (sc_src.z!=1.0) {p.z/=sc_src.z;}
 }
 
+void
+ConvGeo::trans_arr(dPoint * p, const size_t n, const bool frw) const{
+  PJ *pjp = (PJ*)get_pj();
+  double *z = cnv2d? NULL : &p[0].z;
+
+  // one call for the whole array: x, y, z are strided
+  proj_errno_reset(pjp);
+  proj_trans_generic(pjp, frw? PJ_FWD:PJ_INV,
+     &p[0].x, sizeof(dPoint), n,
+     &p[0].y, sizeof(dPoint), n,
+     z, z? sizeof(dPoint):0, z? n:0,
+     NULL, 0, 0);
+
+  int err = proj_errno(pjp);
+  if (err!=0) throw Err() << "Can't convert coordinates: " << proj_errno_string(err);
+}
+
+// Are there points with undefined altitude?
+// (they can not be converted in 3D mode together with others)
+static bool
+has_nan_z(const dPoint * p, const size_t n){
+  for (size_t i=0; i<n; i++) if (std::isnan(p[i].z)) return true;
+  return false;
+}
+
+void
+ConvGeo::frw_arr(dPoint * p, const size_t n) const{
+  if (id==0 || n==0 || (!cnv2d && has_nan_z(p, n))){
+    for (size_t i=0; i<n; i++) frw_pt(p[i]);
+    return;
+  }
+  for (size_t i=0; i<n; i++){
+    if (sc_src.x!=1.0) {p[i].x*=sc_src.x;}
+    if (sc_src.y!=1.0) {p[i].y*=sc_src.y;}
+    if (sc_src.z!=1.0) {p[i].z*=sc_src.z;}
+  }
+  trans_arr(p, n, true);
+  for (size_t i=0; i<n; i++){
+    if (sc_dst.x!=1.0) {p[i].x*=sc_dst.x;}
+    if (sc_dst.y!=1.0) {p[i].y*=sc_dst.y;}
+    if (sc_dst.z!=1.0) {p[i].z*=sc_dst.z;}
+  }
+}
+
+void
+ConvGeo::bck_arr(dPoint * p, const size_t n) const{
+  if (id==0 || n==0 || (!cnv2d && has_nan_z(p, n))){
+    for (size_t i=0; i<n; i++) bck_pt(p[i]);
+    return;
+  }
+  for (size_t i=0; i<n; i++){
+    if (sc_dst.x!=1.0) {p[i].x/=sc_dst.x;}
+    if (sc_dst.y!=1.0) {p[i].y/=sc_dst.y;}
+    if (sc_dst.z!=1.0) {p[i].z/=sc_dst.z;}
+  }
+  trans_arr(p, n, false);
+  for (size_t i=0; i<n; i++){
+    if (sc_src.x!=1.0) {p[i].x/=sc_src.x;}
+    if (sc_src.y!=1.0) {p[i].y/=sc_src.y;}
+    if (sc_src.z!=1.0) {p[i].z/=sc_src.z;}
+  }
+}
+
 bool
 ConvGeo::is_deg(const std::string & str){
   auto str1 = expand_proj_aliases(str);
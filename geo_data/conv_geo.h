@@ -32,6 +32,12 @@ A few aliases are supported:
 Additional parameter 2d switches altitude conversions
 (by default altitude is not converted).
 
+Conversions can be used from many threads at once (also through
+copies made by clone()). Each thread gets its own libproj context
+and transformation object, created on first use from the
+stored projection strings and kept in thread-local storage until
+the last copy of the conversion is destroyed.
+
 */
 
 // expand proj aliases (such as "WGS", "WEB", "FI", "SU39")
@@ -53,6 +59,12 @@ public:
   /// Backward point conversion.
   void bck_pt(dPoint & p) const override;
 
+  /// Forward conversion of a point array (one libproj call).
+  void frw_arr(dPoint * p, const size_t n) const override;
+
+  /// Backward conversion of a point array (one libproj call).
+  void bck_arr(dPoint * p, const size_t n) const override;
+
   // redefine clone() method
   virtual std::shared_ptr<ConvBase> clone() const override{
     return std::shared_ptr<ConvBase>(new ConvGeo(*this));
@@ -67,10 +79,17 @@ public:
   static bool is_rad(const std::string & str);
 
 private:
-  std::shared_ptr<void> pc; // proj context
-  std::shared_ptr<void> pj; // crs_to_crs, should be destroyed after context
-  bool cnv2d; // Do 2D or 3D conversion
+  std::string src, dst; // projection strings
+  size_t id;   // transformation id (0 for trivial conversion), shared by copies
+  std::shared_ptr<void> token; // removes transformations when the last copy is destroyed
+  bool cnv2d;  // Do 2D or 3D conversion
 //  bool su_src, su_dst; // Use automatic 6-degree zones (for SU coordinate system)
+
+  // libproj transformation (PJ*) for the current thread
+  void * get_pj() const;
+
+  // convert array of points with libproj (no scaling)
+  void trans_arr(dPoint * p, const size_t n, const bool frw) const;
 };
 
 
@@ -135,6 +135,23 @@ main(){
     p2.z/=2;
     assert(dist2d(p1,p2*2) < 2e-7);
 
+    // array/line conversions: same as point-to-point (2D and 3D,
+    // with scaling and points with undefined altitude)
+    for (int d3 = 0; d3<2; d3++){
+      cnv3.set_2d(!d3);
+      dLine l2;
+      for (int i=0; i<100; i++)
+        l2.push_back(dPoint(12.0 + i*0.01, 30.0 + i*0.02, i%7==0 && d3? nan(""): i));
+      dLine l2a(l2);
+      cnv3.frw(l2a);
+      for (size_t i=0; i<l2.size(); i++)
+        assert(dist(l2a[i], cnv3.frw_pts(l2[i])) < 1e-6 || std::isnan(l2[i].z));
+      cnv3.bck(l2a.data(), l2a.size());
+      for (size_t i=0; i<l2.size(); i++)
+        assert(dist2d(l2a[i], l2[i]) < 1e-7);
+    }
+    cnv3.set_2d();
+
     // adding coordinate prefix does not change result
     {
       std::string proj1 = "SU99";
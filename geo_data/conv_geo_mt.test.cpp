@@ -0,0 +1,123 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <random>
+#include <string>
+#include "err/assert_err.h"
+#include "conv_geo.h"
+
+// Convert points with a ConvGeo object from many threads
+// and compare results with a single-threaded run.
+
+// make random points in a lon-lat range
+dLine
+make_pts(const size_t n, const int seed){
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<double> dx(35.0, 41.0), dy(54.0, 58.0);
+  dLine ret;
+  for (size_t i=0; i<n; i++) ret.push_back(dPoint(dx(gen), dy(gen)));
+  return ret;
+}
+
+// convert points forward and backward, point by point and as arrays
+void
+convert(const ConvBase & cnv, const dLine & src, dLine & f1, dLine & f2, dLine & b2){
+  f1 = src;
+  for (auto & p: f1) cnv.frw(p);
+  f2 = src;
+  cnv.frw(f2);
+  b2 = f2;
+  cnv.bck(b2);
+}
+
+void
+compare(const dLine & l1, const dLine & l2){
+  assert_eq(l1.size(), l2.size());
+  for (size_t i=0; i<l1.size(); i++)
+    assert_eq(dist(l1[i], l2[i]), 0.0);
+}
+
+int
+main(){
+  try{
+    const size_t nth = 8, npts = 2000;
+
+    std::vector<std::shared_ptr<ConvBase>> cnvs;
+    cnvs.push_back(std::shared_ptr<ConvBase>(new ConvGeo("WGS", "SU39")));
+    cnvs.push_back(std::shared_ptr<ConvBase>(new ConvGeo("WGS", "WEB")));
+    cnvs.push_back(std::shared_ptr<ConvBase>(new ConvGeo("WGS", "SU_LL", false)));
+
+    for (const auto & cnv: cnvs){
+
+      // single-threaded results
+      std::vector<dLine> src(nth), f1(nth), f2(nth), b2(nth);
+      for (size_t t=0; t<nth; t++){
+        src[t] = make_pts(npts, t+1);
+        convert(*cnv, src[t], f1[t], f2[t], b2[t]);
+        compare(f1[t], f2[t]);
+        assert_eq(dist(src[t], b2[t]) < 1e-7, true);
+      }
+
+      // same conversion (and its copies) from many threads
+      std::vector<dLine> mf1(nth), mf2(nth), mb2(nth);
+      std::vector<std::thread> threads;
+      for (size_t t=0; t<nth; t++){
+        auto c = t%2 ? cnv : cnv->clone();
+        threads.emplace_back([c,t,&src,&mf1,&mf2,&mb2](){
+          for (int k=0; k<5; k++)
+            convert(*c, src[t], mf1[t], mf2[t], mb2[t]);
+        });
+      }
+      for (auto & t: threads) t.join();
+
+      for (size_t t=0; t<nth; t++){
+        compare(f1[t], mf1[t]);
+        compare(f2[t], mf2[t]);
+        compare(b2[t], mb2[t]);
+      }
+    }
+
+    // many short-living conversions in one thread (transformations
+    // are removed when conversions are destroyed)
+    dPoint p0(37.5, 55.7);
+    for (int i=0; i<40; i++){
+      ConvGeo c("WGS", i%2? "WEB" : "SU39");
+      dPoint p(p0);
+      c.frw(p); c.bck(p);
+      assert_eq(dist(p, p0) < 1e-7, true);
+    }
+
+    // many conversions alive at the same time, used in turn
+    // from a few threads, then destroyed
+    {
+      std::vector<ConvGeo> cc;
+      for (int lon0=3; lon0<180; lon0+=6)
+        cc.push_back(ConvGeo("WGS", "SU" + std::to_string(lon0)));
+      auto run = [&cc](){
+        for (int k=0; k<3; k++){
+          for (size_t i=0; i<cc.size(); i++){
+            dPoint p1(6.0*i+3.5, 55.7), p(p1);
+            cc[i].frw(p); cc[i].bck(p);
+            assert_eq(dist(p, p1) < 1e-7, true);
+          }
+        }
+      };
+      std::vector<std::thread> threads;
+      for (size_t t=0; t<3; t++) threads.emplace_back(run);
+      run();
+      for (auto & t: threads) t.join();
+      cc.clear();
+      run();
+    }
+
+  }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
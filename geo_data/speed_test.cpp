@@ -0,0 +1,74 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+// Compare speed of point-by-point and batched ConvGeo conversions
+// (one libproj call per point vs one call per array).
+// A 256x256 grid is converted, as in tile rendering.
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include "conv_geo.h"
+
+typedef std::chrono::steady_clock clk;
+
+// convert grid n times, return Mpt/s
+double
+run(const ConvBase & cnv, const dLine & grid, const bool batch, const int n){
+  auto t0 = clk::now();
+  for (int k=0; k<n; k++){
+    dLine l(grid);
+    if (batch) cnv.frw(l);
+    else for (auto & p: l) cnv.frw(p);
+  }
+  std::chrono::duration<double> dt = clk::now() - t0;
+  return n*grid.size()/dt.count()/1e6;
+}
+
+void
+test(const std::string & name, const ConvBase & cnv, const dLine & grid){
+  int n = 20;
+  std::cout << std::setw(20) << name
+            << std::setw(14) << std::setprecision(4) << run(cnv, grid, false, n)
+            << std::setw(14) << std::setprecision(4) << run(cnv, grid, true, n)
+            << "\n";
+}
+
+int
+main(){
+  try {
+    // grid in WGS coordinates
+    dLine grid;
+    for (int j=0; j<256; j++)
+      for (int i=0; i<256; i++)
+        grid.push_back(dPoint(30 + i/256.0, 60 + j/256.0));
+
+    std::cout << std::setw(20) << "conversion"
+              << std::setw(14) << "point, Mpt/s"
+              << std::setw(14) << "batch, Mpt/s" << "\n";
+
+    test("WGS -> WEB", ConvGeo("WGS", "WEB"), grid);
+    test("WGS -> SU33", ConvGeo("WGS", "SU33"), grid);
+
+    // image -> map projection -> WGS, as in ConvMap
+    std::map<dPoint,dPoint> refs = {
+      {dPoint(0,0), dPoint(6500000,6650000)},
+      {dPoint(1000,0), dPoint(6510000,6650000)},
+      {dPoint(0,1000), dPoint(6500000,6640000)},
+    };
+    ConvMulti cnv;
+    cnv.push_back(ConvAff2D(refs));
+    cnv.push_back(ConvGeo("SU33", "WGS"));
+    dLine igrid;
+    for (int j=0; j<256; j++)
+      for (int i=0; i<256; i++)
+        igrid.push_back(dPoint(i,j));
+    test("image -> SU33 -> WGS", cnv, igrid);
+  }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
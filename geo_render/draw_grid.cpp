@@ -1,4 +1,6 @@
 #include <sstream>
+#include <mutex>
+#include <climits>
 
 #include "geo_data/conv_geo.h"
 #include "geo_data/geo_utils.h"
@@ -10,6 +12,19 @@
 using namespace std;
 
 Cache<int, ConvGeo> draw_pulk_grid_convs(10); // lon0 -> Conv
+std::mutex draw_pulk_grid_mutex; // draw_pulk_grid can run in many threads
+
+// Get a copy of pulkovo conversion from the cache
+// (build and put it into the cache if needed).
+// key = INT_MAX for SU_LL, lon0 for SU grid zone.
+ConvGeo
+draw_pulk_grid_conv(const int key){
+  std::lock_guard<std::mutex> lk(draw_pulk_grid_mutex);
+  if (!draw_pulk_grid_convs.contains(key))
+    draw_pulk_grid_convs.add(key,
+      key==INT_MAX? ConvGeo("SU_LL") : ConvGeo(GEO_PROJ_SU(key)));
+  return draw_pulk_grid_convs.get(key);
+}
 
 void
 ms2opt_add_drawgrd(GetOptSet & opts){
@@ -128,17 +143,13 @@ draw_pulk_grid(const CairoWrapper & cr, const iPoint & origin,
   double step = opt.get("grid_step",  0.0);
 
   /* build  pulkovo ll -> wgs conversion or get it from the cache */
-  if (!draw_pulk_grid_convs.contains(INT_MAX))
-    draw_pulk_grid_convs.add(INT_MAX, ConvGeo("SU_LL"));
-  ConvGeo cnv0(draw_pulk_grid_convs.get(INT_MAX));
+  ConvGeo cnv0(draw_pulk_grid_conv(INT_MAX));
 
   /* for all zones */
   for (int lon0=lon0a; lon0<=lon0b; lon0+=6){
 
     /* build  pulkovo grid -> wgs conversion or get it from the cache */
-    if (!draw_pulk_grid_convs.contains(lon0))
-      draw_pulk_grid_convs.add(lon0, ConvGeo(GEO_PROJ_SU(lon0)));
-    ConvGeo cnv1(draw_pulk_grid_convs.get(lon0)); // grid -> wgs
+    ConvGeo cnv1(draw_pulk_grid_conv(lon0)); // grid -> wgs
     ConvMulti cnv2(cnv, cnv1, 1,0); // screen -> grid
 
     dRect rng_grid = cnv1.bck_acc(wgs_rng); // wgs -> pulkovo grid
@@ -4,6 +4,7 @@
 #include "geohash/storage.h"
 #include "geom/line.h"
 #include "geo_data/conv_geo.h"
+#include "conv/conv_grid.h"
 #include "image_tiles/image_t_all.h"
 
 #include "gobj_maps.h"
@@ -12,7 +13,8 @@ using namespace std;
 
 #define IMAGE_CACHE_SIZE 10
 
-#define TILE_CACHE_SIZE 128
+// size of rendered tile cache, bytes
+#define TILE_CACHE_SIZE (32<<20)
 
 void
 ms2opt_add_drawmap(GetOptSet & opts){
@@ -52,6 +54,7 @@ GObjMaps::get_def_opt() {
 
 void
 GObjMaps::set_opt(const Opt & opt) {
+  this->opt = opt;
   smooth    = opt.get("map_smooth",   false);
   clip_brd  = opt.get("map_clip_brd", true);
   draw_refs = opt.get("map_draw_refs", 0);
@@ -115,6 +118,7 @@ GObjMaps::MapData::set_scale(const double k, bool sm){
 void
 GObjMaps::set_cnv(const std::shared_ptr<ConvBase> cnv) {
   if (!cnv) throw Err() << "GObjMaps::set_cnv: cnv is NULL";
+  this->cnv = cnv;
   for (auto & d:data){
 
     // We want to calculate some map parameters in viewer projection:
@@ -186,7 +190,7 @@ GObjMaps::set_cnv(const std::shared_ptr<ConvBase> cnv) {
 /**********************************************************/
 
 GObjMaps::GObjMaps(GeoMapList & maps):
-    maps(maps), img_cache(IMAGE_CACHE_SIZE), tiles(TILE_CACHE_SIZE),
+    maps(maps), img_cache(new ImgCache(IMAGE_CACHE_SIZE)), tiles(TILE_CACHE_SIZE),
     smooth(false), clip_brd(true), draw_brd(0), draw_refs(0), fade(0) {
 
   for (auto & m:maps){
@@ -195,10 +199,22 @@ GObjMaps::GObjMaps(GeoMapList & maps):
   }
 }
 
+GObjMaps::GObjMaps(const GObjMaps & o):
+    GObj(o), maps(o.maps), img_cache(o.img_cache), tiles(o.tiles.get_budget()) {
+  for (auto & m:maps) data.emplace_back(m);
+  set_opt(o.opt);
+  if (o.cnv) set_cnv(o.cnv);
+}
+
+std::shared_ptr<GObj>
+GObjMaps::clone() const {
+  return std::shared_ptr<GObj>(new GObjMaps(*this));
+}
+
 bool
-GObjMaps::render_tile(const dRect & draw_range) {
+GObjMaps::render_tile(const dRect & draw_range, ImageR & image_dst) {
 
-  ImageR image_dst = ImageR(draw_range.w, draw_range.h, IMAGE_32ARGB);
+  image_dst = ImageR(draw_range.w, draw_range.h, IMAGE_32ARGB);
   image_dst.fill32(0);
 
   for (auto const & d:data){
@@ -222,7 +238,10 @@ GObjMaps::render_tile(const dRect & draw_range) {
 
     // non-tiled maps
     if (!d.src->is_tiled && draw_map){
-      imageR_src = img_cache.get(d.src->image, d.load_sc);
+      {
+        std::lock_guard<std::mutex> lk(img_cache->m);
+        imageR_src = img_cache->c.get(d.src->image, d.load_sc);
+      }
       if (imageR_src.is_empty()) continue;
     }
 
@@ -234,17 +253,48 @@ GObjMaps::render_tile(const dRect & draw_range) {
     ConvMulti cnv(d.cnv);
     cnv.simplify(draw_range, 5, 0.5);
 
+    // Interpolate the conversion on an adaptive grid
+    // with 0.5pt accuracy in source image coordinates.
+    ConvGrid gcnv(cnv, draw_range, 0.5);
+    size_t w = image_dst.width(), h = image_dst.height();
+    std::vector<dPoint> pts(w*h);
+    for (size_t yd=0; yd<h; ++yd)
+      gcnv.frw_row(dPoint(draw_range.x, yd + draw_range.y), 1, w, pts.data() + yd*w);
+
+    // Tiled maps: get the whole source region at once (each
+    // map tile is accessed only once) and use it as the source.
+    // Region includes all points needed for interpolation/averaging.
+    ImageR imageR_rgn;
+    dPoint rgn_org;
+    if (image_src == d.timg.get() && pts.size()){
+      dRect bb;
+      bool ok = true;
+      for (auto const & p: pts){
+        if (!std::isfinite(p.x) || !std::isfinite(p.y)) {ok = false; break;}
+        bb.expand(p);
+      }
+      double m = (smooth && avr>=1) ? avr+1 : 1;
+      iRect rr(iPoint(floor(bb.x-m), floor(bb.y-m)),
+               iPoint(floor(bb.x+bb.w+m)+1, floor(bb.y+bb.h+m)+1));
+      if (ok && rr.x>=0 && rr.y>=0 && (double)rr.w*rr.h <= 16.0*pts.size()){
+        imageR_rgn = d.timg->get_image(rr);
+        rgn_org = rr.tlc();
+        image_src = &imageR_rgn;
+      }
+    }
+
     // render image
-    for (size_t yd=0; yd<image_dst.height(); ++yd){
+    for (size_t yd=0; yd<h; ++yd){
       if (is_stopped()) return false;
       auto cr = d.test_brd.get_cr(yd + draw_range.y);
       if (d.brd.size() && cr.size()==0) continue;
-      for (size_t xd=0; xd<image_dst.width(); ++xd){
 
-        dPoint p(xd + draw_range.x, yd + draw_range.y);
-        if (d.brd.size() && !dPolyTester::test_cr(cr, p.x)) continue;
+      const dPoint * row = pts.data() + yd*w;
+      for (size_t xd=0; xd<w; ++xd){
+
+        if (d.brd.size() && !dPolyTester::test_cr(cr, xd + draw_range.x)) continue;
 
-        cnv.frw(p); // convert to source image coordinates
+        dPoint p = row[xd] - rgn_org;
         if (!image_src->check_crd(p.x, p.y)) continue;
 
         int color;
@@ -283,12 +333,13 @@ GObjMaps::draw(const CairoWrapper & cr, const dRect & draw_range) {
   if (check(draw_range)==FILL_NONE) return FILL_NONE;
 
   // render tile, put to tile cache if needed
-  if (!tiles.contains(draw_range)){
-    if (!render_tile(draw_range)) return FILL_NONE;
+  ImageR img;
+  if (!tiles.get(draw_range, img)){
+    if (!render_tile(draw_range, img)) return FILL_NONE;
   }
 
   // render image
-  cr->set_source(image_to_surface(tiles.get(draw_range)),
+  cr->set_source(image_to_surface(img),
     draw_range.x, draw_range.y);
   cr->paint();
 
@@ -7,7 +7,7 @@
 #include "geo_data/geo_data.h"
 #include "image_tiles/image_t.h"
 #include "geom/poly_tools.h"
-#include "cache/cache.h"
+#include "cache/sizecache_mt.h"
 #include "image/image_cache.h"
 #include "opt/opt.h"
 #include "viewer/gobj.h"
@@ -51,10 +51,21 @@ private:
     // - for normal maps we can load smaller image (and save memory/time)
     void set_scale(const double k, bool sm);
   };
-  ImageRCache img_cache;
-  Cache<iRect, ImageR> tiles;
+  // Image cache for non-tiled maps, shared between
+  // copies of the object (see clone()).
+  struct ImgCache {
+    std::mutex m;
+    ImageRCache c;
+    ImgCache(const int maxnum): c(maxnum) {}
+  };
+  std::shared_ptr<ImgCache> img_cache;
+  SizeCacheMT<iRect, ImageR> tiles; // rendered tiles
   std::vector<MapData> data;
 
+  // copies of options and conversion (for clone())
+  Opt opt;
+  std::shared_ptr<ConvBase> cnv;
+
   bool smooth;   // smooth map drawing
   bool clip_brd; // clip map to its border
   int  draw_brd; // draw map border (color)
@@ -63,12 +74,20 @@ private:
   double minsc, maxsc; // scale range (<map pix>/<image pix>) where map should be drawn
   uint32_t def_col; // color to paint the map outside minsc/maxsc
 
-  bool render_tile(const dRect & range_dst);
+  // render a tile, put it into the tile cache
+  bool render_tile(const dRect & range_dst, ImageR & image_dst);
 
 public:
   // constructor
   GObjMaps(GeoMapList & maps);
 
+  // Copy for drawing in another thread: same maps and options,
+  // own conversion, tiled map interfaces and tile cache
+  // (with the shared memory budget), shared image cache.
+  GObjMaps(const GObjMaps & o);
+
+  std::shared_ptr<GObj> clone() const override;
+
   /************************************************/
 
 
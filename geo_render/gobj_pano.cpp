@@ -56,7 +56,7 @@ GObjPano::set_p0(const dPoint & p0_) {
 
   dPoint d;
   {
-    auto srtm_lock = srtm->get_lock();
+    auto srtm_lock = srtm->get_read_lock();
     // data step in degrees in the central point
     st = srtm->get_step(p0);
   }
@@ -111,14 +111,27 @@ GObjPano::get_ray(int x){
   // step along the ray (angle is counted from axis y), m:
   auto dr = 1.0/sqrt(pow(sin(a)/st.x, 2) + pow(cos(a)/st.y, 2));
 
-  std::vector<GObjPano::ray_data> ret;
-  auto srtm_lock = srtm->get_lock();
+  // points along the ray: interpolated data on the near part,
+  // raw data on the far part
+  dLine pts_i, pts_r;
+  std::vector<double> rr;
   for (double r = 0; r<mr; r+=dr){
     bool raw = dr/r < da;
-    auto p2 = geo_bearing_2d(p0, ad, r);
-    auto h = srtm->get_h(p2, raw);
-    auto s = srtm->get_s(p2, raw);
-    if (h>SRTM_VAL_MIN) ret.emplace_back(r, h, s);
+    (raw? pts_r:pts_i).push_back(geo_bearing_2d(p0, ad, r));
+    rr.push_back(r);
+  }
+
+  std::vector<GObjPano::ray_data> ret;
+  auto srtm_lock = srtm->get_read_lock();
+  auto hh_i = srtm->get_h_pts(pts_i, false);
+  auto hh_r = srtm->get_h_pts(pts_r, true);
+  for (size_t i = 0; i<rr.size(); i++){
+    bool raw = i >= pts_i.size();
+    size_t n = raw? i - pts_i.size() : i;
+    auto h = raw? hh_r[n] : hh_i[n];
+    auto p2 = raw? pts_r[n] : pts_i[n];
+    if (h<=SRTM_VAL_MIN) continue;
+    ret.emplace_back(rr[i], h, srtm->get_s(p2, raw));
   }
   std::lock_guard<std::mutex> lk(cache_mutex);
   ray_cache.add(key,ret);
@@ -206,7 +219,7 @@ GObjPano::draw(const CairoWrapper & cr, const dRect &box){
 
   double h0;
   {
-    auto srtm_lock = srtm->get_lock();
+    auto srtm_lock = srtm->get_read_lock();
     h0 = srtm->get_h(p0) + dh; // altitude of observation point
   }
   ImageR image(box.w, box.h, IMAGE_32ARGB);
@@ -3,6 +3,7 @@
 
 #include "rainbow/rainbow.h"
 #include "viewer/gobj.h"
+#include "cache/cache.h"
 #include "srtm/srtm.h"
 #include <vector>
 #include <mutex>
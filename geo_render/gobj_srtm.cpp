@@ -1,5 +1,6 @@
 #include "gobj_srtm.h"
 #include "geom/poly_tools.h"
+#include "conv/conv_grid.h"
 #include <sstream>
 #include <fstream>
 
@@ -93,7 +94,14 @@ GObjSRTM::set_opt(const Opt & o){
     auto srtm_lock = srtm->get_lock();
     srtm->set_opt(o);
   }
+  set_draw_opt(o);
+  tiles.clear();
+  redraw_me();
+}
 
+void
+GObjSRTM::set_draw_opt(const Opt & o){
+  opt = o;
   surf = o.get("srtm_surf", 1);
 
   // contours parameters
@@ -120,9 +128,16 @@ GObjSRTM::set_opt(const Opt & o){
   peaks_text   = o.get<bool>("srtm_peaks_text",  1);
   peaks_text_size   = o.get<double>("srtm_peaks_text_size",  10);
   peaks_text_font   = o.get("srtm_peaks_text_font",  "serif");
+}
 
-  tiles.clear();
-  redraw_me();
+GObjSRTM::GObjSRTM(const GObjSRTM & o):
+    GObj(o), cnv(o.cnv), srtm(o.srtm), tiles(o.tiles.get_budget()) {
+  set_draw_opt(o.opt);
+}
+
+std::shared_ptr<GObj>
+GObjSRTM::clone() const {
+  return std::shared_ptr<GObj>(new GObjSRTM(*this));
 }
 
 void
@@ -142,17 +157,17 @@ GObjSRTM::set_cnv(const std::shared_ptr<ConvBase> c) {
 
 bool
 GObjSRTM::
-render_tile(const dRect & draw_range){
+render_tile(const dRect & draw_range, ImageR & image){
   if (!srtm) return false;
 
-  ImageR image = ImageR(draw_range.w, draw_range.h, IMAGE_32ARGB);
+  image = ImageR(draw_range.w, draw_range.h, IMAGE_32ARGB);
 
   // calculate wgs range
   dRect wgs_range = cnv->frw_acc(draw_range);
 
   // draw surface
   if (surf) {
-    auto srtm_lock = srtm->get_lock();
+    auto srtm_lock = srtm->get_read_lock();
 
     // data resolution [deg/px]
     dPoint data_res((double)wgs_range.w/draw_range.w, (double)wgs_range.h/draw_range.h);
@@ -161,14 +176,56 @@ render_tile(const dRect & draw_range){
     dPoint srtm_res = srtm->get_step(wgs_range.cnt());
     bool raw = data_res.x > srtm_res.x || data_res.y > srtm_res.y;
 
-    for (size_t j=0; j<image.height(); j++){
+    // Get DEM window for the whole tile (with margins for slope
+    // calculation) and convert it to colors. In raw mode
+    // (or if the central tile is missing) DEM grid is built with get_h_grid.
+    dRect r = expand(wgs_range, 2*srtm_res.x, 2*srtm_res.y);
+    dPoint blc, step;
+    ImageR dem;
+    if (!raw) dem = srtm->get_img(r, blc, step);
+    if (dem.is_empty()){
+      step = raw? data_res : srtm_res;
+      if (step.x<=0 || step.y<=0) step = data_res;
+      blc = r.tlc();
+      // use overview levels for low resolution
+      dem = srtm->get_h_grid(blc, step,
+        ceil(r.w/step.x)+1, ceil(r.h/step.y)+1, raw, std::min(step.x, step.y));
+    }
+    if (is_stopped()) return false;
+
+    // Interpolate the conversion on an adaptive grid,
+    // accuracy is 1/4 of the DEM grid step.
+    std::shared_ptr<ConvGrid> gcnv;
+    if (cnv) gcnv.reset(new ConvGrid(*cnv, draw_range, 0.25*std::min(step.x, step.y)));
+
+    // lon-lat coordinates of all image points
+    size_t w = image.width(), h = image.height();
+    std::vector<dPoint> pts(w*h);
+    for (size_t j=0; j<h; j++){
       if (is_stopped()) return false;
-      for (size_t i=0; i<image.width(); i++){
-        dPoint p(i + draw_range.x, j+draw_range.y);
-        if (cnv) cnv->frw(p);
-        image.set32(i,j, srtm->get_color(p, raw));
+      dPoint p0(draw_range.x, j+draw_range.y);
+      if (gcnv) gcnv->frw_row(p0, 1, w, pts.data() + j*w);
+      else for (size_t i=0; i<w; i++) pts[j*w+i] = p0 + dPoint(i,0);
+    }
+
+    // Raw mode: DEM points are denser then image points,
+    // convert DEM to colors and take nearest points.
+    // Otherwise heights and slopes are interpolated to image points
+    // and then converted to colors.
+    if (raw){
+      ImageR colors = srtm->get_color_img(dem, blc, step);
+      for (size_t j=0; j<h; j++){
+        for (size_t i=0; i<w; i++){
+          const dPoint & p = pts[j*w+i];
+          dPoint q((p.x - blc.x)/step.x, (p.y - blc.y)/step.y);
+          image.set32(i,j, colors.get_argb_safe(rint(q)));
+        }
       }
     }
+    else {
+      srtm->get_color_pts(dem, blc, step, pts.data(), pts.size(),
+                          (uint32_t *)image.data());
+    }
   }
   else { image.fill32(0); }
 
@@ -185,8 +242,11 @@ render_tile(const dRect & draw_range){
   if (cnt) {
     double cnt_rdp = 0.2; // todo: move to options?
     double R = 10;        // todo: move to options?
-    auto srtm_lock = srtm->get_lock();
-    auto c_data = srtm->find_contours(wgs_range, cnt_step, cnt_vtol, R);
+    auto srtm_lock = srtm->get_read_lock();
+    // data resolution [deg/px], overview levels are used if it is low
+    double res = std::min((double)wgs_range.w/draw_range.w,
+                          (double)wgs_range.h/draw_range.h);
+    auto c_data = srtm->find_contours(wgs_range, cnt_step, cnt_vtol, R, res);
     cr->set_color(cnt_color);
     for(auto const & c:c_data){
       if (is_stopped()) return false;
@@ -202,7 +262,7 @@ render_tile(const dRect & draw_range){
 
   // draw holes
   if (holes) {
-    auto srtm_lock = srtm->get_lock();
+    auto srtm_lock = srtm->get_read_lock();
     auto h_data = srtm->find_holes(wgs_range);
     cr->set_color(holes_color);
     cr->set_line_width(holes_w);
@@ -216,7 +276,7 @@ render_tile(const dRect & draw_range){
 
   // draw peaks
   if (peaks) {
-    auto srtm_lock = srtm->get_lock();
+    auto srtm_lock = srtm->get_read_lock();
     wgs_range = cnv->frw_acc(expand(draw_range,peaks_text_size*4));
     auto p_data = srtm->find_peaks(wgs_range, peaks_dh, peaks_ps);
     cnv->bck(p_data);
@@ -252,10 +312,11 @@ GObjSRTM::draw(const CairoWrapper & cr, const dRect & draw_range) {
   if (!srtm) return GObj::FILL_NONE;
   if (is_stopped()) return GObj::FILL_NONE;
 
-  if (!tiles.contains(draw_range)){
-    if (!render_tile(draw_range)) return GObj::FILL_NONE;
+  ImageR image;
+  if (!tiles.get(draw_range, image)){
+    if (!render_tile(draw_range, image)) return GObj::FILL_NONE;
   }
-  cr->set_source(image_to_surface(tiles.get(draw_range)),
+  cr->set_source(image_to_surface(image),
                  draw_range.x, draw_range.y);
   cr->paint();
 
@@ -18,6 +18,7 @@ class GObjSRTM : public GObj {
 
   std::shared_ptr<ConvBase> cnv;
   SRTM * srtm;
+  Opt opt; // drawing options
 
   bool surf;         // draw color surface
   double maxsc;      // max scale (srtm pixels / viewer pixels)
@@ -45,14 +46,24 @@ class GObjSRTM : public GObj {
   double peaks_text_size;
   std::string peaks_text_font;
 
-#define SRTM_TILE_CACHE_SIZE 128
-  Cache<iRect, ImageR> tiles;
+#define SRTM_TILE_CACHE_SIZE (32<<20) // bytes
+  SizeCacheMT<iRect, ImageR> tiles; // rendered tiles
+
+  // read drawing parameters (everything except SRTM options)
+  void set_draw_opt(const Opt & o);
 
   public:
 
     GObjSRTM(SRTM *srtm, const Opt & o):
       srtm(srtm), tiles(SRTM_TILE_CACHE_SIZE) { set_opt(o); }
 
+    // Copy for drawing in another thread: same SRTM data and
+    // options, own conversion and tile cache (with the shared
+    // memory budget).
+    GObjSRTM(const GObjSRTM & o);
+
+    std::shared_ptr<GObj> clone() const override;
+
     static Opt get_def_opt();
 
     void redraw();
@@ -61,7 +72,8 @@ class GObjSRTM : public GObj {
 
     void set_cnv(const std::shared_ptr<ConvBase> c) override;
 
-    bool render_tile(const dRect & draw_range);
+    // render a tile, put it into the tile cache
+    bool render_tile(const dRect & draw_range, ImageR & image);
     ret_t draw(const CairoWrapper & cr, const dRect & draw_range) override;
 
 };
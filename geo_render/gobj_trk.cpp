@@ -61,6 +61,15 @@ GObjTrk::set_cnv(const std::shared_ptr<ConvBase> c) {
   redraw_me();
 }
 
+std::shared_ptr<GObj>
+GObjTrk::clone() const {
+  std::shared_ptr<GObjTrk> ret(new GObjTrk(trk));
+  ret->set_opt(opt);
+  ret->set_cnv(cnv);
+  ret->selected = selected;
+  return ret;
+}
+
 double
 GObjTrk::calc_vel(const size_t i, const size_t j){
   if (j==0) return NAN;
@@ -98,6 +98,8 @@ public:
   dRect bbox() const override {
     return expand(range, (dot_w+1)*linewidth + sel_w); }
 
+  std::shared_ptr<GObj> clone() const override;
+
   /************************************************/
 
   // Find track points near pt within radius r.
@@ -55,6 +55,7 @@ GObjWpts::get_def_opt() {
 
 void
 GObjWpts::set_opt(const Opt & opt){
+  this->opt = opt;
   text_font = opt.get("wpt_text_font",  "serif");
   text_size = opt.get("wpt_text_size",  10.0);
   text_pad  = opt.get("wpt_text_pad",   2.0);
@@ -79,6 +80,15 @@ GObjWpts::set_cnv(const std::shared_ptr<ConvBase> c) {
   redraw_me();
 }
 
+std::shared_ptr<GObj>
+GObjWpts::clone() const {
+  std::shared_ptr<GObjWpts> ret(new GObjWpts(wpts));
+  ret->set_opt(opt);
+  ret->set_cnv(cnv);
+  ret->selected = selected;
+  return ret;
+}
+
 void
 GObjWpts::update_data(){
 
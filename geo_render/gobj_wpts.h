@@ -24,6 +24,9 @@ private:
   // coordinate conversion, viewer->wgs84
   std::shared_ptr<ConvBase> cnv;
 
+  // drawing options (last value set with set_opt)
+  Opt opt;
+
   const double sel_w = 1.5; // pixels
   const uint32_t sel_col = 0x80FFFF00;
 
@@ -98,6 +101,8 @@ public:
 
   dRect bbox() const override {return range;}
 
+  std::shared_ptr<GObj> clone() const override;
+
   /************************************************/
 
   // Find waypoints (point is in the waypoint circle or waypoint label).
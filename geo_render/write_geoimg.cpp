@@ -9,6 +9,11 @@
 #include "geom/poly_tools.h"    // for rect_in_polygon
 #include "geo_tiles/geo_tiles.h"
 #include <fstream>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 
 
 void
@@ -47,6 +52,20 @@ ms2opt_add_geoimg(GetOptSet & opts){
   opts.add("tmap_scale", 1,0,g,
     "When creating tiles with multiple zoom levels scale larger tiles to "
     "create smaller ones (instead of rendering all tiles separately). Default: 0.");
+  opts.add("tmap_filter", 1,0,g,
+    "Filter for scaling tiles with tmap_scale option: box, lanczos. Default: box.");
+  opts.add("tmap_threads", 1,0,g,
+    "Number of threads for rendering tiled maps. Tiles are written "
+    "in the same order as in the single-thread mode. Each thread draws "
+    "its own copy of data layers; if a layer can not be copied "
+    "tiles are rendered one at a time (a message is printed in verbose mode). "
+    "Default: 1.");
+  opts.add("db_batch", 1,0,g,
+    "Number of tiles written in one transaction when writing mbtiles. Default: 1000.");
+  opts.add("db_wal", 1,0,g,
+    "Use write-ahead log journal mode when writing mbtiles. Default: 0.");
+  opts.add("db_dedup", 1,0,g,
+    "Store identical tiles only once when creating mbtiles. Default: 0.");
   opts.add("swapy", 0,0,g, "Normally tiled maps are saved in Google row"
     " counting; This will switch to TMS");
   opts.add("skip_empty", 0,0,g,
@@ -55,120 +74,275 @@ ms2opt_add_geoimg(GetOptSet & opts){
 
 #define TMAP_TILE_SIZE 256
 
+/********************************************************************/
+// Tile rendering for write_tiles.
+
+// A single tile: input parameters and result.
+struct TileJob {
+  iPoint tile;       // tile (TMS if swapy is set)
+  dRect trange_wgs;  // tile range (wgs)
+  enum {SKIP, CREATE, UPDATE} res;
+  ImageR img;        // rendered tile
+  bool done;
+  std::exception_ptr err;
+  TileJob(const iPoint & tile, const dRect & r):
+    tile(tile), trange_wgs(r), res(SKIP), done(false) {}
+};
+
+// Render a tile. Can be run in parallel with different objects;
+// access to the tiled image (timg) is locked with timg_mutex.
+// If obj_mutex is not NULL the object is shared between threads and
+// it is locked from setting coordinate conversion until drawing.
+void
+render_tile(TileJob & job, GObj & obj, ImageT & timg, const dMultiLine & brd,
+            const Opt & opts, std::mutex & timg_mutex, std::mutex * obj_mutex){
+  int z = job.tile.z;
+  int zfill = opts.get("zfill", 0);
+  uint32_t bg = opts.get<int>("bgcolor", 0);
+  uint32_t fc = opts.get<int>("fillcolor", 0xFFFF0000);
+  dRect trange_img = dRect(0,0,TMAP_TILE_SIZE,TMAP_TILE_SIZE);
+
+  // make reference for the tile (similar to code in geo_mkref)
+  GeoMap r;
+  r.proj = "WEB";
+  r.image_size = iPoint(1,1)*TMAP_TILE_SIZE;
+  dLine pts_w = rect_to_line(job.trange_wgs, false);
+  dLine pts_r = rect_to_line(trange_img, false);
+  pts_r.flip_y(r.image_size.y);
+  r.add_ref(pts_r, pts_w);
+  std::shared_ptr<ConvMap> cnv(new ConvMap(r));
+
+  std::unique_lock<std::mutex> obj_lock;
+  if (obj_mutex) obj_lock = std::unique_lock<std::mutex>(*obj_mutex);
+  obj.set_cnv(cnv);
+
+  // skip tiles outside object range
+  if (obj.check(trange_img) == GObj::FILL_NONE) {job.res = TileJob::SKIP; return;}
+
+  // render tile in a normal way
+
+  // create background image
+  ImageR img;
+  if (opts.exists("add")){
+    std::lock_guard<std::mutex> lk(timg_mutex);
+    if (timg.tile_exists(job.tile)){
+      try {
+        img = image_to_argb(timg.tile_read(job.tile));
+        if (img.height()!=TMAP_TILE_SIZE || img.width()!=TMAP_TILE_SIZE)
+          img = ImageR();
+      } catch (const Err & e) { }
+    }
+  }
+
+  if (img.is_empty()){
+    img = ImageR(TMAP_TILE_SIZE, TMAP_TILE_SIZE, IMAGE_32ARGB);
+    img.fill32(bg);
+    job.res = TileJob::CREATE;
+  }
+  else job.res = TileJob::UPDATE;
+
+  // setup cairo context
+  CairoWrapper cr;
+  cr.set_surface_img(img);
+
+  // clip to border
+  // convert border to pixel coordinates of this tile
+  r.border = cnv->bck_acc(brd);
+  if (r.border.size()) {
+    cr->set_fill_rule(Cairo::FILL_RULE_EVEN_ODD);
+    cr->mkpath_smline(r.border, true, 0);
+    cr->clip();
+  }
+  // Draw data
+  // Save context (objects may want to have their own clip regions)
+  cr->save();
+  if (z<=zfill){
+    cr->set_color_a(fc);
+    cr->paint();
+  }
+  else {
+    obj.draw(cr, trange_img);
+  }
+  cr->restore();
+  job.img = img;
+}
+
+// Write a rendered tile (in the writer thread).
+void
+write_tile(TileJob & job, ImageT & timg, std::mutex & timg_mutex, bool verb){
+  std::lock_guard<std::mutex> lk(timg_mutex);
+  switch (job.res){
+    case TileJob::SKIP: break;
+    case TileJob::CREATE:
+    case TileJob::UPDATE:
+      if (verb) std::cout << (job.res==TileJob::CREATE? "create":"update")
+                          << " tile: " << job.tile << "\n";
+      timg.tile_write(job.tile, job.img);
+      break;
+  }
+  job.img = ImageR();
+}
+
 void
 write_tiles(const std::string & fname, GObj & obj, const dMultiLine & brd, const Opt & opts){
 
   int zmin  = opts.get("zmin", 0);
   int zmax  = opts.get("zmax", 0);
-  int zfill = opts.get("zfill", 0);
-  uint32_t bg = opts.get<int>("bgcolor", 0);
-  uint32_t fc = opts.get<int>("fillcolor", 0xFFFF0000);
   bool swapy  = opts.exists("swapy");
   if (file_ext_check(fname, ".mbtiles")) swapy = true;
 
   bool verb = opts.get<int>("verbose", false);
+  int nthreads = opts.get<int>("tmap_threads", 1);
+  if (nthreads<1) nthreads = 1;
   obj.set_opt(opts);
 
   GeoTiles tcalc;  // tile calculator
-  auto timg = open_tile_img(fname, opts); // interface to tiled image
+  // interface to tiled image (mbtiles are written in batches)
+  Opt topts(opts);
+  if (!topts.exists("db_batch")) topts.put("db_batch", 1000);
+  auto timg = open_tile_img(fname, topts);
 
   // bbox: intersection of border bbox and object bbox
   dRect bbox = intersect_nonempty(brd.bbox(), obj.bbox());
   if (bbox.is_empty()) return;
 
-  // set of existing directories
-  std::set<std::string> dirs;
+  // Objects for drawing in worker threads. If the object
+  // can not be copied it is used in all threads with locking.
+  std::vector<std::shared_ptr<GObj> > objs;
+  std::mutex obj_mutex, timg_mutex;
+  bool lock_obj = false;
+  for (int i=0; nthreads>1 && i<nthreads; i++){
+    auto o = obj.clone();
+    if (!o) {lock_obj = true; break;}
+    objs.push_back(o);
+  }
+  if (lock_obj && verb)
+    std::cout << "write_tiles: object can not be copied, "
+                 "tiles are rendered one at a time\n";
+
+  int zfill = opts.get("zfill", 0);
+  bool tscale = opts.get("tmap_scale", false);
 
   // for each zoom level
   for (int z = zmax; z>=zmin; --z){
+
+    // collect tiles from four larger tiles: all levels
+    // down to zfill or zmin are built at once
+    if (tscale && z!=zmax && z!=zfill){
+      int z1 = z;
+      while (z1>zmin && z1-1!=zfill) z1--;
+      iRect src = tcalc.range_to_gtiles(bbox,z+1);
+      src.intersect(iRect(0,0, pow(2,z+1), pow(2,z+1)));
+      if (swapy) src.y = pow(2,z+1) - src.y - src.h;
+      std::lock_guard<std::mutex> lk(timg_mutex);
+      timg->tile_pyramid(src, z1, z, opts);
+      z = z1;
+      continue;
+    }
+
     iRect tiles = tcalc.range_to_gtiles(bbox,z); // tile range
     tiles.intersect(iRect(0,0, pow(2,z), pow(2,z)));
 
-    // render tiles
+    // list of tiles
+    std::vector<TileJob> jobs;
     for (int y = tiles.y; y < tiles.y + tiles.h; y++){
       for (int x = tiles.x; x < tiles.x + tiles.w; x++) {
         iPoint tile(x,y,z);
         dRect trange_wgs = tcalc.gtile_to_range(tile, z); // Google, not TMS tiles
-        dRect trange_img = dRect(0,0,TMAP_TILE_SIZE,TMAP_TILE_SIZE);
 
         // convert Google->TMS tile if needed
         if (swapy) tile.y = pow(2,z)-1-y;
 
         // skip tiles outside global border
         if (brd.size() && rect_in_polygon(trange_wgs, brd) == 0) continue;
+        jobs.emplace_back(tile, trange_wgs);
+      }
+    }
+    auto t0 = std::chrono::steady_clock::now();
 
-        // make filename, create subdirectories if needed
-        std::string f = ImageT::make_url(fname, tile);
-
-        // make reference for the tile (similar to code in geo_mkref) 
-        GeoMap r;
-        r.proj = "WEB";
-        r.image_size = iPoint(1,1)*TMAP_TILE_SIZE;
-        dLine pts_w = rect_to_line(trange_wgs, false);
-        dLine pts_r = rect_to_line(trange_img, false);
-        pts_r.flip_y(r.image_size.y);
-        r.add_ref(pts_r, pts_w);
-
-        std::shared_ptr<ConvMap> cnv(new ConvMap(r));
-        obj.set_cnv(cnv);
-
-        // skip tiles outside object range
-        if (obj.check(trange_img) == GObj::FILL_NONE) continue;
-
-
-        // collect the tile from four larger tiles
-        if (z != zmax && z != zfill && opts.get("tmap_scale", false)){
-          if (verb) std::cout << "rescale tile: " << tile << "\n";
-          timg->tile_rescale(tile);
-          continue;
+    if (nthreads == 1){
+      for (auto & job: jobs){
+        render_tile(job, obj, *timg, brd, opts, timg_mutex, NULL);
+        write_tile(job, *timg, timg_mutex, verb);
+      }
+    }
+    else {
+      // Workers take tiles from the list and render them,
+      // the writer writes them in the original order.
+      // Number of rendered tiles waiting for writing is limited.
+      size_t next = 0, written = 0;
+      size_t window = 4*nthreads;
+      bool stop = false;
+      std::exception_ptr err;
+      std::mutex m;
+      std::condition_variable cond;
+
+      auto worker = [&](GObj * o){
+        while (1){
+          size_t i;
+          {
+            std::unique_lock<std::mutex> lk(m);
+            cond.wait(lk, [&]{ return stop || next>=jobs.size() ||
+                                      next < written + window; });
+            if (stop || next>=jobs.size()) return;
+            i = next++;
+          }
+          try {
+            render_tile(jobs[i], *o, *timg, brd, opts, timg_mutex,
+                        lock_obj? &obj_mutex : NULL);
+          }
+          catch (...) { jobs[i].err = std::current_exception(); }
+          {
+            std::unique_lock<std::mutex> lk(m);
+            jobs[i].done = true;
+          }
+          cond.notify_all();
         }
-
-        // render tile in a normal way
-
-        // create background image
-        ImageR img;
-        if (opts.exists("add") && timg->tile_exists(tile)){
+      };
+
+      auto writer = [&](){
+        for (size_t i=0; i<jobs.size(); i++){
+          {
+            std::unique_lock<std::mutex> lk(m);
+            cond.wait(lk, [&]{ return stop || jobs[i].done; });
+            if (stop) return;
+          }
           try {
-            img = image_to_argb(timg->tile_read(tile));
-            if (img.height()!=TMAP_TILE_SIZE || img.width()!=TMAP_TILE_SIZE)
-              img = ImageR();
-          } catch (const Err & e) { }
+            if (jobs[i].err) std::rethrow_exception(jobs[i].err);
+            write_tile(jobs[i], *timg, timg_mutex, verb);
+          }
+          catch (...) {
+            std::unique_lock<std::mutex> lk(m);
+            err = std::current_exception();
+            stop = true;
+            cond.notify_all();
+            return;
+          }
+          {
+            std::unique_lock<std::mutex> lk(m);
+            written++;
+          }
+          cond.notify_all();
         }
+      };
+
+      std::vector<std::thread> threads;
+      for (int i=0; i<nthreads; i++)
+        threads.emplace_back(worker, lock_obj? &obj : objs[i].get());
+      threads.emplace_back(writer);
+      for (auto & t: threads) t.join();
+      if (err) std::rethrow_exception(err);
+    }
 
-        if (img.is_empty()){
-          img = ImageR(TMAP_TILE_SIZE, TMAP_TILE_SIZE, IMAGE_32ARGB);
-          img.fill32(bg);
-          if (verb) std::cout << "create tile: " << tile << "\n";
-        }
-        else if (verb) std::cout << "update tile: " << tile << "\n";
-
-        // setup cairo context
-        CairoWrapper cr;
-        cr.set_surface_img(img);
-
-        // clip to border
-        // convert border to pixel coordinates of this tile
-        r.border = cnv->bck_acc(brd);
-        if (r.border.size()) {
-          cr->set_fill_rule(Cairo::FILL_RULE_EVEN_ODD);
-          cr->mkpath_smline(r.border, true, 0);
-          cr->clip();
-        }
-        // Draw data
-        // Save context (objects may want to have their own clip regions)
-        cr->save();
-        if (z<=zfill){
-          cr->set_color_a(fc);
-          cr->paint();
-        }
-        else {
-          obj.draw(cr, trange_img);
-        }
-        cr->restore();
-        timg->tile_write(tile, img);
-      }
+    if (verb && jobs.size()) {
+      double dt = std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+      std::cout << "zoom " << z << ": " << jobs.size() << " tiles, "
+                << dt << " s, " << jobs.size()/dt << " tiles/s\n";
     }
   }
+
+  auto mbtiles = std::dynamic_pointer_cast<ImageMBTiles>(timg);
+  if (mbtiles && mbtiles->in_batch()) mbtiles->commit_batch();
 }
 
 void
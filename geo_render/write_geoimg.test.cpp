@@ -0,0 +1,93 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <cassert>
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include "write_geoimg.h"
+#include "err/assert_err.h"
+
+// Number of tiles drawn at the same time.
+struct DrawCounter {
+  std::mutex m;
+  int now, max, total;
+  DrawCounter(): now(0), max(0), total(0) {}
+};
+
+// Slow object: fills the tile, counts simultaneous drawings.
+class GObjSlow: public GObj {
+  std::shared_ptr<DrawCounter> cnt;
+  bool can_copy;
+
+public:
+  GObjSlow(const std::shared_ptr<DrawCounter> & cnt, bool can_copy):
+    cnt(cnt), can_copy(can_copy) {}
+
+  ret_t draw(const CairoWrapper & cr, const dRect & draw_range) override{
+    {
+      std::lock_guard<std::mutex> lk(cnt->m);
+      cnt->now++; cnt->total++;
+      if (cnt->max < cnt->now) cnt->max = cnt->now;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    cr->set_color(0xFFFF0000);
+    cr->paint();
+    {
+      std::lock_guard<std::mutex> lk(cnt->m);
+      cnt->now--;
+    }
+    return GObj::FILL_ALL;
+  }
+
+  std::shared_ptr<GObj> clone() const override {
+    if (!can_copy) return std::shared_ptr<GObj>();
+    return std::shared_ptr<GObj>(new GObjSlow(cnt, can_copy));
+  }
+};
+
+// render tiles, return the counter
+std::shared_ptr<DrawCounter>
+render(const int nthreads, const bool can_copy){
+  auto cnt = std::make_shared<DrawCounter>();
+  GObjSlow obj(cnt, can_copy);
+  dMultiLine brd;
+  brd.push_back(rect_to_line(dRect(20,40,40,30)));
+  Opt o;
+  o.put("zmin", 4);
+  o.put("zmax", 4);
+  o.put("tmap_threads", nthreads);
+  ::unlink("tmp.mbtiles");
+  write_tiles("tmp.mbtiles", obj, brd, o);
+  ::unlink("tmp.mbtiles");
+  return cnt;
+}
+
+int
+main(){
+  try{
+
+    // single thread
+    auto c1 = render(1, true);
+    assert(c1->total >= 4);
+    assert_eq(c1->max, 1);
+
+    // copies of the object are drawn in parallel
+    auto c2 = render(4, true);
+    assert_eq(c2->total, c1->total);
+    assert(c2->max > 1);
+
+    // object which can not be copied: one tile at a time
+    auto c3 = render(4, false);
+    assert_eq(c3->total, c1->total);
+    assert_eq(c3->max, 1);
+
+  }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+#include "err/err.h"
+#include "rtree.h"
+
+// File format (host byte order):
+//   "MSRTREE1", uint32 0x01020304 (byte order mark), uint32 number of types,
+//   for each type: uint32 type, uint32 number of levels N,
+//     uint32 levs[N+1], Node nodes[levs[N]].
+static const char rtree_magic[] = "MSRTREE1";
+static const uint32_t rtree_bom = 0x01020304;
+
+// Round coordinates outwards
+static float
+flt_down(const double v){
+  float f = v;
+  return f>v ? std::nextafter(f, -INFINITY) : f;
+}
+
+static float
+flt_up(const double v){
+  float f = v;
+  return f<v ? std::nextafter(f, +INFINITY) : f;
+}
+
+/**********************************************************/
+
+GeoRTree::GeoRTree(const GeoRTree & other): dirty(false){
+  other.pack();
+  trees = other.trees;
+}
+
+void
+GeoRTree::pack(Tree & t){
+  const size_t B = GEORTREE_NODE_SIZE;
+  // upper levels are removed in put/del
+  size_t n = t.nodes.size();
+  t.levs.clear();
+  t.levs.push_back(0);
+  if (n==0) {t.levs.push_back(0); return;}
+
+  // Sort-Tile-Recursive packing of leaves:
+  // sort by x center, cut into vertical slices of S*B nodes,
+  // sort each slice by y center
+  auto cx = [](const Node & a){ return (double)a.x1 + a.x2; };
+  auto cy = [](const Node & a){ return (double)a.y1 + a.y2; };
+  size_t P = (n+B-1)/B;                  // number of leaf pages
+  size_t S = (size_t)ceil(sqrt((double)P)); // number of slices
+  std::sort(t.nodes.begin(), t.nodes.end(),
+    [&cx](const Node & a, const Node & b){ return cx(a) < cx(b); });
+  for (size_t i=0; i<n; i+=S*B){
+    auto e = t.nodes.begin() + std::min(n, i+S*B);
+    std::sort(t.nodes.begin()+i, e,
+      [&cy](const Node & a, const Node & b){ return cy(a) < cy(b); });
+  }
+
+  // build upper levels: each node covers B nodes of the level below
+  size_t l0 = 0, l1 = n;
+  t.levs.push_back(n);
+  while (l1-l0 > 1){
+    for (size_t i=l0; i<l1; i+=B){
+      Node nd = t.nodes[i];
+      nd.id = i-l0; // index of the first child in the level below
+      for (size_t j=i+1; j<std::min(l1, i+B); j++){
+        const Node & c = t.nodes[j];
+        nd.x1 = std::min(nd.x1, c.x1); nd.y1 = std::min(nd.y1, c.y1);
+        nd.x2 = std::max(nd.x2, c.x2); nd.y2 = std::max(nd.y2, c.y2);
+      }
+      t.nodes.push_back(nd);
+    }
+    l0 = l1; l1 = t.nodes.size();
+    t.levs.push_back(l1);
+  }
+}
+
+void
+GeoRTree::pack() const{
+  if (!dirty) return;
+  std::lock_guard<std::mutex> lk(pack_mutex);
+  if (!dirty) return;
+  for (auto & t: trees) if (t.second.levs.size()<2) pack(t.second);
+  dirty = false;
+}
+
+/**********************************************************/
+
+void
+GeoRTree::get(const dRect & range, const uint32_t type, std::vector<uint32_t> & ret) const{
+  get(range, type, ret, dPoint());
+}
+
+void
+GeoRTree::get(const dRect & range, const uint32_t type, std::vector<uint32_t> & ret,
+              const dPoint & min_size) const{
+  ret.clear();
+  if (range.is_empty()) return;
+  pack();
+  auto ti = trees.find(type);
+  if (ti == trees.end()) return;
+  const auto & nodes = ti->second.nodes;
+  const auto & levs  = ti->second.levs;
+  if (levs.size()<2 || levs.back()==0) return;
+
+  double x1 = range.x, x2 = range.x + range.w;
+  double y1 = range.y, y2 = range.y + range.h;
+
+  // stack of (level, node index in the level)
+  std::vector<std::pair<size_t, size_t> > st;
+  size_t top = levs.size()-2;
+  for (size_t i=levs[top]; i<levs[top+1]; i++) st.emplace_back(top, i-levs[top]);
+  while (st.size()){
+    auto l = st.back().first;
+    const Node & nd = nodes[levs[l] + st.back().second];
+    st.pop_back();
+    if (nd.x1 > x2 || nd.x2 < x1 || nd.y1 > y2 || nd.y2 < y1) continue;
+    if (l==0) {
+      if (nd.x2-nd.x1 >= min_size.x || nd.y2-nd.y1 >= min_size.y) ret.push_back(nd.id);
+      continue;
+    }
+    size_t c1 = nd.id;
+    size_t c2 = std::min((size_t)levs[l]-levs[l-1], c1+GEORTREE_NODE_SIZE);
+    for (size_t c=c1; c<c2; c++) st.emplace_back(l-1, c);
+  }
+  std::sort(ret.begin(), ret.end());
+  ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+}
+
+std::set<uint32_t>
+GeoRTree::get(const dRect & range, const uint32_t type) const{
+  std::vector<uint32_t> ret;
+  get(range, type, ret);
+  return std::set<uint32_t>(ret.begin(), ret.end());
+}
+
+std::set<uint32_t>
+GeoRTree::get(const uint32_t type) const{
+  pack();
+  std::set<uint32_t> ret;
+  auto ti = trees.find(type);
+  if (ti == trees.end()) return ret;
+  for (size_t i=0; i<ti->second.levs[1]; i++)
+    ret.insert(ti->second.nodes[i].id);
+  return ret;
+}
+
+void
+GeoRTree::put(const uint32_t id, const dRect & range, const uint32_t type){
+  if (range.is_empty()) return;
+  auto & t = trees[type];
+  if (t.levs.size()>1) t.nodes.resize(t.levs[1]); // drop upper levels
+  t.levs.clear();
+  Node nd;
+  nd.x1 = flt_down(range.x); nd.x2 = flt_up(range.x + range.w);
+  nd.y1 = flt_down(range.y); nd.y2 = flt_up(range.y + range.h);
+  nd.id = id;
+  t.nodes.push_back(nd);
+  dirty = true;
+}
+
+void
+GeoRTree::del(const uint32_t id, const dRect & range, const uint32_t type){
+  auto ti = trees.find(type);
+  if (ti == trees.end()) return;
+  auto & t = ti->second;
+  if (t.levs.size()>1) t.nodes.resize(t.levs[1]); // drop upper levels
+  t.levs.clear();
+  t.nodes.erase(std::remove_if(t.nodes.begin(), t.nodes.end(),
+    [id](const Node & n){ return n.id == id; }), t.nodes.end());
+  if (t.nodes.size()==0) trees.erase(ti);
+  dirty = true;
+}
+
+std::set<uint32_t>
+GeoRTree::get_types() const{
+  std::set<uint32_t> ret;
+  for (const auto & t: trees) ret.insert(t.first);
+  return ret;
+}
+
+dRect
+GeoRTree::bbox() const{
+  pack();
+  dRect ret;
+  for (const auto & t: trees){
+    for (size_t i = t.second.levs[t.second.levs.size()-2];
+                i < t.second.nodes.size(); i++){
+      const Node & n = t.second.nodes[i];
+      ret.expand(dRect(dPoint(n.x1,n.y1), dPoint(n.x2,n.y2)));
+    }
+  }
+  return ret;
+}
+
+void
+GeoRTree::dump() const{
+  pack();
+  for (const auto & t: trees){
+    for (size_t i=0; i<t.second.levs[1]; i++){
+      const Node & n = t.second.nodes[i];
+      std::cout << n.id << "\t" << t.first << "\t"
+                << dRect(dPoint(n.x1,n.y1), dPoint(n.x2,n.y2)) << "\n";
+    }
+  }
+}
+
+std::set<uint32_t>
+GeoRTree::get_hash(const std::string & hash0, bool exact) const{
+  throw Err() << "GeoRTree: get_hash is not supported";
+}
+
+size_t
+GeoRTree::size() const{
+  pack();
+  size_t ret = 0;
+  for (const auto & t: trees) ret += t.second.levs[1];
+  return ret;
+}
+
+/**********************************************************/
+
+void
+GeoRTree::save(const std::string & fname) const{
+  pack();
+  // use temporary file and rename to avoid reading incomplete data
+  std::ostringstream tmp;
+  tmp << fname << ".tmp." << getpid() << "."
+      << std::hash<std::thread::id>()(std::this_thread::get_id());
+
+  FILE *F = fopen(tmp.str().c_str(), "wb");
+  if (!F) throw Err() << "GeoRTree: can't open file: " << fname;
+
+  bool ok = fwrite(rtree_magic, 1, 8, F) == 8;
+  uint32_t nt = trees.size();
+  ok = ok && fwrite(&rtree_bom, 4, 1, F) == 1;
+  ok = ok && fwrite(&nt, 4, 1, F) == 1;
+  for (const auto & t: trees){
+    uint32_t type = t.first;
+    uint32_t nl = t.second.levs.size()-1;
+    ok = ok && fwrite(&type, 4, 1, F) == 1;
+    ok = ok && fwrite(&nl, 4, 1, F) == 1;
+    ok = ok && fwrite(t.second.levs.data(), 4, nl+1, F) == nl+1;
+    ok = ok && fwrite(t.second.nodes.data(), sizeof(Node),
+                      t.second.nodes.size(), F) == t.second.nodes.size();
+  }
+  ok = (fclose(F)==0) && ok;
+  if (!ok || rename(tmp.str().c_str(), fname.c_str())!=0){
+    unlink(tmp.str().c_str());
+    throw Err() << "GeoRTree: can't write file: " << fname;
+  }
+}
+
+GeoRTree::GeoRTree(const std::string & fname): dirty(false){
+  FILE *F = fopen(fname.c_str(), "rb");
+  if (!F) throw Err() << "GeoRTree: can't open file: " << fname;
+  try {
+    char magic[8];
+    uint32_t bom, nt;
+    if (fread(magic, 1, 8, F)!=8 || memcmp(magic, rtree_magic, 8)!=0 ||
+        fread(&bom, 4, 1, F)!=1  || bom!=rtree_bom ||
+        fread(&nt, 4, 1, F)!=1)
+      throw Err() << "GeoRTree: bad file header: " << fname;
+    for (uint32_t i=0; i<nt; i++){
+      uint32_t type, nl;
+      if (fread(&type, 4, 1, F)!=1 || fread(&nl, 4, 1, F)!=1 || nl>64)
+        throw Err() << "GeoRTree: broken file: " << fname;
+      Tree & t = trees[type];
+      t.levs.resize(nl+1);
+      if (fread(t.levs.data(), 4, nl+1, F)!=nl+1 || t.levs[0]!=0)
+        throw Err() << "GeoRTree: broken file: " << fname;
+      for (size_t l=1; l<t.levs.size(); l++)
+        if (t.levs[l]<t.levs[l-1])
+          throw Err() << "GeoRTree: broken file: " << fname;
+      t.nodes.resize(t.levs[nl]);
+      if (fread(t.nodes.data(), sizeof(Node), t.nodes.size(), F)!=t.nodes.size())
+        throw Err() << "GeoRTree: broken file: " << fname;
+    }
+  }
+  catch (Err & e){
+    fclose(F);
+    throw;
+  }
+  fclose(F);
+}
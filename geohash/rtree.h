@@ -0,0 +1,105 @@
+#ifndef GEOHASH_RTREE_H
+#define GEOHASH_RTREE_H
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "geom/rect.h"
+#include "storage.h"
+
+/**********************************************************/
+// Packed static R-tree for spatial indexing, an alternative
+// to geohash storage with same interface.
+//
+// Objects are kept in separate trees for each type. Each tree is
+// bulk-loaded (Sort-Tile-Recursive packing) into a flat array of nodes,
+// leaves first, then upper levels up to the root. Coordinates are
+// stored as floats, rounded outwards. Objects can be added or
+// deleted, the tree is repacked on the next query.
+//
+// Tree can be saved to a file and loaded back without repacking.
+
+#define GEORTREE_NODE_SIZE 16
+
+class GeoRTree : public GeoHashStorage {
+  public:
+
+    // tree node: bounding box and object id (for leaves)
+    struct Node {
+      float x1,y1,x2,y2;
+      uint32_t id;
+    };
+
+  private:
+    struct Tree {
+      std::vector<Node> nodes;    // all levels, leaves first
+      std::vector<uint32_t> levs; // start of each level + end; empty if tree is not packed
+    };
+
+    mutable std::map<uint32_t, Tree> trees;
+    mutable std::atomic<bool> dirty;
+    mutable std::mutex pack_mutex;
+
+    // pack all modified trees
+    void pack() const;
+
+    // pack a tree
+    static void pack(Tree & t);
+
+  public:
+
+    GeoRTree(): dirty(false) {}
+    GeoRTree(const GeoRTree & other);
+
+    // Load tree from a file
+    GeoRTree(const std::string & fname);
+
+    // Get id of objects which may be found in the range,
+    // sorted. Vector is cleared before filling.
+    void get(const dRect & range, const uint32_t type, std::vector<uint32_t> & ret) const;
+
+    // Same, but skip objects smaller then min_size
+    // (both width < min_size.x and height < min_size.y).
+    void get(const dRect & range, const uint32_t type, std::vector<uint32_t> & ret,
+             const dPoint & min_size) const;
+
+    // Get id of objects which may be found in the range
+    std::set<uint32_t> get(const dRect & range, const uint32_t type=0) const override;
+
+    // Get id of all objects with one type
+    std::set<uint32_t> get(const uint32_t type) const override;
+
+    // add an object
+    void put(const uint32_t id, const dRect & range, const uint32_t type=0) override;
+
+    // delete an object
+    void del(const uint32_t id, const dRect & range, const uint32_t type=0) override;
+
+    // get all types
+    std::set<uint32_t> get_types() const override;
+
+    // get bounding box of all objects
+    dRect bbox() const override;
+
+    // dump database
+    void dump() const override;
+
+    // not supported
+    std::set<uint32_t> get_hash(const std::string & hash0, bool exact) const override;
+
+    // coordinate range is not needed
+    void set_db_range(const dRect & range_) override {}
+
+    // number of objects
+    size_t size() const;
+
+    // Save tree to a file
+    void save(const std::string & fname) const;
+};
+
+
+#endif
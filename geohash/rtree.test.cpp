@@ -0,0 +1,146 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <cassert>
+#include <random>
+#include <unistd.h>
+#include <iostream>
+#include <sstream>
+#include "err/assert_err.h"
+#include "rtree.h"
+
+// brute-force search
+std::set<uint32_t>
+find(const std::map<uint32_t, dRect> & objs, const dRect & r){
+  std::set<uint32_t> ret;
+  for (const auto & o: objs)
+    if (o.second.x <= r.x+r.w && o.second.x+o.second.w >= r.x &&
+        o.second.y <= r.y+r.h && o.second.y+o.second.h >= r.y) ret.insert(o.first);
+  return ret;
+}
+
+// set of ids as a string
+std::string
+str(const std::set<uint32_t> & s){
+  std::ostringstream ss;
+  for (auto i = s.begin(); i!=s.end(); i++) ss << (i==s.begin()? "":" ") << *i;
+  return ss.str();
+}
+
+int
+main(){
+  try{
+
+    {
+      GeoRTree db;
+      assert_eq(db.size(), 0);
+      assert_eq(db.bbox(), dRect());
+      assert_eq(db.get(dRect(0,0,1,1), 0).size(), 0);
+
+      db.put(1, dRect(-0.01,-0.01, 0.02,0.02), 0);
+      db.put(2, dRect(1,-0.01,     0.02,0.02), 0);
+      db.put(3, dRect(-0.01,1,     0.02,0.02), 0);
+      db.put(4, dRect(1,1,         0.01,0.01), 0);
+      db.put(5, dRect(36,57,       0.01,0.01), 0);
+      db.put(10, dRect(0,0,    0.1,0.1), 1);
+      db.put(11, dRect(1,1,    0.1,0.1), 1);
+      db.put(12, dRect(2,2,    0.1,0.1), 2);
+      db.put(13, dRect(), 2); // empty range: skipped
+
+      assert_eq(db.size(), 8);
+      assert_eq(str(db.get_types()), "0 1 2");
+      assert_eq(str(db.get(0)), "1 2 3 4 5");
+      assert_eq(str(db.get(1)), "10 11");
+      assert_eq(str(db.get(3)), "");
+
+      assert_eq(str(db.get(dRect(0,0,0.5,0.5), 0)), "1");
+      assert_eq(str(db.get(dRect(0,0,1,1), 0)), "1 2 3 4");
+      assert_eq(str(db.get(dRect(0,0,1,1), 1)), "10 11");
+      assert_eq(str(db.get(dRect(0,0,1,1), 2)), "");
+      assert_eq(str(db.get(dRect(30,50,10,10), 0)), "5");
+      assert_eq(str(db.get(dRect(), 0)), "");
+
+      std::vector<uint32_t> v(10, 0);
+      db.get(dRect(0.5,0.5,0.6,0.6), 0, v);
+      assert_eq(v.size(), 1);
+      assert_eq(v[0], 4);
+
+      // skip small objects
+      db.get(dRect(0,0,1,1), 0, v, dPoint(0.015,0.015));
+      assert_eq(v.size(), 3); // 1, 2, 3
+      db.get(dRect(0,0,1,1), 0, v, dPoint(0.1,0.1));
+      assert_eq(v.size(), 0);
+
+      // bbox (float precision)
+      assert_deq(db.bbox(), dRect(-0.01,-0.01,36.02,57.02), 1e-5);
+
+      // delete
+      db.del(4, dRect(1,1,0.01,0.01), 0);
+      db.del(4, dRect(1,1,0.01,0.01), 0);
+      db.del(12, dRect(2,2,0.1,0.1), 2);
+      assert_eq(str(db.get(dRect(0,0,1,1), 0)), "1 2 3");
+      assert_eq(str(db.get_types()), "0 1");
+      assert_eq(db.size(), 6);
+
+      assert_err(db.get_hash("", false), "GeoRTree: get_hash is not supported");
+
+      // save/load
+      const char *fname = "rtree_test.tmp";
+      db.save(fname);
+      GeoRTree db1(fname);
+      assert_eq(db1.size(), 6);
+      assert_eq(str(db1.get(dRect(0,0,1,1), 0)), "1 2 3");
+      assert_eq(str(db1.get(dRect(0,0,1,1), 1)), "10 11");
+      db1.put(14, dRect(0.5,0.5,0.1,0.1), 0);
+      assert_eq(str(db1.get(dRect(0,0,1,1), 0)), "1 2 3 14");
+      unlink(fname);
+
+      assert_err(GeoRTree("rtree_test.missing"),
+        "GeoRTree: can't open file: rtree_test.missing");
+      assert_err(GeoRTree("rtree.test.cpp"),
+        "GeoRTree: bad file header: rtree.test.cpp");
+
+      // copy
+      GeoRTree db2(db1);
+      assert_eq(str(db2.get(dRect(0,0,1,1), 0)), "1 2 3 14");
+    }
+
+    // random objects, compare with brute-force search
+    {
+      std::mt19937 gen(1);
+      std::uniform_int_distribution<int> crd(0, 1000*64), sz(0, 10*64), tp(0, 3);
+      std::map<uint32_t, dRect> objs[4]; // coordinates are exact in float
+      GeoRTree db;
+      for (uint32_t id=0; id<20000; id++){
+        int t = tp(gen);
+        dRect r(crd(gen)/64.0, crd(gen)/64.0, sz(gen)/64.0, sz(gen)/64.0);
+        objs[t].emplace(id, r);
+        db.put(id, r, t);
+      }
+      // delete some objects
+      for (uint32_t id=0; id<20000; id+=7){
+        for (int t=0; t<4; t++){
+          if (!objs[t].count(id)) continue;
+          db.del(id, objs[t][id], t);
+          objs[t].erase(id);
+        }
+      }
+      std::vector<uint32_t> v;
+      for (int i=0; i<500; i++){
+        int t = tp(gen);
+        dRect r(crd(gen)/64.0, crd(gen)/64.0, sz(gen)/4.0, sz(gen)/4.0);
+        db.get(r, t, v);
+        auto s = find(objs[t], r);
+        assert_eq(v.size(), s.size());
+        assert_eq(str(std::set<uint32_t>(v.begin(), v.end())), str(s));
+      }
+    }
+
+  }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
@@ -5,6 +5,7 @@
 #include <iomanip>
 #include <ios>
 #include <cmath>    // for rint
+#include <functional> // for std::hash
 #include "err/err.h" // for Err
 #include "opt/opt.h" // for str_to_type
 
@@ -328,5 +329,23 @@ std::istream & operator>> (std::istream & s, Point<T> & p){
   return s;
 }
 
+/******************************************************************/
+// hash (for using points as keys in unordered containers)
+
+namespace std {
+/// Hash function for Point
+/// \relates Point
+template <typename T>
+struct hash<Point<T> > {
+  size_t operator()(const Point<T> & p) const {
+    hash<T> h;
+    size_t ret = h(p.x);
+    ret ^= h(p.y) + 0x9e3779b9 + (ret<<6) + (ret>>2);
+    ret ^= h(p.z) + 0x9e3779b9 + (ret<<6) + (ret>>2);
+    return ret;
+  }
+};
+}
+
 ///@}
 #endif
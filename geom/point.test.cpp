@@ -30,6 +30,14 @@ main(){
     assert(iPoint("[3,4,2]")==iPoint(3,4,2));
   }
 
+  {
+    // hash
+    std::hash<iPoint> h;
+    assert(h(iPoint(1,2,3)) == h(iPoint(1,2,3)));
+    assert(h(iPoint(1,2,3)) != h(iPoint(2,1,3)));
+    assert(std::hash<dPoint>()(dPoint(0,0)) == std::hash<dPoint>()(dPoint(-0.0,0)));
+  }
+
   {
     // +, -, *, /
     iPoint p1(1,1,2);
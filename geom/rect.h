@@ -481,5 +481,25 @@ std::istream & operator>> (std::istream & s, Rect<T> & r){
   return s;
 }
 
+/******************************************************************/
+// hash (for using rectangles as keys in unordered containers)
+
+namespace std {
+/// Hash function for Rect. All empty rectangles have same hash.
+/// \relates Rect
+template <typename T>
+struct hash<Rect<T> > {
+  size_t operator()(const Rect<T> & r) const {
+    if (r.e) return 0;
+    hash<T> h;
+    size_t ret = h(r.x);
+    ret ^= h(r.y) + 0x9e3779b9 + (ret<<6) + (ret>>2);
+    ret ^= h(r.w) + 0x9e3779b9 + (ret<<6) + (ret>>2);
+    ret ^= h(r.h) + 0x9e3779b9 + (ret<<6) + (ret>>2);
+    return ret;
+  }
+};
+}
+
 ///@}
 #endif
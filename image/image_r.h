@@ -94,6 +94,17 @@ class ImageR : public Image {
       }
     }
 
+    // constructor -- create WxH image using an existing data buffer
+    // (e.g. a memory-mapped file). Buffer size should be at least dsize(),
+    // it is released by the deleter of the shared pointer.
+    ImageR(const size_t W, const size_t H, const ImageDataType type,
+           const std::shared_ptr<unsigned char> & data): data_(data), w(W), h(H), t(type){
+      if (w<=0 || h<=0)
+        throw Err() << "non-positive image dimension: " << w << "x" << h;
+      if (!data_) throw Err() << "ImageR: empty data buffer";
+      if (type==IMAGE_8PAL) cmap.resize(256);
+    }
+
 
     /******************************************************/
     // Fast get/set/fill functions for specific image types.
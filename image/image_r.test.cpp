@@ -254,6 +254,19 @@ main(){
       assert_feq(im.get_double(2,9), 350.0, 1e-6);
     }
 
+    { // image with external data buffer
+      std::shared_ptr<unsigned char> buf(new unsigned char[20*10*2],
+        std::default_delete<unsigned char[]>());
+      ImageR im(20,10, IMAGE_16, buf);
+      assert_eq(im.data(), buf.get());
+      im.set16(3,4, 1234);
+      assert_eq(((uint16_t*)buf.get())[4*20+3], 1234);
+      ImageR im1(im);
+      assert_eq(im1.get16(3,4), 1234);
+      assert_err(ImageR(20,10, IMAGE_16, std::shared_ptr<unsigned char>()),
+        "ImageR: empty data buffer");
+    }
+
     { // 1bpp image, w*h % 8 = 0
       ImageR im(256,128, IMAGE_1);
       assert_eq(type_to_str(im), "ImageR(256x128, B/W, 1bpp)");
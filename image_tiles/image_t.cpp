@@ -1,7 +1,20 @@
 #include <string>
 #include <sstream>
+#include <map>
+#include <array>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "geo_tiles/quadkey.h"
 #include "image_t.h"
+#include "image/image_colors.h"
 
 // move to geo_tiles module or somewhere else?
 std::string
@@ -69,12 +82,62 @@ ImageT::get_argb(const size_t x, const size_t y) const {
   return img.get_argb(crd.x, crd.y);
 }
 
+// Copy n points of a tile row starting from (x,y).
+static void
+tile_row(const ImageR & img, const size_t tsize,
+         const size_t x, const size_t y, const size_t n, uint32_t *dst){
+  if (img.is_empty()) {
+    std::fill(dst, dst+n, 0);
+    return;
+  }
+  if (img.type()==IMAGE_32ARGB &&
+      img.width()==tsize && img.height()==tsize){
+    memcpy(dst, img.data() + 4*(tsize*y + x), 4*n);
+    return;
+  }
+  for (size_t i=0; i<n; i++) dst[i] = img.get_argb(x+i, y);
+}
+
+void
+ImageT::get_span(const int x, const int y, const size_t n, uint32_t *dst) const{
+  size_t i = 0;
+  while (i<n){
+    int xx = x + i;
+    if (xx<0 || y<0) {dst[i++] = 0; continue;}
+    iPoint key(xx/tsize, y/tsize, zoom);
+    if (swapy) key.y = (1<<zoom) - key.y - 1;
+    size_t m = std::min(n-i, tsize - xx%tsize); // points in this tile
+    tile_row(tile_get_cached(key), tsize, xx%tsize, y%tsize, m, dst+i);
+    i += m;
+  }
+}
+
 ImageR
 ImageT::get_image(const iRect & r) const{
   ImageR ret(r.w,r.h, IMAGE_32ARGB);
-  for (int y = 0; y<r.h; ++y)
-    for (int x = 0; x<r.w; ++x)
-      ret.set32(x, y, get_argb(x+r.x,y+r.y));
+  uint32_t *data = (uint32_t *)ret.data();
+  int ts = tsize;
+
+  // rectangular blocks, one for each tile
+  for (int y = r.y; y < r.y+r.h; ){
+    int ny = y<0 ? std::min(-y, r.y+r.h-y) : std::min(ts - y%ts, r.y+r.h-y);
+    for (int x = r.x; x < r.x+r.w; ){
+      int nx = x<0 ? std::min(-x, r.x+r.w-x) : std::min(ts - x%ts, r.x+r.w-x);
+      uint32_t *dst = data + (y-r.y)*r.w + (x-r.x);
+      if (x<0 || y<0){
+        for (int j=0; j<ny; j++) std::fill(dst + j*r.w, dst + j*r.w + nx, 0);
+      }
+      else {
+        iPoint key(x/ts, y/ts, zoom);
+        if (swapy) key.y = (1<<zoom) - key.y - 1;
+        ImageR img = tile_get_cached(key);
+        for (int j=0; j<ny; j++)
+          tile_row(img, tsize, x%ts, y%ts + j, nx, dst + j*r.w);
+      }
+      x += nx;
+    }
+    y += ny;
+  }
   return ret;
 }
 
@@ -83,31 +146,294 @@ ImageT::tile_bbox(const iPoint & key) const{
   return (int)tsize*iRect(key, key+iPoint(1,1));
 }
 
+/**********************************************************/
+// Downscaling
+
+// Box filter: average of 2x2 pixels for each of 4 color components
+// (rounded down). src0, src1: two source rows (2*n pixels),
+// dst: destination row (n pixels).
+static void
+box_row(const uint8_t *src0, const uint8_t *src1, uint8_t *dst, const size_t n){
+  size_t i = 0;
+#ifdef __SSE2__
+  // 4 destination pixels per step
+  const __m128i z = _mm_setzero_si128();
+  for (; i+4<=n; i+=4){
+    __m128i r[2];
+    for (int k=0; k<2; k++){
+      __m128i a = _mm_loadu_si128((const __m128i*)(src0 + 8*i + 16*k));
+      __m128i b = _mm_loadu_si128((const __m128i*)(src1 + 8*i + 16*k));
+      // vertical sums, 16-bit: two pixels in each register
+      __m128i v01 = _mm_add_epi16(_mm_unpacklo_epi8(a,z), _mm_unpacklo_epi8(b,z));
+      __m128i v23 = _mm_add_epi16(_mm_unpackhi_epi8(a,z), _mm_unpackhi_epi8(b,z));
+      // horizontal sums
+      v01 = _mm_add_epi16(v01, _mm_srli_si128(v01, 8));
+      v23 = _mm_add_epi16(v23, _mm_srli_si128(v23, 8));
+      r[k] = _mm_srli_epi16(_mm_unpacklo_epi64(v01, v23), 2);
+    }
+    _mm_storeu_si128((__m128i*)(dst + 4*i), _mm_packus_epi16(r[0], r[1]));
+  }
+#endif
+  for (; i<n; i++){
+    for (int c=0; c<4; c++){
+      dst[4*i+c] = (src0[8*i+c] + src0[8*i+4+c] +
+                    src1[8*i+c] + src1[8*i+4+c]) >> 2;
+    }
+  }
+}
+
+// Lanczos-2 kernel for 2x downscaling: 8 taps at
+// distances 0.5, 1.5, 2.5, 3.5 source pixels from the center.
+static const double *
+lanczos_weights(){
+  // function-local static: initialized once, thread-safe in C++11
+  static const std::array<double,4> w = []{
+    std::array<double,4> w;
+    double sum = 0;
+    for (int i=0; i<4; i++){
+      double x = (i+0.5)/2.0; // in destination pixels
+      w[i] = sin(M_PI*x)/(M_PI*x) * sin(M_PI*x/2)/(M_PI*x/2);
+      sum += 2*w[i];
+    }
+    for (int i=0; i<4; i++) w[i] /= sum;
+    return w;
+  }();
+  return w.data();
+}
+
+// Lanczos-2 downscaling of a 2N x 2N image (IMAGE_32ARGB) to N x N.
+// Pixels outside the image are replaced by edge pixels.
+static ImageR
+lanczos_scale(const ImageR & src){
+  const double *w = lanczos_weights();
+  int N2 = src.width(), N = N2/2;
+
+  // horizontal pass: N2 rows x N columns
+  std::vector<float> tmp(4*N*N2);
+  for (int y=0; y<N2; y++){
+    const uint8_t *row = src.data() + 4*N2*y;
+    for (int x=0; x<N; x++){
+      float *d = tmp.data() + 4*(N*y+x);
+      for (int k=0; k<4; k++){
+        int x1 = std::max(2*x-k, 0);
+        int x2 = std::min(2*x+1+k, N2-1);
+        for (int c=0; c<4; c++)
+          d[c] += w[k]*(row[4*x1+c] + row[4*x2+c]);
+      }
+    }
+  }
+
+  // vertical pass
+  ImageR ret(N, N, IMAGE_32ARGB);
+  for (int y=0; y<N; y++){
+    uint8_t *row = ret.data() + 4*N*y;
+    for (int x=0; x<N; x++){
+      float v[4] = {0,0,0,0};
+      for (int k=0; k<4; k++){
+        int y1 = std::max(2*y-k, 0);
+        int y2 = std::min(2*y+1+k, N2-1);
+        const float *s1 = tmp.data() + 4*(N*y1+x);
+        const float *s2 = tmp.data() + 4*(N*y2+x);
+        for (int c=0; c<4; c++) v[c] += w[k]*(s1[c] + s2[c]);
+      }
+      // premultiplied colors: 0 <= color <= alpha
+      int a = std::min(std::max((int)lround(v[3]), 0), 255);
+      row[4*x+3] = a;
+      for (int c=0; c<3; c++)
+        row[4*x+c] = std::min(std::max((int)lround(v[c]), 0), a);
+    }
+  }
+  return ret;
+}
+
+ImageR
+tile_downscale(const ImageR src[4], const size_t tsize,
+               const bool swapy, const std::string & filter){
+
+  if (filter != "box" && filter != "lanczos")
+    throw Err() << "tile_downscale: unknown filter: " << filter;
+
+  // convert source images, check size
+  ImageR s[4];
+  for (int t=0; t<4; t++){
+    if (src[t].is_empty()) continue;
+    if (src[t].width()!=tsize || src[t].height()!=tsize)
+      throw Err() << "tile_downscale: wrong tile size: "
+                  << src[t].width() << "x" << src[t].height();
+    s[t] = src[t].type()==IMAGE_32ARGB ? src[t] : image_to_argb(src[t]);
+  }
+
+  ImageR ret;
+  if (filter == "box"){
+    ret = ImageR(tsize, tsize, IMAGE_32ARGB);
+    ret.fill32(0);
+    size_t h = tsize/2;
+    for (int t=0; t<4; t++){
+      if (s[t].is_empty()) continue;
+      int dy = swapy? 1-t/2: t/2;
+      for (size_t y=0; y<h; y++){
+        const uint8_t *r0 = s[t].data() + 4*tsize*(2*y);
+        const uint8_t *r1 = r0 + 4*tsize;
+        uint8_t *d = ret.data() + 4*(tsize*(y + dy*h) + (t%2)*h);
+        box_row(r0, r1, d, h);
+      }
+    }
+  }
+  else {
+    // combine source tiles into one image
+    ImageR big(2*tsize, 2*tsize, IMAGE_32ARGB);
+    big.fill32(0);
+    for (int t=0; t<4; t++){
+      if (s[t].is_empty()) continue;
+      int dy = swapy? 1-t/2: t/2;
+      for (size_t y=0; y<tsize; y++)
+        memcpy(big.data() + 4*(2*tsize*(y + dy*tsize) + (t%2)*tsize),
+               s[t].data() + 4*tsize*y, 4*tsize);
+    }
+    ret = lanczos_scale(big);
+  }
+  return ret;
+}
+
 void
 ImageT::tile_rescale(const iPoint & key) {
-  ImageR img(tsize, tsize, IMAGE_32ARGB);
-  img.fill32(0);
-
+  ImageR src[4];
   for (int t=0; t<4; t++){
-    iPoint src(2*key.x + t%2, 2*key.y + t/2, key.z+1);
-    if (!tile_exists(src)) continue;
-    ImageR src_img = tile_read(src);
-
-    for (size_t y1 = 0; y1<tsize/2; ++y1){
-      for (size_t x1 = 0; x1<tsize/2; ++x1){
-        // calculate 4-point average for all 4 color components
-        int cc[4] = {0,0,0,0};
-        for (int t1 = 0; t1<4; t1++){
-          uint32_t c =  src_img.get_argb(2*x1 + t1%2, 2*y1 + t1/2);
-          for (int i = 0; i<4; ++i) cc[i] += ((c>>(8*i)) & 0xff);
+    iPoint k(2*key.x + t%2, 2*key.y + t/2, key.z+1);
+    if (tile_exists(k)) src[t] = tile_read(k);
+  }
+  tile_write(key, tile_downscale(src, tsize, swapy));
+}
+
+/**********************************************************/
+// Pyramid builder
+
+namespace {
+
+struct Pyramid {
+  ImageT & timg;
+  size_t tsize;
+  bool swapy;
+  std::string filter;
+  int zsrc;                // source level
+  std::vector<iRect> rng;  // tile ranges for each level
+  std::mutex m;            // lock for tile storage
+  size_t count;            // number of written tiles
+  std::map<iPoint, ImageR> top; // built tiles at task level
+
+  Pyramid(ImageT & timg, size_t tsize, bool swapy,
+          const std::string & filter, int zsrc):
+    timg(timg), tsize(tsize), swapy(swapy), filter(filter),
+    zsrc(zsrc), rng(zsrc+1), count(0) {}
+
+  // Build a tile using tiles of level zt (from `top` map)
+  // or from storage at zsrc level if zt<0.
+  ImageR build(const iPoint & key, const int zt){
+    ImageR src[4];
+    bool empty = true;
+    for (int t=0; t<4; t++){
+      iPoint k(2*key.x + t%2, 2*key.y + t/2, key.z+1);
+      if (!rng[k.z].contains_l(k)) continue;
+      if (k.z == zt){
+        auto i = top.find(k);
+        if (i==top.end()) continue;
+        src[t] = i->second;
+        top.erase(i);
+      }
+      else if (k.z == zsrc){
+        std::lock_guard<std::mutex> lk(m);
+        if (!timg.tile_exists(k)) continue;
+        src[t] = timg.tile_read(k);
+      }
+      else {
+        src[t] = build(k, zt);
+      }
+      if (!src[t].is_empty()) empty = false;
+    }
+    if (empty) return ImageR();
+
+    ImageR img = tile_downscale(src, tsize, swapy, filter);
+    std::lock_guard<std::mutex> lk(m);
+    timg.tile_write(key, img);
+    count++;
+    return img;
+  }
+};
+
+} // namespace
+
+void
+ImageT::tile_pyramid(const iRect & range, const int zmin, const int zmax,
+                     const Opt & opts){
+  if (zmin>zmax || zmin<0) return;
+
+  int nthreads = opts.get("tmap_threads", 1);
+  if (nthreads<1) nthreads = 1;
+  bool v = opts.get("verbose", false);
+  Pyramid P(*this, tsize, swapy, opts.get("tmap_filter", "box"), zmax+1);
+
+  // tile ranges
+  P.rng[zmax+1] = range;
+  for (int z = zmax; z>=zmin; z--){
+    const iRect & r = P.rng[z+1];
+    if (r.is_empty()) return;
+    iPoint p1 = floor(dPoint(r.tlc())/2.0);
+    iPoint p2 = ceil(dPoint(r.brc())/2.0);
+    P.rng[z] = iRect(p1, p2);
+  }
+
+  // Task level: tiles of this level are built in parallel.
+  int zt = zmax;
+  for (int z = zmin; z<zmax; z++){
+    if (P.rng[z].w * P.rng[z].h >= 4*nthreads) {zt = z; break;}
+  }
+  std::vector<iPoint> tasks;
+  const iRect & r = P.rng[zt];
+  for (int y = r.y; y < r.y+r.h; y++)
+    for (int x = r.x; x < r.x+r.w; x++) tasks.emplace_back(x,y,zt);
+
+  auto t0 = std::chrono::steady_clock::now();
+  size_t next = 0;
+  std::mutex tm;
+  std::exception_ptr err;
+  auto worker = [&](){
+    while (1){
+      size_t i;
+      {
+        std::lock_guard<std::mutex> lk(tm);
+        if (err || next>=tasks.size()) return;
+        i = next++;
+      }
+      try {
+        auto img = P.build(tasks[i], -1);
+        if (zt>zmin && !img.is_empty()){
+          std::lock_guard<std::mutex> lk(tm);
+          P.top.emplace(tasks[i], img);
         }
-        uint32_t c = 0;
-        for (int i = 0; i<4; ++i)
-          c += ((cc[i]/4) & 0xff) << (8*i);
-        int dy = swapy? 1-t/2: t/2;
-        img.set32(x1 + (t%2)*tsize/2, y1 + dy*tsize/2, c);
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lk(tm);
+        if (!err) err = std::current_exception();
       }
     }
+  };
+
+  if (nthreads==1) worker();
+  else {
+    std::vector<std::thread> threads;
+    for (int i=0; i<nthreads; i++) threads.emplace_back(worker);
+    for (auto & t: threads) t.join();
+  }
+  if (err) std::rethrow_exception(err);
+
+  // levels above the task level
+  if (zt>zmin){
+    const iRect & r = P.rng[zmin];
+    for (int y = r.y; y < r.y+r.h; y++)
+      for (int x = r.x; x < r.x+r.w; x++) P.build(iPoint(x,y,zmin), zt);
   }
-  tile_write(key, img);
+
+  if (v) std::cout << "tile_pyramid: levels " << zmin << ".." << zmax << ", "
+                   << P.count << " tiles, " << std::chrono::duration<double>(
+                        std::chrono::steady_clock::now()-t0).count() << " s\n";
 }
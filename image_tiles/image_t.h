@@ -2,9 +2,11 @@
 #define IMAGE_TILES_H
 
 #include <string>
+#include <vector>
 #include "cache/cache.h"
 #include "image/image.h"
 #include "image/image_r.h"
+#include "opt/opt.h"
 
 // Base interface for tiled images.
 
@@ -49,6 +51,14 @@ class ImageT: public Image {
     // get a tile directly (without using cache)
     virtual ImageR tile_read(const iPoint & key) const = 0;
 
+    // get a few tiles directly (without using cache). Result has same
+    // order as keys, empty images are returned for missing tiles.
+    virtual std::vector<ImageR> tile_read_many(const std::vector<iPoint> & keys) const {
+      std::vector<ImageR> ret;
+      for (auto const & k: keys) ret.push_back(tile_read(k));
+      return ret;
+    }
+
     // write a tile
     virtual void tile_write(const iPoint & key, const ImageR & img) = 0;
 
@@ -61,6 +71,19 @@ class ImageT: public Image {
     // make tile by scaling four z+1 sub-tiles and write it
     virtual void tile_rescale(const iPoint & key);
 
+    // Make tiles at zoom levels zmax..zmin from tiles at level zmax+1
+    // (bottom-up). `range` is the range of source tiles at zmax+1.
+    // Each source tile is read only once, tiles of lower levels are kept
+    // in memory until their parent tile is built. Tiles without any
+    // existing sub-tiles are not written. Subtrees are built in a few
+    // threads, access to tile storage is serialized.
+    // Options:
+    //   tmap_threads -- number of threads (default 1)
+    //   tmap_filter  -- downscaling filter: box (default), lanczos
+    //   verbose      -- print number of tiles and time
+    void tile_pyramid(const iRect & range, const int zmin, const int zmax,
+                      const Opt & opts = Opt());
+
     // get a tile (using tile cache)
     virtual ImageR & tile_get_cached(const iPoint & key) const;
 
@@ -79,7 +102,14 @@ class ImageT: public Image {
     // get point color
     uint32_t get_argb(const size_t x, const size_t y) const override;
 
+    // Get colors of n points in a row, starting from (x,y).
+    // Each tile is looked up once, data is copied directly from
+    // tile buffers if possible. Points with negative coordinates
+    // and points in missing tiles are transparent.
+    void get_span(const int x, const int y, const size_t n, uint32_t *dst) const;
+
     // get an image (move somewhere else?)
+    // Data is copied tile by tile, same as in get_span.
     ImageR get_image(const iRect & r) const;
 
     std::ostream & print (std::ostream & s) const override{
@@ -88,4 +118,16 @@ class ImageT: public Image {
     }
 };
 
+/*******************************************************/
+
+// Make a tile from four tiles of the next zoom level (2x downscaling).
+// Source tiles are (x,y), (x+1,y), (x,y+1), (x+1,y+1), if swapy is set
+// then y is counted from bottom (TMS tiles). Empty images are
+// treated as transparent, other images should have size tsize x tsize,
+// they are converted to IMAGE_32ARGB if needed.
+// Filters: "box" (2x2 average), "lanczos" (Lanczos-2 kernel).
+// Result is an IMAGE_32ARGB image.
+ImageR tile_downscale(const ImageR src[4], const size_t tsize,
+                      const bool swapy, const std::string & filter = "box");
+
 #endif
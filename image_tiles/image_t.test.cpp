@@ -2,6 +2,8 @@
 
 #include <iostream>
 #include "image_t.h"
+#include "image_t_local.h"
+#include "image/image_colors.h"
 #include "err/assert_err.h"
 
 int
@@ -29,6 +31,142 @@ main(){
     assert_err(ImageT::make_url("abc{x}/{y", p),
       "ImageT: } is missing in URL template: abc{x}/{y");
 
+    // tile downscaling
+    {
+      size_t ts = 16;
+      ImageR src[4];
+      for (int t=0; t<3; t++){ // 4th tile is empty
+        src[t] = ImageR(ts, ts, IMAGE_32ARGB);
+        for (size_t y=0; y<ts; y++)
+          for (size_t x=0; x<ts; x++)
+            src[t].set32(x,y, (0x01030507*(x+3*y+7*t)) | 0xFF000000);
+      }
+      src[2] = image_to_argb(src[2]); // same image
+      assert_err(tile_downscale(src, ts, false, "abc"),
+        "tile_downscale: unknown filter: abc");
+      assert_err(tile_downscale(src, 8, false),
+        "tile_downscale: wrong tile size: 16x16");
+
+      ImageR img1 = tile_downscale(src, ts, false);
+      ImageR img2 = tile_downscale(src, ts, true);
+      assert_eq(img1.type(), IMAGE_32ARGB);
+      assert_eq(img1.width(), ts);
+      assert_eq(img1.height(), ts);
+      for (size_t y=0; y<ts; y++){
+        for (size_t x=0; x<ts; x++){
+          int t = (x/(ts/2)) + 2*(y/(ts/2));
+          int t2 = (x/(ts/2)) + 2*(1-y/(ts/2)); // swapy
+          uint32_t c = 0, c2 = 0;
+          if (t<3) {
+            // average of four pixels
+            int cc[4] = {0,0,0,0};
+            for (int t1 = 0; t1<4; t1++){
+              uint32_t c1 = src[t].get_argb(2*(x%(ts/2)) + t1%2, 2*(y%(ts/2)) + t1/2);
+              for (int i = 0; i<4; ++i) cc[i] += ((c1>>(8*i)) & 0xff);
+            }
+            for (int i = 0; i<4; ++i) c += ((cc[i]/4) & 0xff) << (8*i);
+          }
+          assert_eq(img1.get32(x,y), c);
+          if (t2<3) c2 = img1.get32(x, (y+ts/2)%ts);
+          assert_eq(img2.get32(x,y), c2);
+        }
+      }
+
+      // lanczos filter: uniform areas are kept
+      for (int t=0; t<4; t++){
+        src[t] = ImageR(ts, ts, IMAGE_32ARGB);
+        src[t].fill32(0xFF204080);
+      }
+      src[3].fill32(0x80100000);
+      ImageR img3 = tile_downscale(src, ts, false, "lanczos");
+      assert_eq(img3.get32(0,0), 0xFF204080);
+      assert_eq(img3.get32(ts-1,0), 0xFF204080);
+      assert_eq(img3.get32(ts-1,ts-1), 0x80100000);
+      assert_eq(img3.get32(ts/2-4,ts/2-4), 0xFF204080);
+    }
+
+    // get_span, get_image
+    for (int sw=0; sw<2; sw++){
+      ImageTLocal timg("tmp_span_{z}_{x}_{y}.png", sw, 16);
+      // two tiles at level 1: (0,0) and (1,1) in image coordinates
+      for (int t=0; t<2; t++){
+        ImageR img(16, 16, IMAGE_32ARGB);
+        for (int y=0; y<16; y++)
+          for (int x=0; x<16; x++)
+            img.set32(x,y, 0xFF000000 + 0x10000*t + 0x100*y + x);
+        timg.tile_write(iPoint(t, sw? 1-t:t, 1), img);
+      }
+      timg.set_zoom(1);
+
+      iRect r(-3,-2,40,39);
+      ImageR img = timg.get_image(r);
+      for (int y=0; y<r.h; y++){
+        std::vector<uint32_t> row(r.w);
+        timg.get_span(r.x, r.y+y, r.w, row.data());
+        for (int x=0; x<r.w; x++){
+          int xx = x+r.x, yy = y+r.y;
+          uint32_t c = (xx<0 || yy<0)? 0 : timg.get_argb(xx, yy);
+          assert_eq(img.get32(x,y), c);
+          assert_eq(row[x], c);
+        }
+      }
+      assert_eq(img.get32(3+1,2+2), 0xFF000201);
+      assert_eq(img.get32(3+17,2+18), 0xFF010201);
+      assert_eq(img.get32(3+17,2+1), 0);
+
+      timg.tile_delete(iPoint(0, sw? 1:0, 1));
+      timg.tile_delete(iPoint(1, sw? 0:1, 1));
+    }
+
+    // pyramid
+    {
+      ImageTLocal timg("tmp_pyr_{z}_{x}_{y}.png", false, 16);
+      // tiles at level 3: (2..5, 3..4), except (5,4)
+      iRect r(2,3,4,2);
+      for (int y=r.y; y<r.y+r.h; y++){
+        for (int x=r.x; x<r.x+r.w; x++){
+          if (x==5 && y==4) continue;
+          ImageR img(16, 16, IMAGE_32ARGB);
+          img.fill32(0xFF000000 + 0x10*x + 0x1000*y);
+          timg.tile_write(iPoint(x,y,3), img);
+        }
+      }
+      Opt o;
+      o.put("tmap_threads", 3);
+      timg.tile_pyramid(r, 0, 2, o);
+
+      assert_eq(timg.tile_exists(iPoint(0,0,0)), true);
+      assert_eq(timg.tile_exists(iPoint(1,1,1)), true);
+      assert_eq(timg.tile_exists(iPoint(0,1,1)), true);
+      assert_eq(timg.tile_exists(iPoint(1,1,2)), true);
+      assert_eq(timg.tile_exists(iPoint(2,1,2)), true);
+      assert_eq(timg.tile_exists(iPoint(2,2,2)), true);
+      assert_eq(timg.tile_exists(iPoint(0,0,2)), false);
+      assert_eq(timg.tile_exists(iPoint(3,3,2)), false);
+
+      // compare with tile_rescale
+      for (int z=2; z>=0; z--){
+        for (int y=0; y<(1<<z); y++){
+          for (int x=0; x<(1<<z); x++){
+            iPoint k(x,y,z);
+            if (!timg.tile_exists(k)) continue;
+            auto img1 = image_to_argb(timg.tile_read(k));
+            timg.tile_rescale(k);
+            auto img2 = image_to_argb(timg.tile_read(k));
+            for (int i=0; i<16; i++)
+              for (int j=0; j<16; j++)
+                assert_eq(img1.get32(i,j), img2.get32(i,j));
+          }
+        }
+      }
+      assert_eq(timg.tile_read(iPoint(2,2,2)).get_argb(0,0), 0xFF004040);
+      assert_eq(timg.tile_read(iPoint(2,2,2)).get_argb(8,0), 0);
+      for (int z=0; z<=3; z++)
+        for (int y=0; y<(1<<z); y++)
+          for (int x=0; x<(1<<z); x++)
+            if (timg.tile_exists(iPoint(x,y,z))) timg.tile_delete(iPoint(x,y,z));
+    }
+
     {
 //      ImageT imgt("https://tiles.nakarte.me/eurasia25km/7/{x}/{y}", true);
 //      iRect r(87, 78, 3, 2);
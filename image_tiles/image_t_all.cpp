@@ -11,6 +11,9 @@ open_tile_img(const std::string & url, const Opt & opts){
   int dcache_s  = opts.get("tmap_dcache_size", 64);
   bool rdonly   = opts.get("tmap_readonly", false);
   int db_sync   = opts.get("db_sync", 0);
+  bool db_wal   = opts.get("db_wal", false);
+  bool db_dedup = opts.get("db_dedup", false);
+  int db_batch  = opts.get("db_batch", 0);
 
   // If url contains schema, use remote
   if (url.find("://")!=url.npos){
@@ -22,9 +25,10 @@ open_tile_img(const std::string & url, const Opt & opts){
 
   // If extension is mbtiles
   if (file_ext_check(url, ".mbtiles")){
-    std::shared_ptr<ImageT> ret(
-      new ImageMBTiles(url, rdonly, db_sync));
+    std::shared_ptr<ImageMBTiles> ret(
+      new ImageMBTiles(url, rdonly, db_sync, db_wal, db_dedup));
     ret->set_opt(opts);
+    if (db_batch>0 && !rdonly) ret->begin_batch(db_batch);
     return ret;
   }
 
@@ -9,7 +9,12 @@
 #include "image_t_remote.h"
 #include "image_t_mbtiles.h"
 
-// Open an arbitrary tiled map, depending on url
+// Open an arbitrary tiled map, depending on url.
+// For MBTILES databases options db_sync, db_wal, db_dedup
+// are passed to ImageMBTiles constructor; if db_batch>0 then
+// tiles are written in batches of db_batch tiles (the last batch
+// is committed when the database is closed, or rolled back if it is
+// closed because of an exception).
 std::shared_ptr<ImageT> open_tile_img(const std::string & url, const Opt & opts);
 
 #endif
@@ -1,4 +1,7 @@
 #include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <exception> // uncaught_exception
 #include "image_t_mbtiles.h"
 #include "geo_tiles/geo_tiles.h"
 #include "geom/poly_tools.h"
@@ -6,8 +9,21 @@
 #include "image/io.h"
 #include "image/io_png.h"
 
-ImageMBTiles::ImageMBTiles(const std::string & file, bool readonly, int db_sync):
-       readonly(readonly), ImageT(file, true, 256, 0, 16){
+// Tile id for deduplicated storage: 64-bit FNV-1a hash of the data.
+static std::string
+tile_hash(const std::string & data){
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (unsigned char c: data) { h ^= c; h *= 0x100000001b3ULL; }
+  std::ostringstream ss;
+  ss << std::hex << std::setfill('0') << std::setw(16) << h;
+  return ss.str();
+}
+
+ImageMBTiles::ImageMBTiles(const std::string & file, bool readonly,
+                           int db_sync, bool wal, bool dedup):
+       ImageT(file, true, 256, 0, 16), readonly(readonly), dedup(dedup),
+       batch(0), batch_max_tiles(0), batch_max_bytes(0),
+       batch_tiles(0), batch_bytes(0), pool(false), pool_flags(0) {
 
   int flags = readonly? SQLITE_OPEN_READONLY :
                         SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
@@ -27,12 +43,37 @@ ImageMBTiles::ImageMBTiles(const std::string & file, bool readonly, int db_sync)
   }
   db = std::shared_ptr<sqlite3>(pdb, sqlite3_close);
 
+  // set journal mode (it should be done before any transaction)
+  if (wal && !readonly){
+    auto stmt = sql_prepare("PRAGMA journal_mode = WAL");
+    int res = sqlite3_step(stmt.get());
+    if (res!=SQLITE_ROW && res!=SQLITE_DONE) throw Err()
+      << "can't set journal mode: " << sqlite3_errstr(res);
+  }
+
   if (newdb){
     // create MBTILES database (according with spec version 1.3)
-    sql_cmd_simple("CREATE TABLE tiles (tile_column int, tile_row int,"
-                   "  zoom_level int, tile_data blob,"
-                   "  PRIMARY KEY (tile_column, tile_row, zoom_level))");
-    sql_cmd_simple("CREATE UNIQUE INDEX tile_index on tiles (zoom_level, tile_column, tile_row)");
+    if (dedup){
+      // deduplicated storage: tile images are stored in `images` table,
+      // `map` table contains tile_id for each tile.
+      sql_cmd_simple("CREATE TABLE map (zoom_level int, tile_column int,"
+                     "  tile_row int, tile_id text)");
+      sql_cmd_simple("CREATE UNIQUE INDEX map_index on map (zoom_level, tile_column, tile_row)");
+      sql_cmd_simple("CREATE TABLE images (tile_data blob, tile_id text)");
+      sql_cmd_simple("CREATE UNIQUE INDEX images_id on images (tile_id)");
+      sql_cmd_simple("CREATE VIEW tiles AS SELECT"
+                     "  map.zoom_level AS zoom_level,"
+                     "  map.tile_column AS tile_column,"
+                     "  map.tile_row AS tile_row,"
+                     "  images.tile_data AS tile_data"
+                     "  FROM map JOIN images ON images.tile_id = map.tile_id");
+    }
+    else {
+      sql_cmd_simple("CREATE TABLE tiles (tile_column int, tile_row int,"
+                     "  zoom_level int, tile_data blob,"
+                     "  PRIMARY KEY (tile_column, tile_row, zoom_level))");
+      sql_cmd_simple("CREATE UNIQUE INDEX tile_index on tiles (zoom_level, tile_column, tile_row)");
+    }
     sql_cmd_simple("CREATE TABLE metadata (name text, value text)");
 
     //sql_cmd_simple("PRAGMA journal_mode = OFF");
@@ -54,6 +95,14 @@ ImageMBTiles::ImageMBTiles(const std::string & file, bool readonly, int db_sync)
     sql_cmd_simple("INSERT INTO metadata (name, value) VALUES ('type', 'overlay')"); // overlay or baselayer
     sql_cmd_simple("INSERT INTO metadata (name, value) VALUES ('version', '0')");
   }
+  else {
+    // detect deduplicated storage
+    auto stmt = sql_prepare("SELECT COUNT(1) FROM sqlite_master WHERE"
+                            " type='table' AND name IN ('map', 'images')");
+    if (sqlite3_step(stmt.get())!=SQLITE_ROW) throw Err()
+      << "can't read database schema: " << file;
+    this->dedup = sqlite3_column_int(stmt.get(), 0) == 2;
+  }
 
   // set sync mode (0,1,2,3)
   {
@@ -70,34 +119,64 @@ ImageMBTiles::ImageMBTiles(const std::string & file, bool readonly, int db_sync)
   stmt_meta_del = sql_prepare("DELETE FROM metadata WHERE name = ?");
   stmt_meta_ins = sql_prepare("INSERT INTO metadata (name, value) VALUES (?,?)");
 
-  stmt_tile_sel = sql_prepare("SELECT tile_data FROM tiles "
-                              "WHERE tile_column=? AND tile_row=? AND zoom_level=?");
+  // In deduplicated databases tile data is read from `tiles` view,
+  // everything else is done with `map` table.
+  std::string tt = this->dedup ? "map" : "tiles";
 
-  stmt_tile_ex = sql_prepare("SELECT 1 FROM tiles "
-                              "WHERE tile_column=? AND tile_row=? AND zoom_level=?");
+  rconn.db = db;
+  prepare_read(rconn);
 
-  stmt_tile_del = sql_prepare("DELETE FROM tiles "
-                              "WHERE tile_column=? AND tile_row=? AND zoom_level=?");
+  stmt_tile_del = sql_prepare(("DELETE FROM " + tt +
+                              " WHERE tile_column=? AND tile_row=? AND zoom_level=?").c_str());
 
-  stmt_tile_ins = sql_prepare("INSERT INTO tiles "
+  stmt_tile_ins = sql_prepare(this->dedup ?
+                              "INSERT INTO map "
+                              "(tile_column, tile_row, zoom_level, tile_id) "
+                              "VALUES (?,?,?,?)" :
+                              "INSERT INTO tiles "
                               "(tile_column, tile_row, zoom_level, tile_data) "
                               "VALUES (?,?,?,?)");
 
-  stmt_tile_lst = sql_prepare("SELECT tile_column, tile_row, zoom_level FROM tiles "
-                              "WHERE zoom_level=?");
+  stmt_tile_lst = sql_prepare(("SELECT tile_column, tile_row, zoom_level FROM " + tt +
+                              " WHERE zoom_level=?").c_str());
+
+  stmt_ntile  = sql_prepare(("SELECT COUNT(1) FROM " + tt).c_str());
+  stmt_ntilez = sql_prepare(("SELECT COUNT(1) FROM " + tt + " WHERE zoom_level=?").c_str());
 
-  stmt_ntile  = sql_prepare("SELECT COUNT(1) FROM tiles");
-  stmt_ntilez = sql_prepare("SELECT COUNT(1) FROM tiles WHERE zoom_level=?");
+  stmt_minz = sql_prepare(("SELECT MIN(zoom_level) FROM " + tt).c_str());
+  stmt_maxz = sql_prepare(("SELECT MAX(zoom_level) FROM " + tt).c_str());
 
-  stmt_minz = sql_prepare("SELECT MIN(zoom_level) FROM tiles");
-  stmt_maxz = sql_prepare("SELECT MAX(zoom_level) FROM tiles");
+  stmt_x1 = sql_prepare(("SELECT MIN(tile_column) FROM " + tt + " WHERE zoom_level=?").c_str());
+  stmt_x2 = sql_prepare(("SELECT MAX(tile_column) FROM " + tt + " WHERE zoom_level=?").c_str());
+  stmt_y1 = sql_prepare(("SELECT MIN(tile_row) FROM " + tt + " WHERE zoom_level=?").c_str());
+  stmt_y2 = sql_prepare(("SELECT MAX(tile_row) FROM " + tt + " WHERE zoom_level=?").c_str());
 
-  stmt_x1 = sql_prepare("SELECT MIN(tile_column) FROM tiles WHERE zoom_level=?");
-  stmt_x2 = sql_prepare("SELECT MAX(tile_column) FROM tiles WHERE zoom_level=?");
-  stmt_y1 = sql_prepare("SELECT MIN(tile_row) FROM tiles WHERE zoom_level=?");
-  stmt_y2 = sql_prepare("SELECT MAX(tile_row) FROM tiles WHERE zoom_level=?");
+  stmt_delz = sql_prepare(("DELETE FROM " + tt + " WHERE zoom_level=?").c_str());
+
+  if (this->dedup){
+    stmt_img_sel = sql_prepare("SELECT tile_data FROM images WHERE tile_id=?");
+    stmt_img_ins = sql_prepare("INSERT INTO images (tile_id, tile_data) VALUES (?,?)");
+  }
 
-  stmt_delz = sql_prepare("DELETE FROM tiles WHERE zoom_level=?");
+  stmt_begin  = sql_prepare("BEGIN");
+  stmt_commit = sql_prepare("COMMIT");
+}
+
+ImageMBTiles::~ImageMBTiles(){
+  if (batch==0) return;
+  try {
+    // The object is destroyed because of an exception:
+    // do not write a half-finished batch.
+    if (std::uncaught_exception()){
+      sql_cmd_simple("ROLLBACK");
+      return;
+    }
+    sqlite3_reset(stmt_commit.get());
+    sql_run_simple(stmt_commit.get());
+  }
+  catch (Err & e) {
+    std::cerr << "ImageMBTiles: " << e.str() << "\n";
+  }
 }
 
 std::string
@@ -140,27 +219,84 @@ ImageMBTiles::tile_write(const iPoint & key, const ImageR & img){
     image_save_png(img, str, opts);
     data = str.str(); // save data
   }
-  if (tile_exists(key)){
-    auto stmt = stmt_tile_del.get();
-    sqlite3_reset(stmt);
-    sql_bind_int(stmt, 1, key.x);
-    sql_bind_int(stmt, 2, key.y);
-    sql_bind_int(stmt, 3, key.z);
-    sql_run_simple(stmt);
+
+  // Deduplicated storage: find image with same data or add a new one.
+  // In case of hash collision a suffix is added to the tile_id.
+  std::string id;
+  if (dedup){
+    std::string h = tile_hash(data);
+    id = h;
+    for (int n = 1; ; n++){
+      auto sel = stmt_img_sel.get();
+      sqlite3_reset(sel);
+      sql_bind_str(sel, 1, id);
+      if (sqlite3_step(sel)!=SQLITE_ROW){
+        auto ins = stmt_img_ins.get();
+        sqlite3_reset(ins);
+        sql_bind_str(ins, 1, id);
+        sql_bind_blob(ins, 2, data);
+        sql_run_simple(ins);
+        break;
+      }
+      if (data.compare(0, data.npos, (const char *)sqlite3_column_blob(sel, 0),
+                       sqlite3_column_bytes(sel, 0)) == 0) break;
+      id = h + "." + type_to_str(n);
+    }
+    sqlite3_reset(stmt_img_sel.get());
   }
-  auto stmt = stmt_tile_ins.get();
+
+  // Remove old tile. Do not rely on the unique index
+  // (it may be missing in databases created by other programs).
+  auto stmt = stmt_tile_del.get();
+  sqlite3_reset(stmt);
+  sql_bind_int(stmt, 1, key.x);
+  sql_bind_int(stmt, 2, key.y);
+  sql_bind_int(stmt, 3, key.z);
+  sql_run_simple(stmt);
+
+  stmt = stmt_tile_ins.get();
   sqlite3_reset(stmt);
   sql_bind_int(stmt, 1, key.x);
   sql_bind_int(stmt, 2, key.y);
   sql_bind_int(stmt, 3, key.z);
-  sql_bind_blob(stmt, 4, data);
+  if (dedup) sql_bind_str(stmt, 4, id);
+  else sql_bind_blob(stmt, 4, data);
   sql_run_simple(stmt);
+
+  // start a new transaction if batch is too large
+  if (batch>0){
+    batch_tiles++;
+    batch_bytes += data.size();
+    if (batch_tiles >= batch_max_tiles || batch_bytes >= batch_max_bytes){
+      sqlite3_reset(stmt_commit.get());
+      sql_run_simple(stmt_commit.get());
+      sqlite3_reset(stmt_begin.get());
+      sql_run_simple(stmt_begin.get());
+      batch_tiles = batch_bytes = 0;
+    }
+  }
+}
+
+// load image from a blob column
+static ImageR
+load_blob(sqlite3_stmt *stmt, const int col){
+
+  // wrong data type
+  if (sqlite3_column_type(stmt, col) != SQLITE_BLOB)
+    throw Err() << "blob data expected: " << sqlite3_expanded_sql(stmt);
+
+  // obtain data
+  std::string data((const char *)sqlite3_column_blob(stmt, col),
+                                 sqlite3_column_bytes(stmt, col));
+
+  std::istringstream str(data);
+  return image_load(str);
 }
 
 ImageR
 ImageMBTiles::tile_read(const iPoint & key) const {
 
-  auto stmt = stmt_tile_sel.get();
+  auto stmt = read_conn().tile_sel.get();
   sqlite3_reset(stmt);
 
   sql_bind_int(stmt, 1, key.x);
@@ -170,22 +306,60 @@ ImageMBTiles::tile_read(const iPoint & key) const {
   // no data - return empty image
   if (sqlite3_step(stmt)!=SQLITE_ROW) return ImageR();
 
-  // wrong data type
-  if (sqlite3_column_type(stmt, 0) != SQLITE_BLOB)
-    throw Err() << "blob data expected: " << sqlite3_expanded_sql(stmt);
+  return load_blob(stmt, 0);
+}
 
-  // obtain data
-  std::string data((const char *)sqlite3_column_blob(stmt, 0),
-                                 sqlite3_column_bytes(stmt, 0));
+std::vector<ImageR>
+ImageMBTiles::tile_read_many(const std::vector<iPoint> & keys) const {
+  std::vector<ImageR> ret(keys.size());
+  const ReadConn & c = read_conn();
+
+  // key -> indices in the key vector, grouped by zoom level
+  std::map<int, std::map<iPoint, std::vector<size_t> > > idx;
+  for (size_t i=0; i<keys.size(); i++) idx[keys[i].z][keys[i]].push_back(i);
+
+  for (auto const & zi: idx){
+    auto const & ki = zi.second;
+    iRect r;
+    for (auto const & k: ki) r.expand(iPoint(k.first.x, k.first.y));
+
+    // sparse tiles: read them one by one
+    if ((r.w+1.0)*(r.h+1.0) > 4.0*ki.size() + 16){
+      for (auto const & k: ki){
+        ImageR img = tile_read(k.first);
+        for (auto i: k.second) ret[i] = img;
+      }
+      continue;
+    }
 
-  std::istringstream str(data);
-  return image_load(str);
+    // range query
+    auto stmt = c.tile_rng.get();
+    sqlite3_reset(stmt);
+    sql_bind_int(stmt, 1, zi.first);
+    sql_bind_int(stmt, 2, r.x);
+    sql_bind_int(stmt, 3, r.x+r.w);
+    sql_bind_int(stmt, 4, r.y);
+    sql_bind_int(stmt, 5, r.y+r.h);
+    while (1){
+      int res = sqlite3_step(stmt);
+      if (res==SQLITE_DONE) break;
+      if (res!=SQLITE_ROW)
+        throw Err() << "can't read tiles: " << sqlite3_errstr(res);
+      iPoint k(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1), zi.first);
+      auto i = ki.find(k);
+      if (i==ki.end()) continue;
+      ImageR img = load_blob(stmt, 2);
+      for (auto j: i->second) ret[j] = img;
+    }
+    sqlite3_reset(stmt);
+  }
+  return ret;
 }
 
 bool
 ImageMBTiles::tile_exists(const iPoint & key) const {
 
-  auto stmt = stmt_tile_ex.get();
+  auto stmt = read_conn().tile_ex.get();
   sqlite3_reset(stmt);
   sql_bind_int(stmt, 1, key.x);
   sql_bind_int(stmt, 2, key.y);
@@ -375,18 +549,103 @@ ImageMBTiles::crop(const dMultiLine & brd) {
 
 void
 ImageMBTiles::vacuum() {
+  if (batch>0) throw Err() << "can't vacuum database during batch writing";
+  if (dedup) sql_cmd_simple(
+    "DELETE FROM images WHERE tile_id NOT IN (SELECT tile_id FROM map)");
+
+  // VACUUM fails if there are unfinished statements
+  for (auto st: {stmt_meta_sel, rconn.tile_sel, rconn.tile_ex, rconn.tile_rng, stmt_tile_lst,
+                 stmt_ntile, stmt_ntilez, stmt_minz, stmt_maxz,
+                 stmt_x1, stmt_x2, stmt_y1, stmt_y2, stmt_img_sel})
+    if (st) sqlite3_reset(st.get());
+
   auto stmt = sql_prepare("VACUUM");
   sql_run_simple(stmt.get());
 }
 
+void
+ImageMBTiles::begin_batch(const size_t max_tiles, const size_t max_bytes) {
+  if (readonly) throw Err() << "can't write to read-only database";
+  if (batch++ > 0) return;
+  batch_max_tiles = max_tiles;
+  batch_max_bytes = max_bytes;
+  batch_tiles = batch_bytes = 0;
+  sqlite3_reset(stmt_begin.get());
+  sql_run_simple(stmt_begin.get());
+}
+
+void
+ImageMBTiles::commit_batch() {
+  if (batch==0) throw Err() << "can't commit: no batch writing";
+  if (--batch > 0) return;
+  sqlite3_reset(stmt_commit.get());
+  sql_run_simple(stmt_commit.get());
+}
+
+void
+ImageMBTiles::use_read_pool(const bool shared_cache) {
+  if (!readonly) throw Err() << "read pool is available only for read-only databases";
+  std::lock_guard<std::mutex> lk(pool_mutex);
+  pool = true;
+  pool_flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX |
+    (shared_cache ? SQLITE_OPEN_SHAREDCACHE : SQLITE_OPEN_PRIVATECACHE);
+}
+
 /**********************************************************/
 // Private functions
 
+void
+ImageMBTiles::prepare_read(ReadConn & c) const {
+  // In deduplicated databases tile data is read from `tiles` view
+  c.tile_sel = sql_prepare("SELECT tile_data FROM tiles "
+                           "WHERE tile_column=? AND tile_row=? AND zoom_level=?",
+                           c.db.get());
+
+  c.tile_ex = sql_prepare(dedup ?
+                          "SELECT 1 FROM map "
+                          "WHERE tile_column=? AND tile_row=? AND zoom_level=?" :
+                          "SELECT 1 FROM tiles "
+                          "WHERE tile_column=? AND tile_row=? AND zoom_level=?",
+                          c.db.get());
+
+  // tiles in a range, in the order of data storage
+  c.tile_rng = sql_prepare(dedup ?
+    "SELECT map.tile_column, map.tile_row, images.tile_data "
+    "FROM map JOIN images ON images.tile_id = map.tile_id "
+    "WHERE map.zoom_level=? AND map.tile_column BETWEEN ? AND ? "
+    "AND map.tile_row BETWEEN ? AND ? ORDER BY images.rowid" :
+    "SELECT tile_column, tile_row, tile_data FROM tiles "
+    "WHERE zoom_level=? AND tile_column BETWEEN ? AND ? "
+    "AND tile_row BETWEEN ? AND ? ORDER BY rowid",
+    c.db.get());
+}
+
+const ImageMBTiles::ReadConn &
+ImageMBTiles::read_conn() const {
+  if (!pool) return rconn;
+
+  std::lock_guard<std::mutex> lk(pool_mutex);
+  auto i = pool_conn.find(std::this_thread::get_id());
+  if (i!=pool_conn.end()) return i->second;
+
+  ReadConn c;
+  sqlite3 *pdb;
+  int res = sqlite3_open_v2(tmpl.c_str(), &pdb, pool_flags, NULL);
+  if (res != SQLITE_OK){
+    sqlite3_close(pdb);
+    throw Err() << "can't open sqlite database: "
+                << tmpl << ": " << sqlite3_errstr(res);
+  }
+  c.db = std::shared_ptr<sqlite3>(pdb, sqlite3_close);
+  prepare_read(c);
+  return pool_conn[std::this_thread::get_id()] = c;
+}
+
 std::shared_ptr<sqlite3_stmt>
-ImageMBTiles::sql_prepare(const char * cmd) const{
+ImageMBTiles::sql_prepare(const char * cmd, sqlite3 * pdb) const{
   sqlite3_stmt *stmt;
   // cmd memory should be managed in the program!
-  int res = sqlite3_prepare(db.get(), cmd, -1, &stmt, 0);
+  int res = sqlite3_prepare_v2(pdb? pdb : db.get(), cmd, -1, &stmt, 0);
   if (res!=SQLITE_OK) throw Err()
   << "can't prepare sql command: " << cmd << ": " << sqlite3_errstr(res);
   return std::shared_ptr<sqlite3_stmt>(stmt, sqlite3_finalize);
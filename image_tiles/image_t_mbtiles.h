@@ -3,6 +3,9 @@
 
 #include <sqlite3.h>
 #include <sstream>
+#include <map>
+#include <mutex>
+#include <thread>
 #include "opt/opt.h"
 #include "geom/rect.h"
 #include "geom/multiline.h"
@@ -10,28 +13,73 @@
 #include "image_t.h"
 
 // Tiled images in MBTILES databases.
+//
+// Two database layouts are supported: a simple `tiles` table, and
+// deduplicated storage with `map` and `images` tables and `tiles` view
+// (same tile images are stored only once). Layout is detected when
+// opening an existing database.
+//
+// Writing can be done in batches (see begin_batch/commit_batch), many
+// tiles are written in a single transaction.
+//
+// The object is not thread-safe, but read-only databases can be read
+// in many threads using tile_read, tile_exists and tile_read_many
+// methods in the connection pool mode (see use_read_pool).
 
 class ImageMBTiles: public ImageT {
   std::shared_ptr<sqlite3> db;
   Opt opts;
   bool readonly;
+  bool dedup;
+
+  // batch writing: nesting level, tile/byte thresholds and counters
+  int batch;
+  size_t batch_max_tiles, batch_max_bytes;
+  size_t batch_tiles, batch_bytes;
+
+  // Connection and statements for reading tiles.
+  struct ReadConn {
+    std::shared_ptr<sqlite3> db;
+    std::shared_ptr<sqlite3_stmt>
+      tile_sel, tile_ex, // get tile data, does tile exist?
+      tile_rng; // get tiles in a range (column, row, data)
+  };
+  ReadConn rconn; // main connection
+
+  // connection pool: one connection for each thread
+  bool pool;
+  int pool_flags;
+  mutable std::mutex pool_mutex;
+  mutable std::map<std::thread::id, ReadConn> pool_conn;
 
   // precompiled commands
   std::shared_ptr<sqlite3_stmt>
     stmt_meta_sel, stmt_meta_del, stmt_meta_ins, // get, delete, insert metadata field
-    stmt_tile_sel, stmt_tile_del, stmt_tile_ins, // get, delete, insert tile data
-    stmt_tile_ex, stmt_tile_lst, // does tile exist?, list tiles
+    stmt_tile_del, stmt_tile_ins, // delete, insert tile data
+    stmt_tile_lst, // list tiles
     stmt_ntile, stmt_ntilez, // get number of tiles (total/at given z)
     stmt_minz, stmt_maxz,    // get min/max zoom level
     stmt_x1, stmt_x2, stmt_y1, stmt_y2, // x and y tile bounds at some zoom level
-    stmt_delz; // delete layer
+    stmt_delz, // delete layer
+    stmt_img_sel, stmt_img_ins, // get/insert image data (dedup mode)
+    stmt_begin, stmt_commit; // begin/commit transaction
 
   public:
 
     // Open database
     // - If readonly=0 and file does not exist then create it.
     // - Sync is database sync mode: 0-OFF, 1-NORMAL, 2-FULL, 3-EXTRA.
-    ImageMBTiles(const std::string & file, bool readonly, int db_sync = 0);
+    // - If wal=1 then write-ahead log journal mode is used
+    //   (stored in the database file).
+    // - If dedup=1 and a new database is created, then
+    //   use deduplicated storage.
+    ImageMBTiles(const std::string & file, bool readonly, int db_sync = 0,
+                 bool wal = false, bool dedup = false);
+
+    // Commit unfinished batch. If the object is destroyed during
+    // exception handling, the batch is rolled back (transactions
+    // committed before, when batch thresholds were reached, are kept).
+    ~ImageMBTiles();
 
     /*******************************************************/
     // ImageT interface
@@ -42,6 +90,11 @@ class ImageMBTiles: public ImageT {
     // get a tile (without using cache)
     ImageR tile_read(const iPoint & key) const override;
 
+    // get a few tiles (without using cache). Tiles are read
+    // with range queries (one for each zoom level if tiles are dense),
+    // in the database order.
+    std::vector<ImageR> tile_read_many(const std::vector<iPoint> & keys) const override;
+
     // check if tile exists
     bool tile_exists(const iPoint & key) const override;
 
@@ -93,11 +146,48 @@ class ImageMBTiles: public ImageT {
     void crop(const dMultiLine & brd);
 
     // remove all empty space from database (useful after crop())
+    // In deduplicated databases unused images are also removed.
     void vacuum();
 
+    // Does the database use deduplicated storage?
+    bool is_dedup() const {return dedup;}
+
+    /*******************************************************/
+    // Batch writing
+
+    // Start writing in batches: tiles are written in a transaction
+    // which is committed when max_tiles tiles or max_bytes bytes of
+    // data are written (then a new transaction is started).
+    // Calls can be nested, thresholds of the outer call are used.
+    void begin_batch(const size_t max_tiles = 1000,
+                     const size_t max_bytes = 64<<20);
+
+    // Finish batch writing (commit data).
+    // For nested calls only the outermost call commits data.
+    void commit_batch();
+
+    // Is batch writing active?
+    bool in_batch() const {return batch>0;}
+
+    /*******************************************************/
+    // Connection pool
+
+    // Use a separate read-only database connection for each thread
+    // which calls tile_read, tile_exists or tile_read_many (connections
+    // are opened when needed and closed with the object). Other methods
+    // still use the main connection and should not be called in parallel.
+    // Only for read-only databases.
+    void use_read_pool(const bool shared_cache = false);
+
   private:
 
-    std::shared_ptr<sqlite3_stmt> sql_prepare(const char * cmd) const;
+    std::shared_ptr<sqlite3_stmt> sql_prepare(const char * cmd, sqlite3 * pdb = NULL) const;
+
+    // prepare read statements for a connection
+    void prepare_read(ReadConn & c) const;
+
+    // get connection for reading tiles (main one or one from the pool)
+    const ReadConn & read_conn() const;
     void sql_bind_str(sqlite3_stmt *stmt, const int n, const std::string & str) const;
     void sql_bind_blob(sqlite3_stmt *stmt, const int n, const std::string & str) const;
     void sql_bind_int(sqlite3_stmt *stmt, const int n, const int v) const;
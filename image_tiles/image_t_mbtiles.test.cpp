@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <unistd.h>
+#include <thread>
 #include "image_t_mbtiles.h"
 #include "err/assert_err.h"
 
@@ -124,9 +125,114 @@ main(){
       assert_eq(db.tile_number(9),  0);
     }
 
+    // deduplicated storage, batch writing
+    {
+      unlink("db_test_new.mbtiles");
+      {
+        ImageMBTiles db("db_test_new.mbtiles", 0, 0, true, true);
+        assert_eq(db.is_dedup(), true);
+        assert_err(db.commit_batch(), "can't commit: no batch writing");
+        assert_err(db.use_read_pool(), "read pool is available only for read-only databases");
+
+        ImageR img1(256,256, IMAGE_32ARGB), img2(256,256, IMAGE_32ARGB);
+        img1.fill32(0xFF0000FF);
+        img2.fill32(0xFF00FF00);
+
+        db.begin_batch(3);
+        db.begin_batch(); // nested call
+        assert_eq(db.in_batch(), true);
+        for (int x=0; x<10; x++) db.tile_write(iPoint(x,0,4), x%3? img1:img2);
+        db.tile_write(iPoint(0,0,4), img1); // replace a tile
+        assert_err(db.vacuum(), "can't vacuum database during batch writing");
+        db.commit_batch();
+        assert_eq(db.in_batch(), true);
+        db.commit_batch();
+        assert_eq(db.in_batch(), false);
+
+        assert_eq(db.tile_number(), 10);
+        assert_eq(db.tile_bounds(4), iRect(0,0,10,1));
+        assert_eq(db.tile_read(iPoint(0,0,4)).get32(10,10), 0xFF0000FF);
+        assert_eq(db.tile_read(iPoint(3,0,4)).get32(10,10), 0xFF00FF00);
+        assert_eq(db.tile_read(iPoint(4,0,4)).get32(10,10), 0xFF0000FF);
+
+        db.tile_delete(iPoint(3,0,4));
+        assert_eq(db.tile_exists(iPoint(3,0,4)), false);
+        assert_eq(db.tile_number(4), 9);
+        db.vacuum();
+
+        // unfinished batch is committed in the destructor
+        db.begin_batch();
+        db.tile_write(iPoint(0,0,5), img2);
+      }
+      // ... but rolled back if the database is closed because of an error
+      try {
+        ImageMBTiles db("db_test_new.mbtiles", 0);
+        ImageR img3(256,256, IMAGE_32ARGB);
+        img3.fill32(0xFFFF0000);
+        db.begin_batch();
+        db.tile_write(iPoint(1,0,5), img3);
+        db.tile_write(iPoint(0,0,5), img3);
+        throw Err() << "test error";
+      }
+      catch (Err & e) {
+        assert_eq(e.str(), "test error");
+      }
+      {
+        ImageMBTiles db("db_test_new.mbtiles", 1);
+        assert_eq(db.is_dedup(), true);
+        assert_eq(db.tile_number(), 10);
+        assert_eq(db.tile_read(iPoint(0,0,5)).get32(10,10), 0xFF00FF00);
+        assert_eq(db.tile_exists(iPoint(1,0,5)), false);
+        assert_eq(db.tile_read(iPoint(6,0,4)).get32(10,10), 0xFF00FF00);
+        assert_err(db.begin_batch(), "can't write to read-only database");
+
+        // read many tiles: dense and sparse, missing and repeated tiles
+        std::vector<iPoint> keys;
+        for (int x=9; x>=0; x--) keys.emplace_back(x,0,4);
+        keys.emplace_back(0,0,5);
+        keys.emplace_back(9,0,4);
+        auto imgs = db.tile_read_many(keys);
+        assert_eq(imgs.size(), keys.size());
+        for (size_t i=0; i<keys.size(); i++){
+          auto img = db.tile_read(keys[i]);
+          assert_eq(imgs[i].is_empty(), img.is_empty());
+          if (!img.is_empty()) assert_eq(imgs[i].get32(1,1), img.get32(1,1));
+        }
+        assert_eq(imgs[6].is_empty(), true); // (3,0,4) was deleted
+
+        keys.emplace_back(1000,1000,4);
+        auto imgs1 = db.tile_read_many(keys);
+        assert_eq(imgs1.size(), keys.size());
+        assert_eq(imgs1[0].get32(1,1), imgs[0].get32(1,1));
+        assert_eq(imgs1[6].is_empty(), true);
+        assert_eq(imgs1[12].is_empty(), true);
+
+        // read in a few threads
+        db.use_read_pool();
+        std::vector<std::thread> threads;
+        std::vector<int> cnt(4, 0);
+        for (int t=0; t<4; t++){
+          threads.emplace_back([&,t](){
+            for (int n=0; n<20; n++){
+              auto const & k = keys[n%keys.size()];
+              auto img = db.tile_read(k);
+              if (db.tile_exists(k) != !img.is_empty()) return;
+              if (!img.is_empty() && img.get32(1,1) != imgs1[n%keys.size()].get32(1,1)) return;
+              if (db.tile_read_many(keys).size() != keys.size()) return;
+              cnt[t]++;
+            }
+          });
+        }
+        for (auto & t: threads) t.join();
+        for (int t=0; t<4; t++) assert_eq(cnt[t], 20);
+      }
+    }
+
     // try to open non-existing database read-only
     {
       unlink("db_test_new.mbtiles");
+      unlink("db_test_new.mbtiles-wal");
+      unlink("db_test_new.mbtiles-shm");
       assert_err(ImageMBTiles db("db_test_new.mbtiles", 1),
         "can't open sqlite database: db_test_new.mbtiles: file does not exists");
     }
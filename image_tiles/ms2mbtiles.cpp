@@ -15,12 +15,19 @@ public:
     Action("rescale", "Fill leyers zmax .. zmin using data from zmax+1") {
     ms2opt_add_std(options, {"VERB"});
     ms2opt_add_image(options);
+    const char *g = "RESCALE";
+    options.add("tmap_threads", 1,0,g,
+      "Number of threads. Default: 1.");
+    options.add("tmap_filter", 1,0,g,
+      "Scaling filter: box, lanczos. Default: box.");
+    options.add("db_batch", 1,0,g,
+      "Number of tiles written in one transaction. Default: 1000.");
   }
 
   void help_impl(HelpPrinter & pr) override {
     pr.usage("[<options>] <file> <zmin> <zmax>");
     pr.head(2, "Options:");
-    pr.opts({"VERB", "IMG"});
+    pr.opts({"VERB", "IMG", "RESCALE"});
   }
 
   virtual void run_impl(const std::vector<std::string> & args,
@@ -35,19 +42,18 @@ public:
     ImageMBTiles timg(file, 0);
     timg.set_opt(opts);
 
-    // Get tile bounds for zsrc
+    timg.begin_batch(opts.get("db_batch", 1000));
     for (int z = zmax; z>=zmin; z--){
       if (v) std::cout << "delete layer " << z << "\n";
       timg.layer_del(z);
-      iRect trng = ceil((dRect)timg.tile_bounds(z+1)/2.0);
-      if (v) std::cout << "rescale layer" << z << ": " << trng << "\n";
-      for (int x = trng.x; x<=trng.x+trng.w; x++){
-        for (int y = trng.y; y<=trng.y+trng.h; y++){
-          //if (v) std::cout << "  rescale" << iPoint(x,y,z) << "\n";
-          timg.tile_rescale(iPoint(x,y,z));
-        }
-      }
     }
+
+    // Get tile bounds for zmax+1, build all levels
+    iRect trng = timg.tile_bounds(zmax+1);
+    if (v) std::cout << "rescale layers " << zmin << ".." << zmax
+                     << " from " << trng << "\n";
+    timg.tile_pyramid(trng, zmin, zmax, opts);
+    timg.commit_batch();
   }
 };
 
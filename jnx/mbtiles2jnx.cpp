@@ -127,11 +127,18 @@ std::cerr << "r: " << r.tlc() << " - " << r.brc()  << "\n";
     s.seekp(0, s.end);
     size_t tile_offs = tile_info_offs;
     GeoTiles tcalc;
+    const size_t nread = 256; // number of tiles to be read at once
     for (const auto z:zlevels){
-      for (const auto tkey: mbtiles.tile_list(z)){
+      auto tkeys = mbtiles.tile_list(z);
+      std::vector<ImageR> timgs;
+      for (size_t i=0; i<tkeys.size(); i++){
+        if (i%nread == 0)
+          timgs = mbtiles.tile_read_many(std::vector<iPoint>(tkeys.begin()+i,
+                    tkeys.begin() + std::min(i+nread, tkeys.size())));
+        const auto & tkey = tkeys[i];
         dRect r = tcalc.tile_to_range(tkey, z);
         std::ostringstream s1;
-        image_save_jpeg(mbtiles.tile_read(tkey), s1, O);
+        image_save_jpeg(timgs[i%nread], s1, O);
         auto data = s1.str().substr(2, s1.str().size()-4);
 
         jnx_tile_info_t info;
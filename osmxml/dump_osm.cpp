@@ -1,6 +1,6 @@
 ///\cond HIDDEN (do not show this in Doxyden)
 
-#include "osmxml.h"
+#include "osmpbf.h"
 
 int
 main(int argc, char* argv[]){
@@ -15,7 +15,7 @@ main(int argc, char* argv[]){
 
     for (int i=1; i<argc; i++){
       std::cerr << "Reading " << argv[i] << "\n";
-      read_osmxml(argv[i], osm);
+      read_osm(argv[i], osm);
     }
 
     std::cout << "nodes, id -> coords:\n";
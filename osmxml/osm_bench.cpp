@@ -0,0 +1,72 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+// Reading speed of OSM files (XML or PBF).
+// Objects are counted, nothing is stored.
+//
+// usage: osm_bench <file> ... [--threads <N>]
+
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <sys/stat.h>
+#include "osmpbf.h"
+
+typedef std::chrono::steady_clock clk;
+
+struct OSMCounter: public OSMHandler {
+  size_t nodes, ways, rels, tags;
+  OSMCounter(): nodes(0), ways(0), rels(0), tags(0) {}
+  void on_node(const osm_id_t id, const dPoint & pt, const Opt & t) override {
+    nodes++; tags+=t.size();}
+  void on_way(const osm_id_t id, const OSMXML::OSM_Way & way) override {
+    ways++; tags+=way.size();}
+  void on_rel(const osm_id_t id, const OSMXML::OSM_Rel & rel) override {
+    rels++; tags+=rel.size();}
+};
+
+int
+main(int argc, char** argv){
+  try{
+    Opt opts;
+    std::vector<std::string> files;
+    for (int i=1; i<argc; i++){
+      if (strcmp(argv[i], "--threads")==0 && i+1<argc)
+        opts.put("osm_threads", argv[++i]);
+      else files.push_back(argv[i]);
+    }
+    if (files.size()==0) {
+      std::cerr << "usage: osm_bench <file> ... [--threads <N>]\n";
+      return 1;
+    }
+
+    for (auto const & f: files){
+      struct stat st;
+      if (stat(f.c_str(), &st)!=0) throw Err() << "can't stat file: " << f;
+
+      OSMCounter cnt;
+      auto t0 = clk::now();
+      read_osm(f, cnt, opts);
+      double dt = std::chrono::duration<double>(clk::now()-t0).count();
+      size_t nobj = cnt.nodes + cnt.ways + cnt.rels;
+
+      std::cout << f << ": "
+                << cnt.nodes << " nodes, "
+                << cnt.ways << " ways, "
+                << cnt.rels << " relations, "
+                << cnt.tags << " tags\n"
+                << std::fixed << std::setprecision(3)
+                << "  " << dt << " s, "
+                << std::setprecision(0) << nobj/dt << " objects/s, "
+                << std::setprecision(1) << st.st_size/dt/1024/1024 << " MB/s\n";
+    }
+  }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
@@ -0,0 +1,489 @@
+#include "osmpbf.h"
+#include <zlib.h>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+/********************************************************************/
+// Minimal protobuf reader: iterate through fields of a message.
+
+struct PBFMsg {
+  const uint8_t *p, *e;
+  uint32_t field; // field number
+  int wtype;      // wire type
+  uint64_t val;   // value for varint fields
+  const uint8_t *dp; size_t dlen; // data for length-delimited fields
+
+  PBFMsg(const uint8_t *p, const size_t n): p(p), e(p+n),
+    field(0), wtype(0), val(0), dp(NULL), dlen(0) {}
+  PBFMsg(const std::string & s): PBFMsg((const uint8_t *)s.data(), s.size()) {}
+
+  uint64_t varint(){
+    uint64_t ret = 0;
+    for (int sh=0; sh<64; sh+=7){
+      if (p>=e) throw Err() << "OSM PBF: unexpected end of data";
+      uint8_t c = *p++;
+      ret |= (uint64_t)(c & 0x7F) << sh;
+      if (!(c & 0x80)) return ret;
+    }
+    throw Err() << "OSM PBF: bad varint";
+  }
+
+  // read next field, return false at the end of message
+  bool next(){
+    if (p>=e) return false;
+    uint64_t key = varint();
+    field = key>>3;
+    wtype = key & 7;
+    switch (wtype){
+      case 0: val = varint(); break;
+      case 1: if (e-p<8) throw Err() << "OSM PBF: unexpected end of data";
+              p+=8; break;
+      case 2: dlen = varint();
+              if (dlen > (size_t)(e-p)) throw Err() << "OSM PBF: unexpected end of data";
+              dp = p; p+=dlen; break;
+      case 5: if (e-p<4) throw Err() << "OSM PBF: unexpected end of data";
+              p+=4; break;
+      default: throw Err() << "OSM PBF: unsupported wire type: " << wtype;
+    }
+    return true;
+  }
+
+  // signed value (zigzag encoding)
+  static int64_t sval(const uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+  int64_t sval() const { return sval(val); }
+
+  // length-delimited field as a message or a string
+  PBFMsg msg() const { return PBFMsg(dp, dlen); }
+  std::string str() const { return std::string((const char*)dp, dlen); }
+};
+
+// Read values of a packed repeated field
+// (or a single non-packed value).
+static void
+pbf_packed(const PBFMsg & m, std::vector<uint64_t> & ret){
+  ret.clear();
+  if (m.wtype == 0) { ret.push_back(m.val); return; }
+  if (m.wtype != 2) throw Err() << "OSM PBF: packed field expected";
+  PBFMsg d = m.msg();
+  while (d.p < d.e) ret.push_back(d.varint());
+}
+
+/********************************************************************/
+// Decoded data block
+
+struct PBFNode {
+  osm_id_t id;
+  dPoint pt;
+  Opt tags;
+};
+
+struct PBFBlock {
+  std::string type; // OSMHeader or OSMData
+  std::string blob; // input data
+  bool done;
+  std::exception_ptr err;
+
+  dRect bbox;
+  std::vector<PBFNode> nodes;
+  std::vector<std::pair<osm_id_t, OSMXML::OSM_Way> > ways;
+  std::vector<std::pair<osm_id_t, OSMXML::OSM_Rel> > rels;
+
+  PBFBlock(): done(false) {}
+
+  void decode();
+  void parse_header(const std::string & data);
+  void parse_data(const std::string & data);
+};
+
+void
+PBFBlock::decode(){
+  // Blob message
+  std::string data;
+  size_t raw_size = 0;
+  const uint8_t *zp = NULL; size_t zlen = 0;
+  PBFMsg b(blob);
+  while (b.next()){
+    switch (b.field){
+      case 1: data = b.str(); break; // raw
+      case 2: raw_size = b.val; break;
+      case 3: zp = b.dp; zlen = b.dlen; break; // zlib_data
+      case 4: throw Err() << "OSM PBF: lzma compression is not supported";
+      case 5: throw Err() << "OSM PBF: bzip2 compression is not supported";
+      case 6: throw Err() << "OSM PBF: lz4 compression is not supported";
+      case 7: throw Err() << "OSM PBF: zstd compression is not supported";
+    }
+  }
+
+  // raw_size can be written after the data
+  if (zp){
+    if (raw_size == 0 || raw_size > 32*1024*1024)
+      throw Err() << "OSM PBF: bad block size: " << raw_size;
+    data.resize(raw_size);
+    uLongf dlen = raw_size;
+    if (uncompress((Bytef*)&data[0], &dlen, zp, zlen)!=Z_OK || dlen!=raw_size)
+      throw Err() << "OSM PBF: zlib decompression error";
+  }
+
+  blob.clear();
+  blob.shrink_to_fit();
+
+  if (type == "OSMHeader") parse_header(data);
+  else if (type == "OSMData") parse_data(data);
+  // unknown blocks are skipped
+}
+
+void
+PBFBlock::parse_header(const std::string & data){
+  PBFMsg h(data);
+  while (h.next()){
+    if (h.field == 1) { // HeaderBBox, nanodegrees
+      int64_t c[4] = {0,0,0,0}; // left, right, top, bottom
+      PBFMsg bb = h.msg();
+      while (bb.next())
+        if (bb.field>=1 && bb.field<=4) c[bb.field-1] = bb.sval();
+      bbox = dRect(dPoint(c[0]*1e-9, c[3]*1e-9), dPoint(c[1]*1e-9, c[2]*1e-9));
+    }
+    if (h.field == 4) { // required features
+      auto f = h.str();
+      if (f!="OsmSchema-V0.6" && f!="DenseNodes")
+        throw Err() << "OSM PBF: unsupported feature: " << f;
+    }
+  }
+}
+
+void
+PBFBlock::parse_data(const std::string & data){
+  std::vector<std::string> st; // string table
+  std::vector<PBFMsg> groups;
+  int64_t gran = 100, lat_off = 0, lon_off = 0;
+
+  PBFMsg pb(data);
+  while (pb.next()){
+    switch (pb.field){
+      case 1: {
+        PBFMsg s = pb.msg();
+        while (s.next()) if (s.field == 1) st.push_back(s.str());
+        break;
+      }
+      case 2:  groups.push_back(pb.msg()); break;
+      case 17: gran = (int64_t)pb.val; break;
+      case 19: lat_off = (int64_t)pb.val; break;
+      case 20: lon_off = (int64_t)pb.val; break;
+    }
+  }
+
+  auto get_str = [&st](const uint64_t i) -> const std::string & {
+    if (i>=st.size()) throw Err() << "OSM PBF: bad string index: " << i;
+    return st[i];
+  };
+  auto get_pt = [&](const int64_t lon, const int64_t lat){
+    return dPoint(1e-9*(lon_off + gran*lon), 1e-9*(lat_off + gran*lat)); };
+
+  std::vector<uint64_t> keys, vals, v1, v2, v3;
+  for (auto & g: groups){
+    while (g.next()){
+      switch (g.field){
+
+        case 1: { // Node
+          PBFNode n;
+          int64_t lat = 0, lon = 0;
+          PBFMsg m = g.msg();
+          keys.clear(); vals.clear();
+          while (m.next()){
+            switch (m.field){
+              case 1: n.id = m.sval(); break;
+              case 2: pbf_packed(m, keys); break;
+              case 3: pbf_packed(m, vals); break;
+              case 8: lat = m.sval(); break;
+              case 9: lon = m.sval(); break;
+            }
+          }
+          if (keys.size()!=vals.size()) throw Err() << "OSM PBF: bad node tags";
+          for (size_t i=0; i<keys.size(); i++)
+            n.tags.emplace(get_str(keys[i]), get_str(vals[i]));
+          n.pt = get_pt(lon, lat);
+          nodes.push_back(n);
+          break;
+        }
+
+        case 2: { // DenseNodes
+          std::vector<uint64_t> ids, lats, lons, kv;
+          PBFMsg m = g.msg();
+          while (m.next()){
+            switch (m.field){
+              case 1:  pbf_packed(m, ids); break;
+              case 8:  pbf_packed(m, lats); break;
+              case 9:  pbf_packed(m, lons); break;
+              case 10: pbf_packed(m, kv); break;
+            }
+          }
+          if (lats.size()!=ids.size() || lons.size()!=ids.size())
+            throw Err() << "OSM PBF: bad dense nodes";
+          int64_t id = 0, lat = 0, lon = 0;
+          size_t k = 0;
+          size_t n0 = nodes.size();
+          nodes.resize(n0 + ids.size());
+          for (size_t i=0; i<ids.size(); i++){
+            PBFNode & n = nodes[n0+i];
+            n.id = id += PBFMsg::sval(ids[i]);
+            lat += PBFMsg::sval(lats[i]);
+            lon += PBFMsg::sval(lons[i]);
+            n.pt = get_pt(lon, lat);
+            // keys_vals: (key, value)* 0 for each node, or empty
+            while (k < kv.size()){
+              if (kv[k]==0) {k++; break;}
+              if (k+1 >= kv.size()) throw Err() << "OSM PBF: bad dense node tags";
+              n.tags.emplace(get_str(kv[k]), get_str(kv[k+1]));
+              k+=2;
+            }
+          }
+          break;
+        }
+
+        case 3: { // Way
+          osm_id_t id = 0;
+          OSMXML::OSM_Way w;
+          PBFMsg m = g.msg();
+          keys.clear(); vals.clear(); v1.clear();
+          while (m.next()){
+            switch (m.field){
+              case 1: id = (int64_t)m.val; break;
+              case 2: pbf_packed(m, keys); break;
+              case 3: pbf_packed(m, vals); break;
+              case 8: pbf_packed(m, v1); break;
+            }
+          }
+          if (keys.size()!=vals.size()) throw Err() << "OSM PBF: bad way tags";
+          for (size_t i=0; i<keys.size(); i++)
+            w.emplace(get_str(keys[i]), get_str(vals[i]));
+          int64_t ref = 0;
+          w.nodes.resize(v1.size());
+          for (size_t i=0; i<v1.size(); i++) w.nodes[i] = ref += PBFMsg::sval(v1[i]);
+          ways.emplace_back(id, std::move(w));
+          break;
+        }
+
+        case 4: { // Relation
+          osm_id_t id = 0;
+          OSMXML::OSM_Rel r;
+          PBFMsg m = g.msg();
+          keys.clear(); vals.clear(); v1.clear(); v2.clear(); v3.clear();
+          while (m.next()){
+            switch (m.field){
+              case 1:  id = (int64_t)m.val; break;
+              case 2:  pbf_packed(m, keys); break;
+              case 3:  pbf_packed(m, vals); break;
+              case 8:  pbf_packed(m, v1); break; // roles
+              case 9:  pbf_packed(m, v2); break; // member ids
+              case 10: pbf_packed(m, v3); break; // member types
+            }
+          }
+          if (keys.size()!=vals.size()) throw Err() << "OSM PBF: bad relation tags";
+          if (v1.size()!=v2.size() || v1.size()!=v3.size())
+            throw Err() << "OSM PBF: bad relation members";
+          for (size_t i=0; i<keys.size(); i++)
+            r.emplace(get_str(keys[i]), get_str(vals[i]));
+          int64_t ref = 0;
+          for (size_t i=0; i<v1.size(); i++){
+            OSMXML::OSM_Memb mb;
+            mb.ref = ref += PBFMsg::sval(v2[i]);
+            mb.role = get_str(v1[i]);
+            switch (v3[i]){
+              case 0: mb.type = "node"; break;
+              case 1: mb.type = "way"; break;
+              case 2: mb.type = "relation"; break;
+              default: throw Err() << "OSM PBF: bad member type: " << v3[i];
+            }
+            r.members.push_back(mb);
+          }
+          rels.emplace_back(id, std::move(r));
+          break;
+        }
+      }
+    }
+  }
+}
+
+/********************************************************************/
+// Thread pool for decoding blocks
+
+class PBFPool {
+  std::vector<std::thread> threads;
+  std::deque<std::shared_ptr<PBFBlock> > queue;
+  std::mutex m;
+  std::condition_variable add_cond, done_cond;
+  bool stop;
+
+  void worker(){
+    while (1){
+      std::shared_ptr<PBFBlock> b;
+      {
+        std::unique_lock<std::mutex> lk(m);
+        add_cond.wait(lk, [this]{ return stop || queue.size(); });
+        if (stop) return;
+        b = queue.front();
+        queue.pop_front();
+      }
+      try { b->decode(); }
+      catch (...) { b->err = std::current_exception(); }
+      {
+        std::unique_lock<std::mutex> lk(m);
+        b->done = true;
+      }
+      done_cond.notify_all();
+    }
+  }
+
+public:
+  PBFPool(const int n): stop(false){
+    for (int i=0; i<n; i++) threads.emplace_back(&PBFPool::worker, this);
+  }
+
+  ~PBFPool(){
+    {
+      std::unique_lock<std::mutex> lk(m);
+      stop = true;
+    }
+    add_cond.notify_all();
+    for (auto & t: threads) t.join();
+  }
+
+  void add(const std::shared_ptr<PBFBlock> & b){
+    {
+      std::unique_lock<std::mutex> lk(m);
+      queue.push_back(b);
+    }
+    add_cond.notify_one();
+  }
+
+  void wait(const std::shared_ptr<PBFBlock> & b){
+    std::unique_lock<std::mutex> lk(m);
+    done_cond.wait(lk, [&b]{ return b->done; });
+  }
+};
+
+/********************************************************************/
+
+// read big-endian uint32
+static bool
+read_uint32_be(FILE *F, uint32_t & v){
+  uint8_t b[4];
+  if (fread(b, 1, 4, F)!=4) return false;
+  v = ((uint32_t)b[0]<<24) | ((uint32_t)b[1]<<16) | ((uint32_t)b[2]<<8) | b[3];
+  return true;
+}
+
+// Read next block from the file, return NULL at the end of file.
+static std::shared_ptr<PBFBlock>
+read_block(FILE *F, const std::string & filename){
+  uint32_t hsize;
+  if (!read_uint32_be(F, hsize)) return NULL;
+  if (hsize > 64*1024)
+    throw Err() << "OSM PBF: bad block header size: " << filename;
+
+  // BlobHeader
+  std::string h(hsize, '\0');
+  if (fread(&h[0], 1, hsize, F)!=hsize)
+    throw Err() << "OSM PBF: unexpected end of file: " << filename;
+  std::shared_ptr<PBFBlock> ret(new PBFBlock);
+  uint64_t dsize = 0;
+  PBFMsg m(h);
+  while (m.next()){
+    if (m.field == 1) ret->type = m.str();
+    if (m.field == 3) dsize = m.val;
+  }
+  if (dsize > 64*1024*1024)
+    throw Err() << "OSM PBF: bad block size: " << filename;
+
+  // Blob
+  ret->blob.resize(dsize);
+  if (dsize && fread(&ret->blob[0], 1, dsize, F)!=dsize)
+    throw Err() << "OSM PBF: unexpected end of file: " << filename;
+  return ret;
+}
+
+// pass decoded block to the handler
+static void
+send_block(PBFBlock & b, OSMHandler & handler){
+  if (b.err) std::rethrow_exception(b.err);
+  if (b.type == "OSMHeader" && !b.bbox.is_empty()) handler.on_bbox(b.bbox);
+  for (auto const & n: b.nodes) handler.on_node(n.id, n.pt, n.tags);
+  for (auto const & w: b.ways)  handler.on_way(w.first, w.second);
+  for (auto const & r: b.rels)  handler.on_rel(r.first, r.second);
+}
+
+void
+read_osmpbf(const std::string &filename, OSMHandler & handler, const Opt & opts){
+
+  int nthreads = opts.get("osm_threads", (int)std::thread::hardware_concurrency());
+  if (nthreads<1) nthreads = 1;
+
+  if (opts.get("verbose", false)) std::cerr <<
+    "Reading OSM PBF file: " << filename << std::endl;
+
+  std::shared_ptr<FILE> F(fopen(filename.c_str(), "rb"),
+    [](FILE *f){ if (f) fclose(f); });
+  if (!F) throw Err() << "Can't open file: " << filename;
+
+  // single thread
+  if (nthreads == 1){
+    while (1){
+      auto b = read_block(F.get(), filename);
+      if (!b) break;
+      b->decode();
+      send_block(*b, handler);
+    }
+    return;
+  }
+
+  // Blocks are read in this thread, decoded in the pool,
+  // and sent to the handler in the original order.
+  // Number of blocks in memory is limited.
+  PBFPool pool(nthreads);
+  std::deque<std::shared_ptr<PBFBlock> > blocks;
+  bool eof = false;
+  while (1){
+    while (!eof && blocks.size() < 2*(size_t)nthreads){
+      auto b = read_block(F.get(), filename);
+      if (!b) {eof = true; break;}
+      blocks.push_back(b);
+      pool.add(b);
+    }
+    if (blocks.empty()) break;
+    pool.wait(blocks.front());
+    send_block(*blocks.front(), handler);
+    blocks.pop_front();
+  }
+}
+
+void
+read_osmpbf(const std::string &filename, OSMXML & data, const Opt & opts){
+  OSMXMLReader reader(data);
+  read_osmpbf(filename, reader, opts);
+}
+
+/********************************************************************/
+
+static bool
+is_pbf(const std::string & filename){
+  return filename.size()>=4 &&
+         filename.compare(filename.size()-4, 4, ".pbf")==0;
+}
+
+void
+read_osm(const std::string &filename, OSMHandler & handler, const Opt & opts){
+  if (is_pbf(filename)) read_osmpbf(filename, handler, opts);
+  else read_osmxml(filename, handler, opts);
+}
+
+void
+read_osm(const std::string &filename, OSMXML & data, const Opt & opts){
+  OSMXMLReader reader(data);
+  read_osm(filename, reader, opts);
+}
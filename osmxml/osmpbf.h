@@ -0,0 +1,32 @@
+#ifndef OSMPBF_H
+#define OSMPBF_H
+
+// Reader for OSM PBF format
+// https://wiki.openstreetmap.org/wiki/PBF_Format
+//
+// Blocks are decompressed (zlib or raw data) and parsed in a few
+// threads, objects are passed to the handler in the file order
+// in the calling thread. Protobuf messages are parsed directly,
+// without libprotobuf.
+//
+// Options:
+//   osm_threads -- number of threads (default: number of CPUs,
+//                  1 for reading without additional threads)
+//   verbose     -- print file name
+
+#include "osmxml.h"
+
+void read_osmpbf(const std::string &filename, OSMHandler & handler,
+                 const Opt & opts = Opt());
+
+void read_osmpbf(const std::string &filename, OSMXML & data,
+                 const Opt & opts = Opt());
+
+// Read OSM XML or PBF file (with .pbf extension).
+void read_osm(const std::string &filename, OSMHandler & handler,
+              const Opt & opts = Opt());
+
+void read_osm(const std::string &filename, OSMXML & data,
+              const Opt & opts = Opt());
+
+#endif
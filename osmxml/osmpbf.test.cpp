@@ -0,0 +1,84 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <iostream>
+#include "osmpbf.h"
+#include "err/assert_err.h"
+
+// test_data/test.osm.pbf is test_data/test.osm converted to PBF:
+// header and relations in zlib blobs, dense nodes in a zlib blob
+// with raw_size written after the data, ways in a raw blob.
+
+void
+check_data(const OSMXML & d){
+  assert_eq(d.nodes.size(), 5);
+  assert_deq(d.nodes.at(101), dPoint(30,60), 1e-9);
+  assert_deq(d.nodes.at(103), dPoint(30.002,60.001), 1e-9);
+  assert_deq(d.nodes.at(99), dPoint(-179.9999999,-0.5), 1e-9);
+
+  assert_eq(d.points.size(), 1);
+  assert_eq(d.points.at(103).get("name"), "Point");
+  assert_eq(d.points.at(103).get("natural"), "peak");
+
+  assert_eq(d.ways.size(), 2);
+  auto const & w = d.ways.at(201);
+  assert_eq(w.size(), 1);
+  assert_eq(w.get("natural"), "water");
+  assert_eq(w.nodes.size(), 5);
+  assert_eq(w.nodes[0], 101);
+  assert_eq(w.nodes[3], 104);
+  assert_eq(w.nodes[4], 101);
+  assert_eq(d.ways.at(200).nodes[0], 99);
+
+  assert_eq(d.relations.size(), 1);
+  auto const & r = d.relations.at(301);
+  assert_eq(r.get("type"), "multipolygon");
+  assert_eq(r.get("name"), "Lake");
+  assert_eq(r.members.size(), 3);
+  auto m = r.members.begin();
+  assert_eq(m->ref, 201);
+  assert_eq(m->type, "way");
+  assert_eq(m->role, "outer");
+  m++;
+  assert_eq(m->ref, 103);
+  assert_eq(m->type, "node");
+  assert_eq(m->role, "label");
+  m++;
+  assert_eq(m->ref, 300);
+  assert_eq(m->type, "relation");
+  assert_eq(m->role, "");
+}
+
+int
+main(){
+  try{
+
+    {
+      OSMXML d;
+      read_osmxml("test_data/test.osm", d);
+      check_data(d);
+    }
+
+    for (auto th: {"1", "2"}) {
+      Opt o;
+      o.put("osm_threads", th);
+      OSMXML d;
+      read_osmpbf("test_data/test.osm.pbf", d, o);
+      check_data(d);
+
+      OSMXML d1;
+      read_osm("test_data/test.osm.pbf", d1, o);
+      check_data(d1);
+    }
+
+    OSMXML d;
+    assert_err(read_osmpbf("test_data/missing.osm.pbf", d),
+      "Can't open file: test_data/missing.osm.pbf");
+  }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
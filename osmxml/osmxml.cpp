@@ -1,6 +1,10 @@
 #include "osmxml.h"
 #include <libxml/xmlreader.h>
 #include <set>
+#include <map>
+#include <algorithm>
+#include <climits>
+#include <cmath>
 
 
 // same as in io_gpx.cpp, io_kml.cpp
@@ -34,6 +38,20 @@ OSMXML::get_way_coords(const OSMXML::OSM_Way & way){
 
 dMultiLine
 OSMXML::get_rel_coords(const OSMXML::OSM_Rel & rel){
+  return osm_rel_coords(rel,
+    [this](const osm_id_t id, std::vector<osm_id_t> & nodes){
+      auto w = ways.find(id);
+      if (w == ways.end()) return false;
+      nodes = w->second.nodes;
+      return true;
+    },
+    [this](const osm_id_t id){ return get_node_coords(id); });
+}
+
+dMultiLine
+osm_rel_coords(const OSMXML::OSM_Rel & rel,
+  std::function<bool(const osm_id_t, std::vector<osm_id_t> &)> get_way,
+  std::function<dPoint(const osm_id_t)> get_node){
   dMultiLine ret;
 
   // multipolygons should have type=multipolygon|boundary
@@ -42,29 +60,30 @@ OSMXML::get_rel_coords(const OSMXML::OSM_Rel & rel){
 
   // Collect all members with type=way, role=inner|outer
   // Also check that way ID exists, and that each way contains >1 points.
-  std::set<osm_id_t> parts;
+  std::map<osm_id_t, std::vector<osm_id_t> > parts;
   for (auto const & p:rel.members){
     if (p.type!="way") continue;
     if (p.role!="inner" && p.role!="outer") continue;
-    if (ways.count(p.ref)==0) continue;
+    std::vector<osm_id_t> nodes;
+    if (!get_way(p.ref, nodes)) continue;
 //      throw Err() << "way does not exist: " << p.ref;
-    if (ways.find(p.ref)->second.nodes.size()<2)
+    if (nodes.size()<2)
       throw Err() << "way is too short: " << p.ref;
-    parts.insert(p.ref);
+    parts.emplace(p.ref, nodes);
   }
 
   // build rings
   while (parts.size()>0){
     // take first part
     auto i = parts.begin();
-    auto ring = ways.find(*i)->second.nodes;
+    auto ring = i->second;
     parts.erase(i);
 
     while (ring[0]!=ring[ring.size()-1]){
       bool mod=false;
       auto j = parts.begin();
       while (j!=parts.end()){
-        auto seg = ways.find(*j)->second.nodes;
+        auto const & seg = j->second;
 
         // Try to connect segment to the ring in all possible ways.
         // Do not double the connection point.
@@ -97,27 +116,27 @@ OSMXML::get_rel_coords(const OSMXML::OSM_Rel & rel){
     }
     dLine crd;
     for (auto const i:ring)
-      crd.push_back(get_node_coords(i));
+      crd.push_back(get_node(i));
     ret.push_back(crd);
   }
   return ret;
 }
 
-
 /********************************************************************/
 
 // read <node> tag
 int
-read_nod(xmlTextReaderPtr reader, OSMXML & data, const Opt & opts){
+read_nod(xmlTextReaderPtr reader, OSMHandler & data, const Opt & opts){
   auto id  = str_to_type<osm_id_t>(GETATTR("id"));
   dPoint p(str_to_type<double>(GETATTR("lon")),
            str_to_type<double>(GETATTR("lat")));
 
-  data.nodes.emplace(id, p);
-  if (xmlTextReaderIsEmptyElement(reader)) return 1;
-
-  // if node is not empty (have tags) create point object
+  // node tags
   OSMXML::OSM_Point pt;
+  if (xmlTextReaderIsEmptyElement(reader)) {
+    data.on_node(id, p, pt);
+    return 1;
+  }
 
   while(1){
     int ret =xmlTextReaderRead(reader);
@@ -135,13 +154,13 @@ read_nod(xmlTextReaderPtr reader, OSMXML & data, const Opt & opts){
     std::cerr << "Warning: Unknown node \"" << name
               << "\" in <node> (type: " << type << ")\n";
   }
-  data.points.emplace(id, pt);
+  data.on_node(id, p, pt);
   return 1;
 }
 
 // read <way> tag
 int
-read_way(xmlTextReaderPtr reader, OSMXML & data, const Opt & opts){
+read_way(xmlTextReaderPtr reader, OSMHandler & data, const Opt & opts){
   OSMXML::OSM_Way way;
   auto id = str_to_type<osm_id_t>(GETATTR("id"));
 
@@ -165,13 +184,13 @@ read_way(xmlTextReaderPtr reader, OSMXML & data, const Opt & opts){
     std::cerr << "Warning: Unknown node \"" << name
               << "\" in <way> (type: " << type << ")\n";
   }
-  data.ways.emplace(id, way);
+  data.on_way(id, way);
   return 1;
 }
 
 // read <relation> tag
 int
-read_rel(xmlTextReaderPtr reader, OSMXML & data, const Opt & opts){
+read_rel(xmlTextReaderPtr reader, OSMHandler & data, const Opt & opts){
   OSMXML::OSM_Rel rel;
   auto id  = str_to_type<osm_id_t>(GETATTR("id"));
 
@@ -199,13 +218,13 @@ read_rel(xmlTextReaderPtr reader, OSMXML & data, const Opt & opts){
     std::cerr << "Warning: Unknown node \"" << name
               << "\" in <relation> (type: " << type << ")\n";
   }
-  data.relations.emplace(id, rel);
+  data.on_rel(id, rel);
   return 1;
 }
 
 
 int
-read_osm_node(xmlTextReaderPtr reader, OSMXML & data, const Opt & opts){
+read_osm_node(xmlTextReaderPtr reader, OSMHandler & data, const Opt & opts){
 
   while(1){
     int ret =xmlTextReaderRead(reader);
@@ -225,10 +244,10 @@ read_osm_node(xmlTextReaderPtr reader, OSMXML & data, const Opt & opts){
         std::cerr << "Warning: bad <bounds> tag\n";
         continue;
       }
-      data.bbox = dRect(
+      data.on_bbox(dRect(
         dPoint(str_to_type<double>(x1),str_to_type<double>(y1)),
         dPoint(str_to_type<double>(y1),str_to_type<double>(y2))
-      );
+      ));
       continue;
     }
     if (NAMECMP("node") && (type == TYPE_ELEM)){
@@ -258,6 +277,12 @@ read_osm_node(xmlTextReaderPtr reader, OSMXML & data, const Opt & opts){
 
 void
 read_osmxml(const std::string &filename, OSMXML & data, const Opt & opts) {
+  OSMXMLReader reader(data);
+  read_osmxml(filename, reader, opts);
+}
+
+void
+read_osmxml(const std::string &filename, OSMHandler & data, const Opt & opts) {
 
   LIBXML_TEST_VERSION
   xmlTextReaderPtr reader;
@@ -288,3 +313,46 @@ read_osmxml(const std::string &filename, OSMXML & data, const Opt & opts) {
   if (ret != 0) throw Err() << "Can't parse OSMXML file: " << filename;
 
 }
+
+/********************************************************************/
+
+ssize_t
+OSMNodeStore::find(const osm_id_t id) const{
+  auto i = std::lower_bound(ids.begin(), ids.end(), id);
+  if (i==ids.end() || *i!=id) return -1;
+  return i-ids.begin();
+}
+
+void
+OSMNodeStore::add(const osm_id_t id){
+  if (prepared) throw Err() << "OSMNodeStore::add: can't add nodes after prepare()";
+  ids.push_back(id);
+}
+
+void
+OSMNodeStore::prepare(){
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  ids.shrink_to_fit();
+  // INT_MIN: no coordinates
+  crds.assign(2*ids.size(), INT_MIN);
+  prepared = true;
+}
+
+bool
+OSMNodeStore::put(const osm_id_t id, const dPoint & pt){
+  if (!prepared) throw Err() << "OSMNodeStore::put: prepare() should be called first";
+  auto i = find(id);
+  if (i<0) return false;
+  crds[2*i]   = rint(pt.x*1e7);
+  crds[2*i+1] = rint(pt.y*1e7);
+  return true;
+}
+
+dPoint
+OSMNodeStore::get(const osm_id_t id) const{
+  auto i = prepared ? find(id) : -1;
+  if (i<0 || crds[2*i] == INT_MIN)
+    throw Err() << "OSM node does not exist: " << id;
+  return dPoint(crds[2*i]/1e7, crds[2*i+1]/1e7);
+}
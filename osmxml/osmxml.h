@@ -11,6 +11,7 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <functional>
 
 // Node ID
 typedef int64_t osm_id_t;
@@ -65,7 +66,79 @@ struct OSMXML {
 
 };
 
+// Same as OSMXML::get_rel_coords, but with external storage:
+// get_way(id, nodes) should fill node list of a way and return false
+// if the way is unknown, get_node(id) should return node coordinates.
+dMultiLine osm_rel_coords(const OSMXML::OSM_Rel & rel,
+  std::function<bool(const osm_id_t, std::vector<osm_id_t> &)> get_way,
+  std::function<dPoint(const osm_id_t)> get_node);
+
 void read_osmxml(const std::string &filename, OSMXML & data,
                  const Opt & opts = Opt());
 
+/********************************************************************/
+// Streaming interface: objects are passed to a handler in the file
+// order (normally nodes, ways, relations) without storing them.
+
+struct OSMHandler {
+  virtual ~OSMHandler() {}
+  virtual void on_bbox(const dRect & bbox) {}
+  // Node with tags (empty for nodes without tags)
+  virtual void on_node(const osm_id_t id, const dPoint & pt, const Opt & tags) {}
+  virtual void on_way(const osm_id_t id, const OSMXML::OSM_Way & way) {}
+  virtual void on_rel(const osm_id_t id, const OSMXML::OSM_Rel & rel) {}
+};
+
+// Handler for reading the whole file into OSMXML structure
+struct OSMXMLReader: public OSMHandler {
+  OSMXML & data;
+  OSMXMLReader(OSMXML & data): data(data) {}
+  void on_bbox(const dRect & bbox) override {data.bbox = bbox;}
+  void on_node(const osm_id_t id, const dPoint & pt, const Opt & tags) override {
+    data.nodes.emplace(id, pt);
+    if (tags.size()) data.points.emplace(id, tags);
+  }
+  void on_way(const osm_id_t id, const OSMXML::OSM_Way & way) override {
+    data.ways.emplace(id, way);}
+  void on_rel(const osm_id_t id, const OSMXML::OSM_Rel & rel) override {
+    data.relations.emplace(id, rel);}
+};
+
+void read_osmxml(const std::string &filename, OSMHandler & handler,
+                 const Opt & opts = Opt());
+
+/********************************************************************/
+// Compact storage for coordinates of a known set of nodes:
+// sorted flat arrays of ids and int32 coordinates (1e-7 degree,
+// x and y for each node), 16 bytes per node.
+// Usage: add() all needed ids, prepare(), put() coordinates
+// (other nodes are ignored), get() coordinates.
+
+class OSMNodeStore {
+  std::vector<osm_id_t> ids;
+  std::vector<int32_t> crds;
+  bool prepared;
+
+  // index of id, or -1
+  ssize_t find(const osm_id_t id) const;
+
+public:
+  OSMNodeStore(): prepared(false) {}
+
+  // add node id (before prepare)
+  void add(const osm_id_t id);
+
+  // sort and remove duplicated ids
+  void prepare();
+
+  // number of nodes
+  size_t size() const {return ids.size();}
+
+  // set coordinates if id was added, return false otherwise
+  bool put(const osm_id_t id, const dPoint & pt);
+
+  // get coordinates; error if coordinates are not set
+  dPoint get(const osm_id_t id) const;
+};
+
 #endif
@@ -0,0 +1,80 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+// Multi-threaded SRTM speed test: sample random points over
+// a 4x4-degree area from N threads.
+// Usage: speed_test [<srtm_dir> [<lon0> <lat0>]]
+// Default: ./test_srtm 27 76 (only one tile exists there).
+// Two modes are compared: threads reading data in parallel
+// with read locks, and threads holding an exclusive lock
+// for each block of points (old behaviour).
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "srtm.h"
+
+// sample n points, return sum of heights
+double
+sample(SRTM & S, const dPoint & p0, const size_t n, const int seed, const bool excl){
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<double> dist(0.0, 4.0);
+  double sum = 0;
+  const size_t block = 1000;
+  for (size_t i = 0; i<n; i+=block){
+    if (excl) {
+      auto lk = S.get_lock();
+      for (size_t j=0; j<block; j++)
+        sum += S.get_h(p0 + dPoint(dist(gen), dist(gen)));
+    }
+    else {
+      auto lk = S.get_read_lock();
+      for (size_t j=0; j<block; j++)
+        sum += S.get_h(p0 + dPoint(dist(gen), dist(gen)));
+    }
+  }
+  return sum;
+}
+
+int
+main(int argc, char *argv[]){
+  try {
+    Opt o;
+    o.put("srtm_dir", argc>1 ? argv[1] : "./test_srtm");
+    dPoint p0(argc>3 ? atof(argv[2]) : 27, argc>3 ? atof(argv[3]) : 76);
+    SRTM S(o);
+
+    // load tiles
+    sample(S, p0, 100000, 0, false);
+
+    const size_t n = 2000000; // points per thread
+    size_t nmax = std::max(4u, std::thread::hardware_concurrency());
+
+    std::cout << std::setw(10) << "threads"
+              << std::setw(18) << "parallel, Mpt/s"
+              << std::setw(18) << "exclusive, Mpt/s" << "\n";
+
+    for (size_t nth = 1; nth<=nmax; nth*=2){
+      std::cout << std::setw(10) << nth;
+      for (int excl = 0; excl<2; excl++){
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (size_t t=0; t<nth; t++)
+          threads.emplace_back([&S,&p0,n,t,excl](){ sample(S, p0, n, t+1, excl); });
+        for (auto & t: threads) t.join();
+        std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+        std::cout << std::setw(18) << std::setprecision(4) << nth*n/dt.count()/1e6;
+      }
+      std::cout << "\n";
+    }
+  }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
@@ -13,6 +13,11 @@
 #include "image_cnt/image_trace.h"
 #include <zlib.h>
 #include <tiffio.h>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /**********************************************************/
 // load srtm data from *.hgt file
@@ -103,16 +108,170 @@ read_demtif_file(const std::string & file){
 }
 
 
+/**********************************************************/
+// Uncompressed tile cache (see srtm_cache_dir option) and overview tiles.
+// File format: 16-byte header (6-byte magic, grid type, decimation shift,
+// uint32 width, uint32 height) followed by width*height int16 values.
+// All numbers are little-endian. Grid type is 0 (detect from the image
+// width), 1 (SRTM) or 2 (ALOS). Files are memory-mapped and used
+// directly as image data, this is possible only on little-endian hosts.
+
+static const char srtm_dem_magic[6] = {'M','S','D','E','M','1'};
+#define SRTM_DEM_HDR 16
+
+static bool
+host_le(){
+  uint16_t v = 1;
+  return *(unsigned char*)&v == 1;
+}
+
+static uint32_t
+get_le32(const unsigned char *p){
+  return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+static void
+put_le32(unsigned char *p, uint32_t v){
+  for (int i=0; i<4; i++) p[i] = (v >> (8*i)) & 0xFF;
+}
+
+// map *.dem file, return empty image if file is missing or broken
+ImageR
+read_dem_file(const std::string & file, int * grid = NULL, int * shift = NULL){
+  if (!host_le()) return ImageR();
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd<0) return ImageR();
+  struct stat st;
+  if (fstat(fd, &st)!=0 || st.st_size < SRTM_DEM_HDR) {
+    close(fd);
+    return ImageR();
+  }
+  size_t len = st.st_size;
+  void * p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return ImageR();
+  std::shared_ptr<unsigned char> buf((unsigned char *)p,
+    [len](unsigned char *p){ munmap(p, len); });
+
+  size_t w = get_le32(buf.get()+8);
+  size_t h = get_le32(buf.get()+12);
+  if (memcmp(buf.get(), srtm_dem_magic, 6)!=0 || buf.get()[6]>2 ||
+      w==0 || h==0 || len != SRTM_DEM_HDR + 2*w*h) return ImageR();
+  if (grid)  *grid  = buf.get()[6];
+  if (shift) *shift = buf.get()[7];
+
+  // pointer to the data, sharing ownership of the whole mapping
+  std::shared_ptr<unsigned char> data(buf, buf.get() + SRTM_DEM_HDR);
+  return ImageR(w, h, IMAGE_16, data);
+}
+
+// write *.dem file (IMAGE_16 image is expected), return false on errors.
+// use temporary file and rename to avoid reading incomplete data
+bool
+write_dem_file(const std::string & file, const ImageR & im,
+               const int grid = 0, const int shift = 0){
+  if (!host_le() || im.type()!=IMAGE_16) return false;
+  std::ostringstream tmp;
+  tmp << file << ".tmp." << getpid() << "."
+      << std::hash<std::thread::id>()(std::this_thread::get_id());
+
+  FILE *F = fopen(tmp.str().c_str(), "wb");
+  if (!F) return false;
+  unsigned char hdr[SRTM_DEM_HDR];
+  memcpy(hdr, srtm_dem_magic, 6);
+  hdr[6] = grid;
+  hdr[7] = shift;
+  put_le32(hdr+8,  im.width());
+  put_le32(hdr+12, im.height());
+  bool ok = fwrite(hdr, 1, SRTM_DEM_HDR, F) == SRTM_DEM_HDR &&
+            fwrite(im.data(), 1, im.dsize(), F) == im.dsize();
+  ok = (fclose(F)==0) && ok;
+  if (!ok || rename(tmp.str().c_str(), file.c_str())!=0){
+    unlink(tmp.str().c_str());
+    return false;
+  }
+  return true;
+}
+
+// Is cached file valid (not older then any of tile source files)?
+static bool
+dem_file_valid(const std::string & base, const std::string & cfile){
+  return file_exists(cfile) &&
+      !file_newer(base + ".hgt.gz", cfile) &&
+      !file_newer(base + ".hgt", cfile) &&
+      !file_newer(base + ".tif", cfile) &&
+      !file_newer(base + ".tiff", cfile) &&
+      !file_newer(base + ".ovl", cfile);
+}
+
+/**********************************************************/
+// Make overview tile (next level) from src.
+// SRTM grid (points at integer degrees): 3x3 points with 1-2-1 weights,
+// ALOS grid (points in the middle of cells): 2x2 points.
+// Holes are skipped. If the tile can not be decimated (odd
+// number of cells, too small size) data is copied.
+bool
+SRTMTile::can_decimate(const size_t w, const size_t h, const bool srtm){
+  return srtm ? (w-1)%2==0 && (h-1)%2==0 && w>32 && h>32:
+                w%2==0 && h%2==0 && w>=32 && h>=32;
+}
+
+void
+SRTMTile::make_overview(const SRTMTile & src, const bool use_overlay){
+  key.x = src.key.x; key.y = src.key.y;
+  srtm = src.srtm;
+  overlay.clear();
+
+  size_t sw = src.w, sh = src.h;
+  if (!can_decimate(sw, sh, srtm)){
+    ImageR::operator=(src);
+    w = sw; h = sh;
+    step = src.step;
+    shift = src.shift;
+    empty = src.empty;
+    return;
+  }
+
+  w = srtm? (sw-1)/2+1 : sw/2;
+  h = srtm? (sh-1)/2+1 : sh/2;
+  ImageR im(w, h, IMAGE_16);
+  int a0 = srtm? -1:0, a1 = 1;
+  for (size_t y=0; y<h; y++){
+    for (size_t x=0; x<w; x++){
+      double sum = 0, wsum = 0;
+      for (int b=a0; b<=a1; b++){
+        for (int a=a0; a<=a1; a++){
+          int xx = 2*x + a, yy = 2*y + b;
+          if (xx<0 || yy<0 || xx>=(int)sw || yy>=(int)sh) continue;
+          int v = src.get_unsafe(iPoint(xx,yy), use_overlay);
+          if (v<SRTM_VAL_MIN) continue;
+          double k = srtm? (2-abs(a))*(2-abs(b)) : 1;
+          sum += k*v; wsum += k;
+        }
+      }
+      im.set16(x,y, wsum>0 ? (int16_t)rint(sum/wsum) : SRTM_VAL_UNDEF);
+    }
+  }
+  ImageR::operator=(im);
+  step = src.step*2;
+  shift = src.shift+1;
+  empty = false;
+}
+
 /**********************************************************/
 // load SRTM tile
-SRTMTile::SRTMTile(const std::string & dir, const iPoint & key_){
+SRTMTile::SRTMTile(const std::string & dir, const iPoint & key_,
+                   const std::string & cache_dir, const bool use_overlay,
+                   const get_src_t & get_src){
   key = key_;
   w = 0; h = 0;
   empty = true;
   srtm = false;
+  shift = 0;
 
   if ((key.x < -180) || (key.x >= 180) ||
-      (key.y <  -90) || (key.y >=  90)) return;
+      (key.y <  -90) || (key.y >=  90) ||
+      (key.z < 0) || (key.z > SRTM_MAX_LEVEL)) return;
 
   char EW = key.x<0 ? 'W':'E';
   char NS = key.y<0 ? 'S':'N';
@@ -123,20 +282,69 @@ SRTMTile::SRTMTile(const std::string & dir, const iPoint & key_){
        << EW << std::setw(3) << abs(key.x);
 
   ImageR im;
+  std::string base = dir + "/" + file.str();
+
+  // Overview tile: <cache_dir>/<name>.L<level>.dem
+  // (<name>.L<level>.noovl.dem if overlay is not used),
+  // make it from the previous level if needed.
+  if (key.z > 0){
+    std::ostringstream ofile;
+    if (cache_dir!="")
+      ofile << cache_dir << "/" << file.str() << ".L" << key.z
+            << (use_overlay? "":".noovl") << ".dem";
+    int grid = 0, sh = 0;
+    if (cache_dir!="" && host_le() && dem_file_valid(base, ofile.str()))
+      im = read_dem_file(ofile.str(), &grid, &sh);
+    if (!im.is_empty() && grid!=0) {
+      ImageR::operator=(im);
+      w = im.width();
+      h = im.height();
+      srtm = grid==1;
+      shift = sh;
+      step = srtm? dPoint(1.0/(w-1), 1.0/(h-1)) : dPoint(1.0/w, 1.0/h);
+      empty = false;
+      return;
+    }
+    iPoint skey(key.x, key.y, key.z-1);
+    auto src = get_src ? get_src(skey) :
+      std::make_shared<const SRTMTile>(dir, skey, cache_dir, use_overlay);
+    if (src->is_empty()) return;
+    make_overview(*src, use_overlay);
+    if (cache_dir!="") write_dem_file(ofile.str(), *this, srtm? 1:2, shift);
+    return;
+  }
 
-  // try <name>.hgt.gz
-  im= read_zhgt_file(dir + "/" + file.str() + ".hgt.gz");
+  // Try uncompressed cache: <cache_dir>/<name>.dem.
+  // It is used if it is not older then any of source files.
+  std::string cfile = cache_dir + "/" + file.str() + ".dem";
+  bool use_cache = cache_dir != "" && host_le();
+  if (use_cache && dem_file_valid(base, cfile))
+    im = read_dem_file(cfile);
 
-  // try <name>.hgt
-  if (im.is_empty())
-    im = read_hgt_file(dir + "/" + file.str() + ".hgt");
+  if (im.is_empty()){
 
-  // try <name>.tif
-  if (im.is_empty())
-    im = read_demtif_file(dir + "/" + file.str() + ".tif");
+    // try <name>.hgt.gz
+    im= read_zhgt_file(base + ".hgt.gz");
 
-  if (im.is_empty())
-    im = read_demtif_file(dir + "/" + file.str() + ".tiff");
+    // try <name>.hgt
+    if (im.is_empty())
+      im = read_hgt_file(base + ".hgt");
+
+    // try <name>.tif
+    if (im.is_empty())
+      im = read_demtif_file(base + ".tif");
+
+    if (im.is_empty())
+      im = read_demtif_file(base + ".tiff");
+
+    // write the cache file and use mapped data
+    if (use_cache && !im.is_empty()){
+      if (!write_dem_file(cfile, im))
+        std::cerr << "SRTM: can't write file: " << cfile << "\n";
+      ImageR im1 = read_dem_file(cfile);
+      if (!im1.is_empty()) im = im1;
+    }
+  }
 
   if (im.is_empty())
     std::cerr << "SRTM: can't find file: " << file.str() << "\n";
@@ -145,7 +353,7 @@ SRTMTile::SRTMTile(const std::string & dir, const iPoint & key_){
 
   // load binary overlay file
   {
-    std::string fname = dir + "/" + file.str() + ".ovl";
+    std::string fname = base + ".ovl";
     FILE *F = fopen(fname.c_str(), "rb");
     if (F) {
       while (!feof(F)){
@@ -177,6 +385,8 @@ ms2opt_add_srtm(GetOptSet & opts){
   opts.add("srtm_dir", 1,0,g, "Set srtm data folder, default - $HOME/.srtm_data");
   opts.add("srtm_use_overlay", 1,0,g, "Use overlay (0|1, default 1).");
   opts.add("srtm_interp", 1,0,g, "Interpolation (nearest, linear, cubic. Default: linear).");
+  opts.add("srtm_cache_dir", 1,0,g, "Folder for uncompressed memory-mapped copies "
+    "of data tiles, created when tiles are read first time. Default: none.");
 }
 
 void
@@ -198,11 +408,206 @@ ms2opt_add_srtm_surf(GetOptSet & opts){
 }
 
 /************************************************/
+// Tile cache
+
+namespace {
+
+// Counter for cache generations. Zero is not used.
+std::atomic<uint64_t> srtm_gen(0);
+
+// Thread-local cache of tile references. References are weak:
+// memory is limited only by the SRTM tile cache, a tile removed from
+// it is freed as soon as nobody uses it.
+struct SRTMTileRef {
+  uint64_t gen;  // cache generation
+  uint64_t used; // last usage
+  size_t hits;   // hits since last update of the tile cache
+  iPoint key;
+  std::weak_ptr<const SRTMTile> tile;
+  SRTMTileRef(): gen(0), used(0), hits(0) {}
+};
+thread_local SRTMTileRef srtm_tls[SRTM_TLS_SIZE];
+thread_local uint64_t srtm_tls_cnt = 0;
+
+// SRTM objects read-locked by this thread (see SRTM::ReadLock)
+thread_local std::vector<const SRTM *> srtm_rlocks;
+
+// Check that the key is valid (a 1x1 degree cell, valid level).
+inline bool
+tile_key_valid(const iPoint & key){
+  return key.x >= -180 && key.x < 180 && key.y >= -90 && key.y < 90 &&
+         key.z >= 0 && key.z <= SRTM_MAX_LEVEL;
+}
+
+// Tile key for a point and level
+inline iPoint
+tile_key(const dPoint & p, const int level){
+  return iPoint(floor(p.x), floor(p.y), level);
+}
+
+}
+
+std::shared_ptr<const SRTMTile>
+SRTM::load_tile(const iPoint & key){
+  std::lock_guard<std::recursive_mutex> lk(cache_mutex);
+
+  // tile could be loaded by other thread
+  std::shared_ptr<const SRTMTile> t;
+  if (tiles.get(key, t)) return t;
+
+  // overview tiles are made from tiles of the previous level
+  // taken from the cache
+  t = std::make_shared<const SRTMTile>(srtm_dir, key, cache_dir, use_overlay,
+        [this](const iPoint & k){ return get_tile_ptr(k); });
+  tiles.add(key, t);
+  set_cell_info(*t);
+  return t;
+}
 
-SRTM::SRTM(const Opt & o): srtm_cache(SRTM_CACHE_SIZE) {
+void
+SRTM::clear_tiles(){
+  tiles.clear();
+  for (size_t i=0; i<360*180; i++) cell_info[i] = 0;
+  gen = ++srtm_gen;
+}
+
+void
+SRTM::set_cell_info(const SRTMTile & t){
+  if (!tile_key_valid(t.key)) return;
+  uint64_t v = 1;
+  if (!t.is_empty()){
+    // size of original data
+    size_t w = t.w, h = t.h;
+    for (int i=0; i<t.shift; i++){
+      w = t.srtm ? 2*(w-1)+1 : 2*w;
+      h = t.srtm ? 2*(h-1)+1 : 2*h;
+    }
+    // number of overview levels
+    uint64_t n = 0;
+    for (size_t w1=w, h1=h; n<SRTM_MAX_LEVEL &&
+         SRTMTile::can_decimate(w1, h1, t.srtm); n++){
+      w1 = t.srtm ? (w1-1)/2+1 : w1/2;
+      h1 = t.srtm ? (h1-1)/2+1 : h1/2;
+    }
+    v |= (t.srtm? 2:0) | (n<<2) |
+         ((uint64_t)(w & 0xFFFFFF) << 8) | ((uint64_t)(h & 0xFFFFFF) << 32);
+  }
+  cell_info[(t.key.y + 90)*360 + t.key.x + 180] = v;
+}
+
+uint64_t
+SRTM::get_cell_info(const dPoint & p){
+  iPoint key = tile_key(p, SRTM_MAX_LEVEL);
+  if (!tile_key_valid(key)) return 0;
+  auto & ci = cell_info[(key.y + 90)*360 + key.x + 180];
+  uint64_t v = ci;
+  if (v) return v;
+  // load the top level tile (it is small)
+  set_cell_info(*get_tile(key));
+  return ci;
+}
+
+std::shared_ptr<const SRTMTile>
+SRTM::get_tile_ptr(const iPoint & key){
+  // empty tile outside the table
+  if (!tile_key_valid(key))
+    return std::make_shared<const SRTMTile>(srtm_dir, key, cache_dir);
+
+  std::shared_ptr<const SRTMTile> t;
+  if (tiles.get(key, t)) return t;
+  return load_tile(key);
+}
+
+std::shared_ptr<const SRTMTile>
+SRTM::get_tile(const iPoint & key){
+  uint64_t g = gen;
+  SRTMTileRef * lru = srtm_tls;
+  for (auto & r: srtm_tls){
+    if (r.gen == g && r.key == key) {
+      auto t = r.tile.lock();
+      if (!t) { lru = &r; break; } // tile was removed from the cache
+      r.used = ++srtm_tls_cnt;
+
+      // Hits in the thread-local cache do not change the usage
+      // order in the tile cache. Update it from time to time,
+      // put the tile back if it was removed.
+      if (++r.hits >= SRTM_TLS_TOUCH){
+        r.hits = 0;
+        std::shared_ptr<const SRTMTile> t1;
+        if (!tiles.get(key, t1)) tiles.add(key, t);
+      }
+      return t;
+    }
+    if (r.used < lru->used) lru = &r;
+  }
+  auto t = get_tile_ptr(key);
+  lru->tile = t;
+  lru->key  = key;
+  lru->gen  = g;
+  lru->used = ++srtm_tls_cnt;
+  lru->hits = 0;
+  return t;
+}
+
+/************************************************/
+// Locking
+
+SRTM::WriteLock::WriteLock(SRTM * s): s(s) {
+  // pthread_rwlock_wrlock() would deadlock
+  for (auto p: srtm_rlocks)
+    if (p == s) throw Err() << "SRTM: get_lock() is called "
+      "while the same thread holds a read lock";
+  pthread_rwlock_wrlock(&s->opt_lock);
+}
+
+SRTM::WriteLock::~WriteLock() {
+  if (s) pthread_rwlock_unlock(&s->opt_lock);
+}
+
+SRTM::ReadLock::ReadLock(SRTM * s): s(s) {
+  // Lock only once in each thread: with writer preference
+  // a recursive pthread_rwlock_rdlock() can deadlock.
+  bool locked = false;
+  for (auto p: srtm_rlocks) if (p == s) locked = true;
+  if (!locked) pthread_rwlock_rdlock(&s->opt_lock);
+  srtm_rlocks.push_back(s);
+}
+
+SRTM::ReadLock::~ReadLock() {
+  if (!s) return;
+  // remove the last entry for this object
+  auto i = srtm_rlocks.end();
+  while (i != srtm_rlocks.begin()) {
+    --i;
+    if (*i == s) { srtm_rlocks.erase(i); break; }
+  }
+  for (auto p: srtm_rlocks) if (p == s) return;
+  pthread_rwlock_unlock(&s->opt_lock);
+}
+
+/************************************************/
+
+SRTM::SRTM(const Opt & o):
+    tiles((size_t)SRTM_CACHE_SIZE<<20),
+    cell_info(new std::atomic<uint64_t>[360*180]),
+    gen(++srtm_gen), use_overlay(true) {
+  for (size_t i=0; i<360*180; i++) cell_info[i] = 0;
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+  // prefer writers: set_opt() should not wait for all readers forever
+  pthread_rwlockattr_setkind_np(&attr,
+    PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  pthread_rwlock_init(&opt_lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
   set_opt(o);
 }
 
+SRTM::~SRTM(){
+  pthread_rwlock_destroy(&opt_lock);
+}
+
 Opt
 SRTM::get_def_opt() {
   Opt o;
@@ -228,10 +633,25 @@ SRTM::set_opt(const Opt & opt){
   std::string dir = opt.get("srtm_dir",
     std::string(getenv("HOME")? getenv("HOME"):"") + "/.srtm_data");
 
-  // set new value and clear data cache if needed
-  if (dir!=srtm_dir){
-    srtm_dir = dir;
-    srtm_cache.clear();
+  // Folder for uncompressed tile cache. Default: no cache.
+  std::string cdir = opt.get("srtm_cache_dir", "");
+  if (cdir!="") file_mkdir(cdir);
+
+  // Use overlay. Overview tiles are made with or without it.
+  bool ovl = opt.get<bool>("srtm_use_overlay", 1);
+
+  // set new values and clear data cache if needed
+  {
+    std::lock_guard<std::recursive_mutex> lk(cache_mutex);
+    if (dir!=srtm_dir || cdir!=cache_dir || ovl!=use_overlay){
+      srtm_dir = dir;
+      cache_dir = cdir;
+      use_overlay = ovl;
+      clear_tiles();
+      // memory-mapped tiles are cheap, keep more of them
+      tiles.get_budget()->set_size_total((size_t)
+        (cache_dir=="" ? SRTM_CACHE_SIZE : SRTM_CACHE_SIZE_MMAP)<<20);
+    }
   }
 
   auto srtm_interp_s = opt.get("srtm_interp", "linear");
@@ -248,10 +668,10 @@ SRTM::set_opt(const Opt & opt){
     << "(heights, shades, or slopes expected): " << m;
 
   // color limits
-  double hmin = opt.get("srtm_hmin", 0.0);
-  double hmax = opt.get("srtm_hmax", 5000.0);
-  double smin = opt.get("srtm_smin", 35.0);
-  double smax = opt.get("srtm_smax", 50.0);
+  hmin = opt.get("srtm_hmin", 0.0);
+  hmax = opt.get("srtm_hmax", 5000.0);
+  smin = opt.get("srtm_smin", 35.0);
+  smax = opt.get("srtm_smax", 50.0);
 
   // set rainbow converters:
   if (draw_mode == SRTM_DRAW_HEIGHTS ||
@@ -261,9 +681,6 @@ SRTM::set_opt(const Opt & opt){
     R = Rainbow(smin,smax, RAINBOW_BURNING);
 
   bgcolor = opt.get<int>("srtm_bgcolor", 0x60FF0000);
-
-  use_overlay = opt.get<bool>("srtm_use_overlay", 1);
-
 }
 
 /************************************************/
@@ -271,14 +688,30 @@ SRTM::set_opt(const Opt & opt){
 // Distance between points (dx,dy) at a given place.
 // (0,0) if data is missing.
 dPoint
-SRTM::get_step(const dPoint& p){
-  return get_tile(floor(p)).step;
+SRTM::get_step(const dPoint& p, int level){
+  return get_tile(tile_key(p, level))->step;
 }
 
-// Low-level get function: rounding coordinate to the nearest point
+int
+SRTM::get_level(const dPoint& p, double res){
+  if (!(res>0)) return 0;
+  // original step and number of levels are known
+  // from cell_info
+  uint64_t v = get_cell_info(p);
+  size_t w = (v>>8) & 0xFFFFFF, h = (v>>32) & 0xFFFFFF;
+  int n = (v>>2) & 0xF;
+  bool srtm = v & 2;
+  if (w<2 || h<2) return 0; // no data
+  double d = srtm ? 1.0/(std::max(w,h)-1) : 1.0/std::max(w,h);
+  int l = floor(log2(res/d) + 1e-6);
+  if (l<0) l = 0;
+  if (l>n) l = n;
+  return l;
+}
+
+// Nearest point in a given tile
 double
-SRTM::get_nearest(const dPoint& p){
-  auto & tile = get_tile(floor(p));
+SRTM::tile_nearest(const SRTMTile & tile, const dPoint& p) const{
   if (tile.is_empty()) return SRTM_VAL_NOFILE;
 
   // Pixel coordinate, [0..1200) for srtm,  [-0.5 .. 1199.5) for alos
@@ -290,9 +723,43 @@ SRTM::get_nearest(const dPoint& p){
   return tile.get_unsafe(px, use_overlay);
 }
 
+// Bilinear interpolation inside a given tile.
+bool
+SRTM::tile_interp(const SRTMTile & tile, const dPoint& p, double & h) const{
+  if (tile.is_empty()) {h = SRTM_VAL_NOFILE; return true;}
+
+  // Pixel coordinate, [0..1200)
+  dPoint px = tile.ll2px(p);
+  int x1 = floor(px.x), x2 = x1+1;
+  int y1 = floor(px.y), y2 = y1+1;
+
+  // This should always work for SRTM.
+  // But ALOS has 0.5 pixel shift and 1 pixel smaller image,
+  // coordinate could be outside the image on any side.
+  if (!(x1>0 && y1>0 && x2<tile.w && y2<tile.h)) return false;
+
+  double sx = px.x - x1;
+  double sy = px.y - y1;
+  double h1 = tile.get_unsafe(iPoint(x1, y1), use_overlay);
+  double h2 = tile.get_unsafe(iPoint(x1, y2), use_overlay);
+  double h3 = tile.get_unsafe(iPoint(x2, y1), use_overlay);
+  double h4 = tile.get_unsafe(iPoint(x2, y2), use_overlay);
+  if ((h1<SRTM_VAL_MIN)||(h2<SRTM_VAL_MIN)||
+      (h3<SRTM_VAL_MIN)||(h4<SRTM_VAL_MIN)) h = SRTM_VAL_UNDEF;
+  else h = h1*(1-sx)*(1-sy) + h2*(1-sx)*sy + h3*sx*(1-sy) + h4*sy*sx;
+  return true;
+}
+
+// Low-level get function: rounding coordinate to the nearest point
+double
+SRTM::get_nearest(const dPoint& p, int level){
+  return tile_nearest(*get_tile(tile_key(p, level)), p);
+}
+
 void
 SRTM::get_interp_pts(const iPoint key, const dPoint & p, std::set<dPoint> & pts){
-  auto & tile = get_tile(key);
+  auto tp = get_tile(key);
+  const auto & tile = *tp;
   if (tile.empty) return;
 
   // Pixel coordinate (could be outside the image)
@@ -332,83 +799,122 @@ SRTM::get_interp_pts(const iPoint key, const dPoint & p, std::set<dPoint> & pts)
 
 // Bilinear interpolation
 double
-SRTM::get_interp(const dPoint& p){
-  auto & tile = get_tile(floor(p));
-  if (tile.is_empty()) return SRTM_VAL_NOFILE;
+SRTM::get_interp(const dPoint& p, int level){
+  auto tp = get_tile(tile_key(p, level));
+  const auto & tile = *tp;
+  double h;
+  if (tile_interp(tile, p, h)) return h;
+  return get_interp_seam(tile, p);
+}
 
-  // Pixel coordinate, [0..1200)
+// Bilinear interpolation between tiles
+double
+SRTM::get_interp_seam(const SRTMTile & tile, const dPoint& p){
   dPoint px = tile.ll2px(p);
   int x1 = floor(px.x), x2 = x1+1;
   int y1 = floor(px.y), y2 = y1+1;
 
-  // This should always work for SRTM.
-  // But ALOS has 0.5 pixel shift and 1 pixel smaller image,
-  // coordinate could be outside the image on any side.
-  if (x1>0 && y1>0 && x2<tile.w && y2<tile.h){
-    double sx = px.x - x1;
-    double sy = px.y - y1;
-    double h1 = tile.get_unsafe(iPoint(x1, y1), use_overlay);
-    double h2 = tile.get_unsafe(iPoint(x1, y2), use_overlay);
-    if ((h1<SRTM_VAL_MIN)||(h2<SRTM_VAL_MIN)) return SRTM_VAL_UNDEF;
-
-    double h3 = tile.get_unsafe(iPoint(x2, y1), use_overlay);
-    double h4 = tile.get_unsafe(iPoint(x2, y2), use_overlay);
-    if ((h3<SRTM_VAL_MIN)||(h4<SRTM_VAL_MIN)) return SRTM_VAL_UNDEF;
-
-    return h1*(1-sx)*(1-sy) + h2*(1-sx)*sy + h3*sx*(1-sy) + h4*sy*sx;
-  }
-  else {
-    // collect points from adjecent tiles
-    std::set<dPoint> pts;
-    dPoint pa = tile.px2ll(dPoint(x1,y1));
-    dPoint pb = tile.px2ll(dPoint(x2,y2));
-    for (int kx = floor(pa.x); kx<=floor(pb.x); kx++){
-      for (int ky = floor(pb.y); ky<=floor(pa.y); ky++){
-        get_interp_pts(iPoint(kx,ky), p, pts);
-      }
-    }
-
-    // We want to do something close to bilinear interpolation.
-    // In most cases we should have 4 points (unless some tiles are missing).
-    if (pts.size()!=4) return SRTM_VAL_UNDEF;
-    dPoint p1,p2,p3,p4;
-    p1 = p2 = p3 = p4 = *pts.begin();
-
-    // sort points
-    for (const auto & pp:pts){
-      if (p1.x + p1.y < pp.x + pp.y) p1 = pp; // max(x+y), trc
-      if (p2.x - p2.y < pp.x - pp.y) p2 = pp; // max(x-y), brc
-      if (p3.x - p3.y > pp.x - pp.y) p3 = pp; // min(x-y), tlc
-      if (p4.x + p4.y > pp.x + pp.y) p4 = pp; // min(x+y), blc
+  // collect points from adjecent tiles
+  std::set<dPoint> pts;
+  dPoint pa = tile.px2ll(dPoint(x1,y1));
+  dPoint pb = tile.px2ll(dPoint(x2,y2));
+  for (int kx = floor(pa.x); kx<=floor(pb.x); kx++){
+    for (int ky = floor(pb.y); ky<=floor(pa.y); ky++){
+      get_interp_pts(iPoint(kx,ky,tile.key.z), p, pts);
     }
+  }
 
-    dPoint p12 = p1.y==p2.y? (p1+p2)/2 : p1 + (p2-p1)*(p.y - p1.y)/(p2.y-p1.y);
-    dPoint p34 = p3.y==p4.y? (p3+p4)/2 : p3 + (p4-p3)*(p.y - p3.y)/(p4.y-p3.y);
-    dPoint p1234 = p12.x==p34.x? (p12+p34)/2 : p12 + (p34-p12)*(p.x - p12.x)/(p34.x-p12.x);
-    return (int16_t)p1234.z;
+  // We want to do something close to bilinear interpolation.
+  // In most cases we should have 4 points (unless some tiles are missing).
+  if (pts.size()!=4) return SRTM_VAL_UNDEF;
+  dPoint p1,p2,p3,p4;
+  p1 = p2 = p3 = p4 = *pts.begin();
+
+  // sort points
+  for (const auto & pp:pts){
+    if (p1.x + p1.y < pp.x + pp.y) p1 = pp; // max(x+y), trc
+    if (p2.x - p2.y < pp.x - pp.y) p2 = pp; // max(x-y), brc
+    if (p3.x - p3.y > pp.x - pp.y) p3 = pp; // min(x-y), tlc
+    if (p4.x + p4.y > pp.x + pp.y) p4 = pp; // min(x+y), blc
   }
-  return SRTM_VAL_UNDEF;
+
+  dPoint p12 = p1.y==p2.y? (p1+p2)/2 : p1 + (p2-p1)*(p.y - p1.y)/(p2.y-p1.y);
+  dPoint p34 = p3.y==p4.y? (p3+p4)/2 : p3 + (p4-p3)*(p.y - p3.y)/(p4.y-p3.y);
+  dPoint p1234 = p12.x==p34.x? (p12+p34)/2 : p12 + (p34-p12)*(p.x - p12.x)/(p34.x-p12.x);
+  return (int16_t)p1234.z;
 }
 
 // Get with interpolation
 double
-SRTM::get_h(const dPoint& p, bool raw){
-  if (raw || srtm_interp == SRTM_NEAREST) return get_nearest(p);
-  if (srtm_interp == SRTM_LINEAR) { return get_interp(p); }
-  throw Err() << "SRTM: unknown interpolation style: " << srtm_interp;
+SRTM::get_h(const dPoint& p, bool raw, double res){
+  return get_h_level(p, raw, get_level(p, res));
+}
+
+void
+SRTM::get_h_grid(const dPoint & p0, const dPoint & step,
+                 const size_t w, const size_t h, float * buf,
+                 bool raw, double res){
+  bool nearest = raw || srtm_interp == SRTM_NEAREST;
+  for (size_t j=0; j<h; j++){
+    dPoint p(p0.x, p0.y + j*step.y);
+    size_t i = 0;
+    while (i<w){
+      // find tile for a run of points in a row
+      p.x = p0.x + i*step.x;
+      int kx = floor(p.x);
+      auto tile = get_tile(tile_key(p, get_level(p, res)));
+      for (; i<w; i++){
+        p.x = p0.x + i*step.x;
+        if (floor(p.x) != kx) break;
+        buf[j*w+i] = get_h_tile(*tile, p, nearest);
+      }
+    }
+  }
+}
+
+ImageR
+SRTM::get_h_grid(const dPoint & p0, const dPoint & step,
+                 const size_t w, const size_t h, bool raw, double res){
+  ImageR img(w, h, IMAGE_FLOAT);
+  get_h_grid(p0, step, w, h, (float *)img.data(), raw, res);
+  return img;
+}
+
+void
+SRTM::get_h_pts(const dPoint * pts, const size_t n, float * buf,
+                bool raw, double res){
+  bool nearest = raw || srtm_interp == SRTM_NEAREST;
+  std::shared_ptr<const SRTMTile> tile;
+  iPoint key;
+  for (size_t i=0; i<n; i++){
+    iPoint k = tile_key(pts[i], 0);
+    if (!tile || k!=key) {
+      key = k;
+      tile = get_tile(tile_key(pts[i], get_level(pts[i], res)));
+    }
+    buf[i] = get_h_tile(*tile, pts[i], nearest);
+  }
+}
+
+std::vector<float>
+SRTM::get_h_pts(const dLine & pts, bool raw, double res){
+  std::vector<float> ret(pts.size());
+  if (pts.size()) get_h_pts(pts.data(), pts.size(), ret.data(), raw, res);
+  return ret;
 }
 
 double
-SRTM::get_s(const dPoint& p, bool raw){
-  dPoint d = get_step(p);
-  int h  = get_h(p, raw);
-  int h1 = get_h(p + dPoint(-d.x, 0), raw);
-  int h2 = get_h(p + dPoint(+d.x, 0), raw);
+SRTM::get_s(const dPoint& p, bool raw, double res){
+  int l = get_level(p, res);
+  dPoint d = get_step(p, l);
+  int h  = get_h_level(p, raw, l);
+  int h1 = get_h_level(p + dPoint(-d.x, 0), raw, l);
+  int h2 = get_h_level(p + dPoint(+d.x, 0), raw, l);
   if (h1 < SRTM_VAL_MIN && h > SRTM_VAL_MIN && h2 > SRTM_VAL_MIN) h1 = 2*h - h2;
   if (h2 < SRTM_VAL_MIN && h > SRTM_VAL_MIN && h1 > SRTM_VAL_MIN) h2 = 2*h - h1;
 
-  int h3 = get_h(p + dPoint(0, -d.y), raw);
-  int h4 = get_h(p + dPoint(0, +d.y), raw);
+  int h3 = get_h_level(p + dPoint(0, -d.y), raw, l);
+  int h4 = get_h_level(p + dPoint(0, +d.y), raw, l);
   if (h3 < SRTM_VAL_MIN && h > SRTM_VAL_MIN && h4 > SRTM_VAL_MIN) h3 = 2*h - h4;
   if (h4 < SRTM_VAL_MIN && h > SRTM_VAL_MIN && h3 > SRTM_VAL_MIN) h4 = 2*h - h3;
 
@@ -422,10 +928,11 @@ SRTM::get_s(const dPoint& p, bool raw){
 }
 
 ImageR
-SRTM::get_img(const dRect & rng, dPoint & blc, dPoint & step){
-  iPoint key0 = floor(rng.cnt());
-  // main tile - we want to copy it, because it can be removed from the cache
-  auto tile0 = get_tile(key0);
+SRTM::get_img(const dRect & rng, dPoint & blc, dPoint & step, double res){
+  iPoint key0 = tile_key(rng.cnt(), get_level(rng.cnt(), res));
+  // main tile - we want to keep it, because it can be removed from the cache
+  auto tile0p = get_tile(key0);
+  const auto & tile0 = *tile0p;
   if (tile0.is_empty()) return ImageR();
 
   dPoint c1p = tile0.ll2px(rng.tlc());
@@ -447,7 +954,7 @@ SRTM::get_img(const dRect & rng, dPoint & blc, dPoint & step){
       }
       else {
         dPoint pt = tile0.px2ll(dPoint(x,y));
-        int16_t c = (int16_t)get_interp(pt);
+        int16_t c = (int16_t)get_interp(pt, key0.z);
         if (c<SRTM_VAL_MIN) c=0;
         img.set16(x-c1.x, c2.y-y, c);
       }
@@ -471,24 +978,259 @@ SRTM::get_color(const double h, const double s){
 
 /// Get color for a point (lon-lat coords), according with drawing options.
 uint32_t
-SRTM::get_color(const dPoint & p, bool raw) {
+SRTM::get_color(const dPoint & p, bool raw, double res) {
   switch (draw_mode){
-    case SRTM_DRAW_SLOPES:  return R.get(get_s(p, raw));
-    case SRTM_DRAW_HEIGHTS: return R.get(get_h(p, raw));
+    case SRTM_DRAW_SLOPES:  return R.get(get_s(p, raw, res));
+    case SRTM_DRAW_HEIGHTS: return R.get(get_h(p, raw, res));
     case SRTM_DRAW_SHADES:
-      return color_shade(R.get(get_h(p, raw)), 1-get_s(p, raw)/90.0);
+      return color_shade(R.get(get_h(p, raw, res)), 1-get_s(p, raw, res)/90.0);
   }
   return bgcolor;
 }
 
+/************************************************/
+// Raster surface pipeline
+
+// Size of lookup tables for colors
+#define SRTM_LUT_SIZE 4096
+
+// Aspect [deg] for a height gradient (gx to east, gy to north):
+// direction of the downhill slope, clockwise from north, 0..360.
+// NaN for flat areas.
+static inline float
+grad_aspect(const float gx, const float gy){
+  if (gx==0 && gy==0) return NAN;
+  float a = atan2(-gx, -gy)*180.0/M_PI;
+  return a<0 ? a+360 : a;
+}
+
+// Calculate u = sin(slope) for a height grid (w x h floats) with 3x3
+// stencil, and (if aa is not NULL) aspect. Holes and image borders are
+// processed as in get_s(): missing point is extrapolated from the
+// opposite one, NaN is returned if it is not possible. Interior rows are
+// processed with separate loops over contiguous arrays without checks.
+// This is plain scalar code, no SIMD intrinsics are used.
+static void
+slope_rows(const float * hh, const size_t w, const size_t h,
+           const dPoint & blc, const dPoint & step, float * uu,
+           float * aa = NULL){
+
+  const double m = 6380e3 * M_PI/180;
+  std::vector<float> gx(w), gy(w);
+
+  for (size_t y=0; y<h; y++){
+    const float *r0 = hh + y*w;
+    const float *rp = y>0   ? r0-w : r0; // row to the south
+    const float *rn = y<h-1 ? r0+w : r0; // row to the north
+    float *u = uu + y*w;
+    float *a = aa? aa + y*w : NULL;
+
+    // step in meters
+    const float kx = 1.0/(2*step.x*m*cos(M_PI*(blc.y + y*step.y)/180.0));
+    const float ky = 1.0/(2*step.y*m);
+
+    // main loop (no checks)
+    if (w>2) {
+      for (size_t x=1; x<w-1; x++) gx[x] = (r0[x+1] - r0[x-1])*kx;
+      for (size_t x=1; x<w-1; x++) gy[x] = (rn[x] - rp[x])*ky;
+      for (size_t x=1; x<w-1; x++){
+        float U2 = gx[x]*gx[x] + gy[x]*gy[x];
+        u[x] = sqrt(U2/(1+U2));
+      }
+      if (a) for (size_t x=1; x<w-1; x++) a[x] = grad_aspect(gx[x], gy[x]);
+    }
+
+    // points near holes and borders
+    for (size_t x=0; x<w; x++){
+      bool brd = x==0 || x==w-1 || y==0 || y==h-1;
+      if (!brd &&
+          r0[x]>=SRTM_VAL_MIN && r0[x-1]>=SRTM_VAL_MIN && r0[x+1]>=SRTM_VAL_MIN &&
+          rp[x]>=SRTM_VAL_MIN && rn[x]>=SRTM_VAL_MIN) continue;
+
+      double h0 = r0[x];
+      double h1 = x>0   ? r0[x-1] : SRTM_VAL_UNDEF;
+      double h2 = x<w-1 ? r0[x+1] : SRTM_VAL_UNDEF;
+      double h3 = y>0   ? rp[x] : SRTM_VAL_UNDEF;
+      double h4 = y<h-1 ? rn[x] : SRTM_VAL_UNDEF;
+      if (a) a[x] = NAN;
+      if (h0 < SRTM_VAL_MIN) { u[x] = NAN; continue; }
+      if (h1 < SRTM_VAL_MIN && h2 >= SRTM_VAL_MIN) h1 = 2*h0 - h2;
+      if (h2 < SRTM_VAL_MIN && h1 >= SRTM_VAL_MIN) h2 = 2*h0 - h1;
+      if (h3 < SRTM_VAL_MIN && h4 >= SRTM_VAL_MIN) h3 = 2*h0 - h4;
+      if (h4 < SRTM_VAL_MIN && h3 >= SRTM_VAL_MIN) h4 = 2*h0 - h3;
+      if (h1 < SRTM_VAL_MIN || h2 < SRTM_VAL_MIN ||
+          h3 < SRTM_VAL_MIN || h4 < SRTM_VAL_MIN) { u[x] = NAN; continue; }
+      double U2 = pow((h2-h1)*kx, 2) + pow((h4-h3)*ky, 2);
+      u[x] = sqrt(U2/(1+U2));
+      if (a) a[x] = grad_aspect((h2-h1)*kx, (h4-h3)*ky);
+    }
+  }
+}
+
+// Get heights from IMAGE_16 or IMAGE_FLOAT image as a float array
+static std::vector<float>
+dem_to_float(const ImageR & dem){
+  std::vector<float> ret(dem.width()*dem.height());
+  switch (dem.type()){
+    case IMAGE_FLOAT:
+      memcpy(ret.data(), dem.data(), ret.size()*sizeof(float));
+      break;
+    case IMAGE_16:
+      for (size_t i=0; i<ret.size(); i++)
+        ret[i] = ((int16_t *)dem.data())[i];
+      break;
+    default:
+      throw Err() << "SRTM: IMAGE_16 or IMAGE_FLOAT image expected";
+  }
+  return ret;
+}
+
+ImageR
+SRTM::get_slope_img(const ImageR & dem, const dPoint & blc, const dPoint & step){
+  if (dem.is_empty()) return ImageR();
+  auto hh = dem_to_float(dem);
+  ImageR ret(dem.width(), dem.height(), IMAGE_FLOAT);
+  float * uu = (float *)ret.data();
+  slope_rows(hh.data(), dem.width(), dem.height(), blc, step, uu);
+  for (size_t i=0; i<hh.size(); i++) uu[i] = asin(uu[i])*180.0/M_PI;
+  return ret;
+}
+
+ImageR
+SRTM::get_aspect_img(const ImageR & dem, const dPoint & blc, const dPoint & step){
+  if (dem.is_empty()) return ImageR();
+  auto hh = dem_to_float(dem);
+  std::vector<float> uu(hh.size());
+  ImageR ret(dem.width(), dem.height(), IMAGE_FLOAT);
+  slope_rows(hh.data(), dem.width(), dem.height(), blc, step,
+             uu.data(), (float *)ret.data());
+  return ret;
+}
+
+// Lookup tables for converting heights and slopes to colors
+// according with SRTM drawing options.
+class SRTMColorLUT {
+  const SRTM & S;
+  const size_t N;
+  double h1, h2;   // height range of the LUT
+  bool use_hlut;
+  std::vector<uint32_t> hlut;  // heights: N values + colors below/above the range
+  std::vector<uint32_t> slut;  // slopes, as a function of u = sin(slope)
+  std::vector<double> klut;    // shading factor, as a function of u
+
+public:
+  SRTMColorLUT(const SRTM & S): S(S), N(SRTM_LUT_SIZE) {
+    // LUT for heights, built over [h1,h2] range. Colors are taken
+    // from the rainbow, which knows the ramp direction (hmin can be
+    // larger then hmax). For a degenerate range use the rainbow directly.
+    h1 = std::min(S.hmin, S.hmax);
+    h2 = std::max(S.hmin, S.hmax);
+    use_hlut = h2 > h1 && std::isfinite(h2-h1) &&
+      (S.draw_mode == SRTM::SRTM_DRAW_HEIGHTS ||
+       S.draw_mode == SRTM::SRTM_DRAW_SHADES);
+    if (use_hlut){
+      hlut.resize(N+2);
+      for (size_t i=0; i<N; i++) hlut[i] = S.R.get(h1 + (h2-h1)*i/(N-1));
+      hlut[N]   = S.R.get(-INFINITY);
+      hlut[N+1] = S.R.get(+INFINITY);
+    }
+    if (S.draw_mode == SRTM::SRTM_DRAW_HEIGHTS) return;
+    slut.resize(N);
+    klut.resize(N);
+    for (size_t i=0; i<N; i++){
+      double s = asin(double(i)/(N-1))*180.0/M_PI;
+      slut[i] = S.R.get(s);
+      klut[i] = 1-s/90.0;
+    }
+  }
+
+  // color for a height
+  uint32_t hcol(const float v) const {
+    if (!use_hlut || std::isnan(v)) return S.R.get(v);
+    if (v < h1) return hlut[N];
+    if (v > h2) return hlut[N+1];
+    return hlut[rint((v-h1)/(h2-h1)*(N-1))];
+  }
+
+  // color for height h and u = sin(slope) (u is not used in heights mode)
+  uint32_t operator()(const float h, const float u) const {
+    if (S.draw_mode == SRTM::SRTM_DRAW_HEIGHTS)
+      return h < SRTM_VAL_MIN ? S.bgcolor : hcol(h);
+    if (std::isnan(u)) return S.bgcolor;
+    size_t n = rint(u*(N-1));
+    if (S.draw_mode == SRTM::SRTM_DRAW_SLOPES) return slut[n];
+    return color_shade(hcol(h), klut[n]);
+  }
+};
+
+ImageR
+SRTM::get_color_img(const ImageR & dem, const dPoint & blc, const dPoint & step){
+  if (dem.is_empty()) return ImageR();
+  size_t w = dem.width(), h = dem.height();
+  auto hh = dem_to_float(dem);
+  ImageR ret(w, h, IMAGE_32ARGB);
+  ret.set_bgcolor(bgcolor);
+  uint32_t * cc = (uint32_t *)ret.data();
+  SRTMColorLUT lut(*this);
+
+  // heights mode: no slopes are needed
+  if (draw_mode == SRTM_DRAW_HEIGHTS){
+    for (size_t i=0; i<hh.size(); i++) cc[i] = lut(hh[i], 0);
+    return ret;
+  }
+
+  std::vector<float> uu(w*h);
+  slope_rows(hh.data(), w, h, blc, step, uu.data());
+  for (size_t i=0; i<hh.size(); i++) cc[i] = lut(hh[i], uu[i]);
+  return ret;
+}
+
+void
+SRTM::get_color_pts(const ImageR & dem, const dPoint & blc, const dPoint & step,
+                    const dPoint * pts, const size_t n, uint32_t * cc){
+  if (dem.is_empty()) {
+    for (size_t k=0; k<n; k++) cc[k] = bgcolor;
+    return;
+  }
+  int w = dem.width(), h = dem.height();
+  auto hh = dem_to_float(dem);
+  std::vector<float> uu(w*h);
+  if (draw_mode != SRTM_DRAW_HEIGHTS)
+    slope_rows(hh.data(), w, h, blc, step, uu.data());
+  SRTMColorLUT lut(*this);
+
+  for (size_t k=0; k<n; k++){
+    dPoint q((pts[k].x - blc.x)/step.x, (pts[k].y - blc.y)/step.y);
+    int x1 = floor(q.x), y1 = floor(q.y);
+    if (x1<0 || y1<0 || x1+1>=w || y1+1>=h) { cc[k] = bgcolor; continue; }
+    double dx = q.x-x1, dy = q.y-y1;
+    size_t i[4] = {(size_t)(y1*w+x1), (size_t)(y1*w+x1+1),
+                   (size_t)((y1+1)*w+x1), (size_t)((y1+1)*w+x1+1)};
+    double k4[4] = {(1-dx)*(1-dy), dx*(1-dy), (1-dx)*dy, dx*dy};
+    double H = 0, U = 0;
+    bool hole = false;
+    for (int m=0; m<4; m++){
+      if (hh[i[m]] < SRTM_VAL_MIN || std::isnan(uu[i[m]])) {hole = true; break;}
+      H += k4[m]*hh[i[m]];
+      U += k4[m]*uu[i[m]];
+    }
+    // near holes use the nearest DEM point
+    if (hole){
+      size_t i0 = i[(dx>=0.5? 1:0) + (dy>=0.5? 2:0)];
+      H = hh[i0]; U = uu[i0];
+    }
+    cc[k] = lut(H, U);
+  }
+}
+
 /************************************************/
 
 std::map<double, dMultiLine>
-SRTM::find_contours(const dRect & range, double step, double vtol, double R){
+SRTM::find_contours(const dRect & range, double step, double vtol, double R, double res){
 
   // Extract altitudes for the whole range, make image
   dPoint blc, d;
-  ImageR img = get_img(range, blc, d);
+  ImageR img = get_img(range, blc, d, res);
 
   auto ret = image_cnt(img, NAN, NAN, step, 0);
   if (vtol>0 && R>0) image_cnt_vtol_filter(img, ret, vtol);
@@ -508,14 +1250,15 @@ SRTM::find_slope_contours(const dRect & range, double val, double vtol, double R
   int y1  = irange.tlc().y;
   int y2  = irange.brc().y;
 
-  // Extract slopes for the whole range.
+  // Extract slopes for the whole range (with 1pt margins),
   // make image with slopes
-  ImageR img(x2-x1+1, y2-y1+1, IMAGE_FLOAT);
-  for (int y=y1; y<=y2; y++){
-    for (int x=x1; x<=x2; x++){
-      img.setF(x-x1,y-y1, get_s(dPoint(x*d.x,y*d.y)));
-    }
-  }
+  size_t w = x2-x1+1, h = y2-y1+1;
+  dPoint blc((x1-1)*d.x, (y1-1)*d.y);
+  ImageR img0 = get_slope_img(get_h_grid(blc, d, w+2, h+2), blc, d);
+  ImageR img(w, h, IMAGE_FLOAT);
+  for (size_t y=0; y<h; y++)
+    for (size_t x=0; x<w; x++)
+      img.setF(x,y, img0.getF(x+1,y+1));
 
   auto ret = image_cnt(img, val, val, 1.0, 1);
   if (vtol>0 && R>0) image_cnt_vtol_filter(img, ret, vtol, R);
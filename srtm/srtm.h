@@ -5,8 +5,13 @@
 #include <map>
 #include <string>
 #include <mutex>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <pthread.h>
 
-#include "cache/cache.h"
+#include "cache/sizecache_mt.h"
 #include "image/image_r.h"
 #include "geom/multiline.h"
 #include "rainbow/rainbow.h"
@@ -26,6 +31,20 @@ with --srtm_dir option.
 or .hgt.gz, .tif, or .tiff files. Each file contains 1x1 degree area.
 Different resolutions and formats can be mixed in a singe folder.
 
+- With --srtm_cache_dir option uncompressed copies of tiles
+(<name>.dem files: 16-byte header and raw little-endian int16 data)
+are created in the cache folder when tiles are read first time.
+These files are memory-mapped instead of decompressing data.
+
+- Overview tiles (levels 1..SRTM_MAX_LEVEL, 2x, 4x, ... decimation) are
+used for low-resolution requests: each level is made from the previous
+one by averaging (holes are skipped), and saved to
+<name>.L<n>.dem files in the cache folder (<name>.L<n>.noovl.dem if
+overlay is not used) when tiles are requested first time. If the cache
+folder is not set or files can not be written, overviews are kept only
+in memory. Data access functions have `res` parameter: resolution [deg]
+needed by the caller, level with step not larger then res is used.
+
 SRTM data: https://surferhelp.goldensoftware.com/subsys/HGT_NASA_SRTM_Data_File_Description.htm
 1x1-degree tiles, 1201x1201 or 3601x3601 pixels. Resolution is 1/1200 or 1/3600 degree.
 Center of lower-left pixel is at integer degree coordinate. First and last column/row are identical.
@@ -37,8 +56,21 @@ center of lower-left point is at integer degree coordinate + 1/2 of the resoluti
 
 */
 
-// default size of SRTM tile cache
-#define SRTM_CACHE_SIZE 32
+// default size of SRTM tile cache, MB
+#define SRTM_CACHE_SIZE 512
+
+// size of SRTM tile cache when memory-mapped tiles are used, MB
+#define SRTM_CACHE_SIZE_MMAP 2048
+
+// max overview level (decimation factor 2^SRTM_MAX_LEVEL)
+#define SRTM_MAX_LEVEL 4
+
+// size of thread-local tile cache (see SRTM::get_tile)
+#define SRTM_TLS_SIZE 8
+
+// update usage of a tile in SRTM tile cache after this number
+// of hits in the thread-local cache
+#define SRTM_TLS_TOUCH 256
 
 #define SRTM_VAL_NOFILE -32767 // file not found
 #define SRTM_VAL_UNDEF  -32768 // hole in data
@@ -58,13 +90,28 @@ void ms2opt_add_srtm_surf(GetOptSet & opts);
 /********************************************************************/
 
 struct SRTMTile: public ImageR {
-  SRTMTile(const std::string & dir, const iPoint & key); // load tile
+
+  // Function for getting tiles of the previous level
+  typedef std::function<std::shared_ptr<const SRTMTile>(const iPoint &)> get_src_t;
+
+  // Load tile from dir. If cache_dir is not empty, use memory-mapped
+  // uncompressed copy of the tile from it (create it if needed).
+  // key.z is overview level (0 for original data). Overview tiles are
+  // read from cache_dir or made from the previous level, which is
+  // taken from get_src (or loaded from dir if get_src is empty).
+  // use_overlay -- use overlay data for making overviews.
+  SRTMTile(const std::string & dir, const iPoint & key,
+           const std::string & cache_dir = "",
+           const bool use_overlay = true,
+           const get_src_t & get_src = get_src_t());
 
   iPoint key;
-  std::map<iPoint, int16_t> overlay; // overlay data
+  std::map<iPoint, int16_t> overlay; // overlay data (only for level 0)
   bool srtm;   // SRTM/ALOS data format
   dPoint step; // x/y steps in degrees
   size_t w, h; // image dimensions
+  int shift;   // decimation factor is 2^shift (can be less then the level
+               // if the tile can not be decimated further)
 
   bool empty;
   bool is_empty() const {return empty;} // slightly different from Image::is_empty
@@ -93,7 +140,21 @@ struct SRTMTile: public ImageR {
     return get16(crd.x, crd.y);
   }
 
+  // make overview tile from the previous level
+  void make_overview(const SRTMTile & src, const bool use_overlay);
 
+  // Can a tile with w x h points be decimated?
+  static bool can_decimate(const size_t w, const size_t h, const bool srtm);
+
+};
+
+// Cost function for the tile cache: memory used by the tile.
+struct SRTMTileCost {
+  size_t operator()(const std::shared_ptr<const SRTMTile> & t) const {
+    if (!t) return 0;
+    return sizeof(SRTMTile) + t->dsize() +
+           t->overlay.size()*(sizeof(iPoint) + sizeof(int16_t) + 32);
+  }
 };
 
 /********************************************************************/
@@ -103,19 +164,79 @@ class SRTM {
   /// SRTM data folder.
   std::string srtm_dir;
 
-  /// data cache. key is lon,lat in degrees, images are of IMAGE_16 type
-  Cache<iPoint, SRTMTile> srtm_cache;
+  /// Folder for uncompressed tile cache (empty if not used).
+  std::string cache_dir;
+
+  /// Tile cache. Key is lon,lat in degrees, level. Loaded tiles are
+  /// immutable and reference-counted, the cache is sharded and
+  /// limited by memory used by tiles (SRTM_CACHE_SIZE or
+  /// SRTM_CACHE_SIZE_MMAP megabytes), see SizeCacheMT.
+  SizeCacheMT<iPoint, std::shared_ptr<const SRTMTile>,
+              std::hash<iPoint>, SRTMTileCost> tiles;
+
+  // Locking tile loading. Recursive: overview tiles
+  // are made from tiles of previous level which are loaded
+  // through the cache.
+  std::recursive_mutex cache_mutex;
+
+  // Information about original data for each 1x1 degree cell,
+  // filled when a tile is loaded and kept when it is removed from
+  // the cache: 0 if unknown, or bit 0: data known, bit 1: SRTM grid,
+  // bits 2..5: number of overview levels, bits 8..31, 32..55: width
+  // and height of original data. Used for overview level selection.
+  std::unique_ptr<std::atomic<uint64_t>[]> cell_info;
 
-  // Locking srtm cache
-  std::mutex cache_mutex;
+  // Update cell_info for a tile
+  void set_cell_info(const SRTMTile & t);
+
+  // Get cell_info for a point (load a tile if needed)
+  uint64_t get_cell_info(const dPoint & p);
+
+  // Cache generation, unique for each SRTM object and
+  // changed when the cache is cleared. Used to validate
+  // thread-local tile references.
+  std::atomic<uint64_t> gen;
+
+  // Read/write lock for options (see get_lock(), get_read_lock())
+  pthread_rwlock_t opt_lock;
 
   bool use_overlay;
 
-  // get tile
-  inline SRTMTile & get_tile(const iPoint & key) {
-    if (!srtm_cache.contains(key))
-      srtm_cache.add(key, SRTMTile(srtm_dir, key));
-    return srtm_cache.get(key);
+  // Load tile into the cache (if needed) and return it.
+  std::shared_ptr<const SRTMTile> load_tile(const iPoint & key);
+
+  // Remove all tiles from the cache (cache_mutex should be locked).
+  void clear_tiles();
+
+  // Get tile. Last used tiles are found through a small
+  // thread-local cache of weak references, without locking.
+  std::shared_ptr<const SRTMTile> get_tile(const iPoint & key);
+
+  // Get tile from the tile cache, load it if needed.
+  std::shared_ptr<const SRTMTile> get_tile_ptr(const iPoint & key);
+
+  // Get altitude at the nearest point of a given tile.
+  double tile_nearest(const SRTMTile & tile, const dPoint& p) const;
+
+  // Get altitude with bilinear interpolation inside a given tile.
+  // Return false if the point needs data from adjacent tiles.
+  bool tile_interp(const SRTMTile & tile, const dPoint& p, double & h) const;
+
+  // Get altitude with interpolation between tiles (slow).
+  double get_interp_seam(const SRTMTile & tile, const dPoint& p);
+
+  // Get altitude at a given level (see get_h).
+  double get_h_level(const dPoint& p, bool raw, int level){
+    if (raw || srtm_interp == SRTM_NEAREST) return get_nearest(p, level);
+    return get_interp(p, level);
+  }
+
+  // Get altitude for a point in a given tile (nearest or interpolated).
+  double get_h_tile(const SRTMTile & tile, const dPoint& p, bool nearest){
+    if (nearest) return tile_nearest(tile, p);
+    double h;
+    if (tile_interp(tile, p, h)) return h;
+    return get_interp_seam(tile, p);
   }
 
   public:
@@ -123,17 +244,55 @@ class SRTM {
     /// Constructor.
     SRTM(const Opt & o = Opt());
 
+    /// Destructor.
+    ~SRTM();
+
+    SRTM(const SRTM &) = delete;
+    SRTM & operator=(const SRTM &) = delete;
+
     // Options can be used to change data dir
     void set_opt(const Opt & opt);
 
     // Get default options.
     static Opt get_def_opt();
 
-    // Get lock. SRTM class goes not lock anything itself,
-    // User must lock set_opt, get_val, ... methods if they are
-    // used from different threads.
-    std::unique_lock<std::mutex> get_lock() {
-      return std::unique_lock<std::mutex>(cache_mutex);}
+    // Locking. Data access methods (get_h, get_s, get_color,
+    // get_img, find_*, ...) are thread-safe and can be used from many
+    // threads in parallel: tile loading and eviction are locked inside
+    // the SRTM class (tile cache, loading mutex), reading of loaded
+    // tiles does not need any locks. Changing options with set_opt()
+    // should be done with exclusive lock from get_lock(), users which
+    // read data from different threads should hold a read lock from
+    // get_read_lock().
+    // Many read locks can be held at the same time, get_lock() waits
+    // until all of them are released. Waiting writers have priority
+    // over new readers (on glibc), so a stream of readers can not
+    // block set_opt() forever. Read locks are recursive within a
+    // thread. A thread holding a read lock can not take the exclusive
+    // lock (there is no lock upgrade): get_lock() throws an error
+    // instead of a deadlock.
+
+    // Exclusive lock for set_opt().
+    class WriteLock {
+      SRTM * s;
+    public:
+      WriteLock(SRTM * s);
+      WriteLock(WriteLock && other): s(other.s) {other.s = NULL;}
+      WriteLock(const WriteLock &) = delete;
+      ~WriteLock();
+    };
+    WriteLock get_lock() { return WriteLock(this); }
+
+    // Shared lock for reading data.
+    class ReadLock {
+      SRTM * s;
+    public:
+      ReadLock(SRTM * s);
+      ReadLock(ReadLock && other): s(other.s) {other.s = NULL;}
+      ReadLock(const ReadLock &) = delete;
+      ~ReadLock();
+    };
+    ReadLock get_read_lock() { return ReadLock(this); }
 
     /******************************/
     // new interface
@@ -145,24 +304,50 @@ class SRTM {
 
     style_t srtm_interp;
 
-    // Distance between points (dx,dy) at a given place.
+    // Distance between points (dx,dy) at a given place and level.
     // (0,0) if data is missing.
-    dPoint get_step(const dPoint& p);
+    dPoint get_step(const dPoint& p, int level = 0);
+
+    // Overview level for resolution res [deg] at a given place:
+    // the largest level with data step not larger then res.
+    int get_level(const dPoint& p, double res);
 
     // Get points for interpolation (0,1,2,4 points) for a given tile.
     void get_interp_pts(const iPoint key, const dPoint & p, std::set<dPoint> & pts);
 
     // Get altitude at the nearest point
-    double get_nearest(const dPoint& p);
+    double get_nearest(const dPoint& p, int level = 0);
 
     // Get altitude with bilinear interpolation
-    double get_interp(const dPoint& p);
+    double get_interp(const dPoint& p, int level = 0);
 
     // get with interpolation
-    double get_h(const dPoint& p, bool raw=false);
+    // res -- resolution [deg] needed by the caller (0 - original data)
+    double get_h(const dPoint& p, bool raw=false, double res=0);
+
+    // get altitudes for a regular lon/lat grid of w x h points:
+    // (p0.x + i*step.x, p0.y + j*step.y), i=0..w-1, j=0..h-1.
+    // Values are written to buf[j*w+i].
+    // Each tile is found once for a row, cross-tile interpolation
+    // is done only near tile edges.
+    void get_h_grid(const dPoint & p0, const dPoint & step,
+                    const size_t w, const size_t h, float * buf,
+                    bool raw=false, double res=0);
+
+    // same, return IMAGE_FLOAT image
+    ImageR get_h_grid(const dPoint & p0, const dPoint & step,
+                      const size_t w, const size_t h,
+                      bool raw=false, double res=0);
+
+    // get altitudes for n points, write them to buf
+    void get_h_pts(const dPoint * pts, const size_t n, float * buf,
+                   bool raw=false, double res=0);
+
+    // same, return vector of altitudes
+    std::vector<float> get_h_pts(const dLine & pts, bool raw=false, double res=0);
 
     // get slope
-    double get_s(const dPoint& p, bool raw=false);
+    double get_s(const dPoint& p, bool raw=false, double res=0);
 
     // Get raster image with original points (if possible)
     // rng -- lonlat range
@@ -170,7 +355,8 @@ class SRTM {
     // step -- return conversion factor points -> degrees
     // Point grid is taken from the tile in the middle of the range.
     // Other tiles will be interpolated to this grid.
-    ImageR get_img(const dRect & rng, dPoint & blc, dPoint & step);
+    // res -- resolution [deg] needed by the caller (0 - original data)
+    ImageR get_img(const dRect & rng, dPoint & blc, dPoint & step, double res=0);
 
     /******************************/
     // color surface interface
@@ -190,7 +376,34 @@ class SRTM {
     uint32_t get_color(const double h, const double s);
 
     /// Get color for a point (lon-lat coords), according with drawing options.
-    uint32_t get_color(const dPoint & p, bool raw=false);
+    uint32_t get_color(const dPoint & p, bool raw=false, double res=0);
+
+    // Raster surface pipeline.
+    // dem -- DEM window: IMAGE_16 image from get_img() or IMAGE_FLOAT
+    // image from get_h_grid(); blc, step -- lon-lat coordinates of
+    // image point (0,0) and grid step (image y axis goes to north).
+
+    // Calculate slopes [deg] with 3x3 stencil, return IMAGE_FLOAT
+    // image (NaN for holes).
+    ImageR get_slope_img(const ImageR & dem, const dPoint & blc, const dPoint & step);
+
+    // Calculate aspect [deg] with the same stencil: direction of the
+    // downhill slope, clockwise from north (0..360). Return IMAGE_FLOAT
+    // image (NaN for holes and flat areas).
+    ImageR get_aspect_img(const ImageR & dem, const dPoint & blc, const dPoint & step);
+
+    // Make IMAGE_32ARGB image according with drawing options.
+    // Heights and slopes are converted to colors using lookup tables.
+    // Holes are drawn with bgcolor.
+    ImageR get_color_img(const ImageR & dem, const dPoint & blc, const dPoint & step);
+
+    // Same, but colors are calculated in n points pts (lon-lat coords)
+    // and written to cc array: heights and slopes are interpolated
+    // (bilinear) to the points, then converted to colors.
+    // Used for drawing with resolution higher then the DEM resolution.
+    // Points outside the DEM (or without neighbours) are drawn with bgcolor.
+    void get_color_pts(const ImageR & dem, const dPoint & blc, const dPoint & step,
+                       const dPoint * pts, const size_t n, uint32_t * cc);
 
     uint32_t get_bgcolor() const {return bgcolor;}
 
@@ -200,7 +413,9 @@ class SRTM {
     // vtol, R - smooth lines with vertical tolerance vtol (in meters) and radius R (in srtm grid units),
     // see image_cnt_vtol_filter function in image_cnt module.
     // if vtol or R is zero, no smoothing is done
-    std::map<double, dMultiLine> find_contours(const dRect & range, double step, double vtol = 0.0, double R = 0.0);
+    // res -- resolution [deg] needed by the caller (0 - original data)
+    std::map<double, dMultiLine> find_contours(const dRect & range, double step,
+       double vtol = 0.0, double R = 0.0, double res = 0.0);
 
     // make vector data: slope contours
     // vtol, R - smooth lines with vertical tolerance vtol (in meters) and radius R (in srtm grid units),
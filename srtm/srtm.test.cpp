@@ -1,7 +1,9 @@
 ///\cond HIDDEN (do not show this in Doxyden)
 
 #include <iostream>
+#include <cstring>
 #include "srtm.h"
+#include "filename/filename.h"
 #include "err/assert_err.h"
 
 int
@@ -31,6 +33,129 @@ main(){
       assert_deq(T.step, dPoint(1.0,1.0)/1200.0, 1e-8);
     }
 
+    {
+      // uncompressed tile cache
+      std::string cdir = "./test_srtm_cache";
+      file_mkdir(cdir);
+      SRTMTile T0("./test_srtm", iPoint(29,78));
+      SRTMTile T1("./test_srtm", iPoint(29,78), cdir);
+      assert_eq(file_exists(cdir + "/N78E029.dem"), true);
+      SRTMTile T2("./test_srtm", iPoint(29,78), cdir); // read mapped file
+      assert_eq(T2.is_empty(), false);
+      assert_eq(T2.srtm, true);
+      assert_eq(T2.w, 1201);
+      assert_eq(T2.h, 1201);
+      assert_eq(memcmp(T0.data(), T1.data(), T0.dsize()), 0);
+      assert_eq(memcmp(T0.data(), T2.data(), T0.dsize()), 0);
+
+      // no cache files for missing tiles
+      SRTMTile T3("./test_srtm", iPoint(30,78), cdir);
+      assert_eq(T3.is_empty(), true);
+      assert_eq(file_exists(cdir + "/N78E030.dem"), false);
+
+      // SRTM object with the cache
+      Opt o;
+      o.put("srtm_dir", "./test_srtm");
+      o.put("srtm_cache_dir", cdir);
+      SRTM S(o);
+      assert_eq(S.get_h(dPoint(29.6, 78.9)), 58);
+
+      // overview levels
+      SRTMTile T4("./test_srtm", iPoint(29,78,4), cdir);
+      assert_eq(T4.is_empty(), false);
+      assert_eq(T4.srtm, true);
+      assert_eq(T4.w, 76);
+      assert_eq(T4.h, 76);
+      assert_eq(T4.shift, 4);
+      assert_deq(T4.step, dPoint(1.0,1.0)/75.0, 1e-8);
+      for (int l=1; l<=4; l++)
+        assert_eq(file_exists(cdir + "/N78E029.L" + type_to_str(l) + ".dem"), true);
+
+      SRTMTile T5("./test_srtm", iPoint(29,78,1), cdir); // read from file
+      assert_eq(T5.w, 601);
+      assert_eq(T5.shift, 1);
+      assert_deq(T5.step, dPoint(1.0,1.0)/600.0, 1e-8);
+      // 1-2-1 averaging
+      {
+        int x=200, y=300; double sum=0;
+        for (int b=-1; b<=1; b++)
+          for (int a=-1; a<=1; a++)
+            sum += (2-abs(a))*(2-abs(b))*(int16_t)T0.get16(2*x+a, 2*y+b);
+        assert_eq((int16_t)T5.get16(x,y), (int16_t)rint(sum/16));
+      }
+
+      // level selection
+      assert_eq(S.get_level(dPoint(29.5, 78.5), 0), 0);
+      assert_eq(S.get_level(dPoint(29.5, 78.5), 1.0/1200), 0);
+      assert_eq(S.get_level(dPoint(29.5, 78.5), 1.5/1200), 0);
+      assert_eq(S.get_level(dPoint(29.5, 78.5), 1.0/600), 1);
+      assert_eq(S.get_level(dPoint(29.5, 78.5), 1.0/200), 2);
+      assert_eq(S.get_level(dPoint(29.5, 78.5), 1.0), 4);
+      assert_eq(S.get_level(dPoint(30.5, 78.5), 1.0), 0); // no data
+      assert_deq(S.get_step(dPoint(29.5, 78.5), 2), dPoint(1.0,1.0)/300.0, 1e-8);
+      assert_eq(S.get_h(dPoint(29+200/600.0, 79-300/600.0), true, 1.0/600),
+                (int16_t)T5.get16(200,300));
+
+      // images and contours
+      dPoint blc, st;
+      dRect r(29.4,78.5,0.5,0.45);
+      ImageR img = S.get_img(r, blc, st, 1.0/150);
+      assert_deq(st, dPoint(1.0/150,1.0/150,1.0), 1e-8);
+      assert_eq(img.width(), 77);
+      assert_eq(S.find_contours(r, 10, 0, 0, 1.0/150).size() > 0, true);
+
+      // overviews without overlay use separate files
+      o.put("srtm_use_overlay", 0);
+      S.set_opt(o);
+      assert_eq(S.get_level(dPoint(29.5, 78.5), 1.0), 4);
+      S.get_h(dPoint(29.5, 78.5), false, 1.0);
+      for (int l=1; l<=4; l++){
+        std::string f = cdir + "/N78E029.L" + type_to_str(l) + ".noovl.dem";
+        assert_eq(file_exists(f), true);
+        file_remove(f);
+      }
+
+      for (int l=1; l<=4; l++)
+        file_remove(cdir + "/N78E029.L" + type_to_str(l) + ".dem");
+      file_remove(cdir + "/N78E029.dem");
+      file_remove(cdir);
+    }
+
+    // overviews without the cache folder: nothing is written
+    {
+      Opt o;
+      o.put("srtm_dir", "./test_srtm");
+      SRTM S(o);
+      assert_eq(S.get_level(dPoint(29.5, 78.5), 1.0), 4);
+      assert_eq(S.get_level(dPoint(29.5, 78.5), 1.0/600), 1);
+      assert_deq(S.get_step(dPoint(29.5, 78.5), 2), dPoint(1.0,1.0)/300.0, 1e-8);
+      SRTMTile T1("./test_srtm", iPoint(29,78,1));
+      assert_eq(S.get_h(dPoint(29+200/600.0, 79-300/600.0), true, 1.0/600),
+                (int16_t)T1.get16(200,300));
+      for (int l=1; l<=4; l++)
+        assert_eq(file_exists("./test_srtm/N78E029.L" + type_to_str(l) + ".dem"), false);
+    }
+
+    // locking
+    {
+      Opt o;
+      o.put("srtm_dir", "./test_srtm");
+      SRTM S(o);
+      {
+        auto lk1 = S.get_read_lock();
+        auto lk2 = S.get_read_lock(); // recursive read lock
+        assert_eq(S.get_h(dPoint(29.6, 78.9)), 58);
+        assert_err(S.get_lock(), "SRTM: get_lock() is called "
+          "while the same thread holds a read lock");
+      }
+      {
+        auto lk = S.get_lock();
+        S.set_opt(o);
+      }
+      auto lk = S.get_read_lock();
+      assert_eq(S.get_h(dPoint(29.6, 78.9)), 58);
+    }
+
     // coordinate conversions
     {
       iPoint key(10,10);
@@ -89,6 +214,140 @@ main(){
     assert_feq(S.get_h(dPoint(29.1, 78.1)), 0, 1e-3);
     assert_feq(S.get_h(dPoint(29.6, 78.9)), 58, 1e-3);
 
+    // batch interface: compare with get_h
+    for (int raw = 0; raw<2; raw++){
+      dPoint p0(28.95, 79.05), st(0.0123, -0.0117);
+      size_t w = 100, h = 110;
+      ImageR img = S.get_h_grid(p0, st, w, h, raw);
+      dLine pts;
+      for (size_t j=0; j<h; j++){
+        for (size_t i=0; i<w; i++){
+          dPoint p = p0 + dPoint(i*st.x, j*st.y);
+          double v = S.get_h(p, raw);
+          assert_feq(img.getF(i,j), v, 1e-3);
+          pts.push_back(p);
+        }
+      }
+      auto vals = S.get_h_pts(pts, raw);
+      assert_eq(vals.size(), w*h);
+      for (size_t i=0; i<pts.size(); i++)
+        assert_feq(vals[i], img.getF(i%w, i/w), 1e-3);
+    }
+
+    // raster pipeline: compare slopes with get_s (raw data, tile nodes)
+    {
+      dPoint st = S.get_step(dPoint(29.5,78.5));
+      dPoint p0(29.5, 78.2);
+      size_t w = 50, h = 40;
+      ImageR dem = S.get_h_grid(p0, st, w, h, true);
+      ImageR sl = S.get_slope_img(dem, p0, st);
+      assert_eq(sl.type(), IMAGE_FLOAT);
+      for (size_t j=1; j<h-1; j++){
+        for (size_t i=1; i<w-1; i++){
+          dPoint p = p0 + dPoint(i*st.x, j*st.y);
+          double v = S.get_s(p, true);
+          if (std::isnan(v)) { assert_eq(std::isnan(sl.getF(i,j)), true); }
+          else assert_feq(sl.getF(i,j), v, 1e-3);
+        }
+      }
+      ImageR cc = S.get_color_img(dem, p0, st);
+      assert_eq(cc.type(), IMAGE_32ARGB);
+      assert_eq(cc.width(), w);
+      assert_eq(cc.height(), h);
+      // same colors in DEM points (shades mode)
+      std::vector<dPoint> pts;
+      for (size_t j=0; j<h-1; j++)
+        for (size_t i=0; i<w-1; i++) pts.push_back(p0 + dPoint(i*st.x, j*st.y));
+      std::vector<uint32_t> cp(pts.size());
+      S.get_color_pts(dem, p0, st, pts.data(), pts.size(), cp.data());
+      for (size_t j=0; j<h-1; j++)
+        for (size_t i=0; i<w-1; i++) assert_eq(cp[j*(w-1)+i], cc.get32(i,j));
+      assert_eq(S.get_slope_img(ImageR(), p0, st).is_empty(), true);
+
+      // aspect: compare with get_s() neighbours
+      ImageR as = S.get_aspect_img(dem, p0, st);
+      assert_eq(as.type(), IMAGE_FLOAT);
+      assert_eq(as.width(), w);
+      for (size_t j=1; j<h-1; j++){
+        for (size_t i=1; i<w-1; i++){
+          if (std::isnan(as.getF(i,j))) continue;
+          double gx = dem.getF(i+1,j) - dem.getF(i-1,j);
+          double gy = dem.getF(i,j+1) - dem.getF(i,j-1);
+          assert_eq(as.getF(i,j)>=0 && as.getF(i,j)<360, true);
+          // downhill direction: heights decrease along it
+          double a = as.getF(i,j)*M_PI/180;
+          assert_eq(sin(a)*gx/st.x/cos(p0.y*M_PI/180) + cos(a)*gy/st.y <= 0, true);
+        }
+      }
+    }
+
+    // aspect of simple planes
+    {
+      dPoint st(0.001, 0.001), p0(29.0, 0.0);
+      ImageR dem(5,5,IMAGE_FLOAT);
+      for (size_t j=0; j<5; j++)
+        for (size_t i=0; i<5; i++) dem.setF(i,j, 100.0 + i); // rising to east
+      ImageR as = S.get_aspect_img(dem, p0, st);
+      for (size_t j=0; j<5; j++)
+        for (size_t i=0; i<5; i++) assert_feq(as.getF(i,j), 270, 1e-3);
+      for (size_t j=0; j<5; j++)
+        for (size_t i=0; i<5; i++) dem.setF(i,j, 100.0 + j); // rising to north
+      as = S.get_aspect_img(dem, p0, st);
+      assert_feq(as.getF(2,2), 180, 1e-3);
+      for (size_t j=0; j<5; j++)
+        for (size_t i=0; i<5; i++) dem.setF(i,j, 100.0 - i - j); // falling to NE
+      as = S.get_aspect_img(dem, p0, st);
+      assert_feq(as.getF(2,2), 45, 1e-2);
+      for (size_t j=0; j<5; j++)
+        for (size_t i=0; i<5; i++) dem.setF(i,j, 100.0); // flat
+      as = S.get_aspect_img(dem, p0, st);
+      assert_eq(std::isnan(as.getF(2,2)), true);
+    }
+
+    // colors in heights mode: normal, inverted and degenerate ramps
+    {
+      dPoint st(0.001, 0.001), p0(29.0, 0.0);
+      std::vector<double> hh = {-100, 0, 100, 1000, 2500, 4999, 5000, 6000};
+      ImageR dem(hh.size(),2,IMAGE_FLOAT);
+      for (size_t i=0; i<hh.size(); i++) dem.setF(i,0, hh[i]);
+      for (size_t i=0; i<hh.size(); i++) dem.setF(i,1, hh[i]);
+      // compare colors, allow small difference because of the LUT
+      auto near = [](uint32_t c1, uint32_t c2){
+        for (int sh=0; sh<32; sh+=8)
+          if (abs(int((c1>>sh)&0xFF) - int((c2>>sh)&0xFF)) > 2) return false;
+        return true;
+      };
+      std::vector<std::pair<double,double> > ranges =
+        {{0,5000}, {5000,0}, {1000,1000}, {2500,100}};
+      for (auto const & r: ranges){
+        Opt o2(o);
+        o2.put("srtm_draw_mode", "heights");
+        o2.put("srtm_hmin", r.first);
+        o2.put("srtm_hmax", r.second);
+        S.set_opt(o2);
+        Rainbow R(r.first, r.second, RAINBOW_NORMAL);
+        ImageR cc = S.get_color_img(dem, p0, st);
+        for (size_t i=0; i<hh.size(); i++)
+          assert_eq(near(cc.get32(i,0), R.get(hh[i])), true);
+
+        // interpolation: heights are interpolated, then converted to colors
+        std::vector<dPoint> pts;
+        for (size_t i=0; i<hh.size()-1; i++){
+          pts.push_back(p0 + dPoint(i*st.x, 0));
+          pts.push_back(p0 + dPoint((i+0.5)*st.x, 0.5*st.y));
+        }
+        pts.push_back(p0 - st); // outside
+        std::vector<uint32_t> cp(pts.size());
+        S.get_color_pts(dem, p0, st, pts.data(), pts.size(), cp.data());
+        for (size_t i=0; i<hh.size()-1; i++){
+          assert_eq(cp[2*i], cc.get32(i,0));
+          assert_eq(near(cp[2*i+1], R.get((hh[i]+hh[i+1])/2)), true);
+        }
+        assert_eq(cp.back(), S.get_bgcolor());
+      }
+      S.set_opt(o);
+    }
+
     Opt o1 = S.get_def_opt();
     assert_eq(o1.exists("srtm_dir"), true);
     assert_eq(o1.get("srtm_use_overlay"), "1");
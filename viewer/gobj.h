@@ -49,6 +49,10 @@ public:
   /// Default constructor
   GObj(): stop_drawing_flag(false) { }
 
+  /// Copy constructor (for clone() implementations): mutex,
+  /// signal connections and stop flag are not copied.
+  GObj(const GObj & o): stop_drawing_flag(false) { }
+
   /// Possible results for draw() method.
   enum ret_t{
     FILL_NONE = 0, // object draws nothing
@@ -103,6 +107,12 @@ public:
   // by GUI it could be useful to get default state of the interface.
   static Opt get_def_opt() {return Opt();}
 
+  // Make a copy of the object for drawing in another thread.
+  // The copy uses same data and options, but has its own coordinate
+  // conversion and drawing state. Empty pointer is returned if
+  // the object can not be copied.
+  virtual std::shared_ptr<GObj> clone() const {return std::shared_ptr<GObj>();}
+
   /********************************************************/
 
   // If GObj is used from a DThreadViewer then the draw() method
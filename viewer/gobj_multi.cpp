@@ -3,6 +3,7 @@
 #include <map>
 #include <vector>
 #include <memory>
+#include <typeinfo>
 #include "gobj.h"
 
 
@@ -242,3 +243,24 @@ GObjMulti::border() const{
   }
   return border;
 }
+
+std::shared_ptr<GObj>
+GObjMulti::clone() const{
+  // derived classes may have additional data
+  if (typeid(*this) != typeid(GObjMulti)) return std::shared_ptr<GObj>();
+
+  std::shared_ptr<GObjMulti> ret(new GObjMulti(isolate));
+  ret->error_policy = error_policy;
+  ret->opt = opt;
+  ret->cnv = cnv;
+  for (auto const & p:data){
+    GObjData D;
+    D.obj = p.second.obj->clone();
+    if (!D.obj) return std::shared_ptr<GObj>();
+    D.on = p.second.on;
+    D.redraw_conn = D.obj->signal_redraw_me().connect(
+      sigc::mem_fun (ret.get(), &GObjMulti::redraw_me_deferred));
+    ret->data.emplace(p.first, D);
+  }
+  return ret;
+}
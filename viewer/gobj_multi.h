@@ -39,8 +39,6 @@ private:
     GOBJ_MULTI_ERR_EXC    // throw exception
   } error_policy;
 
-  void process_error(std::exception & e);
-
   // process redraw_me signals from sub-objects,
   // emit redraw_me signal if counter == -1.
   void redraw_me_deferred(iRect r);
@@ -51,6 +49,12 @@ private:
   // save/restore on the Cairo::Context. Default: true.
   bool isolate;
 
+protected:
+
+  // Process an error in a sub-object according with error_policy.
+  // Should be called from a catch block.
+  void process_error(std::exception & e);
+
 public:
 
   // constructor
@@ -104,6 +108,11 @@ public:
   // Border (append borders of all objects)
   virtual dMultiLine border() const override;
 
+  // Copy the object with copies of all sub-objects.
+  // Empty pointer is returned if any of sub-objects can not be copied,
+  // or for derived classes.
+  std::shared_ptr<GObj> clone() const override;
+
 };
 
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <map>
 #include <string>
 #include <map>
+#include <algorithm>
 #include <db.h>
 
 #include "err/err.h"
@@ -14,8 +15,13 @@
 // Max hash length. 12 gives 0.1m accuracy
 #define HASHLEN 12
 
+// Max number of records collected in bulk mode
+// (about 80 bytes per record in memory)
+#define BULK_MAX 500000
+
 /**********************************************************/
-GeoHashDB::GeoHashDB(std::string fname, const char *dbname, bool create) {
+GeoHashDB::GeoHashDB(std::string fname, const char *dbname, bool create,
+                     const size_t cache_mb): bulk(false) {
   // set flags
   int open_flags = create? DB_CREATE:0;
 
@@ -29,6 +35,12 @@ GeoHashDB::GeoHashDB(std::string fname, const char *dbname, bool create) {
   ret = dbp->set_flags(dbp, DB_DUPSORT);
   if (ret != 0) throw Err() << "db_geohash: " << db_strerror(ret);
 
+  // set cache size
+  if (cache_mb){
+    ret = dbp->set_cachesize(dbp, cache_mb/1024, (cache_mb%1024)*1024*1024, 1);
+    if (ret != 0) throw Err() << "db_geohash: " << db_strerror(ret);
+  }
+
   /* Open the database */
   ret = dbp->open(dbp,    /* Pointer to the database */
                   NULL,          /* Txn pointer */
@@ -41,11 +53,47 @@ GeoHashDB::GeoHashDB(std::string fname, const char *dbname, bool create) {
     throw Err() << "db_geohash: " << fname << ": " << db_strerror(ret);
 }
 
+GeoHashDB::~GeoHashDB() {
+  try { flush(); }
+  catch (...) {}
+}
+
+// write collected data
+void
+GeoHashDB::flush() const {
+  if (pending.size()==0) return;
+  // Sorted keys go to neighbouring btree pages,
+  // this is much faster then random order.
+  std::sort(pending.begin(), pending.end());
+  pending.erase(std::unique(pending.begin(), pending.end()), pending.end());
+  DB *dbp = (DB*)db.get();
+  for (auto const & p:pending) {
+    DBT k = mk_dbt(p.first);
+    DBT v = mk_dbt(&p.second);
+    int ret = dbp->put(dbp, NULL, &k, &v, DB_NODUPDATA);
+    if (ret!=0 && ret!=DB_KEYEXIST) throw Err() << "db_geohash::put: " << db_strerror(ret);
+  }
+  pending.clear();
+  pending.shrink_to_fit();
+}
+
+void
+GeoHashDB::sync() {
+  flush();
+  int ret = ((DB*)db.get())->sync((DB*)db.get(), 0);
+  if (ret!=0) throw Err() << "db_geohash: " << db_strerror(ret);
+}
+
 // add an object
 void
 GeoHashDB::put(const uint32_t id, const dRect & range, const uint32_t type) {
   if (range.is_empty()) return;
   std::set<std::string> hashes = GEOHASH_encode4(range, HASHLEN);
+  if (bulk){
+    for (auto const & h:hashes) pending.emplace_back(join_type(type,h), id);
+    if (pending.size() > BULK_MAX) flush();
+    return;
+  }
   for (auto const & h:hashes) {
     std::string s = join_type(type,h);
     DBT k = mk_dbt(s);
@@ -62,6 +110,7 @@ GeoHashDB::put(const uint32_t id, const dRect & range, const uint32_t type) {
 void
 GeoHashDB::del(const uint32_t id, const dRect & range, const uint32_t type) {
   if (range.is_empty()) return;
+  flush();
   std::set<std::string> hashes = GEOHASH_encode4(range, HASHLEN);
   DBC *curs = NULL;
   try {
@@ -92,6 +141,7 @@ GeoHashDB::del(const uint32_t id, const dRect & range, const uint32_t type) {
 // get all types
 std::set<uint32_t>
 GeoHashDB::get_types() const {
+  flush();
   DBT k = mk_dbt();
   DBT v = mk_dbt();
   std::string ks;
@@ -134,6 +184,7 @@ GeoHashDB::get_types() const {
 // get range of the largest geohash
 dRect
 GeoHashDB::bbox() const {
+  flush();
   DBT k = mk_dbt();
   DBT v = mk_dbt();
   std::string ks; // keep data for k
@@ -178,6 +229,7 @@ GeoHashDB::bbox() const {
 // dump database
 void
 GeoHashDB::dump() const {
+  flush();
   DBT k = mk_dbt();
   DBT v = mk_dbt();
 
@@ -219,6 +271,7 @@ GeoHashDB::dump() const {
 // get objects for geohash
 std::set<uint32_t>
 GeoHashDB::get_hash(const std::string & hash0, bool exact) const {
+  flush();
   DBT k = mk_dbt(hash0);
   DBT v = mk_dbt();
 
@@ -3,6 +3,8 @@
 
 #include <memory>
 #include <set>
+#include <vector>
+#include <string>
 #include <stdint.h>
 #include "geom/rect.h"
 #include "geohash/storage.h"
@@ -16,8 +18,27 @@
 class GeoHashDB : public GeoHashStorage {
     std::shared_ptr<void> db;
 
+    // Bulk mode: keys and ids are collected in memory
+    // and written in sorted order by flush().
+    bool bulk;
+    mutable std::vector<std::pair<std::string, uint32_t> > pending;
+    void flush() const;
+
   public:
-    GeoHashDB(std::string fname, const char *dbname, bool create);
+    // cache_mb - BerkleyDB cache size in megabytes (0 - BerkleyDB default).
+    GeoHashDB(std::string fname, const char *dbname, bool create,
+              const size_t cache_mb = 0);
+    ~GeoHashDB();
+
+    // Start/stop bulk mode. In bulk mode put() only collects data,
+    // it is written to the database in sorted order (much faster for
+    // large imports) by bulk_end(), before any query, or when too much
+    // data is collected.
+    void bulk_begin() {bulk = true;}
+    void bulk_end() {bulk = false; flush();}
+
+    // Flush data to disk.
+    void sync();
 
     // add an object
     void put(const uint32_t id, const dRect & range, const uint32_t type=0) override;
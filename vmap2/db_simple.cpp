@@ -33,7 +33,8 @@ unpack_uint32(DBT *k){
 
 DBSimple::~DBSimple(){}
 
-DBSimple::DBSimple(std::string fname, const char *dbname, bool create, bool dup){
+DBSimple::DBSimple(std::string fname, const char *dbname, bool create, bool dup,
+                   const size_t cache_mb){
   // set flags
   int open_flags = create? DB_CREATE|DB_EXCL:0;
 
@@ -49,6 +50,12 @@ DBSimple::DBSimple(std::string fname, const char *dbname, bool create, bool dup)
     if (ret != 0) throw Err() << "db_simple: " << db_strerror(ret);
   }
 
+  // set cache size
+  if (cache_mb){
+    ret = dbp->set_cachesize(dbp, cache_mb/1024, (cache_mb%1024)*1024*1024, 1);
+    if (ret != 0) throw Err() << "db_simple: " << db_strerror(ret);
+  }
+
   /* Open the database */
   ret = dbp->open(dbp,    /* Pointer to the database */
                   NULL,          /* Txn pointer */
@@ -92,6 +99,13 @@ DBSimple::put(const uint32_t key, const std::string & val){
   if (ret != 0) throw Err() << "db_simple: " << db_strerror(ret);
 }
 
+void
+DBSimple::sync(){
+  DB  *dbp = (DB*)db.get();
+  int ret = dbp->sync(dbp, 0);
+  if (ret != 0) throw Err() << "db_simple: " << db_strerror(ret);
+}
+
 // Main get function. Uses cursor, supports all flags.
 // Set key to 0xFFFFFFFF if nothing is found.
 std::string
@@ -21,9 +21,11 @@ class DBSimple{
    // dbname - database name (can be NULL),
    // create - create flag.
    // dup    - alow duplicates flag (default false).
+   // cache_mb - BerkleyDB cache size in megabytes (0 - BerkleyDB default).
    // Note: if you use non-null dbname and put a few databases in a single file,
    // you will need to create environment to open both databases.
-   DBSimple(std::string fname, const char *dbname, bool create, bool dup = false);
+   DBSimple(std::string fname, const char *dbname, bool create, bool dup = false,
+            const size_t cache_mb = 0);
    ~DBSimple();
 
    // Put data with a given key (overwrite old value if it exists).
@@ -35,11 +37,14 @@ class DBSimple{
    uint32_t put(const std::string & val) {
      uint32_t key;
      get_last(key);
-     key = 0xFFFFFFFF ? 0 : key+1;
+     key = (key == 0xFFFFFFFF) ? 0 : key+1;
      put(key, val);
      return key;
    }
 
+   // Flush data to disk.
+   void sync();
+
    // Check if the key exists in the database.
    bool exists(const uint32_t key);
 
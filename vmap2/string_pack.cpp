@@ -230,3 +230,80 @@ string_read_bbox(istream & s) {
   return dRect(p1,p2);
 }
 
+
+/**********************************************************/
+
+void
+string_pack_uvar(std::string & s, uint64_t v){
+  while (v >= 0x80) {
+    s.push_back((char)(v | 0x80));
+    v >>= 7;
+  }
+  s.push_back((char)v);
+}
+
+uint64_t
+string_unpack_uvar(const char * & p, const char * e){
+  uint64_t ret = 0;
+  for (int sh = 0; sh<64; sh+=7) {
+    if (p>=e) throw Err() << "string_unpack_uvar: unexpected end of data";
+    uint8_t c = *p++;
+    ret |= (uint64_t)(c & 0x7F) << sh;
+    if (!(c & 0x80)) return ret;
+  }
+  throw Err() << "string_unpack_uvar: bad data";
+}
+
+void
+string_pack_svar(std::string & s, int64_t v){
+  string_pack_uvar(s, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+int64_t
+string_unpack_svar(const char * & p, const char * e){
+  uint64_t v = string_unpack_uvar(p, e);
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+void
+string_pack_vstr(std::string & s, const std::string & str){
+  string_pack_uvar(s, str.size());
+  s.append(str);
+}
+
+std::string
+string_unpack_vstr(const char * & p, const char * e){
+  uint64_t size = string_unpack_uvar(p, e);
+  if (size > (uint64_t)(e-p))
+    throw Err() << "string_unpack_vstr: unexpected end of data";
+  std::string ret(p, size);
+  p += size;
+  return ret;
+}
+
+void
+string_pack_vcrds(std::string & s, const dLine & l, Point<int32_t> & p0){
+  string_pack_uvar(s, l.size());
+  for (auto const & p:l) {
+    auto ip = convert_crd(p);
+    string_pack_svar(s, (int64_t)ip.x - p0.x);
+    string_pack_svar(s, (int64_t)ip.y - p0.y);
+    p0 = ip;
+  }
+}
+
+dLine
+string_unpack_vcrds(const char * & p, const char * e, Point<int32_t> & p0){
+  uint64_t n = string_unpack_uvar(p, e);
+  // at least two bytes per point
+  if (n > (uint64_t)(e-p)/2)
+    throw Err() << "string_unpack_vcrds: unexpected end of data";
+  dLine ret;
+  ret.reserve(n);
+  for (uint64_t i=0; i<n; i++) {
+    p0.x = (int32_t)(p0.x + string_unpack_svar(p, e));
+    p0.y = (int32_t)(p0.y + string_unpack_svar(p, e));
+    ret.emplace_back(p0.x/1e7, p0.y/1e7);
+  }
+  return ret;
+}
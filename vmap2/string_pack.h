@@ -51,6 +51,10 @@ void string_pack_crds(std::ostream & s, const char *tag, const dMultiLine & ml);
 // Same but for writing a text file
 void string_write_crds(std::ostream & s, const char *tag, const dMultiLine & ml);
 
+// Convert LonLat coordinates to integers (multiplied by 1e7, rounded).
+// This is used in string_pack_crds, string_pack_pt, string_pack_bbox.
+Point<int32_t> convert_crd(dPoint p);
+
 // Pack a point with LonLat coordinates.
 // Double values are multiplied by 1e7 and rounded to nearest integer values.
 // Tag should contain 4 characters.
@@ -122,4 +126,31 @@ dRect string_unpack_bbox(std::istream & s);
 // Same for reading a text file
 dRect string_read_bbox(std::istream & s);
 
+/**********************************************************/
+// 3. Compact binary format (VMap2obj::pack, version 2).
+// Data is appended to a std::string and read from a memory
+// buffer (pointer p is moved, e is end of the buffer).
+// Unsigned integers are written as varints (7 bits per byte,
+// low bits first, high bit of a byte is continuation flag),
+// signed ones are zigzag-encoded first. Reading functions
+// throw an error if data ends unexpectedly.
+
+// write/read unsigned varint
+void string_pack_uvar(std::string & s, uint64_t v);
+uint64_t string_unpack_uvar(const char * & p, const char * e);
+
+// write/read signed (zigzag) varint
+void string_pack_svar(std::string & s, int64_t v);
+int64_t string_unpack_svar(const char * & p, const char * e);
+
+// write/read string (varint size + data)
+void string_pack_vstr(std::string & s, const std::string & str);
+std::string string_unpack_vstr(const char * & p, const char * e);
+
+// Write/read a coordinate line (varint number of points, then
+// delta-encoded int32 coordinates, see convert_crd). Deltas are
+// calculated from the previous point, p0 is updated.
+void string_pack_vcrds(std::string & s, const dLine & l, Point<int32_t> & p0);
+dLine string_unpack_vcrds(const char * & p, const char * e, Point<int32_t> & p0);
+
 #endif
\ No newline at end of file
@@ -88,6 +88,50 @@ main(){
       assert_deq(crds1, crds2, 1e-7);
     }
 
+    // compact format: varints, strings, coordinates
+    {
+      std::string s;
+      string_pack_uvar(s, 0);
+      string_pack_uvar(s, 127);
+      string_pack_uvar(s, 128);
+      string_pack_uvar(s, 0xFFFFFFFFFFFFFFFF);
+      string_pack_svar(s, -1);
+      string_pack_svar(s, 63);
+      string_pack_svar(s, -64);
+      string_pack_svar(s, (int64_t)-0x7FFFFFFFFFFFFFFF-1);
+      string_pack_vstr(s, "text");
+      string_pack_vstr(s, "");
+      assert_eq(s.size(), 1+1+2+10+1+1+1+10+5+1);
+
+      dMultiLine crds1("[[[-180,-90],[0,0],[180,90]],[],[[37.11,56.20],[37.22,56.11]]]");
+      Point<int32_t> p0(0,0);
+      for (auto const & l:crds1) string_pack_vcrds(s, l, p0);
+
+      const char *p = s.data(), *e = s.data() + s.size();
+      assert_eq(string_unpack_uvar(p,e), 0);
+      assert_eq(string_unpack_uvar(p,e), 127);
+      assert_eq(string_unpack_uvar(p,e), 128);
+      assert_eq(string_unpack_uvar(p,e), 0xFFFFFFFFFFFFFFFF);
+      assert_eq(string_unpack_svar(p,e), -1);
+      assert_eq(string_unpack_svar(p,e), 63);
+      assert_eq(string_unpack_svar(p,e), -64);
+      assert_eq(string_unpack_svar(p,e), (int64_t)-0x7FFFFFFFFFFFFFFF-1);
+      assert_eq(string_unpack_vstr(p,e), "text");
+      assert_eq(string_unpack_vstr(p,e), "");
+      dMultiLine crds2;
+      p0 = Point<int32_t>(0,0);
+      for (size_t i=0; i<crds1.size(); i++) crds2.push_back(string_unpack_vcrds(p,e,p0));
+      assert_deq(crds1, crds2, 1e-7);
+      assert_eq(p==e, true);
+
+      assert_err(string_unpack_uvar(p,e), "string_unpack_uvar: unexpected end of data");
+      std::string s1("\x85");
+      p = s1.data(); e = s1.data()+s1.size();
+      assert_err(string_unpack_vstr(p,e), "string_unpack_uvar: unexpected end of data");
+      s1 = "\x05" "ab";
+      p = s1.data(); e = s1.data()+s1.size();
+      assert_err(string_unpack_vstr(p,e), "string_unpack_vstr: unexpected end of data");
+    }
 
   }
   catch (Err & e) {
@@ -5,29 +5,50 @@
 #include <string>
 #include <cstdio>
 #include <algorithm>
+#include <tuple>
+#include <unordered_map>
 #include <unistd.h>
 
 #include "vmap2.h"
 #include "string_pack.h"
 #include "filename/filename.h"
 #include "geom/poly_tools.h"
+#include "vmap2gen.h"
+#include "vmap2refidx.h"
 
 using namespace std;
 
 
 /**********************************************************/
-VMap2::VMap2(const std::string & name, const bool create) {
+VMap2::VMap2(const std::string & name, const bool create):
+    rtree_mod(false), gen(false), mod_count(0),
+    bulk(0), bulk_id(0), bulk_count(0) {
 
   bdb = (name!="");
   if (bdb){
     dbname = file_ext_repl(name, VMAP2DB_EXT);
     ghname = file_ext_repl(dbname, VMAP2GH_EXT);
+    rtname = file_ext_repl(dbname, VMAP2RT_EXT);
+    genname = file_ext_repl(dbname, VMAP2GEN_EXT);
     bool nogh = file_exists(dbname) && !file_exists(ghname);
     objects_bdb.reset(new DBSimple(dbname, NULL, create, false));
     if (nogh)
       geohash_rebuild();
     else
       geohash.reset(new GeoHashDB(ghname, NULL, create));
+
+    // use R-tree index if it is up to date
+    if (file_exists(rtname) && !nogh &&
+        !file_newer(dbname, rtname) && !file_newer(ghname, rtname)){
+      try { rtree.reset(new GeoRTree(rtname)); }
+      catch (Err & e) { rtree.reset(); }
+    }
+
+    // use generalization levels if they are up to date
+    if (file_exists(genname) && !file_newer(dbname, genname)){
+      gen_bdb.reset(new DBSimple(genname, NULL, false));
+      gen = true;
+    }
   }
   else {
     geohash.reset(new GeoHashStorage);
@@ -35,12 +56,31 @@ VMap2::VMap2(const std::string & name, const bool create) {
 
 };
 
+VMap2::~VMap2(){
+  // Write modified R-tree index. Databases are closed first:
+  // the index file should not be older then them.
+  // Skip it if a bulk-load session was not finished.
+  if (!bdb || !rtree || !rtree_mod || bulk>0) return;
+  try {
+    it_bdb = DBSimple::iterator();
+    objects_bdb.reset();
+    geohash.reset();
+    gen_bdb.reset();
+    rtree->save(rtname);
+  }
+  catch (...) {}
+}
+
 void
 VMap2::remove_db(const std::string & name){
   auto dbname = file_ext_repl(name,   VMAP2DB_EXT);
   auto ghname = file_ext_repl(dbname, VMAP2GH_EXT);
+  auto rtname = file_ext_repl(dbname, VMAP2RT_EXT);
+  auto genname = file_ext_repl(dbname, VMAP2GEN_EXT);
   if (file_exists(dbname)) ::unlink(dbname.c_str());
   if (file_exists(ghname)) ::unlink(ghname.c_str());
+  if (file_exists(rtname)) ::unlink(rtname.c_str());
+  if (file_exists(genname)) ::unlink(genname.c_str());
 }
 
 void
@@ -61,6 +101,128 @@ VMap2::geohash_rebuild(){
   }
 }
 
+void
+VMap2::rtree_rebuild(){
+  rtree.reset(new GeoRTree);
+  if (bdb){
+    for (const auto & p:*objects_bdb){
+      auto o = VMap2obj::unpack(p.second);
+      rtree->put(p.first, o.bbox(), o.type);
+    }
+    rtree->save(rtname);
+  }
+  else {
+    for (const auto & p:objects_mem)
+      rtree->put(p.first, p.second.bbox(), p.second.type);
+  }
+  rtree_mod = false;
+}
+
+// R-tree is modified together with geohashes, the file is
+// not valid anymore. It is removed once, on the first modification.
+void
+VMap2::rtree_put(const uint32_t id, const dRect & range, const uint32_t type){
+  if (!rtree) return;
+  if (!rtree_mod && bdb) ::unlink(rtname.c_str());
+  rtree_mod = true;
+  rtree->put(id, range, type);
+}
+
+void
+VMap2::rtree_del(const uint32_t id, const dRect & range, const uint32_t type){
+  if (!rtree) return;
+  if (!rtree_mod && bdb) ::unlink(rtname.c_str());
+  rtree_mod = true;
+  rtree->del(id, range, type);
+}
+
+void
+VMap2::find(uint32_t type, const dRect & range, std::vector<uint32_t> & ids){
+  if (rtree) return rtree->get(range, type, ids);
+  auto s = geohash->get(range, type);
+  ids.assign(s.begin(), s.end());
+}
+
+void
+VMap2::find(uint32_t type, const dRect & range, std::vector<uint32_t> & ids,
+            const double res){
+  auto cl = VMap2obj::get_class(type);
+  if (!rtree || res<=0 || (cl!=VMAP2_LINE && cl!=VMAP2_POLYGON))
+    return find(type, range, ids);
+
+  // resolution in degrees
+  double dy = res/(6380e3*M_PI/180.0);
+  double dx = dy/std::max(cos(range.cnt().y*M_PI/180.0), 1e-3);
+  rtree->get(range, type, ids, dPoint(dx,dy));
+}
+
+/**********************************************************/
+
+void
+VMap2::gen_rebuild(const std::vector<double> & tols){
+
+  // read all lines and polygons
+  VMap2gen G;
+  std::vector<uint32_t> ids;
+  iter_start();
+  while (!iter_end()){
+    auto p = iter_get_next();
+    auto cl = p.second.get_class();
+    if (cl!=VMAP2_LINE && cl!=VMAP2_POLYGON) continue;
+    ids.push_back(p.first);
+    G.add(p.second, cl==VMAP2_POLYGON);
+  }
+  G.prepare();
+
+  // remove old data
+  gen_mem.clear();
+  gen_bdb.reset();
+  if (bdb){
+    if (file_exists(genname)) ::unlink(genname.c_str());
+    gen_bdb.reset(new DBSimple(genname, NULL, true));
+  }
+
+  std::vector<double> t(tols);
+  std::sort(t.begin(), t.end());
+  for (size_t i=0; i<ids.size(); i++){
+    auto o = get(ids[i]);
+    auto np = o.npts();
+    std::ostringstream s;
+    for (auto const tol: t){
+      auto ml = G.get(i, tol);
+      if (ml.size()==0 || ml.npts() >= np) continue;
+      np = ml.npts();
+      VMap2obj o1(o);
+      o1.dMultiLine::operator=(ml);
+      string_pack<double>(s, "gtol", tol);
+      string_pack_str(s, "gobj", VMap2obj::pack(o1));
+    }
+    if (s.str().size()==0) continue;
+    if (bdb) gen_bdb->put(ids[i], s.str());
+    else gen_mem[ids[i]] = s.str();
+  }
+  gen = true;
+}
+
+std::string
+VMap2::gen_get(const uint32_t id){
+  if (!gen) return std::string();
+  if (bdb) {
+    uint32_t id1(id);
+    auto str = gen_bdb->get(id1);
+    return id1 == 0xFFFFFFFF ? std::string() : str;
+  }
+  auto i = gen_mem.find(id);
+  return i==gen_mem.end() ? std::string() : i->second;
+}
+
+void
+VMap2::gen_del(const uint32_t id){
+  if (!gen) return;
+  if (bdb) gen_bdb->del(id);
+  else gen_mem.erase(id);
+}
+
 /**********************************************************/
 
 uint32_t
@@ -70,27 +232,79 @@ VMap2::add(const VMap2obj & o){
 
   // get last id
   uint32_t id;
-  if (bdb)
-    objects_bdb->get_last(id);
-  else
-    id = objects_mem.size() ? objects_mem.rbegin()->first : 0xFFFFFFFF;
+  if (bdb && bulk)
+    id = bulk_id;
+  else {
+    if (bdb)
+      objects_bdb->get_last(id);
+    else
+      id = objects_mem.size() ? objects_mem.rbegin()->first : 0xFFFFFFFF;
 
-  if (id == 0xFFFFFFFF) id=0;
-  else id++;
+    if (id == 0xFFFFFFFF) id=0;
+    else id++;
+  }
   if (id == 0xFFFFFFFF)
     throw Err() << "VMap2::add: object ID overfull";
+  if (bulk) {bulk_id = id+1; bulk_count++;}
 
   // write object
+  mod_count++;
   if (bdb)
     objects_bdb->put(id, VMap2obj::pack(o));
   else
     objects_mem.emplace(id, o);
 
   geohash->put(id, o.bbox(), o.type);
+  rtree_put(id, o.bbox(), o.type);
 
   return id;
 }
 
+void
+VMap2::begin_bulk(const size_t cache_mb){
+  if (bulk++ > 0) return;
+  bulk_count = 0;
+  bulk_t0 = std::chrono::steady_clock::now();
+  if (!bdb) return;
+
+  // reopen databases with larger cache (split between them)
+  size_t mb = std::max<size_t>(cache_mb/2, 1);
+  it_bdb = DBSimple::iterator();
+  objects_bdb.reset();
+  objects_bdb.reset(new DBSimple(dbname, NULL, false, false, mb));
+  geohash.reset();
+  auto gh = std::make_shared<GeoHashDB>(ghname, (const char*)NULL, false, mb);
+  gh->bulk_begin();
+  geohash = gh;
+
+  // next object id
+  uint32_t id;
+  objects_bdb->get_last(id);
+  bulk_id = (id == 0xFFFFFFFF)? 0 : id+1;
+}
+
+Opt
+VMap2::commit(){
+  if (bulk == 0)
+    throw Err() << "VMap2::commit: no bulk-load session";
+  if (--bulk > 0) return Opt();
+
+  if (bdb){
+    auto gh = (GeoHashDB*)geohash.get();
+    gh->bulk_end();
+    gh->sync();
+    objects_bdb->sync();
+  }
+
+  double t = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - bulk_t0).count();
+  Opt ret;
+  ret.put("objects", bulk_count);
+  ret.put("time", t);
+  ret.put("rate", t>0 ? bulk_count/t : 0.0);
+  return ret;
+}
+
 bool
 VMap2::try_add_hole(const uint32_t type, const dLine & l){
   if (l.size()==0) return false;
@@ -144,6 +358,9 @@ VMap2::put(const uint32_t id, const VMap2obj & o){
   if (o.empty())
     throw Err() << "VMap2::put: empty object";
 
+  mod_count++;
+  gen_del(id);
+
   if (bdb){
     // get old object
     uint32_t id1 = id;
@@ -159,6 +376,8 @@ VMap2::put(const uint32_t id, const VMap2obj & o){
     if (o1.bbox()!=o.bbox() || o1.type!=o.type) {
       geohash->del(id, o1.bbox(), o1.type);
       geohash->put(id, o.bbox(), o.type);
+      rtree_del(id, o1.bbox(), o1.type);
+      rtree_put(id, o.bbox(), o.type);
     }
 
   }
@@ -172,6 +391,8 @@ VMap2::put(const uint32_t id, const VMap2obj & o){
     if (i->second.bbox()!=o.bbox() || i->second.type!=o.type) {
       geohash->del(id, i->second.bbox(), i->second.type);
       geohash->put(id, o.bbox(), o.type);
+      rtree_del(id, i->second.bbox(), i->second.type);
+      rtree_put(id, o.bbox(), o.type);
     }
 
     // write new object
@@ -197,8 +418,33 @@ VMap2::get(const uint32_t id){
 }
 
 
+VMap2obj
+VMap2::get(const uint32_t id, const double res){
+  if (res<=0 || !gen) return get(id);
+  auto str = gen_get(id);
+  if (str.size()==0) return get(id);
+
+  // find level with the largest tolerance <= res
+  std::istringstream s(str);
+  std::string obj;
+  double tol = 0, tol0 = -1;
+  while (1){
+    auto tag = string_unpack_tag(s);
+    if (tag == "") break;
+    else if (tag == "gtol") tol = string_unpack<double>(s);
+    else if (tag == "gobj") {
+      auto o = string_unpack_str(s);
+      if (tol<=res && tol>tol0) {obj = o; tol0 = tol;}
+    }
+    else throw Err() << "VMap2::get: unknown tag in generalization data: " << tag;
+  }
+  return obj.size() ? VMap2obj::unpack(obj) : get(id);
+}
+
 void
 VMap2::del(const uint32_t id){
+  mod_count++;
+  gen_del(id);
   if (bdb) {
     // get old object
     uint32_t id1 = id;
@@ -210,6 +456,7 @@ VMap2::del(const uint32_t id){
 
     // Delete geohashes
     geohash->del(id, o.bbox(), o.type);
+    rtree_del(id, o.bbox(), o.type);
     // Delete the object
     objects_bdb->del(id);
   }
@@ -220,6 +467,7 @@ VMap2::del(const uint32_t id){
 
     // Delete geohashes
     geohash->del(id, i->second.bbox(), i->second.type);
+    rtree_del(id, i->second.bbox(), i->second.type);
     // Delete the object
     objects_mem.erase(i);
   }
@@ -339,45 +587,93 @@ VMap2::find_nearest(const uint32_t & type, const std::string name, const dPoint
 std::multimap<uint32_t, uint32_t>
 VMap2::find_refs(const double & dist1, const double & dist2){
   std::multimap<uint32_t, uint32_t> tab;
+  std::unordered_map<uint32_t, std::string> lab_names; // label names
 
-  // Find all labels (text objects).
-  // It's better to use geohash, because there we have
-  // objects sorted by type.
+  // We work with every label type independently.
+  // Reference points of all labels are put into a spatial index
+  // (VMap2refidx), then objects near these points are read (only once),
+  // and for each label all objects with distance < max(dist1, dist2)
+  // are collected.
+  double dmax = std::max(dist1, dist2);
+  if (dmax <= 0) dmax = 1.0;
 
-  // We work with every type independently:
   for (const auto & t:  geohash->get_types()){
     if (t>>24 != VMAP2_TEXT) continue;
 
-    // all labels
-    auto labels = geohash->get(t);
+    struct Label {
+      uint32_t id;
+      std::string name;
+      bool done;
+      // candidates: object id, distance, same name (sorted by id)
+      std::vector<std::tuple<uint32_t, double, bool> > objs;
+    };
+    std::vector<Label> labels;
+    VMap2refidx idx(dmax);
+    for (auto const i: geohash->get(t)){
+      auto l = get(i);
+      idx.add(l.ref_type, l.ref_pt, labels.size());
+      lab_names[i] = l.name;
+      labels.push_back(Label{i, l.name, false, {}});
+    }
+
+    // Objects near label reference points. If there are many
+    // labels, all objects of the type are used (this is faster then
+    // searching near every index cell).
+    std::map<uint32_t, std::vector<dRect> > cells; // ref_type -> index cells
+    idx.iter_cells([&cells](const uint32_t rt, const dRect & c){
+      if (rt != 0xFFFFFFFF) cells[rt].push_back(c);});
+
+    std::map<uint32_t, std::set<uint32_t> > objs; // ref_type -> object ids
+    double D = dmax * 180/M_PI/6380000; // in approx.degrees
+    for (auto const & rc: cells){
+      auto & ids = objs[rc.first];
+      ids = geohash->get(rc.first);
+      if (ids.size() <= 16*rc.second.size()) continue;
+      ids.clear();
+      for (auto const & c: rc.second){
+        double cy = cos(std::min(std::max(fabs(c.y), fabs(c.y+c.h))+D, 89.0)*M_PI/180);
+        auto ii = find(rc.first, expand(c, D/cy, D));
+        ids.insert(ii.begin(), ii.end());
+      }
+    }
+
+    // distances between objects and labels
+    for (auto const & ro: objs){
+      for (auto const i: ro.second){
+        auto o = get(i);
+        std::map<size_t, double> ld; // label index -> min distance
+        for (auto const & l: o){
+          for (auto const & p: l){
+            for (auto const & r: idx.find(ro.first, p, dmax)){
+              auto it = ld.find(r.first);
+              if (it == ld.end()) ld.emplace(r.first, r.second);
+              else if (it->second > r.second) it->second = r.second;
+            }
+          }
+        }
+        for (auto const & r: ld)
+          labels[r.first].objs.emplace_back(i, r.second,
+            o.name == labels[r.first].name);
+      }
+    }
 
     // Pass 1. For each label try to find object with
     // same name within distance dist1.
     // Pass 2. Repeat same with distance dist2.
     for (auto pass=0; pass<2; pass++){
       auto & dist = pass==0? dist1:dist2;
-      auto it = labels.begin();
-      while (it != labels.end()){
-        auto l = get(*it);
-
-        dRect r(l.ref_pt, l.ref_pt);
-        double D = dist * 180/M_PI/6380000;
-        r.expand(D); // in approx.degrees
+      for (auto & l: labels){
+        if (l.done) continue;
         double md = dist;
         uint32_t mi = 0xFFFFFFFF;
-        for (auto const & i:find(l.ref_type, r)){
-          auto o1 = get(i);
-          if (o1.name != l.name) continue;
-          auto d1 = nearest_vertex(o1, l.ref_pt, (dPoint *)NULL,
-                    (double (*)(const dPoint&, const dPoint&))geo_dist_2d);
-          if (d1<md) {md=d1, mi=i;}
+        for (auto const & o: l.objs){
+          if (!std::get<2>(o)) continue;
+          if (std::get<1>(o)<md) {md=std::get<1>(o), mi=std::get<0>(o);}
         }
-
         if (md<dist) {
-          tab.emplace(mi,*it);
-          it = labels.erase(it);
+          tab.emplace(mi, l.id);
+          l.done = true;
         }
-        else ++it;
       }
     }
 
@@ -386,36 +682,26 @@ VMap2::find_refs(const double & dist1, const double & dist2){
     // Pass 4. Repeat same with dist2.
     for (auto pass=0; pass<2; pass++){
       auto & dist = pass==0? dist1:dist2;
-      auto it = labels.begin();
-      while (it != labels.end()){
-        auto l = get(*it);
-
-        dRect r(l.ref_pt, l.ref_pt);
-        double D = dist * 180/M_PI/6380000;
-        r.expand(D); // in approx.degrees
+      for (auto & l: labels){
+        if (l.done) continue;
         double md = dist;
         uint32_t mi = 0xFFFFFFFF;
-        for (auto const & i:find(l.ref_type, r)){
-          if (tab.count(i)>0){
-            auto l1 = get(tab.find(i)->second);
-            if (l1.name != l.name) continue;
-          }
-          auto o1 = get(i);
-          auto d1 = nearest_vertex(o1, l.ref_pt, (dPoint *)NULL,
-                    (double (*)(const dPoint&, const dPoint&))geo_dist_2d);
-          if (d1<md) {md=d1, mi=i;}
+        for (auto const & o: l.objs){
+          auto i = std::get<0>(o);
+          auto ti = tab.find(i);
+          if (ti!=tab.end() && lab_names[ti->second] != l.name) continue;
+          if (std::get<1>(o)<md) {md=std::get<1>(o), mi=i;}
         }
         if (md<dist) {
-          tab.emplace(mi,*it);
-          it = labels.erase(it);
+          tab.emplace(mi, l.id);
+          l.done = true;
         }
-        else ++it;
       }
     }
 
     // For unconnected labels put 0x0xFFFFFFFF into the tab.
-    for (auto & i:labels){
-      tab.emplace(0xFFFFFFFF, i);
+    for (auto const & l: labels){
+      if (!l.done) tab.emplace(0xFFFFFFFF, l.id);
     }
 
   }
@@ -3,6 +3,7 @@
 
 #include <set>
 #include <memory>
+#include <chrono>
 #include "vmap2obj.h"
 
 // BerkleyDB storage
@@ -12,8 +13,13 @@
 // in-memory geohash storage
 #include "geohash/storage.h"
 
+// packed R-tree index
+#include "geohash/rtree.h"
+
 #define VMAP2DB_EXT  ".vmap2db"
 #define VMAP2GH_EXT  ".vmap2gh"
+#define VMAP2RT_EXT  ".vmap2rt"
+#define VMAP2GEN_EXT ".vmap2gen"
 
 /*********************************************************************/
 // VMap2 -- interface class for map object storage
@@ -34,9 +40,50 @@ class VMap2 {
   // geohashes for spatial indexing
   std::shared_ptr<GeoHashStorage> geohash;
 
+  // Packed R-tree index (optional). If it exists it is used
+  // for queries instead of geohashes. It is loaded from
+  // the .vmap2rt file if the file is up to date, and modified
+  // together with geohashes. The file is removed on the first
+  // modification and written again when the database is closed.
+  std::shared_ptr<GeoRTree> rtree;
+  bool rtree_mod; // R-tree was modified after loading/saving
+
+  // spatial index for queries
+  GeoHashStorage * sindex() const {
+    return rtree? (GeoHashStorage*)rtree.get() : geohash.get(); }
+
+  // update rtree after modifications
+  void rtree_put(const uint32_t id, const dRect & range, const uint32_t type);
+  void rtree_del(const uint32_t id, const dRect & range, const uint32_t type);
+
+  // Generalization levels (optional): simplified copies of lines
+  // and polygons, see gen_rebuild(). For each object id a string with
+  // packed objects for all levels is stored in the .vmap2gen file
+  // (or in memory). Data for an object is removed when it is modified.
+  std::shared_ptr<DBSimple> gen_bdb;
+  std::map<uint32_t, std::string> gen_mem;
+  bool gen;
+
+  // get/delete generalization data for an object
+  std::string gen_get(const uint32_t id);
+  void gen_del(const uint32_t id);
+
   /// filenames (empty for in-memory database)
   std::string dbname;
   std::string ghname;
+  std::string rtname;
+  std::string genname;
+
+  /// modification counter
+  size_t mod_count;
+
+  // Bulk-load session (see begin_bulk/commit): nesting level,
+  // next object id (BerkleyDB storage), number of added objects,
+  // start time.
+  int bulk;
+  uint32_t bulk_id;
+  size_t bulk_count;
+  std::chrono::steady_clock::time_point bulk_t0;
 
 public:
 
@@ -45,7 +92,8 @@ public:
   // <name> is database name with or without .vmap2db extension.
   VMap2(const std::string & name = std::string(), const bool create = false);
 
-  ~VMap2() {}
+  // Destructor. Save modified R-tree index.
+  ~VMap2();
 
   // remove database files
   static void remove_db(const std::string & dbname);
@@ -56,9 +104,46 @@ public:
   /// Dump geohash database
   void geohash_dump() {geohash->dump();}
 
+  /// Build packed R-tree index. For BerkleyDB storage it is
+  /// saved to .vmap2rt file and used next time the database is opened.
+  void rtree_rebuild();
+
+  /// Is R-tree index used?
+  bool has_rtree() const {return (bool)rtree;}
+
+  /// Build generalization levels: copies of lines and polygons
+  /// simplified with given tolerances [m] (topology-preserving, see vmap2gen.h).
+  /// Only copies with reduced number of points are stored.
+  /// For BerkleyDB storage they are saved to .vmap2gen file.
+  void gen_rebuild(const std::vector<double> & tols = {1,10,100});
+
+  /// Are generalization levels available?
+  bool has_gen() const {return gen;}
+
   /// Add new object to the map, return object ID.
   uint32_t add(const VMap2obj & o);
 
+  /// Start bulk-load session. For BerkleyDB storage databases are
+  /// reopened with larger cache (cache_mb, megabytes, total for
+  /// the object and geohash databases), new objects get
+  /// sequential IDs without looking up the last one, and geohash
+  /// records are collected in memory and written in sorted order
+  /// (before any query or at commit). For in-memory storage
+  /// nothing changes. Sessions can be nested, only the outer
+  /// one has effect. There is no rollback: BerkleyDB databases
+  /// are opened without transaction environment. If the session is
+  /// not finished, collected data is written when VMap2 is destroyed.
+  void begin_bulk(const size_t cache_mb = 64);
+
+  /// Finish bulk-load session: write collected geohash data,
+  /// flush databases to disk. Returns statistics for the outer
+  /// session (empty for inner ones): "objects" - number of added
+  /// objects, "time" - session time [s], "rate" - objects per second.
+  Opt commit();
+
+  /// Is bulk-load session active?
+  bool in_bulk() const {return bulk>0;}
+
   // Check if line l is a hole inside some object of type t.
   // If yes, insert it into the object. Return true if line was inserted.
   // Function is_hole from geom module is used for tests.
@@ -80,32 +165,50 @@ public:
   /// Read an object.
   VMap2obj get(const uint32_t id);
 
+  /// Read an object with resolution hint [m]: return
+  /// generalized copy with the largest tolerance not exceeding res
+  /// (or the original object).
+  VMap2obj get(const uint32_t id, const double res);
+
   /// Delete an object (error if not exist).
   void del(const uint32_t id);
 
+  /// Modification counter, increased on every add/put/del
+  /// operation. Can be used to invalidate data derived from the map.
+  size_t get_mod_count() const {return mod_count;}
+
 
   /// Number of objects
   size_t size() const;
 
   /// Find objects with given type and range
   std::set<uint32_t> find(VMap2objClass cl, uint16_t tnum, const dRect & range) {
-    return geohash->get(range, (cl  << 24) | tnum); }
+    return sindex()->get(range, (cl  << 24) | tnum); }
 
   /// Find objects with given type and range
   std::set<uint32_t> find(uint32_t type, const dRect & range) {
-    return geohash->get(range,type); }
+    return sindex()->get(range,type); }
+
+  /// Find objects with given type and range, write sorted ids to
+  /// a vector (cleared before filling). Faster with R-tree index.
+  void find(uint32_t type, const dRect & range, std::vector<uint32_t> & ids);
+
+  /// Same with resolution hint [m]: if R-tree index is used, skip
+  /// lines and polygons smaller then res (both in x and y).
+  void find(uint32_t type, const dRect & range, std::vector<uint32_t> & ids,
+            const double res);
 
   /// Find objects with given type (string representation) and range
   std::set<uint32_t> find(const std::string & type, const dRect & range) {
-    return geohash->get(range, VMap2obj::make_type(type)); }
+    return sindex()->get(range, VMap2obj::make_type(type)); }
 
   /// Find objects with given type
   std::set<uint32_t> find(uint32_t type) {
-    return geohash->get(type); }
+    return sindex()->get(type); }
 
   /// Find objects with given type (string representation)
   std::set<uint32_t> find(const std::string & type) {
-    return geohash->get(VMap2obj::make_type(type)); }
+    return sindex()->get(VMap2obj::make_type(type)); }
 
   /// Find nearest object of a given type.
   /// Only distance between vertices are counted.
@@ -129,6 +232,8 @@ public:
   /// get filename (empty for in-memory database)
   public: std::string get_dbname() const {return dbname;}
   public: std::string get_ghname() const {return ghname;}
+  public: std::string get_rtname() const {return rtname;}
+  public: std::string get_genname() const {return genname;}
 
 
   // Functions for getting all elements.
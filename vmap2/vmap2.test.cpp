@@ -5,6 +5,7 @@
 #include <iostream>
 #include "err/assert_err.h"
 #include "vmap2.h"
+#include "filename/filename.h"
 
 using namespace std;
 
@@ -77,6 +78,79 @@ main(){
       assert_eq(m.iter_end(), true);
 
     }
+
+    // R-tree index
+    {
+      VMap2 m("tmp.vmap2db", 0);
+      assert_eq(m.has_rtree(), false);
+      m.rtree_rebuild();
+      assert_eq(m.has_rtree(), true);
+    }
+    {
+      VMap2 m("tmp.vmap2db", 0);
+      assert_eq(m.has_rtree(), true);
+      uint32_t t = (VMAP2_LINE<<24) | 0x2342;
+      std::vector<uint32_t> ids;
+      m.find(t, dRect("[1,1,1,1]"), ids);
+      assert_eq(ids.size(), 1);
+      assert_eq(ids[0], 0);
+      m.find(t, dRect("[10,1,1,1]"), ids);
+      assert_eq(ids.size(), 0);
+
+      // modifications: R-tree file is removed
+      VMap2obj o2;
+      o2.set_type(VMAP2_LINE, 0x2342);
+      o2.dMultiLine::operator=(dMultiLine("[[10,1],[11,2]]"));
+      uint32_t id = m.add(o2);
+      assert_eq(file_exists(m.get_rtname()), false);
+      m.find(t, dRect("[10,1,1,1]"), ids);
+      assert_eq(ids.size(), 1);
+      assert_eq(ids[0], id);
+      assert_eq(m.find(t, dRect("[0,0,20,20]")).size(), 2);
+      m.del(id);
+      assert_eq(m.find(t, dRect("[0,0,20,20]")).size(), 1);
+    }
+    {
+      // modified R-tree is saved when the database is closed
+      VMap2 m("tmp.vmap2db", 0);
+      assert_eq(m.has_rtree(), true);
+      uint32_t t = (VMAP2_LINE<<24) | 0x2342;
+      assert_eq(m.find(t, dRect("[0,0,20,20]")).size(), 1);
+      assert_eq(m.find(t, dRect("[10,1,1,1]")).size(), 0);
+    }
+
+    // Bulk-load session
+    {
+      VMap2 m("tmp.vmap2db", 0);
+      uint32_t t = (VMAP2_LINE<<24) | 0x2342;
+      assert_err(m.commit(), "VMap2::commit: no bulk-load session");
+      m.begin_bulk(16);
+      m.begin_bulk(); // nested session
+      assert_eq(m.in_bulk(), true);
+      VMap2obj o;
+      o.set_type(VMAP2_LINE, 0x2342);
+      for (int i=0; i<100; i++){
+        o.dMultiLine::operator=(dMultiLine("[[30,-50],[31,-49]]"));
+        o.dMultiLine::operator+=(dPoint(10*(i%10), 10*(i/10)));
+        assert_eq(m.add(o), 1+i);
+      }
+      // queries are available before commit
+      assert_eq(m.find(t, dRect("[30.2,-49.8,0.5,0.5]")).size(), 1);
+      assert_eq(m.commit().size(), 0); // inner session
+      o.dMultiLine::operator=(dMultiLine("[[60,60],[61,61]]"));
+      assert_eq(m.add(o), 101);
+      Opt st = m.commit();
+      assert_eq(m.in_bulk(), false);
+      assert_eq(st.get<size_t>("objects"), 101);
+      assert_eq(m.find(t, dRect("[-180,-90,360,180]")).size(), 102);
+    }
+    {
+      VMap2 m("tmp.vmap2db", 0);
+      uint32_t t = (VMAP2_LINE<<24) | 0x2342;
+      assert_eq(m.size(), 102);
+      assert_eq(m.find(t, dRect("[60.2,60.2,0.5,0.5]")).size(), 1);
+      assert_eq(m.add(m.get(0)), 102);
+    }
     VMap2::remove_db("tmp.vmap2db");
 
 
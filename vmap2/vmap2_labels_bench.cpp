@@ -0,0 +1,74 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+// Synthetic benchmark for label matching: VMap2::find_refs
+// (used in do_update_labels) and do_keep_labels.
+//
+// usage: vmap2_labels_bench [<number of labels>]  (default 100000)
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include "vmap2.h"
+#include "vmap2tools.h"
+
+typedef std::chrono::steady_clock clk;
+
+double
+dt(const clk::time_point & t0){
+  return std::chrono::duration<double>(clk::now()-t0).count();
+}
+
+// random number in 0..1 range
+double
+rnd(){ return (double)rand()/RAND_MAX; }
+
+int
+main(int argc, char** argv){
+  try{
+    int n = argc>1 ? atoi(argv[1]) : 100000;
+    if (n<1) n = 1;
+    srand(1);
+
+    // n named points with labels in 1x1 degree area,
+    // labels are shifted by up to 20m from the objects
+    VMap2 map, mapo;
+    for (int i=0; i<n; i++){
+      VMap2obj o(VMAP2_POINT, 1 + i%3);
+      dPoint p(30 + rnd(), 60 + rnd());
+      o.set_coords(p);
+      o.name = "name " + std::to_string(i%100);
+      map.add(o);
+
+      VMap2obj l(VMAP2_TEXT, 1 + i%2);
+      l.ref_type = o.type;
+      l.ref_pt = p + dPoint(2e-4*(rnd()-0.5), 2e-4*(rnd()-0.5));
+      l.set_coords(l.ref_pt);
+      l.name = o.name;
+      map.add(l);
+      // old labels: half of them match new ones
+      if (i%2) l.ref_pt += dPoint(0.01, 0.01);
+      mapo.add(l);
+    }
+    std::cout << n << " objects, " << n << " labels\n";
+
+    auto t0 = clk::now();
+    auto refs = map.find_refs(10, 1000);
+    size_t nc = refs.size() - refs.count(0xFFFFFFFF);
+    std::cout << std::fixed << std::setprecision(3)
+              << "find_refs:      " << dt(t0) << " s, "
+              << nc << " labels connected\n";
+
+    t0 = clk::now();
+    do_keep_labels(mapo, map, 10);
+    std::cout << "do_keep_labels: " << dt(t0) << " s, "
+              << map.find_class(VMAP2_TEXT).size() << " labels\n";
+  }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
@@ -0,0 +1,104 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+// Compare size and speed of VMap2obj packing formats
+// (version 1 and version 2) on objects from an existing map.
+//
+// usage: vmap2_pack_cmp <file>.vmap2db [<number of repeats>]
+// (any file supported by VMap2::read can be used: .vmap2, .vmap2db)
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include "vmap2.h"
+#include "filename/filename.h"
+
+typedef std::chrono::steady_clock clk;
+
+double
+dt(const clk::time_point & t0){
+  return std::chrono::duration<double>(clk::now()-t0).count();
+}
+
+int
+main(int argc, char** argv){
+  try{
+    if (argc < 2) {
+      std::cerr << "usage: vmap2_pack_cmp <file>.vmap2db [<number of repeats>]\n";
+      return 1;
+    }
+    int nrep = argc>2 ? atoi(argv[2]) : 3;
+    if (nrep<1) nrep = 1;
+
+    // read all objects into memory
+    std::vector<VMap2obj> objs;
+    size_t npts = 0, nstored = 0;
+    if (file_ext_check(argv[1], ".vmap2db")){
+      VMap2 map(argv[1]);
+      map.iter_start();
+      while (!map.iter_end()) objs.push_back(map.iter_get_next().second);
+    }
+    else {
+      VMap2 map;
+      map.read(argv[1]);
+      map.iter_start();
+      while (!map.iter_end()) objs.push_back(map.iter_get_next().second);
+    }
+    for (auto const & o:objs) npts += o.npts();
+    std::cout << argv[1] << ": " << objs.size() << " objects, "
+              << npts << " points\n";
+    if (objs.size()==0) return 0;
+
+    std::cout << std::setw(8)  << "format"
+              << std::setw(14) << "size, bytes"
+              << std::setw(12) << "bytes/obj"
+              << std::setw(14) << "pack, obj/s"
+              << std::setw(14) << "unpack, obj/s" << "\n";
+
+    size_t size1 = 0;
+    for (int ver = 1; ver<=2; ver++){
+      std::vector<std::string> packed(objs.size());
+
+      auto t0 = clk::now();
+      for (int r=0; r<nrep; r++)
+        for (size_t i=0; i<objs.size(); i++)
+          packed[i] = VMap2obj::pack(objs[i], ver);
+      double tp = dt(t0);
+
+      t0 = clk::now();
+      for (int r=0; r<nrep; r++)
+        for (size_t i=0; i<objs.size(); i++)
+          nstored += VMap2obj::unpack(packed[i]).size();
+      double tu = dt(t0);
+
+      // check data
+      for (size_t i=0; i<objs.size(); i++){
+        if (VMap2obj::unpack(packed[i]) != VMap2obj::unpack(VMap2obj::pack(objs[i], 1)))
+          throw Err() << "data mismatch in object " << i;
+      }
+
+      size_t size = 0;
+      for (auto const & s:packed) size += s.size();
+      if (ver==1) size1 = size;
+
+      std::cout << std::setw(8)  << ver
+                << std::setw(14) << size
+                << std::setw(12) << std::fixed << std::setprecision(1)
+                                 << (double)size/objs.size()
+                << std::setw(14) << std::setprecision(0) << nrep*objs.size()/tp
+                << std::setw(14) << nrep*objs.size()/tu << "\n";
+      if (ver==2)
+        std::cout << "size ratio v1/v2: " << std::setprecision(2)
+                  << (double)size1/size << "\n";
+    }
+  }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
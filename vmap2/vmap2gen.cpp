@@ -0,0 +1,129 @@
+#include <algorithm>
+#include "err/err.h"
+#include "vmap2gen.h"
+#include "string_pack.h"
+#include "geom/poly_tools.h"
+#include "geo_data/geo_utils.h"
+
+uint64_t
+VMap2gen::key(const dPoint & p){
+  auto ip = convert_crd(p);
+  return ((uint64_t)(uint32_t)ip.x << 32) | (uint32_t)ip.y;
+}
+
+void
+VMap2gen::add_neighbour(const dPoint & p, const dPoint & n){
+  auto kp = key(p), kn = key(n);
+  if (kp == kn) return;
+  auto & i = pts[kp];
+  if (i.fixed) return;
+  for (int j=0; j<i.nn; j++) if (i.n[j] == kn) return;
+  if (i.nn == 2) {i.fixed = true; return;}
+  i.n[i.nn++] = kn;
+}
+
+void
+VMap2gen::simplify_part(dLine & l, const double tol){
+  size_t n = l.size();
+  if (n<3) return;
+  // use same direction for a part shared by two lines
+  auto k1 = key(l[0]), k2 = key(l[n-1]);
+  bool rev = k1>k2 || (k1==k2 && key(l[1]) > key(l[n-2]));
+  if (rev) std::reverse(l.begin(), l.end());
+  line_filter_rdp(l, tol, geo_dist_2d);
+  if (rev) std::reverse(l.begin(), l.end());
+}
+
+size_t
+VMap2gen::add(const dMultiLine & ml, const bool closed){
+  lines.emplace_back(ml, closed);
+  return lines.size()-1;
+}
+
+void
+VMap2gen::prepare(){
+  pts.clear();
+  for (auto const & ml: lines){
+    bool closed = ml.second;
+    for (auto l: ml.first){
+      if (closed && l.size()>1 && key(l.front()) == key(l.back())) l.pop_back();
+      size_t n = l.size();
+      if (n==0) continue;
+      for (size_t i=0; i<n; i++){
+        if (i>0)    add_neighbour(l[i], l[i-1]);
+        else if (closed) add_neighbour(l[i], l[n-1]);
+        if (i<n-1)  add_neighbour(l[i], l[i+1]);
+        else if (closed) add_neighbour(l[i], l[0]);
+      }
+      // ends of open lines
+      if (!closed){
+        pts[key(l[0])].fixed = true;
+        pts[key(l[n-1])].fixed = true;
+      }
+    }
+  }
+}
+
+dMultiLine
+VMap2gen::get(const size_t n, const double tol) const{
+  if (n>=lines.size()) throw Err() << "VMap2gen::get: wrong index: " << n;
+  bool closed = lines[n].second;
+
+  dMultiLine ret;
+  for (auto l: lines[n].first){
+    bool dup = false; // closed line with duplicated first point
+    if (closed && l.size()>1 && key(l.front()) == key(l.back())) {
+      l.pop_back();
+      dup = true;
+    }
+    size_t N = l.size();
+    if (N<4) { // nothing to simplify
+      if (dup) l.push_back(l[0]);
+      if (N>0) ret.push_back(l);
+      continue;
+    }
+
+    // indices of fixed points
+    std::vector<size_t> fix;
+    for (size_t i=0; i<N; i++){
+      auto p = pts.find(key(l[i]));
+      if (p!=pts.end() && p->second.fixed) fix.push_back(i);
+    }
+
+    if (closed){
+      // no fixed points: use point with minimal key
+      if (fix.size()==0){
+        size_t a = 0;
+        for (size_t i=1; i<N; i++) if (key(l[i]) < key(l[a])) a = i;
+        fix.push_back(a);
+      }
+      // start from the first fixed point, close the loop
+      auto f0 = fix[0];
+      std::rotate(l.begin(), l.begin()+f0, l.end());
+      for (auto & f: fix) f -= f0;
+      l.push_back(l[0]);
+      fix.push_back(N);
+    }
+    else {
+      if (fix.size()==0 || fix[0]!=0) fix.insert(fix.begin(), 0);
+      if (fix.back()!=N-1) fix.push_back(N-1);
+    }
+
+    // simplify parts between fixed points
+    dLine res;
+    for (size_t k=0; k+1<fix.size(); k++){
+      dLine part(l.begin()+fix[k], l.begin()+fix[k+1]+1);
+      simplify_part(part, tol);
+      if (res.size()) res.pop_back(); // same as the first point of the part
+      res.insert(res.end(), part.begin(), part.end());
+    }
+
+    if (closed){
+      res.pop_back(); // closing point
+      if (res.size()<3) continue;
+      if (dup) res.push_back(res[0]);
+    }
+    ret.push_back(res);
+  }
+  return ret;
+}
@@ -0,0 +1,61 @@
+#ifndef VMAP2GEN_H
+#define VMAP2GEN_H
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include "geom/multiline.h"
+
+/*********************************************************************/
+// Topology-preserving simplification of lines and polygons
+// (used for building generalization levels in VMap2::gen_rebuild).
+//
+// All lines are added first, then points where lines meet are found
+// (points with more then two different neighbours and ends of open lines).
+// These points are kept, parts of lines between them are simplified
+// with Ramer-Douglas-Peucker algorithm (tolerance in meters, coordinates
+// are WGS lon-lat). Each part is simplified in the same direction
+// independently of its direction in the line, so shared borders of
+// polygons give same results on both sides.
+//
+// Points are compared with 1e-7 degree precision (as in VMap2 storage).
+
+class VMap2gen {
+
+  struct NInfo {
+    uint64_t n[2]; // up to two neighbours
+    uint8_t  nn;   // number of neighbours
+    bool fixed;    // the point should be kept
+    NInfo(): nn(0), fixed(false) {}
+  };
+
+  std::vector<std::pair<dMultiLine, bool> > lines; // lines and closed flags
+  std::unordered_map<uint64_t, NInfo> pts;
+
+  // point key
+  static uint64_t key(const dPoint & p);
+
+  // add neighbour to a point
+  void add_neighbour(const dPoint & p, const dPoint & n);
+
+  // simplify a part of a line between fixed points (in place)
+  static void simplify_part(dLine & l, const double tol);
+
+public:
+
+  // Add a multiline (closed=true for polygons), return its index.
+  size_t add(const dMultiLine & ml, const bool closed);
+
+  // Number of added multilines
+  size_t size() const {return lines.size();}
+
+  // Find points which should be kept.
+  // Should be called after adding all lines.
+  void prepare();
+
+  // Get simplified multiline number n with tolerance tol [m].
+  // Polygon rings with less then 3 points are removed.
+  dMultiLine get(const size_t n, const double tol) const;
+};
+
+#endif
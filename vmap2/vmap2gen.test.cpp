@@ -0,0 +1,152 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <set>
+#include <sstream>
+#include <algorithm>
+#include <iostream>
+#include "err/assert_err.h"
+#include "vmap2.h"
+#include "vmap2gen.h"
+#include "string_pack.h"
+
+// sorted points of a multiline on the vertical line x=x0
+std::string
+pts_at(const dMultiLine & ml, double x0){
+  std::set<std::pair<int32_t,int32_t> > pts;
+  for (auto const & l:ml) for (auto const & p:l){
+    if (fabs(p.x-x0) > 1e-5) continue;
+    auto ip = convert_crd(p);
+    pts.emplace(ip.x, ip.y);
+  }
+  std::ostringstream ret;
+  for (auto const & p:pts) ret << p.first << "," << p.second << " ";
+  return ret.str();
+}
+
+dMultiLine
+mk_ml(const dLine & l){
+  dMultiLine ret;
+  ret.push_back(l);
+  return ret;
+}
+
+int
+main(){
+  try{
+
+    // Two squares (30..30.01, 60..60.01), (30.01..30.02, 60..60.01)
+    // with a shared zigzag border at x=30.01 (amplitude about 0.05 m),
+    // and a zigzag line
+    dLine brd;
+    for (int i=0; i<=10; i++) brd.push_back(dPoint(30.01 + 1e-6*(i%2), 60+0.001*i));
+
+    dLine l1(brd);
+    l1.push_back(dPoint(30,60.01));
+    l1.push_back(dPoint(30,60));
+
+    dLine l2(brd);
+    std::reverse(l2.begin(), l2.end());
+    l2.push_back(dPoint(30.02,60));
+    l2.push_back(dPoint(30.02,60.01));
+    l2.push_back(l2[0]); // with closing point
+
+    dLine l3;
+    for (int i=0; i<=20; i++) l3.push_back(dPoint(30 + 0.001*i, 60.02 + 1e-6*(i%2)));
+
+    {
+      VMap2gen G;
+      assert_eq(G.add(mk_ml(l1), true), 0);
+      assert_eq(G.add(mk_ml(l2), true), 1);
+      assert_eq(G.add(mk_ml(l3), false), 2);
+      assert_eq(G.size(), 3);
+      G.prepare();
+
+      // small tolerance: nothing changes
+      assert_eq(G.get(0, 0.001).npts(), l1.size());
+      assert_eq(G.get(1, 0.001).npts(), l2.size());
+      assert_eq(G.get(2, 0.001).npts(), l3.size());
+
+      // 1m tolerance: shared border is simplified in the same way
+      auto m1 = G.get(0, 1), m2 = G.get(1, 1), m3 = G.get(2, 1);
+      assert_eq(m1.npts(), 4);
+      assert_eq(m2.npts(), 5); // closing point is kept
+      assert_eq(pts_at(m1, 30.01), pts_at(m2, 30.01));
+      assert_eq(pts_at(m1, 30.01), "300100000,600000000 300100000,600100000 ");
+      assert_eq(m3.npts(), 2); // line ends are kept
+      assert_deq(m3[0][0], l3[0], 1e-7);
+      assert_deq(m3[0][1], l3[20], 1e-7);
+
+      // large tolerance: rings are removed
+      assert_eq(G.get(0, 1e4).size(), 0);
+      assert_eq(G.get(2, 1e4).npts(), 2);
+
+      assert_err(G.get(3, 1), "VMap2gen::get: wrong index: 3");
+    }
+
+    {
+      // a single ring without fixed points
+      dLine r;
+      for (int i=0; i<40; i++)
+        r.push_back(dPoint(30 + 0.01*cos(i*M_PI/20), 60 + 0.01*sin(i*M_PI/20)));
+      VMap2gen G;
+      G.add(mk_ml(r), true);
+      G.prepare();
+      assert_eq(G.get(0, 0.001).npts(), 40);
+      auto n1 = G.get(0, 30).npts();
+      assert_eq(n1 < 40 && n1 >= 3, true);
+    }
+
+    // VMap2 generalization levels (in-memory)
+    {
+      VMap2 m;
+      VMap2obj o1(VMap2obj::make_type("area:1"));
+      o1.push_back(l1);
+      o1.name = "A";
+      VMap2obj o2(VMap2obj::make_type("area:1"));
+      o2.push_back(l2);
+      VMap2obj o3(VMap2obj::make_type("point:1"));
+      o3.push_back(dLine("[[30.005,60.005]]"));
+
+      auto id1 = m.add(o1);
+      auto id2 = m.add(o2);
+      auto id3 = m.add(o3);
+      assert_eq(m.has_gen(), false);
+      assert_eq(m.get(id1, 10).npts(), l1.size());
+
+      m.gen_rebuild({1,10});
+      assert_eq(m.has_gen(), true);
+      assert_eq(m.get(id1, 0).npts(), l1.size());
+      assert_eq(m.get(id1, 0.5).npts(), l1.size());
+      assert_eq(m.get(id1, 5).npts(), 4);
+      assert_eq(m.get(id1, 5).name, "A");
+      assert_eq(m.get(id1, 5).type, o1.type);
+      assert_eq(m.get(id2, 50).npts(), 5);
+      assert_eq(m.get(id3, 50).npts(), 1);
+
+      // modified object: no generalization data
+      m.put(id1, o1);
+      assert_eq(m.get(id1, 5).npts(), l1.size());
+      assert_eq(m.get(id2, 5).npts(), 5);
+
+      // skip small objects (only with R-tree)
+      std::vector<uint32_t> ids;
+      m.find(o1.type, dRect(29,59,2,2), ids, 1e4);
+      assert_eq(ids.size(), 2);
+      m.rtree_rebuild();
+      m.find(o1.type, dRect(29,59,2,2), ids, 100);
+      assert_eq(ids.size(), 2);
+      m.find(o1.type, dRect(29,59,2,2), ids, 1e4);
+      assert_eq(ids.size(), 0);
+      m.find(o3.type, dRect(29,59,2,2), ids, 1e4); // points are not skipped
+      assert_eq(ids.size(), 1);
+    }
+
+  }
+  catch (Err & e) {
+    if (e.str()!="") std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
@@ -4,6 +4,8 @@
 #include <cstring>
 #include <string>
 #include <deque>
+#include <thread>
+#include <exception>
 
 #include "vmap2gobj.h"
 
@@ -32,6 +34,12 @@ ms2opt_add_vmap2_render(GetOptSet & opts){
            "This option is useful for generating tiled images. Default: false.");
   opts.add("vmap_minsc_color", 1,0,g, "Color to draw maps below minimum scale (see --vmap2_minsc). "
            "Default is 0xFFDB5A00).");
+  opts.add("vmap_threads", 1,0,g, "Number of threads for parallel rendering of "
+           "drawing steps. Default: 1 (no parallel rendering).");
+  opts.add("vmap_gen", 1,0,g, "Use generalization levels of the map (if they exist) and skip "
+           "lines and areas smaller then a pixel (if R-tree index exists). Default: 1.");
+  opts.add("vmap_cache_size", 1,0,g, "Memory limit for the cache of objects converted "
+           "to viewer coordinates, megabytes. 0 to disable the cache. Default: 64.");
 }
 /**********************************************************/
 
@@ -79,6 +87,7 @@ void
 GObjVMap2::set_cnv(const std::shared_ptr<ConvBase> c) {
   if (!c) throw Err() << "GObjVMap2::set_cnv: cnv is NULL";
   cnv = c;
+  cache_clear();
   update_bbox();
 }
 
@@ -93,7 +102,74 @@ GObjVMap2::update_bbox(){
 
 /**********************************************************/
 
-GObjVMap2::GObjVMap2(VMap2 & map, const Opt &o): GObjMulti(false), map(map) {
+// Approximate memory usage of a cached object
+size_t
+GObjVMap2::ObjCacheCost::operator()(const obj_ptr_t & o) const {
+  if (!o) return 0;
+  size_t ret = sizeof(ObjCacheEntry) + o->obj.name.size() + o->obj.comm.size();
+  for (auto const & l: o->obj) ret += sizeof(dLine) + l.size()*sizeof(dPoint);
+  for (auto const & op: o->obj.opts) ret += op.first.size() + op.second.size() + 64;
+  return ret;
+}
+
+GObjVMap2::obj_ptr_t
+GObjVMap2::get_obj(const uint32_t id){
+  obj_ptr_t ret;
+  uint64_t key = ((uint64_t)res_lev << 32) | id;
+  if (obj_cache && obj_cache->get(key, ret)) return ret;
+
+  std::shared_ptr<ObjCacheEntry> e(new ObjCacheEntry);
+  VMap2obj & O = e->obj;
+  {
+    std::lock_guard<std::mutex> lk(*map_mutex);
+    O = map.get(id, get_res());
+  }
+  e->bbox = O.bbox();
+
+  // Convert angle to radians, add map-north angle, add PI/2
+  if (!std::isnan(O.angle) && O.npts() && cnv) {
+    dPoint pt1 = O.get_first_pt();
+    dPoint pt2 = pt1 + dPoint(0,1e-3);
+    cnv->bck(pt1); cnv->bck(pt2); // lonlat -> px
+    pt2-=pt1;
+    double da = atan2(pt2.y, pt2.x) + M_PI/2.0; // y axis is inverted!
+    O.angle = O.angle*M_PI/180 + da; // from north, cw, rad
+  }
+  if (cnv) cnv->bck(O);
+
+  ret = e;
+  if (obj_cache) obj_cache->add(key, ret);
+  return ret;
+}
+
+void
+GObjVMap2::find_objs(const uint32_t type, const dRect & range,
+                     std::vector<uint32_t> & ids, const bool use_res){
+  std::lock_guard<std::mutex> lk(*map_mutex);
+  map.find(type, range, ids, use_res? get_res():0);
+}
+
+Opt
+GObjVMap2::cache_stat() const{
+  Opt ret;
+  size_t h = 0, m = 0;
+  if (obj_cache){
+    h = obj_cache->stat_hits();
+    m = obj_cache->stat_misses();
+    ret.put("size",      obj_cache->size_used());
+    ret.put("count",     obj_cache->count());
+    ret.put("evictions", obj_cache->stat_evictions());
+  }
+  ret.put("hits",     h);
+  ret.put("misses",   m);
+  ret.put("hit_rate", h+m>0 ? (double)h/(h+m) : 0.0);
+  return ret;
+}
+
+/**********************************************************/
+
+GObjVMap2::GObjVMap2(VMap2 & map, const Opt &o):
+    GObjMulti(false), map(map), map_mutex(new std::mutex) {
 
   ptsize0 = 0;
   sc = 1.0;
@@ -104,6 +180,21 @@ GObjVMap2::GObjVMap2(VMap2 & map, const Opt &o): GObjMulti(false), map(map) {
   fit_patt_size = o.get<bool>("fit_patt_size", false);
   nsaved=0;
 
+  double cache_size = o.get<double>("vmap_cache_size", 64);
+  if (cache_size>0)
+    obj_cache.reset(new SizeCacheMT<uint64_t, obj_ptr_t, std::hash<uint64_t>,
+                    ObjCacheCost>(cache_size*1024*1024));
+  obj_cache_mod = map.get_mod_count();
+
+  use_gen = o.get<bool>("vmap_gen", true);
+  res_lev = 0;
+  if (o.exists("vmap_gen") && use_gen && !map.has_gen())
+    std::cerr << "GObjVMap2: warning: --vmap_gen is set, but the map has no "
+                 "generalization levels (see --vmap2_gen option)\n";
+
+  nthreads = o.get<size_t>("vmap_threads", 1);
+  if (nthreads<1) nthreads = 1;
+
   opt = o;
 
   // Read configuration file.
@@ -114,6 +205,37 @@ GObjVMap2::GObjVMap2(VMap2 & map, const Opt &o): GObjMulti(false), map(map) {
   load_conf(cfg, defs, depth);
 }
 
+GObjVMap2::GObjVMap2(const GObjVMap2 & o):
+    GObjMulti(false), map(o.map), groups(o.groups), ref(o.ref),
+    max_text_size(o.max_text_size), obj_scale(o.obj_scale),
+    border(o.border), fit_patt_size(o.fit_patt_size), ptsize0(o.ptsize0),
+    sc(o.sc), minsc(o.minsc), minsc_color(o.minsc_color), nsaved(0),
+    obj_cache_mod(o.obj_cache_mod), use_gen(o.use_gen), res_lev(o.res_lev),
+    map_mutex(o.map_mutex), nthreads(o.nthreads),
+    cnv(o.cnv), opt(o.opt), range(o.range) {
+
+  if (o.obj_cache)
+    obj_cache.reset(new SizeCacheMT<uint64_t, obj_ptr_t, std::hash<uint64_t>,
+                    ObjCacheCost>(o.obj_cache->get_budget()));
+
+  // Copy drawing steps: they have a back reference to the object
+  // and may modify their patterns while drawing.
+  for (auto const & s: o.get_data()){
+    auto st0 = (const DrawingStep *)s.get();
+    std::shared_ptr<DrawingStep> st(new DrawingStep(*st0));
+    st->gobj = this;
+    st->patt = st0->patt.clone();
+    st->img  = st0->img.clone();
+    add(o.get_depth(s), st);
+    if (!o.get_visibility(s)) set_visibility(st, false);
+  }
+}
+
+std::shared_ptr<GObj>
+GObjVMap2::clone() const {
+  return std::shared_ptr<GObj>(new GObjVMap2(*this));
+}
+
 void
 GObjVMap2::push_step(std::shared_ptr<DrawingStep> & st, int & depth){
   if (!st) return;
@@ -516,6 +638,13 @@ GObjVMap2::load_conf(const std::string & cfgfile, read_words_defs & defs, int &
         continue;
       }
 
+      // barrier
+      if (ftr == "barrier"){
+        st->check_args(vs, {});
+        st->barrier = true;
+        continue;
+      }
+
       // lines <lines> ...
       if (ftr == "lines"){
         st->check_type(STEP_DRAW_POINT | STEP_DRAW_LINE | STEP_DRAW_AREA);
@@ -749,24 +878,12 @@ GObjVMap2::load_conf(const std::string & cfgfile, read_words_defs & defs, int &
 
 #include "geom/poly_tools.h"
 // change object coordinates according to features
-// change object angle to radians
+// (object is already converted to viewer coordinates, see get_obj)
 void
 GObjVMap2::DrawingStep::convert_coords(VMap2obj & O){
 
   ConvBase *cnv = gobj->cnv.get();
 
-  // Convert angle to radians, add map-north angle, add PI/2
-  if (!std::isnan(O.angle) && O.npts() && cnv) {
-    dPoint pt1 = O.get_first_pt();
-    dPoint pt2 = pt1 + dPoint(0,1e-3);
-    cnv->bck(pt1); cnv->bck(pt2); // lonlat -> px
-    pt2-=pt1;
-    double da = atan2(pt2.y, pt2.x) + M_PI/2.0; // y axis is inverted!
-    O.angle = O.angle*M_PI/180 + da; // from north, cw, rad
-  }
-
-  if (cnv) cnv->bck(O);
-
   // move/rotate
   if (move_data.size()>0){
     for (auto & l:O){ // segments
@@ -782,16 +899,16 @@ GObjVMap2::DrawingStep::convert_coords(VMap2obj & O){
           dRect r(p,p);
           r.expand(md.dist);
           if (cnv) r = cnv->frw_acc(r);
-          auto ids = gobj->map.find(md.target, r);
+          std::vector<uint32_t> ids;
+          gobj->find_objs(md.target, r, ids, false);
           bool moved = false;
 
           for (int i:ids){
-            auto O1 = gobj->map.get(i);
-            if (cnv) cnv->bck(O1);
+            auto O1 = gobj->get_obj(i);
 
             dPoint t(1,0);
             dPoint p1(p);
-            double d = nearest_pt(O1, t, p1, md.dist);
+            double d = nearest_pt(O1->obj, t, p1, md.dist);
             if (d>=dm) continue;
             dm = d;
             pm = p1;
@@ -975,7 +1092,7 @@ GObjVMap2::DrawingStep::draw(const CairoWrapper & cr, const dRect & range){
   double osc = gobj->obj_scale;
   if (gobj->sc!=0) osc *= gobj->sc;
 
-  std::set<uint32_t> ids;
+  std::vector<uint32_t> ids;
 
   // calculate range for object selecting
   dRect sel_range(range);
@@ -1021,7 +1138,7 @@ GObjVMap2::DrawingStep::draw(const CairoWrapper & cr, const dRect & range){
       action == STEP_DRAW_AREA ||
       action == STEP_DRAW_TEXT){
 
-    ids = gobj->map.find(etype, sel_range);
+    gobj->find_objs(etype, sel_range, ids, true);
     if (ids.size()==0){
       // set empty clipping range if needed
       if (do_clip && action == STEP_DRAW_AREA) {
@@ -1040,9 +1157,9 @@ GObjVMap2::DrawingStep::draw(const CairoWrapper & cr, const dRect & range){
     cr->set_color_a(sel_range_color);
     cr->set_line_width(sel_range_thickness);
     for (auto const i: ids){
-      auto O = gobj->map.get(i);
-      if (!intersect(O.bbox(), sel_range)) continue;
-      dRect box = cnv->bck_acc(O.bbox()); //to points
+      auto O = gobj->get_obj(i);
+      if (!intersect(O->bbox, sel_range)) continue;
+      dRect box = cnv->bck_acc(O->bbox); //to points
       box.expand(exp_dist);
       cr->mkpath(rect_to_line(box), true);
     }
@@ -1092,8 +1209,9 @@ GObjVMap2::DrawingStep::draw(const CairoWrapper & cr, const dRect & range){
 
   // Draw each object
   for (auto const i: ids){
-    auto O = gobj->map.get(i);
-    if (!intersect(O.bbox(), sel_range)) continue;
+    auto C = gobj->get_obj(i);
+    if (!intersect(C->bbox, sel_range)) continue;
+    auto O = C->obj;
     convert_coords(O);
     cr->begin_new_path();
 
@@ -1246,8 +1364,9 @@ GObjVMap2::DrawingStep::draw(const CairoWrapper & cr, const dRect & range){
     cr->save(); gobj->nsaved++;
     cr->begin_new_path();
     for (auto const i: ids){
-      auto O = gobj->map.get(i);
-      if (!intersect(O.bbox(), sel_range)) continue;
+      auto C = gobj->get_obj(i);
+      if (!intersect(C->bbox, sel_range)) continue;
+      auto O = C->obj;
       convert_coords(O);
       cr->mkpath_smline(O, close, sm);
     }
@@ -1260,8 +1379,9 @@ GObjVMap2::DrawingStep::draw(const CairoWrapper & cr, const dRect & range){
     cr->save(); gobj->nsaved++;
     cr->begin_new_path();
     for (auto const i: ids){
-      auto O = gobj->map.get(i);
-      if (!intersect(O.bbox(), sel_range)) continue;
+      auto C = gobj->get_obj(i);
+      if (!intersect(C->bbox, sel_range)) continue;
+      auto O = C->obj;
       convert_coords(O);
       draw_text(O, cr, range, true);
     }
@@ -1362,16 +1482,119 @@ GObj::ret_t
 GObjVMap2::draw(const CairoWrapper & cr, const dRect & draw_range) {
 
   // calculate scaling for this range
-  sc = ptsize0/get_ptsize(*cnv, draw_range);
+  double ptsize = get_ptsize(*cnv, draw_range);
+  sc = ptsize0/ptsize;
   if (sc!=0 && sc < minsc){
     cr->set_color_a(minsc_color);
     cr->paint();
     return FILL_PART;
   }
 
+  // resolution hint for reading objects
+  res_lev = (use_gen && ptsize>0 && std::isfinite(ptsize)) ?
+     1024 + (int)floor(log2(ptsize)) : 0;
+
+  // map has been modified since last drawing
+  if (obj_cache_mod != map.get_mod_count()){
+    cache_clear();
+    obj_cache_mod = map.get_mod_count();
+  }
+
   // we want to track save/restore pairs here
   nsaved=0;
-  auto ret = GObjMulti::draw(cr, draw_range);
+  auto ret = nthreads>1 ? draw_parallel(cr, draw_range):
+                          GObjMulti::draw(cr, draw_range);
   while (nsaved>0){ cr->restore(); nsaved--; }
   return ret;
 }
+
+GObj::ret_t
+GObjVMap2::draw_parallel(const CairoWrapper & cr, const dRect & draw_range) {
+
+  // only image surfaces are supported
+  auto surf = Cairo::RefPtr<Cairo::ImageSurface>::cast_dynamic(cr->get_target());
+  if (!surf) return GObjMulti::draw(cr, draw_range);
+  int w = surf->get_width(), h = surf->get_height();
+  Cairo::Matrix M;
+  cr->get_matrix(M);
+
+  // visible steps in drawing order
+  std::vector<std::shared_ptr<DrawingStep> > steps;
+  for (auto const & o: get_data())
+    if (get_visibility(o)) steps.push_back(std::static_pointer_cast<DrawingStep>(o));
+
+  auto ret = GObj::FILL_NONE;
+  size_t i0 = 0;
+  while (i0 < steps.size()){
+    if (is_stopped()) return GObj::FILL_NONE;
+
+    // barrier: draw the step directly
+    if (steps[i0]->is_barrier()){
+      auto & st = steps[i0++];
+      try {
+        auto lk = st->get_lock();
+        auto res = st->draw(cr, draw_range);
+        if (res != GObj::FILL_NONE && ret != GObj::FILL_ALL) ret = res;
+      }
+      catch (std::exception & e) { process_error(e); }
+      continue;
+    }
+
+    // sequence of independent steps [i0,i1) split into np parts
+    size_t i1 = i0;
+    while (i1 < steps.size() && !steps[i1]->is_barrier()) i1++;
+    size_t np = std::min(nthreads, i1-i0);
+
+    std::vector<CairoWrapper> layers(np);
+    std::vector<GObj::ret_t> rets(np, GObj::FILL_NONE);
+    std::vector<std::exception_ptr> errs(i1-i0);
+
+    auto draw_part = [&](const size_t p){
+      size_t j0 = i0 + (i1-i0)*p/np, j1 = i0 + (i1-i0)*(p+1)/np;
+      try {
+        ImageR img(w, h, IMAGE_32ARGB);
+        img.fill32(0);
+        layers[p].set_surface_img(img);
+        layers[p]->set_matrix(M);
+      }
+      catch (...) { errs[j0-i0] = std::current_exception(); return; }
+
+      for (size_t j = j0; j<j1; j++){
+        if (is_stopped()) return;
+        try {
+          auto lk = steps[j]->get_lock();
+          auto res = steps[j]->draw(layers[p], draw_range);
+          if (res != GObj::FILL_NONE && rets[p] != GObj::FILL_ALL) rets[p] = res;
+        }
+        catch (...) { errs[j-i0] = std::current_exception(); }
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t p = 1; p<np; p++) threads.emplace_back(draw_part, p);
+    draw_part(0);
+    for (auto & t: threads) t.join();
+    if (is_stopped()) return GObj::FILL_NONE;
+
+    // process errors in drawing order
+    for (auto const & err: errs){
+      if (!err) continue;
+      try { std::rethrow_exception(err); }
+      catch (std::exception & e) { process_error(e); }
+    }
+
+    // composite layers
+    for (size_t p = 0; p<np; p++){
+      if (rets[p] == GObj::FILL_NONE) continue;
+      cr->save();
+      cr->set_identity_matrix();
+      cr->set_operator(Cairo::OPERATOR_OVER);
+      cr->set_source(layers[p].get_surface(), 0, 0);
+      cr->paint();
+      cr->restore();
+      if (ret != GObj::FILL_ALL) ret = rets[p];
+    }
+    i0 = i1;
+  }
+  return ret;
+}
@@ -2,9 +2,11 @@
 #define VMAP2_GOBJ_H
 
 #include <list>
+#include <cmath>
 #include <vector>
 #include <string>
 #include <map>
+#include <mutex>
 
 #include "cairo/cairo_wrapper.h"
 #include "image/image_colors.h"
@@ -15,6 +17,7 @@
 #include "geo_data/conv_geo.h"
 #include "opt/opt.h"
 #include "read_words/read_words.h"
+#include "cache/sizecache_mt.h"
 
 #include "vmap2.h"
 
@@ -76,6 +79,8 @@ where possible features are:
     fi_grid <step> <color> <line width> -- draw ETRS-TM35FIN grid (Finland)
     grid_labels <size> <font> <color> -- draw grid labels
     save_to_stack <name>    -- save the drawing step to a named stack instead of rendering
+    barrier                 -- in parallel rendering mode (see below) draw this step
+                               directly, after all previous steps and before all following ones
 
 
 
@@ -98,6 +103,15 @@ other commands in the configuration file
     stack_render <name> [<operator>]  -- render a stack of previously saved drawing steps
     stack_clear <name> - clear the stack
 
+Parallel rendering (--vmap_threads option, N>1). Drawing steps
+between "barriers" are split into N parts (keeping depth order), each part
+is drawn in a separate thread into its own ARGB layer, then layers are
+composited into the main context in depth order. Barriers are steps with
+the `clip` feature, steps with non-default `operator` and steps with
+the `barrier` feature, they are drawn directly into the main context.
+This mode works only for image surfaces (for other surfaces steps are
+drawn one by one) and needs up to N additional images of the surface size.
+
 */
 
 /********************************************************************/
@@ -130,6 +144,46 @@ private:
   uint32_t minsc_color;  // Color for drawing too small scales.
   size_t nsaved;         // how many times cairo context has been saved (fr clipping)
 
+  // Cache of objects converted to viewer coordinates, keyed by object id
+  // and resolution level (see res_lev).
+  // Objects touching a few tiles or drawn by a few steps are read from
+  // the database and converted only once. The cache is cleared when
+  // coordinate conversion is changed (set_cnv) or when the map is modified.
+  struct ObjCacheEntry {
+    dRect bbox;   // object bounding box in map (WGS) coordinates
+    VMap2obj obj; // object in viewer coordinates, angle in radians
+  };
+  typedef std::shared_ptr<const ObjCacheEntry> obj_ptr_t;
+  struct ObjCacheCost { size_t operator()(const obj_ptr_t & o) const; };
+  std::shared_ptr<SizeCacheMT<uint64_t, obj_ptr_t,
+                  std::hash<uint64_t>, ObjCacheCost> > obj_cache; // NULL if disabled
+  size_t obj_cache_mod;  // map modification counter for the cache
+
+  // Resolution hint for reading objects from the map (see VMap2::get, VMap2::find):
+  // pixel size in meters rounded down to a power of 2, 2^res_lev. Set in draw().
+  // res_lev = 0 means no resolution hint (when --vmap_gen=0 is used).
+  bool use_gen;
+  int res_lev;
+  double get_res() const {return res_lev? pow(2.0, res_lev-1024) : 0;}
+
+  // Read object from the map and convert to viewer coordinates
+  // (or get it from the cache).
+  obj_ptr_t get_obj(const uint32_t id);
+
+  // Find objects in the map (see VMap2::find).
+  // If use_res = true, use the resolution hint.
+  void find_objs(const uint32_t type, const dRect & range,
+                 std::vector<uint32_t> & ids, const bool use_res);
+
+  // Map access is locked: BerkleyDB storage can not be used from many threads.
+  // The mutex is shared between copies of the object (see clone()).
+  std::shared_ptr<std::mutex> map_mutex;
+
+  size_t nthreads;       // number of threads for parallel rendering
+
+  // Draw steps in parallel (see description above)
+  ret_t draw_parallel(const CairoWrapper & cr, const dRect & draw_range);
+
 public:
 
   /*******************************************/
@@ -148,13 +202,16 @@ public:
   // for both FEATURE_PATT and FEATURE_IMG
   struct ImageRenderer {
     ImageR img; // actual data for raster images
+    std::string svg; // file name for svg images
     Cairo::RefPtr<Cairo::SurfacePattern> patt;
-    double sc0,w,h;
+    double sc0,w,h,dx,dy;
     bool empty;
-    ImageRenderer(){ sc0 = w = h = 0; empty = true;}
-    ImageRenderer(const std::string & fname, double sc, double dx, double dy){
+    ImageRenderer(){ sc0 = w = h = dx = dy = 0; empty = true;}
+    ImageRenderer(const std::string & fname, double sc, double dx, double dy):
+        dx(dx), dy(dy){
       sc0 = sc;
       if (file_ext_check(fname, ".svg")){
+        svg = fname;
         patt = svg_to_pattern(fname, 1.0, 1.0, dx, dy, &w, &h);
       }
       else {
@@ -166,7 +223,8 @@ public:
       }
       empty = false;
     }
-    ImageRenderer(const ImageR & image, double sc, double dx=0.0, double dy=0.0){
+    ImageRenderer(const ImageR & image, double sc, double dx=0.0, double dy=0.0):
+        dx(dx), dy(dy){
       img = image; sc0=sc;
       if (img.type() != IMAGE_32ARGB) img = image_to_argb(img);
       w = img.width(); h = img.height();
@@ -205,6 +263,16 @@ public:
     bool is_empty() const {return empty;}
     double width() const {return w;}
     double height() const {return h;}
+
+    // Copy with its own cairo pattern (for drawing in another thread).
+    // Image data is shared, svg file is read again.
+    ImageRenderer clone() const {
+      if (!patt) return *this;
+      ImageRenderer ret = svg.size()?
+        ImageRenderer(svg, sc0, dx, dy) : ImageRenderer(img, sc0, dx, dy);
+      ret.empty = empty;
+      return ret;
+    }
   };
 
   /*******************************************/
@@ -243,6 +311,7 @@ public:
     double text_vspace;
     double rotate;
     bool outer;
+    bool barrier; // draw the step in order with all other steps (parallel rendering)
     struct move_t {uint32_t target; double dist; bool rot; bool dir;};
     std::list<move_t> move_data; // move_to, move_from, rotate_to data
     double sel_range_thickness;
@@ -255,6 +324,7 @@ public:
     DrawingStep(GObjVMap2 * gobj): gobj(gobj), action(STEP_UNKNOWN), etype(0) {
       do_clip = do_stroke = do_stroke2 = do_fill = do_write = false;
       do_patt = do_img = do_pulk_grid = do_fi_grid = do_sel_range = false;
+      barrier = false;
       stroke_color = 0;
       fill_color = 0;
       write_color = 0;
@@ -280,6 +350,9 @@ public:
     std::string get_name() const {return step_name;}
     std::string get_group() const {return group_name;}
 
+    // Should the step be drawn directly in parallel rendering mode?
+    bool is_barrier() const {return barrier || do_clip || op != Cairo::OPERATOR_OVER;}
+
     // helpers used in draw() method, see .cpp files for description
     void convert_coords(VMap2obj & O);
     void draw_text(VMap2obj & O, const CairoWrapper & cr, const dRect & range, bool path);
@@ -355,11 +428,26 @@ public:
   // update range (used in set_brd, set_ref, set_cnv)
   void update_bbox();
 
+  // Clear the object cache. This is done automatically
+  // in set_cnv() and on map modifications.
+  void cache_clear() { if (obj_cache) obj_cache->clear(); }
+
+  // Object cache statistics: size (bytes), count, hits, misses,
+  // evictions, hit_rate.
+  Opt cache_stat() const;
+
   /*******************************************/
 
   // constructor -- open new map
   GObjVMap2(VMap2 & map, const Opt & o);
 
+  // Copy for drawing in another thread: same map, options and
+  // drawing steps (copied), own conversion and object cache
+  // (with the shared memory budget).
+  GObjVMap2(const GObjVMap2 & o);
+
+  std::shared_ptr<GObj> clone() const override;
+
   // load configuration file
   void load_conf(const std::string & cfgfile, read_words_defs & defs, int & depth);
 
@@ -22,6 +22,13 @@ ms2opt_add_vmap2(GetOptSet & opts, bool read, bool write){
         "Skip objects which are not defined in typeinfo file."
         " Default: 0. This works when reading/writing MP, VMAP.");
 
+    opts.add("bulk_cache",  1, 0, g,
+        "BerkleyDB cache size (MB) for bulk import into VMAP2DB databases."
+        " Objects are appended with sequential IDs, spatial index is written"
+        " in sorted order at the end of import. Recommended value is 64-256,"
+        " it is used for both object and spatial index databases."
+        " Default: 0 (add objects one by one).");
+
     opts.add("min_depth",  1, 0, "FIG", "minimum depth of map object (default 40)");
     opts.add("max_depth",  1, 0, "FIG", "minimum depth of map object (default 200)");
 
@@ -39,11 +46,14 @@ ms2opt_add_vmap2(GetOptSet & opts, bool read, bool write){
         " If skip_unknown is set then labels are skipped with unknown objects.");
 
     opts.add("osm_conf",  1, 0, "OSM",
-        "Configuration file for OSM XML -> VMAP2 conversion");
+        "Configuration file for OSM XML/PBF -> VMAP2 conversion");
     opts.add("osm_ids",  0, 0, "OSM",
         "Put OSM IDs in object comments");
     opts.add("osm_tags",  0, 0, "OSM",
         "Put OSM tags in object comments");
+    opts.add("osm_threads",  1, 0, "OSM",
+        "Number of threads for decoding OSM PBF files "
+        "(default: number of CPUs, 1: no additional threads)");
 
   }
   if (write) {
@@ -87,13 +97,55 @@ ms2opt_add_vmap2(GetOptSet & opts, bool read, bool write){
     opts.add("join_lines_a",1, 0, "VMAP2", "Max angle for joining lines in degrees. Default 45.");
     opts.add("filter_pts",0, 0,   "VMAP2", "Reduce number of points in lines and polygons.");
     opts.add("filter_pts_d",1, 0, "VMAP2", "Accuracy for point filtering in meters. Default: 10");
+    opts.add("vmap2_rtree", 1, 0, "VMAP2",
+      "When writing VMAP2DB database, build R-tree index (.vmap2rt file) "
+      "used for faster spatial queries. Values: 0 or 1, default: 0.");
+    opts.add("vmap2_gen", 1, 0, "VMAP2",
+      "When writing VMAP2DB database, build generalization levels "
+      "(.vmap2gen file): copies of lines and polygons simplified with "
+      "given tolerances, comma-separated list in meters, e.g. \"1,10,100\". "
+      "They are used for drawing small-scale maps (see --vmap_gen option). "
+      "Default: empty, do not build.");
   }
 }
 
 /****************************************************************************/
-void
-vmap2_import(const std::string & ifile, const VMap2types & types,
-             VMap2 & vmap2, const Opt & opts){
+// Bulk-load session for import (if bulk_cache option is non-zero).
+// The session is always finished: by commit(), or in the destructor
+// if an exception is thrown. Statistics are printed by commit()
+// for BerkleyDB databases unless "quite" option is set.
+class ImportSession {
+  VMap2 & vmap2;
+  const Opt & opts;
+  bool active;
+public:
+  ImportSession(VMap2 & vmap2, const Opt & opts):
+      vmap2(vmap2), opts(opts), active(false) {
+    size_t bulk_cache = opts.get("bulk_cache", 0);
+    if (bulk_cache) {vmap2.begin_bulk(bulk_cache); active = true;}
+  }
+
+  ~ImportSession(){
+    if (!active) return;
+    try { vmap2.commit(); }
+    catch (...) {}
+  }
+
+  void commit(){
+    if (!active) return;
+    active = false;
+    auto st = vmap2.commit();
+    if (opts.get("quite", false) || vmap2.get_dbname()=="" ||
+        !st.exists("objects")) return;
+    std::cerr << "VMAP2 import: " << st.get<size_t>("objects") << " objects in "
+              << st.get<double>("time") << " s ("
+              << (size_t)st.get<double>("rate") << " objects/s)\n";
+  }
+};
+
+static void
+import_file(const std::string & ifile, const VMap2types & types,
+            VMap2 & vmap2, const Opt & opts){
 
   if (file_ext_check(ifile, ".vmap2db")){
     if (ifile == vmap2.get_dbname()) throw Err()
@@ -119,7 +171,8 @@ vmap2_import(const std::string & ifile, const VMap2types & types,
   else if (file_ext_check(ifile, ".fig")){
     fig_to_vmap2(ifile, types, vmap2, opts);
   }
-  else if (file_ext_check(ifile, ".osm")){
+  else if (file_ext_check(ifile, ".osm") ||
+           file_ext_check(ifile, ".osm.pbf")){
     osm_to_vmap2(ifile, vmap2, opts);
   }
   else if (file_ext_check(ifile, ".gpx")){
@@ -128,13 +181,34 @@ vmap2_import(const std::string & ifile, const VMap2types & types,
   else throw Err() << "unsupported file extension: " << ifile;
 }
 
+void
+vmap2_import(const std::string & ifile, const VMap2types & types,
+             VMap2 & vmap2, const Opt & opts){
+  vmap2_import(std::vector<std::string>(1, ifile), types, vmap2, opts);
+}
+
 void vmap2_import(const std::vector<std::string> & ifiles,
                   const VMap2types & types, VMap2 & vmap2, const Opt & opts){
-  for (const auto & ifile:ifiles) vmap2_import(ifile, types, vmap2, opts);
+  ImportSession sess(vmap2, opts);
+  for (const auto & ifile:ifiles) import_file(ifile, types, vmap2, opts);
+  sess.commit();
 }
 
 /****************************************************************************/
 
+// Build additional indices of VMAP2DB database (according with options).
+static void
+build_indices(VMap2 & vmap2, const Opt & opts){
+  if (vmap2.get_dbname()=="") return;
+  if (opts.get("vmap2_rtree", false)) vmap2.rtree_rebuild();
+  if (opts.get("vmap2_gen", "")!=""){
+    auto tols = str_to_type_dvec(opts.get("vmap2_gen"));
+    for (auto t: tols) if (t<=0) throw Err()
+      << "vmap2_gen: positive tolerances expected: " << opts.get("vmap2_gen");
+    vmap2.gen_rebuild(tols);
+  }
+}
+
 void
 vmap2_export(VMap2 & vmap2, const VMap2types & types,
              const std::string & ofile, const Opt & opts){
@@ -168,7 +242,7 @@ vmap2_export(VMap2 & vmap2, const VMap2types & types,
     vmap2_import({ofile}, types, vmap2o, opts);
 
     if (keep_labels!=0)
-      do_keep_labels(vmap2o, vmap2);
+      do_keep_labels(vmap2o, vmap2, keep_labels);
 
     if (replace_source!="")
       do_replace_source(vmap2o, vmap2, replace_source);
@@ -203,14 +277,18 @@ vmap2_export(VMap2 & vmap2, const VMap2types & types,
 
   // Save files
   if (file_ext_check(ofile, ".vmap2db")){
-    // If we are saving vmap2db to itself - no need to do anything.
+    // If we are saving vmap2db to itself - no need to copy objects.
     // If it's a different database, then delete, create it and copy objects.
     if (ofile != vmap2.get_dbname()){
       VMap2::remove_db(ofile);
       VMap2 out(ofile, 1);
+      ImportSession sess(out, opts);
       vmap2.iter_start();
       while (!vmap2.iter_end()) out.add(vmap2.iter_get_next().second);
+      sess.commit();
+      build_indices(out, opts);
     }
+    else build_indices(vmap2, opts);
   }
   else if (file_ext_check(ofile, ".vmap2")){
     vmap2.write(ofile);
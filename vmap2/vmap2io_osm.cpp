@@ -1,11 +1,14 @@
 #include <fstream>
 #include <deque>
+#include <algorithm>
+#include <functional>
 #include "filename/filename.h"
 #include "read_words/read_words.h"
-#include "osmxml/osmxml.h"
+#include "osmxml/osmpbf.h"
 #include "geo_data/geo_utils.h" // geo_dist_2d
 #include "vmap2.h"
 #include "vmap2obj.h"
+#include "string_pack.h"
 
 void
 load_osm_conf(const std::string & fname,
@@ -77,95 +80,80 @@ bool match_tags(const Opt & obj, const Opt & mask){
 }
 
 
-// convert OSM to vmap
-void
-osm_to_vmap2(const std::string & fname, VMap2 & data, const Opt & opts){
-
-  // read configuration
-  std::string conf = opts.get("osm_conf","");
-  if (conf=="")
-    throw Err() << "empty configuration file, use --osm_conf option";
-
-  bool keep_id   = opts.get("osm_ids", false);
-  bool keep_tags = opts.get("osm_tags", false);
+/********************************************************************/
+// Conversion of OSM objects using configuration rules
 
+struct OSMConv {
   std::list<std::pair<Opt, std::vector<uint32_t> > > osm_conf;
-  read_words_defs defs;
-  load_osm_conf(conf, osm_conf, defs);
-
-  //read OSM data
-  OSMXML data_in;
-  read_osmxml(fname, data_in, opts);
-
-  // For each OSM point go through configuration list
-  // until it can be converted. Tags should match, "name"="*"
-  // matches any tag value. Point objects can not be converted
-  // to lines and areas, areas and lines can be converted to points
-  // "none" type is used to skip the object.
+  bool keep_id, keep_tags;
+  VMap2 & data;
+
+  OSMConv(VMap2 & data, const Opt & opts): data(data){
+    std::string conf = opts.get("osm_conf","");
+    if (conf=="")
+      throw Err() << "empty configuration file, use --osm_conf option";
+    keep_id   = opts.get("osm_ids", false);
+    keep_tags = opts.get("osm_tags", false);
+    read_words_defs defs;
+    load_osm_conf(conf, osm_conf, defs);
+  }
 
-  // convert OSM points
-  for (auto const & e:data_in.points){
-    bool done=false;
+  // Are coordinates needed for converting the object?
+  bool need_crds(const Opt & tags, const bool is_node){
     for (auto const & conf:osm_conf){
-      if (!match_tags(e.second, conf.first)) continue;
-
-      // extract coordinates
-      dPoint pt = data_in.get_node_coords(e.first);
-
+      if (!match_tags(tags, conf.first)) continue;
+      bool done = false;
       for (const auto t:conf.second){
-        // we can't convert point to lines or areas:
         auto cl = VMap2obj::get_class(t);
-        if (cl==VMAP2_LINE || cl==VMAP2_POLYGON) continue;
         if (cl==VMAP2_NONE) {done=true; continue;}
-        if (cl!=VMAP2_POINT) throw Err()
-          << "Bad object type in configuration file: "
-          << VMap2obj::print_type(t);
-
-        // make object
-        VMap2obj obj(t);
-        obj.name = e.second.get("name", "");
-        if (keep_id)
-          obj.comm += 'n' + type_to_str(e.first) + '\n';
-        if (keep_tags) for (const auto & t:e.second)
-          obj.comm += t.first + ": " + t.second + '\n';
-        obj.set_coords(pt);
-        data.add(obj);
-        done=true;
+        if (is_node && (cl==VMAP2_LINE || cl==VMAP2_POLYGON)) continue;
+        return true;
       }
-      if (done) break;
+      if (done) return false;
     }
-    if (!done && e.second.size()>0) std::cerr
-      << "osm object doen not match any rule:\n"
-      << "node " << e.first << ": " << e.second << "\n";
+    return false;
   }
 
-  // convert OSM ways
-  for (auto const & e:data_in.ways){
+  // For each OSM object go through configuration list
+  // until it can be converted. Tags should match, "name"="*"
+  // matches any tag value. Point objects can not be converted
+  // to lines and areas, areas and lines can be converted to points
+  // "none" type is used to skip the object.
+  // Coordinates are requested with get_crds only if needed,
+  // objects with empty coordinates are skipped.
+  void convert(const char pref, const osm_id_t id, const Opt & tags,
+               std::function<dMultiLine()> get_crds){
+    bool is_node = (pref == 'n');
     bool done=false;
+    bool have_crds=false;
+    dMultiLine pts;
     for (auto const & conf:osm_conf){
-      if (!match_tags(e.second, conf.first)) continue;
-
-      // extract coordinates
-      dLine pts = data_in.get_way_coords(e.second);
+      if (!match_tags(tags, conf.first)) continue;
 
       for (const auto t:conf.second){
         auto cl = VMap2obj::get_class(t);
         if (cl==VMAP2_NONE) {done=true; continue;}
+        // we can't convert point to lines or areas:
+        if (is_node && (cl==VMAP2_LINE || cl==VMAP2_POLYGON)) continue;
+
+        // extract coordinates
+        if (!have_crds) {pts = get_crds(); have_crds=true;}
+        if (pts.empty()) break;
 
         // make object
         VMap2obj obj(t);
-        obj.name = e.second.get("name", "");
+        obj.name = tags.get("name", "");
         if (keep_id)
-          obj.comm += 'w' + type_to_str(e.first) + '\n';
-        if (keep_tags) for (const auto & t:e.second)
+          obj.comm += pref + type_to_str(id) + '\n';
+        if (keep_tags) for (const auto & t:tags)
           obj.comm += t.first + ": " + t.second + '\n';
 
         // convert coordinates
         switch (cl){
-          case VMAP2_POINT: 
+          case VMAP2_POINT:
             obj.set_coords(pts.bbox().cnt());
             break;
-          case VMAP2_LINE: 
+          case VMAP2_LINE:
           case VMAP2_POLYGON:
             obj.set_coords(pts);
             break;
@@ -179,57 +167,154 @@ osm_to_vmap2(const std::string & fname, VMap2 & data, const Opt & opts){
       }
       if (done) break;
     }
-    if (!done && e.second.size()>0) std::cerr
+    if (!done && tags.size()>0) std::cerr
       << "osm object doen not match any rule:\n"
-      << "way " << e.first << ": " << e.second << "\n";
+      << (pref=='n'? "node ": pref=='w'? "way ":"rel ")
+      << id << ": " << tags << "\n";
+  }
+};
+
+/********************************************************************/
+// Compact storage for node lists of ways: node ids are written
+// as zigzag varint deltas into a single string.
+
+class OSMWayStore {
+  std::string data;
+  std::vector<std::pair<osm_id_t, size_t> > index; // way id -> offset
+  bool sorted = true;
+
+public:
+  void add(const osm_id_t id, const std::vector<osm_id_t> & nodes){
+    if (index.size() && index.back().first >= id) sorted = false;
+    index.emplace_back(id, data.size());
+    string_pack_uvar(data, nodes.size());
+    osm_id_t n0 = 0;
+    for (auto const n:nodes) {string_pack_svar(data, n-n0); n0 = n;}
   }
 
-  // Convert OSM multipolygon relations
-  // (with outer/inner member roles)
-  for (auto const & e:data_in.relations){
-    bool done=false;
-    for (auto const & conf:osm_conf){
-      if (!match_tags(e.second, conf.first)) continue;
+  bool get(const osm_id_t id, std::vector<osm_id_t> & nodes){
+    if (!sorted) {
+      std::stable_sort(index.begin(), index.end(),
+        [](const std::pair<osm_id_t, size_t> & a,
+           const std::pair<osm_id_t, size_t> & b){ return a.first < b.first; });
+      sorted = true;
+    }
+    auto i = std::lower_bound(index.begin(), index.end(),
+               std::make_pair(id, (size_t)0));
+    if (i==index.end() || i->first!=id) return false;
+    const char *p = data.data() + i->second, *e = data.data() + data.size();
+    nodes.resize(string_unpack_uvar(p, e));
+    osm_id_t n0 = 0;
+    for (auto & n:nodes) n = n0 = n0 + string_unpack_svar(p, e);
+    return true;
+  }
 
-      // extract coordinates
-      dMultiLine pts = data_in.get_rel_coords(e.second);
-      if (pts.empty()) continue;
+  // keep only given ways (sorted ids)
+  void filter(const std::vector<osm_id_t> & ids){
+    OSMWayStore ret;
+    std::vector<osm_id_t> nodes;
+    for (auto const id:ids) if (get(id, nodes)) ret.add(id, nodes);
+    *this = ret;
+  }
+};
+
+/********************************************************************/
+
+// Pass 1: find nodes which are needed for converting ways
+// and relations, keep node lists of ways which can be used
+// in relations.
+struct OSMPass1: public OSMHandler {
+  OSMConv & conv;
+  OSMNodeStore & nodes;
+  OSMWayStore & ways;
+  std::vector<osm_id_t> rel_ways; // ways needed for relations
+
+  OSMPass1(OSMConv & conv, OSMNodeStore & nodes, OSMWayStore & ways):
+    conv(conv), nodes(nodes), ways(ways) {}
+
+  void on_way(const osm_id_t id, const OSMXML::OSM_Way & way) override {
+    ways.add(id, way.nodes);
+    if (!conv.need_crds(way, false)) return;
+    for (auto const n:way.nodes) nodes.add(n);
+  }
 
-      for (const auto t:conf.second){
-        auto cl = VMap2obj::get_class(t);
-        if (cl==VMAP2_NONE) {done=true; continue;}
+  void on_rel(const osm_id_t id, const OSMXML::OSM_Rel & rel) override {
+    if (rel.get("type")!="multipolygon" && rel.get("type")!="boundary") return;
+    if (!conv.need_crds(rel, false)) return;
+    for (auto const & m:rel.members)
+      if (m.type=="way" && (m.role=="inner" || m.role=="outer"))
+        rel_ways.push_back(m.ref);
+  }
+};
+
+// Pass 2: store node coordinates, convert objects
+struct OSMPass2: public OSMHandler {
+  OSMConv & conv;
+  OSMNodeStore & nodes;
+  OSMWayStore & ways;
+
+  OSMPass2(OSMConv & conv, OSMNodeStore & nodes, OSMWayStore & ways):
+    conv(conv), nodes(nodes), ways(ways) {}
+
+  void on_node(const osm_id_t id, const dPoint & pt, const Opt & tags) override {
+    nodes.put(id, pt);
+    if (tags.size()==0) return;
+    conv.convert('n', id, tags, [&pt](){
+      dLine l;
+      l.push_back(pt);
+      dMultiLine ret;
+      ret.push_back(l);
+      return ret;
+    });
+  }
 
-        // make object
-        VMap2obj obj(t);
-        obj.name = e.second.get("name", "");
-        if (keep_id)
-          obj.comm += 'r' + type_to_str(e.first) + '\n';
-        if (keep_tags) for (const auto & t:e.second)
-          obj.comm += t.first + ": " + t.second + '\n';
+  void on_way(const osm_id_t id, const OSMXML::OSM_Way & way) override {
+    conv.convert('w', id, way, [this, &way](){
+      dLine pts;
+      for (auto const i:way.nodes) pts.push_back(nodes.get(i));
+      dMultiLine ret;
+      ret.push_back(pts);
+      return ret;
+    });
+  }
 
-        // fill coordinates
-        switch (cl){
-          case VMAP2_POINT:
-            obj.set_coords(pts.bbox().cnt());
-            break;
-          case VMAP2_LINE:
-          case VMAP2_POLYGON:
-            obj.set_coords(pts);
-            break;
-          default:
-            throw Err()
-                << "Bad object type in configuration file: "
-                << VMap2obj::print_type(t);
-        }
-        data.add(obj);
-        done=true;
-      }
-      if (done) break;
-    }
-    if (!done && e.second.size()>0) std::cerr
-      << "osm object doen not match any rule:\n"
-      << "rel " << e.first << ": " << e.second << "\n";
+  void on_rel(const osm_id_t id, const OSMXML::OSM_Rel & rel) override {
+    conv.convert('r', id, rel, [this, &rel](){
+      return osm_rel_coords(rel,
+        [this](const osm_id_t id, std::vector<osm_id_t> & n){ return ways.get(id, n); },
+        [this](const osm_id_t id){ return nodes.get(id); });
+    });
   }
+};
 
+// Convert OSM (XML or PBF) to vmap. The file is read twice:
+// first time node ids needed for objects are collected,
+// second time their coordinates are stored and objects are converted.
+// Only coordinates of needed nodes (16 bytes per node) and node lists
+// of ways used in multipolygons are kept in memory.
+void
+osm_to_vmap2(const std::string & fname, VMap2 & data, const Opt & opts){
+
+  OSMConv conv(data, opts);
+  OSMNodeStore nodes;
+  OSMWayStore ways;
+
+  // pass 1
+  {
+    OSMPass1 pass1(conv, nodes, ways);
+    read_osm(fname, pass1, opts);
+
+    std::sort(pass1.rel_ways.begin(), pass1.rel_ways.end());
+    pass1.rel_ways.erase(std::unique(pass1.rel_ways.begin(), pass1.rel_ways.end()),
+                         pass1.rel_ways.end());
+    ways.filter(pass1.rel_ways);
+    std::vector<osm_id_t> n;
+    for (auto const id:pass1.rel_ways)
+      if (ways.get(id, n)) for (auto const i:n) nodes.add(i);
+    nodes.prepare();
+  }
 
+  // pass 2
+  OSMPass2 pass2(conv, nodes, ways);
+  read_osm(fname, pass2, opts);
 }
@@ -36,10 +36,159 @@ VMap2obj::add_tags(const std::string & s){
   }
 }
 
+/**********************************************************/
+// Compact binary format (version 2).
+//
+// Header: 3 bytes with type number (little-endian), one byte
+// with 0x40 + class (0..3, 4 for VMAP2_NONE). In version 1 this byte
+// (high byte of the type in host order) is 0..3 or 0xFF.
+//
+// Then records with one-byte codes:
+//  'a' angle, 's' scale (4-byte floats), 'l' align (1 byte),
+//  'n' name, 'c' comment (varint size + data),
+//  'o' option (varint key index in opt_keys, 0 for a key written
+//      as varint size + data; then value as varint size + data),
+//  'r' reference type (4 bytes), 'p' reference point (zigzag varints),
+//  'x' line (varint number of points, zigzag varint deltas of int32
+//      coordinates; the first point is relative to the last point
+//      of the previous line or to zero).
+//
+// Known option keys. This list can be only appended.
+
+static const char * opt_keys[] = {"", "Source", "Tags", "Angle", "Scale",
+  "Align", "FullText", "RefPt", "RefType"};
+static const size_t opt_keys_n = sizeof(opt_keys)/sizeof(*opt_keys);
+
+static const uint8_t pack_v2_flag = 0x40;
+
+static bool
+is_pack_v2(const std::string & str){
+  return str.size()>=4 && ((uint8_t)str[3] & 0xF8) == pack_v2_flag;
+}
+
+// write fixed-size value
+template <typename T>
+static void
+pack_v2_val(std::string & s, const char code, const T & v){
+  s.push_back(code);
+  s.append((const char *)&v, sizeof(T));
+}
+
+// read fixed-size value (code is already read)
+template <typename T>
+static T
+unpack_v2_val(const char * & p, const char * e){
+  if (e-p < (ptrdiff_t)sizeof(T))
+    throw Err() << "VMap2obj::unpack: unexpected end of data";
+  T ret;
+  memcpy(&ret, p, sizeof(T));
+  p+=sizeof(T);
+  return ret;
+}
+
+static std::string
+pack_v2(const VMap2obj & obj) {
+  std::string s;
+  s.reserve(16 + obj.name.size() + obj.comm.size() + 3*obj.npts());
+
+  // header
+  uint8_t cl = obj.type>>24;
+  s.push_back((char)(obj.type & 0xFF));
+  s.push_back((char)((obj.type>>8) & 0xFF));
+  s.push_back((char)((obj.type>>16) & 0xFF));
+  s.push_back((char)(pack_v2_flag + (cl==VMAP2_NONE ? 4:cl)));
+
+  // optional values
+  if (!isnan(obj.angle)) pack_v2_val<float>(s, 'a', obj.angle);
+  if (obj.scale != 1.0)  pack_v2_val<float>(s, 's', obj.scale);
+  if (obj.align != VMAP2_ALIGN_SW)
+    pack_v2_val<int8_t>(s, 'l', (int8_t)(obj.align));
+
+  // text fields
+  if (obj.name!="") {s.push_back('n'); string_pack_vstr(s, obj.name);}
+  if (obj.comm!="") {s.push_back('c'); string_pack_vstr(s, obj.comm);}
+
+  // opts
+  for (auto const & o: obj.opts){
+    s.push_back('o');
+    size_t k = 1;
+    while (k<opt_keys_n && o.first != opt_keys[k]) k++;
+    if (k<opt_keys_n) string_pack_uvar(s, k);
+    else {string_pack_uvar(s, 0); string_pack_vstr(s, o.first);}
+    string_pack_vstr(s, o.second);
+  }
+
+  // reference type and point
+  if (obj.ref_type!=0xFFFFFFFF)
+    pack_v2_val<uint32_t>(s, 'r', obj.ref_type);
+  if (obj.ref_pt!=dPoint()){
+    auto ip = convert_crd(obj.ref_pt);
+    s.push_back('p');
+    string_pack_svar(s, ip.x);
+    string_pack_svar(s, ip.y);
+  }
+
+  // coordinates
+  Point<int32_t> p0(0,0);
+  for (auto const & l:obj){
+    s.push_back('x');
+    string_pack_vcrds(s, l, p0);
+  }
+  return s;
+}
+
+static VMap2obj
+unpack_v2(const std::string & str) {
+  VMap2obj ret;
+  const char *p = str.data(), *e = str.data() + str.size();
+
+  // header
+  uint8_t cl = (uint8_t)p[3] - pack_v2_flag;
+  if (cl>4) throw Err() << "VMap2obj::unpack: bad header";
+  if (cl==4) ret.type = 0xFFFFFFFF;
+  else ret.type = ((uint32_t)cl<<24) | ((uint32_t)(uint8_t)p[2]<<16) |
+                  ((uint32_t)(uint8_t)p[1]<<8) | (uint32_t)(uint8_t)p[0];
+  p+=4;
+
+  Point<int32_t> p0(0,0);
+  while (p<e){
+    switch (*p++){
+      case 'a': ret.angle = unpack_v2_val<float>(p,e); break;
+      case 's': ret.scale = unpack_v2_val<float>(p,e); break;
+      case 'l': ret.align = (VMap2objAlign)unpack_v2_val<int8_t>(p,e); break;
+      case 'n': ret.name  = string_unpack_vstr(p,e); break;
+      case 'c': ret.comm  = string_unpack_vstr(p,e); break;
+      case 'o': {
+        auto k = string_unpack_uvar(p,e);
+        std::string key;
+        if (k==0) key = string_unpack_vstr(p,e);
+        else if (k<opt_keys_n) key = opt_keys[k];
+        else throw Err() << "VMap2obj::unpack: unknown option key: " << k;
+        ret.opts.emplace(key, string_unpack_vstr(p,e));
+        break;
+      }
+      case 'r': ret.ref_type = unpack_v2_val<uint32_t>(p,e); break;
+      case 'p': {
+        int32_t x = string_unpack_svar(p,e);
+        int32_t y = string_unpack_svar(p,e);
+        ret.ref_pt = dPoint(x/1e7, y/1e7);
+        break;
+      }
+      case 'x': ret.push_back(string_unpack_vcrds(p,e,p0)); break;
+      default: throw Err() << "VMap2obj::unpack: unknown code: " << (int)*(p-1);
+    }
+  }
+  return ret;
+}
+
 /**********************************************************/
 // pack object to a string (for DB storage)
 string
-VMap2obj::pack(const VMap2obj & obj) {
+VMap2obj::pack(const VMap2obj & obj, const int ver) {
+  uint8_t cl = obj.type>>24;
+  if (ver==2 && (cl<4 || cl==VMAP2_NONE)) return pack_v2(obj);
+  if (ver<1 || ver>2) throw Err() << "VMap2obj::pack: unsupported version: " << ver;
+
   ostringstream s;
 
   // type is as a single 32-bit integer:
@@ -114,6 +263,8 @@ VMap2obj::write(std::ostream & s, const VMap2obj & obj) {
 VMap2obj
 VMap2obj::unpack(const std::string & str) {
 
+  if (is_pack_v2(str)) return unpack_v2(str);
+
   VMap2obj ret;
 
   istringstream s(str);
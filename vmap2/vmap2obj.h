@@ -185,10 +185,13 @@ struct VMap2obj: public dMultiLine {
   /***********************************************/
 
 
-  // pack object to a string (for DB storage)
-  static std::string pack(const VMap2obj & obj);
+  // pack object to a string (for DB storage).
+  // Version 1: RIFF-like records with 4-byte tags and sizes,
+  // version 2 (default): compact format with varint delta-encoded
+  // coordinates (see vmap2obj.cpp).
+  static std::string pack(const VMap2obj & obj, const int ver = 2);
 
-  // unpack object from a string (for DB storage)
+  // unpack object from a string (for DB storage), both versions are supported
   static VMap2obj unpack(const std::string & s);
 
   // write object (to text file)
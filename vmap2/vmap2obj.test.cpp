@@ -168,6 +168,11 @@ main(){
         std::string pack = VMap2obj::pack(o1);
         o2 = VMap2obj::unpack(pack);
         assert_eq(o1,o2);
+        std::string pack1 = VMap2obj::pack(o1, 1);
+        o2 = VMap2obj::unpack(pack1);
+        assert_eq(o1,o2);
+        assert_eq(pack.size() < pack1.size(), true);
+        assert_err(VMap2obj::pack(o1, 3), "VMap2obj::pack: unsupported version: 3");
       }
 
       //write/read
@@ -194,6 +199,34 @@ main(){
         assert_eq(o1,o2);
       }
 
+      // pack/unpack, version 2: known and unknown option keys,
+      // reference type and point, negative coordinates, NONE type
+      {
+        VMap2obj o3(VMap2obj::make_type("area:0x1234"));
+        o3.opts.put("Source", "src");
+        o3.opts.put("my key", "");
+        o3.ref_type = VMap2obj::make_type("text:5");
+        o3.ref_pt = dPoint(-179.9999999, 89.1234567);
+        o3.set_coords("[[[-179.9999999,-89.9],[179.9999999,89.9],[0,0]],[[1e-7,-1e-7]]]");
+        o2 = VMap2obj::unpack(VMap2obj::pack(o3));
+        assert_eq(o3,o2);
+        assert_deq(o2.ref_pt, o3.ref_pt, 1e-8);
+        assert_deq(o2[0][0], o3[0][0], 1e-8);
+        assert_deq(o2[1][0], o3[1][0], 1e-8);
+
+        o3.type = 0xFFFFFFFF;
+        o2 = VMap2obj::unpack(VMap2obj::pack(o3));
+        assert_eq(o2.type, 0xFFFFFFFF);
+        o2 = VMap2obj::unpack(VMap2obj::pack(o3,1));
+        assert_eq(o2.type, 0xFFFFFFFF);
+
+        std::string pack = VMap2obj::pack(o3);
+        assert_err(VMap2obj::unpack(pack.substr(0, pack.size()-1)),
+          "string_unpack_vcrds: unexpected end of data");
+        assert_err(VMap2obj::unpack(pack + 'q'),
+          "VMap2obj::unpack: unknown code: 113");
+      }
+
       //write/read
       {
         std::ostringstream s1;
@@ -0,0 +1,453 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "err/err.h"
+#include "string_pack.h"
+#include "vmap2.h"
+#include "vmap2pack.h"
+
+static const char vmap2pack_magic[] = "MSVMAP2P";
+static const uint32_t vmap2pack_bom = 0x01020304;
+static const uint32_t vmap2pack_version = 1;
+
+/**********************************************************/
+// Hilbert curve index of a point (x,y) in a 2^16 x 2^16 grid
+static uint32_t
+hilbert_key(uint32_t x, uint32_t y){
+  uint32_t d = 0;
+  for (uint32_t s = 1<<15; s>0; s>>=1) {
+    uint32_t rx = (x & s) > 0;
+    uint32_t ry = (y & s) > 0;
+    d += s * s * ((3 * rx) ^ ry);
+    // rotate
+    if (ry == 0) {
+      if (rx == 1) { x = s-1 - (x & (s-1)); y = s-1 - (y & (s-1)); }
+      std::swap(x, y);
+    }
+    x &= s-1; y &= s-1;
+  }
+  return d;
+}
+
+// Do two boxes intersect?
+static bool
+box_intersect(const int32_t * a, const int32_t * b){
+  return a[0] <= b[2] && a[2] >= b[0] && a[1] <= b[3] && a[3] >= b[1];
+}
+
+// Expand box a to include box b
+static void
+box_expand(int32_t * a, const int32_t * b){
+  a[0] = std::min(a[0], b[0]); a[1] = std::min(a[1], b[1]);
+  a[2] = std::max(a[2], b[2]); a[3] = std::max(a[3], b[3]);
+}
+
+// Number of nodes in each level of a type tree above the object table
+static std::vector<uint32_t>
+tree_levels(uint32_t n){
+  std::vector<uint32_t> ret;
+  while (n>1){
+    n = (n + VMAP2PACK_NODE_SIZE - 1)/VMAP2PACK_NODE_SIZE;
+    ret.push_back(n);
+  }
+  return ret;
+}
+
+/**********************************************************/
+// Writing
+
+namespace {
+
+// String pool with interning of repeated strings
+struct StrPool {
+  std::string data;
+  std::map<std::string, uint32_t> index;
+  StrPool() { add(""); }
+  uint32_t add(const std::string & s){
+    auto i = index.find(s);
+    if (i!=index.end()) return i->second;
+    uint32_t off = data.size();
+    uint32_t len = s.size();
+    data.append((char*)&len, sizeof(len));
+    data.append(s);
+    data.push_back('\0');
+    // keep entries 4-byte aligned
+    while (data.size()%4) data.push_back('\0');
+    index.emplace(s, off);
+    return off;
+  }
+};
+
+struct SortRec {
+  uint32_t type, key, id;
+  bool operator< (const SortRec & o) const {
+    if (type!=o.type) return type < o.type;
+    if (key!=o.key) return key < o.key;
+    return id < o.id;
+  }
+};
+
+// pad a file to 8-byte boundary
+bool
+file_pad(FILE *F, uint64_t & pos){
+  while (pos%8) {
+    if (fputc(0, F)==EOF) return false;
+    pos++;
+  }
+  return true;
+}
+
+bool
+file_write(FILE *F, const void * data, const size_t size, uint64_t & pos){
+  if (size && fwrite(data, 1, size, F)!=size) return false;
+  pos += size;
+  return true;
+}
+
+}
+
+void
+VMap2pack::write(const std::string & fname, VMap2 & map){
+
+  // Pass 1: types and bboxes of all objects
+  std::vector<SortRec> order;
+  std::vector<dRect> boxes;
+  dRect bb;
+  map.iter_start();
+  while (!map.iter_end()){
+    auto p = map.iter_get_next();
+    auto box = p.second.bbox();
+    order.push_back(SortRec{p.second.type, 0, p.first});
+    boxes.push_back(box);
+    bb.expand(box);
+  }
+
+  // Hilbert keys of bbox centers
+  for (size_t i=0; i<order.size(); i++){
+    if (boxes[i].is_empty() || bb.is_zsize()) continue;
+    dPoint c = (boxes[i].cnt() - bb.tlc());
+    uint32_t x = std::min(65535.0, floor(c.x/bb.w*65536));
+    uint32_t y = std::min(65535.0, floor(c.y/bb.h*65536));
+    order[i].key = hilbert_key(x,y);
+  }
+  std::sort(order.begin(), order.end());
+
+  // Pass 2: build object table, coordinates, strings
+  std::vector<ObjRec> objs;
+  std::vector<TypeRec> types;
+  std::vector<uint32_t> segs;
+  std::vector<int32_t> pts;
+  StrPool strs;
+  for (const auto & s: order){
+    auto o = map.get(s.id);
+    ObjRec r;
+    memset(&r, 0, sizeof(r));
+    r.id = s.id;
+    r.type = o.type;
+    r.angle = o.angle;
+    r.scale = o.scale;
+    r.align = o.align;
+    r.name = strs.add(o.name);
+    r.comm = strs.add(o.comm);
+    std::string opts;
+    for (const auto & op: o.opts){
+      opts += op.first;  opts.push_back('\0');
+      opts += op.second; opts.push_back('\0');
+    }
+    r.opts = strs.add(opts);
+    r.ref_type = o.ref_type;
+    auto rp = convert_crd(o.ref_pt);
+    r.ref_pt[0] = rp.x; r.ref_pt[1] = rp.y;
+    r.seg0 = segs.size();
+    r.nseg = o.size();
+    r.box[0] = r.box[1] = INT32_MAX;
+    r.box[2] = r.box[3] = INT32_MIN;
+    for (const auto & l: o){
+      segs.push_back(pts.size()/2);
+      for (const auto & p: l){
+        auto ip = convert_crd(p);
+        pts.push_back(ip.x);
+        pts.push_back(ip.y);
+        int32_t b[4] = {ip.x, ip.y, ip.x, ip.y};
+        box_expand(r.box, b);
+      }
+    }
+    if (types.size()==0 || types.back().type != r.type)
+      types.push_back(TypeRec{r.type, (uint32_t)objs.size(), 0, 0});
+    types.back().nobj++;
+    objs.push_back(r);
+  }
+  segs.push_back(pts.size()/2);
+
+  // Spatial index: for each type levels of nodes on top of
+  // the object table. Objects without coordinates have an
+  // inverted box and never match.
+  std::vector<Node> nodes;
+  for (auto & t: types){
+    t.node0 = nodes.size();
+    size_t prev0 = 0, prevn = t.nobj; // previous level
+    bool first = true;
+    for (auto n: tree_levels(t.nobj)){
+      size_t lev0 = nodes.size();
+      for (size_t i=0; i<n; i++){
+        Node nd;
+        nd.box[0] = nd.box[1] = INT32_MAX;
+        nd.box[2] = nd.box[3] = INT32_MIN;
+        for (size_t j=i*VMAP2PACK_NODE_SIZE;
+                    j<std::min(prevn, (i+1)*VMAP2PACK_NODE_SIZE); j++){
+          box_expand(nd.box, first? objs[t.obj0+j].box : nodes[prev0+j].box);
+        }
+        nodes.push_back(nd);
+      }
+      prev0 = lev0; prevn = n;
+      first = false;
+    }
+  }
+
+  // Header
+  Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, vmap2pack_magic, 8);
+  h.bom = vmap2pack_bom;
+  h.version = vmap2pack_version;
+  h.nobj = objs.size();
+  h.ntypes = types.size();
+  h.nnodes = nodes.size();
+  h.nsegs = segs.size()-1;
+  h.npts = pts.size()/2;
+  h.strsize = strs.data.size();
+
+  // write file: use temporary file and rename to avoid reading incomplete data
+  std::ostringstream tmp;
+  tmp << fname << ".tmp." << getpid() << "."
+      << std::hash<std::thread::id>()(std::this_thread::get_id());
+  FILE *F = fopen(tmp.str().c_str(), "wb");
+  if (!F) throw Err() << "VMap2pack: can't open file: " << fname;
+
+  uint64_t pos = sizeof(h);
+  bool ok = fseek(F, sizeof(h), SEEK_SET)==0;
+  ok = ok && file_pad(F, pos); h.off_types = pos;
+  ok = ok && file_write(F, types.data(), types.size()*sizeof(TypeRec), pos);
+  ok = ok && file_pad(F, pos); h.off_objs = pos;
+  ok = ok && file_write(F, objs.data(), objs.size()*sizeof(ObjRec), pos);
+  ok = ok && file_pad(F, pos); h.off_nodes = pos;
+  ok = ok && file_write(F, nodes.data(), nodes.size()*sizeof(Node), pos);
+  ok = ok && file_pad(F, pos); h.off_segs = pos;
+  ok = ok && file_write(F, segs.data(), segs.size()*sizeof(uint32_t), pos);
+  ok = ok && file_pad(F, pos); h.off_pts = pos;
+  ok = ok && file_write(F, pts.data(), pts.size()*sizeof(int32_t), pos);
+  ok = ok && file_pad(F, pos); h.off_strs = pos;
+  ok = ok && file_write(F, strs.data.data(), strs.data.size(), pos);
+  ok = ok && fseek(F, 0, SEEK_SET)==0;
+  ok = ok && fwrite(&h, sizeof(h), 1, F)==1;
+  ok = (fclose(F)==0) && ok;
+  if (!ok || rename(tmp.str().c_str(), fname.c_str())!=0){
+    unlink(tmp.str().c_str());
+    throw Err() << "VMap2pack: can't write file: " << fname;
+  }
+}
+
+/**********************************************************/
+// Reading
+
+VMap2pack::VMap2pack(const std::string & fname){
+  int fd = open(fname.c_str(), O_RDONLY);
+  if (fd<0) throw Err() << "VMap2pack: can't open file: " << fname;
+  struct stat st;
+  if (fstat(fd, &st)!=0) {
+    close(fd);
+    throw Err() << "VMap2pack: can't open file: " << fname;
+  }
+  size_t len = st.st_size;
+  if (len < sizeof(Header)) {
+    close(fd);
+    throw Err() << "VMap2pack: bad file: " << fname;
+  }
+  void * p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) throw Err() << "VMap2pack: can't map file: " << fname;
+  buf = std::shared_ptr<unsigned char>((unsigned char *)p,
+    [len](unsigned char *p){ munmap(p, len); });
+
+  // check header and section sizes
+  hdr = (const Header *)buf.get();
+  auto sect = [&](uint64_t off, uint64_t size){
+    return off%4==0 && off <= len && size <= len - off; };
+  if (memcmp(hdr->magic, vmap2pack_magic, 8)!=0 ||
+      hdr->bom != vmap2pack_bom || hdr->version != vmap2pack_version ||
+      !sect(hdr->off_types, (uint64_t)hdr->ntypes*sizeof(TypeRec)) ||
+      !sect(hdr->off_objs,  (uint64_t)hdr->nobj*sizeof(ObjRec)) ||
+      !sect(hdr->off_nodes, (uint64_t)hdr->nnodes*sizeof(Node)) ||
+      !sect(hdr->off_segs,  ((uint64_t)hdr->nsegs+1)*sizeof(uint32_t)) ||
+      !sect(hdr->off_pts,   (uint64_t)hdr->npts*2*sizeof(int32_t)) ||
+      !sect(hdr->off_strs,  hdr->strsize) || hdr->strsize < 5)
+    throw Err() << "VMap2pack: bad file: " << fname;
+
+  types = (const TypeRec *)(buf.get() + hdr->off_types);
+  objs  = (const ObjRec *)(buf.get() + hdr->off_objs);
+  nodes = (const Node *)(buf.get() + hdr->off_nodes);
+  segs  = (const uint32_t *)(buf.get() + hdr->off_segs);
+  pts   = (const int32_t *)(buf.get() + hdr->off_pts);
+  strs  = (const char *)(buf.get() + hdr->off_strs);
+
+  // check tables, then access without checks is safe
+  for (uint32_t i=0; i<hdr->nsegs; i++)
+    if (segs[i] > segs[i+1]) throw Err() << "VMap2pack: broken file: " << fname;
+  if (segs[hdr->nsegs] > hdr->npts) throw Err() << "VMap2pack: broken file: " << fname;
+
+  for (uint32_t i=0; i<hdr->nobj; i++){
+    const ObjRec & r = objs[i];
+    if ((uint64_t)r.seg0 + r.nseg > hdr->nsegs)
+      throw Err() << "VMap2pack: broken file: " << fname;
+    // string: 4-byte length, data, '\0' (64-bit arithmetics, no overflow)
+    for (auto off: {r.name, r.comm, r.opts}){
+      if ((uint64_t)off + 4 >= hdr->strsize)
+        throw Err() << "VMap2pack: broken file: " << fname;
+      uint32_t l;
+      memcpy(&l, strs+off, 4);
+      if ((uint64_t)off + 4 + l >= hdr->strsize || strs[(uint64_t)off+4+l]!='\0')
+        throw Err() << "VMap2pack: broken file: " << fname;
+    }
+  }
+
+  uint64_t nn = 0, no = 0;
+  for (uint32_t i=0; i<hdr->ntypes; i++){
+    const TypeRec & t = types[i];
+    if (t.obj0 != no || t.node0 != nn || t.nobj == 0)
+      throw Err() << "VMap2pack: broken file: " << fname;
+    no += t.nobj;
+    for (auto n: tree_levels(t.nobj)) nn += n;
+  }
+  if (no != hdr->nobj || nn != hdr->nnodes)
+    throw Err() << "VMap2pack: broken file: " << fname;
+}
+
+const char *
+VMap2pack::str_ptr(const uint32_t off, uint32_t * len) const {
+  if (len) memcpy(len, strs+off, 4);
+  return strs + off + 4;
+}
+
+void
+VMap2pack::read(VMap2 & map) const {
+  std::vector<std::pair<uint32_t, uint32_t> > ids;
+  for (uint32_t i=0; i<hdr->nobj; i++) ids.emplace_back(objs[i].id, i);
+  std::sort(ids.begin(), ids.end());
+  for (const auto & i: ids) map.add(get(i.second).obj());
+}
+
+std::set<uint32_t>
+VMap2pack::get_types() const{
+  std::set<uint32_t> ret;
+  for (uint32_t i=0; i<hdr->ntypes; i++) ret.insert(types[i].type);
+  return ret;
+}
+
+dRect
+VMap2pack::bbox() const{
+  dRect ret;
+  for (uint32_t i=0; i<hdr->nobj; i++){
+    auto v = get(i);
+    if (v.nseg()) ret.expand(v.bbox());
+  }
+  return ret;
+}
+
+std::pair<uint32_t,uint32_t>
+VMap2pack::find(const uint32_t type) const{
+  auto t = std::lower_bound(types, types + hdr->ntypes, type,
+    [](const TypeRec & a, const uint32_t t){ return a.type < t; });
+  if (t == types + hdr->ntypes || t->type != type)
+    return std::make_pair(0,0);
+  return std::make_pair(t->obj0, t->obj0 + t->nobj);
+}
+
+void
+VMap2pack::find(const uint32_t type, const dRect & range, std::vector<uint32_t> & ret) const{
+  ret.clear();
+  if (range.is_empty()) return;
+  auto t = std::lower_bound(types, types + hdr->ntypes, type,
+    [](const TypeRec & a, const uint32_t t){ return a.type < t; });
+  if (t == types + hdr->ntypes || t->type != type) return;
+
+  // range in 1e-7 degrees, rounded outwards
+  auto clamp = [](double v){
+    return (int32_t)std::max((double)INT32_MIN, std::min((double)INT32_MAX, v)); };
+  int32_t box[4] = {clamp(floor(range.x*1e7)), clamp(floor(range.y*1e7)),
+                    clamp(ceil((range.x+range.w)*1e7)), clamp(ceil((range.y+range.h)*1e7))};
+
+  // level sizes and starts
+  auto levs = tree_levels(t->nobj);
+  std::vector<uint32_t> starts;
+  uint32_t s = t->node0;
+  for (auto n: levs) { starts.push_back(s); s+=n; }
+
+  // stack of (level, index); level 0 is the object table
+  std::vector<std::pair<uint32_t,uint32_t> > st;
+  if (levs.size()) st.emplace_back(levs.size(), 0);
+  else st.emplace_back(0, 0);
+  while (st.size()){
+    auto l = st.back().first, i = st.back().second;
+    st.pop_back();
+    if (l==0){
+      if (box_intersect(objs[t->obj0+i].box, box)) ret.push_back(t->obj0+i);
+      continue;
+    }
+    if (!box_intersect(nodes[starts[l-1]+i].box, box)) continue;
+    uint32_t nch = l>1 ? levs[l-2] : t->nobj;
+    for (uint32_t c = i*VMAP2PACK_NODE_SIZE;
+                  c < std::min(nch, (i+1)*VMAP2PACK_NODE_SIZE); c++)
+      st.emplace_back(l-1, c);
+  }
+  std::sort(ret.begin(), ret.end());
+}
+
+/**********************************************************/
+
+Opt
+VMap2objView::opts() const{
+  Opt ret;
+  uint32_t len;
+  const char * s = pk->str_ptr(r->opts, &len);
+  const char * e = s + len;
+  while (s<e){
+    std::string k(s);
+    s += k.size()+1;
+    if (s>=e) break;
+    std::string v(s);
+    s += v.size()+1;
+    ret.emplace(k, v);
+  }
+  return ret;
+}
+
+VMap2obj
+VMap2objView::obj() const{
+  VMap2obj ret(type());
+  ret.angle = angle();
+  ret.scale = scale();
+  ret.align = align();
+  uint32_t len;
+  const char * s = name(&len);
+  ret.name = std::string(s, len);
+  s = comm(&len);
+  ret.comm = std::string(s, len);
+  ret.opts = opts();
+  ret.ref_type = ref_type();
+  ret.ref_pt = ref_pt();
+  for (size_t k=0; k<nseg(); k++){
+    dLine l;
+    for (size_t i=0; i<seg_size(k); i++) l.push_back(pt(k,i));
+    ret.push_back(l);
+  }
+  return ret;
+}
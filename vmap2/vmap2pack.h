@@ -0,0 +1,167 @@
+#ifndef VMAP2PACK_H
+#define VMAP2PACK_H
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "vmap2obj.h"
+
+#define VMAP2PACK_EXT ".vmap2pack"
+
+class VMap2;
+class VMap2objView;
+
+/*********************************************************************/
+// VMap2pack -- compiled read-only VMap2 container.
+//
+// One file which is memory-mapped and used without deserialization:
+//  - object table, sorted by type and Hilbert key of the bbox center,
+//  - coordinate arrays (int32, 1e-7 degrees, same as in string_pack_crds),
+//  - string pool (names, comments, options),
+//  - spatial index: for each type a packed R-tree built on top
+//    of the object table (16 children per node).
+// Objects are accessed by index (0..size()-1) through VMap2objView.
+
+#define VMAP2PACK_NODE_SIZE 16
+
+class VMap2pack {
+  public:
+
+    // File structures (host byte order, all fields 4-byte aligned).
+    struct Header {
+      char magic[8];      // "MSVMAP2P"
+      uint32_t bom;       // 0x01020304
+      uint32_t version;   // 1
+      uint32_t nobj, ntypes, nnodes, nsegs, npts, strsize;
+      uint64_t off_types, off_objs, off_nodes, off_segs, off_pts, off_strs;
+    };
+
+    struct TypeRec {
+      uint32_t type;
+      uint32_t obj0, nobj; // range in the object table
+      uint32_t node0;      // first index tree node (levels above objects)
+    };
+
+    struct ObjRec {
+      uint32_t id;         // object id in the original map
+      uint32_t type;
+      int32_t  box[4];     // bbox: x1,y1,x2,y2 (1e-7 deg)
+      uint32_t seg0, nseg; // range in the segment table
+      float    angle, scale;
+      int32_t  align;
+      uint32_t name, comm, opts; // offsets in the string pool
+      uint32_t ref_type;
+      int32_t  ref_pt[2];
+    };
+
+    struct Node {
+      int32_t box[4];
+    };
+
+  private:
+    std::shared_ptr<unsigned char> buf; // memory-mapped file
+    const Header  * hdr;
+    const TypeRec * types;
+    const ObjRec  * objs;
+    const Node    * nodes;
+    const uint32_t * segs; // nsegs+1 indices in the point array
+    const int32_t  * pts;  // npts x,y pairs
+    const char     * strs; // string pool
+
+    friend class VMap2objView;
+
+    // get string from the pool: entry is uint32 length, data, '\0'
+    const char * str_ptr(const uint32_t off, uint32_t * len) const;
+
+  public:
+
+    // Open the file
+    VMap2pack(const std::string & fname);
+
+    // Write map to a file
+    static void write(const std::string & fname, VMap2 & map);
+
+    // Add all objects to a map (in order of original ids).
+    void read(VMap2 & map) const;
+
+    // Number of objects
+    size_t size() const {return hdr->nobj;}
+
+    // All object types
+    std::set<uint32_t> get_types() const;
+
+    // Bounding box of all objects
+    dRect bbox() const;
+
+    // Range of object indices with a given type
+    std::pair<uint32_t,uint32_t> find(const uint32_t type) const;
+
+    // Find objects with given type and range, write sorted object
+    // indices to the vector (cleared before filling).
+    void find(const uint32_t type, const dRect & range, std::vector<uint32_t> & ret) const;
+
+    // Get object view by index
+    VMap2objView get(const uint32_t n) const;
+};
+
+/*********************************************************************/
+// Read-only view of an object in a VMap2pack container.
+// Coordinates are available without copying as arrays of
+// int32 x,y pairs (1e-7 degrees). View is valid while
+// the container exists.
+
+class VMap2objView {
+    const VMap2pack * pk;
+    const VMap2pack::ObjRec * r;
+
+  public:
+    VMap2objView(const VMap2pack * pk, const VMap2pack::ObjRec * r): pk(pk), r(r) {}
+
+    uint32_t id()   const {return r->id;}
+    uint32_t type() const {return r->type;}
+    float angle()   const {return r->angle;}
+    float scale()   const {return r->scale;}
+    VMap2objAlign align() const {return (VMap2objAlign)r->align;}
+    uint32_t ref_type() const {return r->ref_type;}
+    dPoint ref_pt() const {return dPoint(r->ref_pt[0]/1e7, r->ref_pt[1]/1e7);}
+    dRect bbox() const {
+      return dRect(dPoint(r->box[0]/1e7, r->box[1]/1e7),
+                   dPoint(r->box[2]/1e7, r->box[3]/1e7));}
+
+    // name and comment: pointers to '\0'-terminated strings in the container
+    const char * name(uint32_t * len = NULL) const {return pk->str_ptr(r->name, len);}
+    const char * comm(uint32_t * len = NULL) const {return pk->str_ptr(r->comm, len);}
+
+    // options (decoded)
+    Opt opts() const;
+
+    // number of segments
+    size_t nseg() const {return r->nseg;}
+
+    // number of points in segment k
+    size_t seg_size(const size_t k) const {
+      return pk->segs[r->seg0+k+1] - pk->segs[r->seg0+k];}
+
+    // coordinates of segment k: x,y pairs, 1e-7 degrees
+    const int32_t * seg_data(const size_t k) const {
+      return pk->pts + 2*pk->segs[r->seg0+k];}
+
+    // point i of segment k
+    dPoint pt(const size_t k, const size_t i) const {
+      const int32_t * p = seg_data(k) + 2*i;
+      return dPoint(p[0]/1e7, p[1]/1e7);
+    }
+
+    // decode the whole object
+    VMap2obj obj() const;
+};
+
+inline VMap2objView
+VMap2pack::get(const uint32_t n) const {
+  if (n >= hdr->nobj) throw Err() << "VMap2pack: object index out of range: " << n;
+  return VMap2objView(this, objs + n);
+}
+
+#endif
@@ -0,0 +1,170 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <cmath>
+#include <cassert>
+#include <cstdio>
+#include <cstddef>
+#include <random>
+#include <unistd.h>
+#include <iostream>
+#include "err/assert_err.h"
+#include "vmap2.h"
+#include "vmap2pack.h"
+
+int
+main(){
+  try{
+
+    const char *fname = "tmp.vmap2pack";
+
+    // empty map
+    {
+      VMap2 m;
+      VMap2pack::write(fname, m);
+      VMap2pack p(fname);
+      assert_eq(p.size(), 0);
+      assert_eq(p.get_types().size(), 0);
+      assert_eq(p.bbox(), dRect());
+      std::vector<uint32_t> v;
+      p.find(0, dRect(0,0,1,1), v);
+      assert_eq(v.size(), 0);
+      assert_err(p.get(0), "VMap2pack: object index out of range: 0");
+    }
+
+    assert_err(VMap2pack("missing.vmap2pack"),
+      "VMap2pack: can't open file: missing.vmap2pack");
+    assert_err(VMap2pack("vmap2pack.test.cpp"),
+      "VMap2pack: bad file: vmap2pack.test.cpp");
+
+    // a few objects
+    {
+      VMap2 m;
+      VMap2obj o1;
+      o1.set_type(VMAP2_LINE, 0x2342);
+      o1.angle = 60;
+      o1.scale = 2;
+      o1.align = VMAP2_ALIGN_C;
+      o1.name = "object name\nsecond line";
+      o1.comm = "object comment";
+      o1.opts.put("opt1", "object source");
+      o1.opts.put("opt2", "");
+      o1.ref_type = VMap2obj::make_type("point:0x12");
+      o1.ref_pt = dPoint(10.1234567,20.7654321);
+      o1.dMultiLine::operator=(dMultiLine("[[[0,0],[1,1]],[[1,1],[2,2],[3,1]]]"));
+      m.add(o1);
+
+      VMap2obj o2;
+      o2.set_type(VMAP2_POINT, 0x12);
+      o2.name = "object name\nsecond line"; // same string
+      o2.dMultiLine::operator=(dMultiLine("[[10,10]]"));
+      m.add(o2);
+      o2.dMultiLine::operator=(dMultiLine("[[-10,-10]]"));
+      m.add(o2);
+      o2.set_type(VMAP2_LINE, 0x2342);
+      o2.dMultiLine::operator=(dMultiLine("[[5,5],[6,6]]"));
+      m.add(o2);
+
+      VMap2pack::write(fname, m);
+      VMap2pack p(fname);
+      assert_eq(p.size(), 4);
+      assert_eq(p.get_types().size(), 2);
+      assert_deq(p.bbox(), dRect(-10,-10,20,20), 1e-7);
+
+      // objects are sorted by type
+      uint32_t t1 = o1.type, t2 = o2.type, tp = VMap2obj::make_type("point:0x12");
+      auto r = p.find(tp);
+      assert_eq(r.first, 0);
+      assert_eq(r.second, 2);
+      r = p.find(t1);
+      assert_eq(r.first, 2);
+      assert_eq(r.second, 4);
+      r = p.find(0);
+      assert_eq(r.first, r.second);
+
+      std::vector<uint32_t> v;
+      p.find(t1, dRect(0.5,0.5,0.1,0.1), v);
+      assert_eq(v.size(), 1);
+      auto ov = p.get(v[0]);
+      assert_eq(ov.id(), 0);
+      assert_eq(ov.type(), t1);
+      assert_eq(ov.nseg(), 2);
+      assert_eq(ov.seg_size(0), 2);
+      assert_eq(ov.seg_size(1), 3);
+      assert_eq(ov.seg_data(1)[4], 30000000); // x of point 2 in segment 1
+      assert_eq(ov.seg_data(1)[5], 10000000);
+      assert_eq(ov.pt(1,2), dPoint(3,1));
+      assert_eq(std::string(ov.name()), o1.name);
+      assert_eq(ov.bbox(), dRect(0,0,3,2));
+      assert_eq(ov.obj(), o1);
+
+      p.find(t2, dRect(4,4,10,10), v);
+      assert_eq(v.size(), 1);
+      assert_eq(p.get(v[0]).id(), 3);
+      p.find(tp, dRect(-20,-20,40,40), v);
+      assert_eq(v.size(), 2);
+      p.find(tp, dRect(9,9,0.5,0.5), v);
+      assert_eq(v.size(), 0);
+
+      // convert back to VMap2
+      VMap2 m1;
+      p.read(m1);
+      assert_eq(m1.size(), 4);
+      for (uint32_t i=0; i<4; i++) assert_eq(m1.get(i), m.get(i));
+
+      // broken file: string offsets close to 2^32
+      for (uint32_t off: {0xFFFFFFFFu, 0xFFFFFFFCu, 0xFFFFFFF0u}){
+        FILE *F = fopen(fname, "r+b");
+        assert(F);
+        VMap2pack::Header h;
+        assert(fread(&h, sizeof(h), 1, F)==1);
+        assert(fseek(F, h.off_objs + offsetof(VMap2pack::ObjRec, comm), SEEK_SET)==0);
+        assert(fwrite(&off, sizeof(off), 1, F)==1);
+        fclose(F);
+        assert_err(VMap2pack p1(fname),
+          "VMap2pack: broken file: tmp.vmap2pack");
+      }
+    }
+
+    // many objects, compare with brute-force search
+    {
+      std::mt19937 gen(1);
+      std::uniform_int_distribution<int> crd(0, 1000000), sz(0, 5000), tp(0, 3);
+      VMap2 m;
+      for (int i=0; i<5000; i++){
+        VMap2obj o;
+        o.set_type(VMAP2_LINE, tp(gen));
+        dPoint p0(30 + crd(gen)*1e-6, 50 + crd(gen)*1e-6);
+        dLine l;
+        l.push_back(p0);
+        l.push_back(p0 + dPoint(sz(gen)*1e-6, sz(gen)*1e-6));
+        o.push_back(l);
+        m.add(o);
+      }
+      VMap2pack::write(fname, m);
+      VMap2pack p(fname);
+      assert_eq(p.size(), 5000);
+      std::vector<uint32_t> v;
+      for (int i=0; i<200; i++){
+        uint32_t t = VMap2obj::make_type(VMAP2_LINE, tp(gen));
+        dRect r(30 + crd(gen)*1e-6, 50 + crd(gen)*1e-6, sz(gen)*1e-5, sz(gen)*1e-5);
+        p.find(t, r, v);
+        std::set<uint32_t> ids1, ids2;
+        for (auto n: v) ids1.insert(p.get(n).id());
+        for (uint32_t id=0; id<5000; id++){
+          auto o = m.get(id);
+          if (o.type == t && !intersect(o.bbox(), r).is_empty()) ids2.insert(id);
+        }
+        assert_eq(ids1.size(), ids2.size());
+        assert_eq(ids1==ids2, true);
+      }
+    }
+    unlink(fname);
+  }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
@@ -0,0 +1,63 @@
+#include <cmath>
+#include <algorithm>
+#include "vmap2refidx.h"
+#include "geo_data/geo_utils.h"
+#include "err/err.h"
+
+// meters to degrees of latitude
+#define M2DEG(x) ((x)*180/M_PI/6380000)
+
+VMap2refidx::VMap2refidx(const double csize): cell(M2DEG(csize)), num(0){
+  if (csize<=0) throw Err() << "VMap2refidx: positive cell size expected";
+}
+
+void
+VMap2refidx::add(const uint32_t ref_type, const dPoint & pt, const uint32_t id){
+  Key k = {ref_type, cc(pt.x), cc(pt.y)};
+  cells[k].emplace_back(pt, id);
+  num++;
+}
+
+std::vector<std::pair<uint32_t, double> >
+VMap2refidx::find(const uint32_t ref_type, const dPoint & pt, const double dist) const {
+  std::vector<std::pair<uint32_t, double> > ret;
+  if (cells.size()==0 || dist<=0) return ret;
+
+  // search range in degrees (longitude range is wider at high latitudes)
+  double dy = M2DEG(dist);
+  double c  = cos(std::min(fabs(pt.y)+dy, 89.0)*M_PI/180);
+  double dx = std::min(dy/c, 180.0);
+
+  Key k = {ref_type, 0, 0};
+  for (k.x = cc(pt.x-dx); k.x <= cc(pt.x+dx); k.x++){
+    for (k.y = cc(pt.y-dy); k.y <= cc(pt.y+dy); k.y++){
+      auto it = cells.find(k);
+      if (it==cells.end()) continue;
+      for (auto const & e: it->second){
+        double d = geo_dist_2d(e.pt, pt);
+        if (d < dist) ret.emplace_back(e.id, d);
+      }
+    }
+  }
+  std::sort(ret.begin(), ret.end());
+  return ret;
+}
+
+bool
+VMap2refidx::exists(const uint32_t ref_type, const dPoint & pt, const double dist) const {
+  if (cells.size()==0 || dist<=0) return false;
+  double dy = M2DEG(dist);
+  double c  = cos(std::min(fabs(pt.y)+dy, 89.0)*M_PI/180);
+  double dx = std::min(dy/c, 180.0);
+
+  Key k = {ref_type, 0, 0};
+  for (k.x = cc(pt.x-dx); k.x <= cc(pt.x+dx); k.x++){
+    for (k.y = cc(pt.y-dy); k.y <= cc(pt.y+dy); k.y++){
+      auto it = cells.find(k);
+      if (it==cells.end()) continue;
+      for (auto const & e: it->second)
+        if (geo_dist_2d(e.pt, pt) < dist) return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,78 @@
+#ifndef VMAP2REFIDX_H
+#define VMAP2REFIDX_H
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include "geom/point.h"
+#include "geom/rect.h"
+
+/*********************************************************************/
+// Spatial index of label reference points (used for matching labels
+// with objects and with other labels).
+//
+// Points are stored in a hash of square grid cells, separately for each
+// reference type. Cell size is set in meters (converted to degrees of
+// latitude), coordinates are WGS lon-lat. Search is done in all cells
+// which may contain points within the given distance, distances are
+// calculated with geo_dist_2d.
+
+class VMap2refidx {
+
+  struct Key {
+    uint32_t type;
+    int32_t x,y;
+    bool operator==(const Key & k) const {
+      return type==k.type && x==k.x && y==k.y;}
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key & k) const {
+      return std::hash<uint64_t>()(
+        ((uint64_t)(uint32_t)k.x << 32) ^ (uint32_t)k.y ^ ((uint64_t)k.type << 16));
+    }
+  };
+
+  struct Entry {
+    dPoint pt;
+    uint32_t id;
+    Entry(const dPoint & pt, const uint32_t id): pt(pt), id(id){}
+  };
+
+  double cell; // cell size, degrees
+  std::unordered_map<Key, std::vector<Entry>, KeyHash> cells;
+  size_t num;
+
+  // cell coordinate
+  int32_t cc(const double v) const {return (int32_t)floor(v/cell);}
+
+public:
+
+  // Create index with cell size csize [m]. Searches are most efficient
+  // when distances are comparable with the cell size.
+  VMap2refidx(const double csize);
+
+  // Add a point with reference type ref_type and some id.
+  void add(const uint32_t ref_type, const dPoint & pt, const uint32_t id);
+
+  // Number of points in the index.
+  size_t size() const {return num;}
+
+  // Find all points of reference type ref_type within distance dist [m]
+  // from pt. Result is a vector of (id, distance) pairs sorted by id.
+  std::vector<std::pair<uint32_t, double> >
+    find(const uint32_t ref_type, const dPoint & pt, const double dist) const;
+
+  // Check if there is any point of reference type ref_type
+  // within distance dist [m] from pt.
+  bool exists(const uint32_t ref_type, const dPoint & pt, const double dist) const;
+
+  // Call a function for all cells (ref_type and cell rectangle in degrees).
+  template <typename F>
+  void iter_cells(F f) const {
+    for (auto const & c: cells)
+      f(c.first.type, dRect(c.first.x*cell, c.first.y*cell, cell, cell));
+  }
+};
+
+#endif
@@ -0,0 +1,53 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <iostream>
+#include "err/assert_err.h"
+#include "vmap2refidx.h"
+
+int
+main(){
+  try{
+
+    assert_err(VMap2refidx(0), "VMap2refidx: positive cell size expected");
+
+    VMap2refidx idx(100);
+    assert_eq(idx.size(), 0);
+    assert_eq(idx.find(1, dPoint(30,60), 100).size(), 0);
+
+    // 1e-3 deg is about 111m in latitude and 55m in longitude at 60N
+    idx.add(1, dPoint(30,60), 10);
+    idx.add(1, dPoint(30.001,60), 11);
+    idx.add(1, dPoint(30,60.001), 12);
+    idx.add(2, dPoint(30,60), 20);
+    idx.add(1, dPoint(-30,-60), 13);
+    assert_eq(idx.size(), 5);
+
+    auto r = idx.find(1, dPoint(30,60), 60);
+    assert_eq(r.size(), 2);
+    assert_eq(r[0].first, 10);
+    assert_eq(r[0].second, 0);
+    assert_eq(r[1].first, 11);
+    assert_feq(r[1].second, 55.7, 0.1);
+
+    assert_eq(idx.find(1, dPoint(30,60), 200).size(), 3);
+    assert_eq(idx.find(1, dPoint(30,60), 50).size(), 1);
+    assert_eq(idx.find(2, dPoint(30,60), 1000).size(), 1);
+    assert_eq(idx.find(3, dPoint(30,60), 1000).size(), 0);
+    assert_eq(idx.find(1, dPoint(-30,-60), 1).size(), 1);
+
+    // distances much larger then cell size
+    assert_eq(idx.find(1, dPoint(30.05,60), 1e4).size(), 3);
+
+    assert_eq(idx.exists(1, dPoint(30.0005,60.0005), 100), true);
+    assert_eq(idx.exists(1, dPoint(30.0005,60.0005), 30), false);
+    assert_eq(idx.exists(2, dPoint(30.0005,60.0005), 30), false);
+
+  }
+  catch (Err & e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
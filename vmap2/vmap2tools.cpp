@@ -1,4 +1,5 @@
 #include "vmap2tools.h"
+#include "vmap2refidx.h"
 #include <map>
 #include "geo_data/geo_utils.h"
 #include "geo_data/conv_geo.h"
@@ -14,24 +15,21 @@ do_keep_labels(VMap2 & mapo, VMap2 & mapn, const double dist){
   auto old_labels = mapo.find_class(VMAP2_TEXT);
   auto new_labels = mapn.find_class(VMAP2_TEXT);
 
-  // transfer labels from mapo to mapn
-  for (auto const i: old_labels)
-    mapn.add(mapo.get(i));
+  // transfer labels from mapo to mapn, put their
+  // reference points into the index
+  VMap2refidx idx(dist > 0 ? dist : 1.0);
+  for (auto const i: old_labels){
+    const auto & oo = mapo.get(i);
+    mapn.add(oo);
+    if (dist > 0) idx.add(oo.ref_type, oo.ref_pt, i);
+  }
 
   // remove labels from mapn if they match old labels
   for (auto const i: new_labels){
 
     if (dist > 0){
-      bool match = false;
-      const auto & on = mapo.get(i);
-      for (auto const j: old_labels){
-        const auto & oo = mapo.get(j);
-        if (oo.ref_type != on.ref_type ||
-           geo_dist_2d(oo.ref_pt, on.ref_pt) >= dist) continue;
-        match = true;
-        break;
-      }
-      if (!match) continue;
+      const auto & on = mapn.get(i);
+      if (!idx.exists(on.ref_type, on.ref_pt, dist)) continue;
     }
 
     mapn.del(i);